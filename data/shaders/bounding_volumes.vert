@@ -1,8 +1,8 @@
-//Bounding volumes fragment shader
+//Bounding volumes vertex shader
 
 layout(location = 0) in vec3 in_Vertex;
-
-uniform mat4 in_ModelViewMatrix;
+//unit cube -> bounding box -> eye space transformation (per instance)
+layout(location = 1) in mat4 in_BoxModelViewMatrix;
 
 layout(std140) uniform Matrices{
   mat4 in_ProjectionMatrix;
@@ -11,5 +11,5 @@ layout(std140) uniform Matrices{
 void main()
 {
 	vec4 vertex = vec4(in_Vertex,1.0);
-	gl_Position = in_ProjectionMatrix * in_ModelViewMatrix * vertex;
-}
\ No newline at end of file
+	gl_Position = in_ProjectionMatrix * in_BoxModelViewMatrix * vertex;
+}
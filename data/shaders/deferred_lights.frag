@@ -0,0 +1,54 @@
+// Accumulation of local point lights (street lights) from G-buffer. Lights of pixel are read from
+// light list of its view frustum cluster (see TLightClusters), result is added to scene color
+
+in vec2 fragTexCoord;
+out vec4 out_FragColor;
+
+//G-buffer: albedo and specular intensity, octahedral normal, shininess and view depth
+uniform sampler2D gbuffer_albedo, gbuffer_normal;
+
+//light lists of view frustum clusters (CLUSTER_X x CLUSTER_Y tiles, CLUSTER_Z depth slices)
+uniform usamplerBuffer cluster_grid;    //offset and count of cluster lights
+uniform usamplerBuffer cluster_items;   //light indices
+uniform samplerBuffer cluster_lights;   //view space position and radius, color
+uniform vec4 cluster;                   //view direction to NDC (xy), log(depth) to depth slice (zw)
+
+#include "func/gbuffer.frag"
+
+void main()
+{
+  vec4 albedo = texture(gbuffer_albedo, fragTexCoord);
+  vec4 g_normal = texture(gbuffer_normal, fragTexCoord);
+
+  //view space position from screen position and depth
+  float depth = max(g_normal.w, 0.0001);
+  vec3 pos = vec3((fragTexCoord * 2.0 - 1.0) / cluster.xy * depth, -depth);
+  vec3 N = OctDecode(g_normal.xy);
+  vec3 E = normalize(-pos);
+
+  //cluster containing pixel - tile is given by screen position
+  ivec3 c = ivec3(vec3(fragTexCoord * vec2(CLUSTER_X, CLUSTER_Y), log(depth) * cluster.z + cluster.w));
+  c = clamp(c, ivec3(0), ivec3(CLUSTER_X - 1, CLUSTER_Y - 1, CLUSTER_Z - 1));
+  uvec2 range = texelFetch(cluster_grid, (c.z * CLUSTER_Y + c.y) * CLUSTER_X + c.x).rg;
+
+  vec3 final_color = vec3(0.0);
+  for(uint k = 0u; k < range.y; k++)
+  {
+    int l = int(texelFetch(cluster_items, int(range.x + k)).r);
+    vec4 light = texelFetch(cluster_lights, 2*l);
+    vec3 color = texelFetch(cluster_lights, 2*l + 1).rgb;
+    vec3 lightDir = (light.xyz - pos)/light.w;
+    float att = max(0.0, 1.0 - dot(lightDir, lightDir));
+    vec3 L = normalize(lightDir);
+
+    float lambertTerm = dot(N,L);
+    if(lambertTerm > 0.0 && att > 0.0)
+    {
+      final_color += color * albedo.rgb * lambertTerm * att;
+      vec3 R = reflect(-L, N);
+      float specular = pow( max(dot(R, E), 0.0), g_normal.z );
+      final_color += color * albedo.a * specular * att;
+    }
+  }
+  out_FragColor = vec4(final_color, 0.0);
+}
@@ -0,0 +1,20 @@
+
+//Octahedral encoding of unit normal into two components in range [-1,1] (normal is projected onto
+//octahedron, lower hemisphere is folded over diagonals)
+vec2 OctEncode(in vec3 n)
+{
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  vec2 e = n.xy;
+  if(n.z < 0.0)
+    e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+  return e;
+}
+
+//Decode unit normal from octahedral encoding
+vec3 OctDecode(in vec2 e)
+{
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if(n.z < 0.0)
+    n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+  return normalize(n);
+}
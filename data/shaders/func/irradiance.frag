@@ -0,0 +1,11 @@
+
+//Diffuse irradiance of environment map stored in SH9 coefficients (already convolved with cosine
+//lobe and divided by PI)
+vec3 IrradianceSH(in vec3 sh[9], in vec3 n)
+{
+  return sh[0] * 0.282095
+       + (sh[1] * n.y + sh[2] * n.z + sh[3] * n.x) * 0.488603
+       + (sh[4] * n.x * n.y + sh[5] * n.y * n.z + sh[7] * n.x * n.z) * 1.092548
+       + sh[6] * (0.315392 * (3.0 * n.z * n.z - 1.0))
+       + sh[8] * (0.546274 * (n.x * n.x - n.y * n.y));
+}
@@ -16,9 +16,25 @@ layout(std140) uniform Lights{
     vec3 diffuse[LIGHTS];
     vec3 specular[LIGHTS];
     float radius[LIGHTS];
+    int count;      //lights used (LIGHTS is capacity of arrays)
+    vec4 cluster;   //clustered lights: view direction to NDC (xy), log(depth) to depth slice (zw), 0 - deferred
     //vec3 camPos;
 }lights;
 
+#ifdef OBJECT_LIGHTS
+//lights selected for drawn object (indices into light arrays)
+uniform int in_ObjectLights[OBJECT_LIGHTS];
+uniform int in_ObjectLightCount;
+uniform vec3 in_ObjectAmbient;      //ambient color of other lights (ambient isn't attenuated)
+#endif
+
+#ifdef CLUSTERED_LIGHTS
+//light lists of view frustum clusters (CLUSTER_X x CLUSTER_Y tiles, CLUSTER_Z depth slices)
+uniform usamplerBuffer cluster_grid;    //offset and count of cluster lights
+uniform usamplerBuffer cluster_items;   //light indices
+uniform samplerBuffer cluster_lights;   //view space position and radius, color
+#endif
+
 //Calculate light model
 vec4 LightModel(in vec3 normal, in vec3 eyeVec)
 {
@@ -28,8 +44,15 @@ vec4 LightModel(in vec3 normal, in vec3 eyeVec)
   vec3 lightDir, L;
   float lambertTerm, specular, distsqr, att;
 
-  for(int i=0; i<LIGHTS; i++)
+#ifdef OBJECT_LIGHTS
+  final_color += in_ObjectAmbient * material.ambient;
+  for(int k=0; k<in_ObjectLightCount; k++)
   {
+    int i = in_ObjectLights[k];
+#else
+  for(int i=0; i<lights.count; i++)
+  {
+#endif
     final_color += lights.ambient[i] * material.ambient;
     lightDir = (lights.position[i] + eyeVec)/lights.radius[i];
     att = max(0.0, 1.0 - dot(lightDir, lightDir));
@@ -45,6 +68,37 @@ vec4 LightModel(in vec3 normal, in vec3 eyeVec)
   	}
   }
 
+#ifdef CLUSTERED_LIGHTS
+  //local lights of cluster containing point (unless they are accumulated by deferred pass)
+  if(lights.cluster.x > 0.0)
+  {
+    vec3 pos = -eyeVec;
+    float depth = max(-pos.z, 0.0001);
+    ivec3 c = ivec3(vec3((pos.xy / depth * lights.cluster.xy * 0.5 + 0.5) * vec2(CLUSTER_X, CLUSTER_Y),
+                         log(depth) * lights.cluster.z + lights.cluster.w));
+    c = clamp(c, ivec3(0), ivec3(CLUSTER_X - 1, CLUSTER_Y - 1, CLUSTER_Z - 1));
+    uvec2 range = texelFetch(cluster_grid, (c.z * CLUSTER_Y + c.y) * CLUSTER_X + c.x).rg;
+    for(uint k = 0u; k < range.y; k++)
+    {
+      int l = int(texelFetch(cluster_items, int(range.x + k)).r);
+      vec4 light = texelFetch(cluster_lights, 2*l);
+      vec3 color = texelFetch(cluster_lights, 2*l + 1).rgb;
+      lightDir = (light.xyz + eyeVec)/light.w;
+      att = max(0.0, 1.0 - dot(lightDir, lightDir));
+      L = normalize(lightDir);
+
+      lambertTerm = dot(N,L);
+      if(lambertTerm > 0.0 && att > 0.0)
+      {
+        final_color += color * material.diffuse * lambertTerm * att;
+        vec3 R = reflect(-L, N);
+        specular = pow( max(dot(R, E), 0.0), material.shininess );
+        final_color += color * material.specular * specular * att;
+      }
+    }
+  }
+#endif
+
   return vec4(final_color,0.0);
 }
 
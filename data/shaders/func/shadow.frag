@@ -2,22 +2,42 @@
 const int PCF_SAMPLES = 5;
 const float STEP = 0.2;
 
-//Calculate shadow projection with simple blurred shadows (PCF filtering)
-vec4 PCFShadow(in sampler2DShadow shadowMap, in vec4 projection, in float intensity)
+#ifdef SHADOW_SINGLE_TAP
+//Calculate shadow projection with one shadow map lookup (reduced shading of distant objects).
+//Shadow map is region of shadow atlas (offset, size), empty region has no shadow
+vec4 PCFShadow(in sampler2DShadow shadowMap, in vec4 projection, in vec4 region, in float intensity)
+{
+  projection.z -= 0.01;		//to avoid z-fighting
+
+  vec3 coordPos = projection.xyz/projection.w;
+  if(region.z > 0.0 && coordPos.x > 0.01 && coordPos.y > 0.01 && coordPos.x < 0.99 && coordPos.y < 0.99)
+  {
+    float val = texture(shadowMap, vec3(region.xy + coordPos.xy*region.zw, coordPos.z));
+    return vec4(val + intensity*float(val < 0.99));
+  }
+  return vec4(1.0);
+}
+#else
+//Calculate shadow projection with simple blurred shadows (PCF filtering). Shadow map is region
+//of shadow atlas (offset, size), samples are clamped half texel inside region (linear filtering
+//doesn't blend neighbouring region)
+vec4 PCFShadow(in sampler2DShadow shadowMap, in vec4 projection, in vec4 region, in float intensity)
 {
   float rValue = 1.0;
   float shadow = 0.0;
+  float border = 0.5/(float(textureSize(shadowMap, 0).x)*region.z);
 
   projection.z -= 0.01;		//to avoid z-fighting
     
   vec3 coordPos = projection.xyz/projection.w;
-  if(coordPos.x > 0.01 && coordPos.y > 0.01 && coordPos.x < 0.99 && coordPos.y < 0.99)
+  if(region.z > 0.0 && coordPos.x > 0.01 && coordPos.y > 0.01 && coordPos.x < 0.99 && coordPos.y < 0.99)
   {
     for(int i=0; i<PCF_SAMPLES; i++)
 	{
       for(int j=0; j<PCF_SAMPLES; j++)
 	  {
-	    float val = textureProj(shadowMap, projection + STEP*vec4(i-1.0, j-1.0, 0.0, 0.0) );
+	    vec2 coords = clamp((projection.xy + STEP*vec2(i-1.0, j-1.0))/projection.w, border, 1.0 - border);
+	    float val = texture(shadowMap, vec3(region.xy + coords*region.zw, coordPos.z));
 		shadow += val + intensity*float(val < 0.99);
 	  }
       rValue = shadow/(PCF_SAMPLES*PCF_SAMPLES);
@@ -25,3 +45,4 @@ vec4 PCFShadow(in sampler2DShadow shadowMap, in vec4 projection, in float intens
   }
   return vec4(rValue);
 }
+#endif
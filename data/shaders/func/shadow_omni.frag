@@ -72,8 +72,9 @@ vec3 DPCoordsBack()
     return vec3( 0.5*texCoords.xy + 0.5, texCoords.z);
 }
 
-//Compute shadow using dual-paraboloid projection
-float ShadowOMNI(in sampler2DArray shadow_map, in float intensity)
+//Compute shadow using dual-paraboloid projection. Paraboloids are regions of shadow atlas
+//(offset, size), empty region has no shadow. Samples are clamped half texel inside region.
+float ShadowOMNI(in sampler2DShadow shadow_map, in vec4 front, in vec4 back, in float intensity)
 {
     //calculate front and back coordinates
     int cascade = 0;
@@ -83,52 +84,30 @@ float ShadowOMNI(in sampler2DArray shadow_map, in float intensity)
     //calculate split plane position between paraboloids
     float split_plane = vec4(lightModelView[0] * o_vertex).z;
 
-    float depth, mydepth;
+    //select front or back paraboloid
+    vec4 region = split_plane < 0.0 ? front : back;
+    vec3 coords = split_plane < 0.0 ? front_coords : back_coords;
+    if(region.z <= 0.0)
+        return 1.0;
+    float border = 0.5/(float(textureSize(shadow_map, 0).x)*region.z);
 
-    //select depth value from front or back paraboloid texture (with PCF)
+    //compare depths (1.0 - lit), with PCF
     float result = 0.0;
 #ifdef USE_PCF
     for(int i=0; i < PCF_SAMPLES; i++)
     {
         for(int j=0; j<PCF_SAMPLES; j++)
         {
-          if(split_plane < 0.0)
-          {
-              depth = texture(shadow_map, vec3(front_coords.xy + vec2((i - 1.0)*PCF_STEP, (j - 1.0)*PCF_STEP), cascade) ).r;
-              mydepth = front_coords.z;
-          }
-          else
-          {
-              depth = texture(shadow_map, vec3(back_coords.xy + vec2((i - 1.0)*PCF_STEP, (j - 1.0)*PCF_STEP), cascades) ).r;
-              mydepth = back_coords.z;
-          }
-
-          //compare depths
-          if(depth < mydepth)
-              result += intensity;
-          else
-              result += 1.0;
+          vec2 uv = clamp(coords.xy + vec2((i - 1.0)*PCF_STEP, (j - 1.0)*PCF_STEP), border, 1.0 - border);
+          float lit = texture(shadow_map, vec3(region.xy + uv*region.zw, coords.z));
+          result += mix(intensity, 1.0, lit);
         }
     }
     return result/(PCF_SAMPLES*PCF_SAMPLES);
 #else
-      if(split_plane < 0.0)
-      {
-          depth = texture(shadow_map, vec3(front_coords.xy, 0.0) ).r;
-          mydepth = front_coords.z;
-      }
-      else
-      {
-          depth = texture(shadow_map, vec3(back_coords.xy, 1.0) ).r;
-          mydepth = back_coords.z;
-      }
-
-      //compare depths
-      if(depth < mydepth)
-          result += intensity;
-      else
-          result += 1.0;
-
-      return result;
+    float lit = texture(shadow_map, vec3(region.xy + clamp(coords.xy, border, 1.0 - border)*region.zw, coords.z));
+    result += mix(intensity, 1.0, lit);
+
+    return result;
 #endif
 }
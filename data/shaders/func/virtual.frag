@@ -0,0 +1,28 @@
+
+//Virtual texturing - page table points every page to resident tile in physical tile cache
+//(VT_TILE_SIZE and VT_TILE_BORDER are defined by material generator)
+
+//object's rectangle in virtual texture (offset, size)
+uniform vec4 in_VirtualRect;
+
+vec4 VirtualTexture(in sampler2D cache, in sampler2D pages, in vec2 coord)
+{
+  //position in virtual texture
+  vec2 uv = in_VirtualRect.xy + clamp(coord, 0.0, 1.0) * in_VirtualRect.zw;
+  float page_count = float(textureSize(pages, 0).x);
+  float levels = log2(page_count) + 1.0;
+
+  //mip level from screen space derivatives of virtual texels
+  vec2 texel = uv * page_count * VT_TILE_SIZE;
+  vec2 dx = dFdx(texel), dy = dFdy(texel);
+  float lod = clamp(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy)))), 0.0, levels - 1.0);
+
+  //page table entry: tile position in cache (xy) and mip level of resident tile (z)
+  ivec2 page = min(ivec2(uv * page_count), ivec2(page_count - 1.0)) >> int(lod);
+  vec3 entry = texelFetch(pages, page, int(lod)).xyz * 255.0;
+
+  //sample resident tile (it can be coarser than requested level)
+  vec2 in_tile = fract(uv * page_count / exp2(entry.z));
+  vec2 pos = entry.xy * (VT_TILE_SIZE + 2.0 * VT_TILE_BORDER) + VT_TILE_BORDER + in_tile * VT_TILE_SIZE;
+  return textureLod(cache, pos / vec2(textureSize(cache, 0)), 0.0);
+}
@@ -1,4 +1,5 @@
-uniform sampler2D show_depthShadowA;
+//shadow atlas is first texture of material (unit 0)
+uniform sampler2D shadow_atlas;
 
 in vec2 fragTexCoord;
 out vec4 out_fragData;
@@ -6,7 +7,6 @@ uniform float far_plane;
 
 void main()
 {
-    float depth = texture(show_depthShadowA, fragTexCoord).r;
+    float depth = texture(shadow_atlas, fragTexCoord).r;
     out_fragData = vec4( 2.0/(far_plane - depth * far_plane) );
 }
-
@@ -1,14 +1,13 @@
-uniform sampler2DArray show_depth_dpShadowA;
+//shadow atlas is first texture of material (unit 0), paraboloids are its regions
+uniform sampler2D shadow_atlas;
 
 in vec2 fragTexCoord;
 out vec4 out_fragData;
 
-uniform float index;
 uniform float far_plane;
 
 void main()
 {
-    float depth = texture(show_depth_dpShadowA, vec3(fragTexCoord, index)).r;
+    float depth = texture(shadow_atlas, fragTexCoord).r;
     out_fragData = vec4(5.0*depth );
 }
-
@@ -0,0 +1,26 @@
+//Virtual texture feedback - stores page and mip level required by fragment
+//(VT_TILE_SIZE is defined by scene)
+
+//object's rectangle in virtual texture (offset, size)
+uniform vec4 in_VirtualRect;
+//pages of virtual texture per side
+uniform float vt_pages;
+//feedback buffer is smaller than screen, mip level is corrected by bias
+uniform float vt_lod_bias;
+
+in vec2 fragTexCoord;
+out vec4 out_FragData;
+
+void main()
+{
+    vec2 uv = in_VirtualRect.xy + clamp(fragTexCoord, 0.0, 1.0) * in_VirtualRect.zw;
+    float levels = log2(vt_pages) + 1.0;
+
+    //the same level selection as in VirtualTexture()
+    vec2 texel = uv * vt_pages * VT_TILE_SIZE;
+    vec2 dx = dFdx(texel), dy = dFdy(texel);
+    float lod = clamp(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + vt_lod_bias), 0.0, levels - 1.0);
+    ivec2 page = min(ivec2(uv * vt_pages), ivec2(vt_pages - 1.0)) >> int(lod);
+
+    out_FragData = vec4(vec2(page), lod, 255.0) / 255.0;
+}
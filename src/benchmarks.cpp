@@ -0,0 +1,599 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: benchmarks.cpp
+@brief command line benchmarks of engine CPU paths (run without opening a window) and of
+rendering paths of city scene
+****************************************************************************************************
+***************************************************************************************************/
+#include "glux_engine/engine.h"
+#include "glux_engine/image_decoder.h"
+#include "benchmarks.h"
+
+#ifdef _LINUX_
+    #include <dirent.h>
+    #include <sys/stat.h>
+#endif
+
+///floats per interleaved vertex (position, normal, texcoord) - same layout as imported meshes
+#define BENCH_VERTEX_FLOATS 8
+///repetitions of each measurement, the best time is reported
+#define BENCH_REPEAT 5
+///frames rendered before measurement of rendering path (GPU queries return results of previous frame)
+#define BENCH_WARMUP_FRAMES 10
+
+
+/**
+****************************************************************************************************
+@brief Generate triangle soup of rotated ellipsoid with interleaved vertices
+@param rings number of rings
+@param segments number of segments
+@param soup output vertices (BENCH_VERTEX_FLOATS floats per vertex)
+****************************************************************************************************/
+static void GenerateSoup(int rings, int segments, vector<GLfloat> &soup)
+{
+    glm::mat4 rot = glm::rotate(glm::mat4(1.0f), 30.0f, glm::vec3(1.0f, 2.0f, 0.5f));
+    vector<glm::vec3> grid;
+    for(int i=0; i<=rings; i++)
+    {
+        for(int j=0; j<=segments; j++)
+        {
+            float th = PI*i/rings, ph = 2.0f*PI*j/segments;
+            glm::vec4 p(3.0f*sin(th)*cos(ph), cos(th), 0.5f*sin(th)*sin(ph), 1.0f);
+            grid.push_back(glm::vec3(rot * p));
+        }
+    }
+
+    soup.clear();
+    soup.reserve(rings*segments*6*BENCH_VERTEX_FLOATS);
+    for(int i=0; i<rings; i++)
+    {
+        for(int j=0; j<segments; j++)
+        {
+            int a = i*(segments + 1) + j, b = a + 1, c = a + segments + 1, d = c + 1;
+            int tri[6] = { a, c, b, b, c, d };
+            for(int k=0; k<6; k++)
+            {
+                glm::vec3 p = grid[tri[k]];
+                glm::vec3 n = glm::normalize(p);
+                GLfloat v[BENCH_VERTEX_FLOATS] = { p.x, p.y, p.z, n.x, n.y, n.z, float(j)/segments, float(i)/rings };
+                soup.insert(soup.end(), v, v + BENCH_VERTEX_FLOATS);
+            }
+        }
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Print one benchmark result with difference of box extents from reference result
+****************************************************************************************************/
+static void PrintResult(const char *name, double ms, int verts, const DiTO::OBB<float> &o, const DiTO::OBB<float> &ref)
+{
+    float diff = max(fabs(o.ext.x - ref.ext.x), max(fabs(o.ext.y - ref.ext.y), fabs(o.ext.z - ref.ext.z)));
+    printf("  %-26s %9.3f ms %8.2f Mvert/s   ext %.4f %.4f %.4f (diff %g)\n", name, ms,
+           verts/(ms*1000.0), o.ext.x, o.ext.y, o.ext.z, diff);
+}
+
+/**
+****************************************************************************************************
+@brief Benchmark of OBB fitting. Compares previous BoundingVolume path (copy of positions into
+DiTO vector array + scalar DiTO-14) with strided in-place variant (SIMD, serial and parallel) and
+with fitting after deduplication of soup vertices. Input is triangle soup with interleaved vertices.
+@return program exit code
+****************************************************************************************************/
+int BenchDiTO()
+{
+    const int sizes[] = { 40, 130, 410 };
+    const int stride = BENCH_VERTEX_FLOATS*sizeof(GLfloat);
+    HRTimer timer;
+
+    cout<<"DiTO-14 OBB fitting benchmark, "<<TThreadPool::Instance()->GetThreadCount()<<" threads"
+#ifdef USE_SSE
+        <<", SSE2"
+#endif
+        <<endl;
+
+    for(unsigned s=0; s<sizeof(sizes)/sizeof(int); s++)
+    {
+        vector<GLfloat> soup;
+        GenerateSoup(sizes[s], sizes[s], soup);
+        int verts = soup.size()/BENCH_VERTEX_FLOATS;
+
+        //tightly packed positions - input of previous path
+        vector<GLfloat> positions(3*verts);
+        for(int i=0; i<verts; i++)
+            memcpy(&positions[3*i], &soup[BENCH_VERTEX_FLOATS*i], 3*sizeof(GLfloat));
+
+        cout<<verts<<" vertices:\n";
+        DiTO::OBB<float> ref, o;
+        double best;
+
+        //copy + scalar DiTO-14
+        best = 1e30;
+        for(int r=0; r<BENCH_REPEAT; r++)
+        {
+            timer.Reset();
+            DiTO::Vector<float> *dVertices = new DiTO::Vector<float>[verts];
+            memcpy(dVertices, &positions[0], verts*sizeof(DiTO::Vector<float>));
+            DiTO::DiTO_14(dVertices, verts, ref);
+            delete[] dVertices;
+            best = min(best, timer.GetElapsedTimeMilliseconds());
+        }
+        PrintResult("copy + DiTO_14", best, verts, ref, ref);
+
+        //strided, serial
+        best = 1e30;
+        for(int r=0; r<BENCH_REPEAT; r++)
+        {
+            timer.Reset();
+            DiTO::DiTO_14_Strided(&soup[0], verts, stride, o, false);
+            best = min(best, timer.GetElapsedTimeMilliseconds());
+        }
+        PrintResult("strided, serial", best, verts, o, ref);
+
+        //strided, parallel
+        best = 1e30;
+        for(int r=0; r<BENCH_REPEAT; r++)
+        {
+            timer.Reset();
+            DiTO::DiTO_14_Strided(&soup[0], verts, stride, o, true);
+            best = min(best, timer.GetElapsedTimeMilliseconds());
+        }
+        PrintResult("strided, parallel", best, verts, o, ref);
+
+        //deduplication + strided
+        best = 1e30;
+        int unique_count = 0;
+        for(int r=0; r<BENCH_REPEAT; r++)
+        {
+            timer.Reset();
+            vector<float> unique;
+            unique_count = DeduplicatePositions(&soup[0], verts, stride, unique);
+            DiTO::DiTO_14_Strided(&unique[0], unique_count, 0, o, true);
+            best = min(best, timer.GetElapsedTimeMilliseconds());
+        }
+        PrintResult("dedup + strided, parallel", best, verts, o, ref);
+        cout<<"  ("<<unique_count<<" unique positions)\n";
+    }
+    return 0;
+}
+
+/**
+****************************************************************************************************
+@brief Generate RGBA test image - smooth gradients, sharp stripes and noise, alpha gradient.
+Pixels with normal map layout (normals from height field in RG, height in B) are generated
+when normal_map is set.
+****************************************************************************************************/
+static void GenerateImage(GLuint size, bool normal_map, vector<GLubyte> &rgba)
+{
+    rgba.resize(size*size*4);
+    srand(1);
+    for(GLuint y=0; y<size; y++)
+    {
+        for(GLuint x=0; x<size; x++)
+        {
+            float u = float(x)/size, v = float(y)/size;
+            GLubyte *p = &rgba[(y*size + x)*4];
+            if(normal_map)
+            {
+                //waves in both directions
+                glm::vec3 n = glm::normalize(glm::vec3(-0.8f*cos(20.0f*u), -0.8f*cos(13.0f*v), 1.0f));
+                p[0] = (GLubyte)(127.5f*(n.x + 1.0f));
+                p[1] = (GLubyte)(127.5f*(n.y + 1.0f));
+                p[2] = (GLubyte)(255.0f*(0.5f + 0.25f*(sin(20.0f*u) + sin(13.0f*v))));
+                p[3] = 255;
+            }
+            else
+            {
+                int noise = rand()%24 - 12;
+                bool stripe = (int)(u*40.0f + 10.0f*v) % 7 == 0;
+                float r = 255.0f*u, g = 255.0f*(0.5f + 0.5f*sin(6.0f*v)), b = stripe ? 230.0f : 40.0f + 100.0f*u*v;
+                p[0] = (GLubyte)glm::clamp(r + noise, 0.0f, 255.0f);
+                p[1] = (GLubyte)glm::clamp(g + noise, 0.0f, 255.0f);
+                p[2] = (GLubyte)glm::clamp(b + noise, 0.0f, 255.0f);
+                p[3] = (GLubyte)(255.0f*v);
+            }
+        }
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Peak signal to noise ratio of first channels of two RGBA images
+****************************************************************************************************/
+static double PSNR(const vector<GLubyte> &a, const vector<GLubyte> &b, int channels)
+{
+    double mse = 0.0;
+    for(size_t i=0; i<a.size(); i+=4)
+        for(int k=0; k<channels; k++)
+        {
+            double d = double(a[i + k]) - double(b[i + k]);
+            mse += d*d;
+        }
+    mse /= (a.size()/4)*channels;
+    return mse > 0.0 ? 10.0*log10(255.0*255.0/mse) : 99.0;
+}
+
+/**
+****************************************************************************************************
+@brief Benchmark of CPU block compression. Each format compresses whole mip chain of test image
+serially and in thread pool, quality is measured on top level.
+@return program exit code
+****************************************************************************************************/
+int BenchBlockCompression()
+{
+    const GLuint sizes[] = { 256, 1024, 2048 };
+    const GLenum formats[] = { GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+                               GL_COMPRESSED_RED_RGTC1, GL_COMPRESSED_RG_RGTC2 };
+    const char *names[] = { "BC1", "BC3", "BC4", "BC5" };
+    const int channels[] = { 3, 4, 1, 2 };
+    HRTimer timer;
+
+    cout<<"Block compression benchmark, "<<TThreadPool::Instance()->GetThreadCount()<<" threads"
+#ifdef USE_SSE
+        <<", SSE2"
+#endif
+        <<endl;
+
+    for(unsigned s=0; s<sizeof(sizes)/sizeof(GLuint); s++)
+    {
+        cout<<sizes[s]<<"x"<<sizes[s]<<" with mipmaps:\n";
+        for(int f=0; f<4; f++)
+        {
+            vector<GLubyte> image, decoded(sizes[s]*sizes[s]*4);
+            GenerateImage(sizes[s], formats[f] == GL_COMPRESSED_RG_RGTC2, image);
+            //mip chain has 4/3 pixels of top level
+            double mpix = sizes[s]*sizes[s]*4.0/3.0/1e6;
+
+            TCompressedImage img;
+            double serial = 1e30, parallel = 1e30;
+            for(int r=0; r<BENCH_REPEAT; r++)
+            {
+                timer.Reset();
+                CompressImage(&image[0], sizes[s], sizes[s], 4, formats[f], true, img, false);
+                serial = min(serial, timer.GetElapsedTimeMilliseconds());
+                timer.Reset();
+                CompressImage(&image[0], sizes[s], sizes[s], 4, formats[f], true, img, true);
+                parallel = min(parallel, timer.GetElapsedTimeMilliseconds());
+            }
+
+            DecompressImage(&img.data[0], sizes[s], sizes[s], formats[f], &decoded[0]);
+            printf("  %s  serial %8.2f ms %7.2f Mpix/s   parallel %8.2f ms %7.2f Mpix/s   PSNR %.2f dB\n",
+                   names[f], serial, mpix*1000.0/serial, parallel, mpix*1000.0/parallel,
+                   PSNR(image, decoded, channels[f]));
+        }
+    }
+    return 0;
+}
+
+
+/**
+****************************************************************************************************
+@brief Append files in directory and its subdirectories
+@param dir directory
+@param files list of file paths
+****************************************************************************************************/
+static void ListFiles(const string &dir, vector<string> &files)
+{
+#ifdef _WIN_
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA((dir + "/*").c_str(), &fd);
+    if(h == INVALID_HANDLE_VALUE)
+        return;
+    do
+    {
+        string name = fd.cFileName;
+        if(name == "." || name == "..")
+            continue;
+        if(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            ListFiles(dir + "/" + name, files);
+        else
+            files.push_back(dir + "/" + name);
+    }
+    while(FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    DIR *d = opendir(dir.c_str());
+    if(d == NULL)
+        return;
+    struct dirent *e;
+    while((e = readdir(d)) != NULL)
+    {
+        string name = e->d_name;
+        if(name == "." || name == "..")
+            continue;
+        string path = dir + "/" + name;
+        struct stat st;
+        if(stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+            ListFiles(path, files);
+        else
+            files.push_back(path);
+    }
+    closedir(d);
+#endif
+}
+
+/**
+****************************************************************************************************
+@brief Image decoding benchmark over data/tex: DevIL (ilLoadImage + ilCopyPixels) vs. native
+TGA/PNG decoder from memory mapped file. Files without native decoder count with DevIL time in
+both columns. Native output is compared with DevIL output.
+****************************************************************************************************/
+int BenchImageDecoding()
+{
+    vector<string> files;
+    ListFiles("data/tex", files);
+    sort(files.begin(), files.end());
+    Texture::InitImageLibrary();
+
+    HRTimer timer;
+    double il_total = 0.0, native_total = 0.0;
+    size_t bytes = 0;
+    unsigned images = 0, native = 0, mismatch = 0;
+
+    cout<<"Image decoding benchmark, "<<files.size()<<" files in data/tex"
+#ifdef USE_SSE
+        <<", SSE2"
+#endif
+        <<endl;
+    for(unsigned i=0; i<files.size(); i++)
+    {
+        GLubyte *data = NULL;
+        GLuint w = 0, h = 0, bpp = 0;
+        vector<GLubyte> ref;
+
+        //DevIL
+        double il_ms = 1e30;
+        for(int r=0; r<BENCH_REPEAT; r++)
+        {
+            timer.Reset();
+            const char *err = Texture::DecodeImageIL(files[i].c_str(), &data, &w, &h, &bpp);
+            il_ms = min(il_ms, timer.GetElapsedTimeMilliseconds());
+            if(err != NULL)
+                break;
+            if(r == 0)
+                ref.assign(data, data + w*h*bpp);
+            delete [] data;
+            data = NULL;
+        }
+        if(ref.empty())     //not an image
+            continue;
+#ifdef _LINUX_
+        //native decoder stores pixels in upload order (BGR on Linux)
+        SwapRedBlue(&ref[0], &ref[0], w*h, bpp);
+#endif
+
+        //native decoder
+        double native_ms = 1e30;
+        bool decoded = false;
+        for(int r=0; r<BENCH_REPEAT; r++)
+        {
+            timer.Reset();
+            TImageFile img;
+            if(!img.Open(files[i].c_str()))
+                break;
+            data = new GLubyte[img.GetDataSize()];
+            decoded = img.Decode(data);
+            native_ms = min(native_ms, timer.GetElapsedTimeMilliseconds());
+            if(r == 0 && (!decoded || img.GetDataSize() != ref.size() || memcmp(data, &ref[0], ref.size()) != 0))
+                mismatch++;
+            delete [] data;
+            if(!decoded)
+                break;
+        }
+
+        double mb = ref.size()/1e6;
+        if(decoded)
+        {
+            printf("  %-40s %4ux%-4u %u B  DevIL %7.2f ms  native %7.2f ms  %6.1f MB/s  %5.2fx\n", files[i].c_str(),
+                   w, h, bpp, il_ms, native_ms, mb*1000.0/native_ms, il_ms/native_ms);
+            native++;
+        }
+        else
+        {
+            printf("  %-40s %4ux%-4u %u B  DevIL %7.2f ms  (no native decoder)\n", files[i].c_str(), w, h, bpp, il_ms);
+            native_ms = il_ms;
+        }
+        il_total += il_ms;
+        native_total += native_ms;
+        bytes += ref.size();
+        images++;
+    }
+
+    double mb = bytes/1e6;
+    printf("%u images (%u native), %.2f MB decoded\n", images, native, mb);
+    printf("  DevIL   %8.2f ms  %7.1f MB/s\n", il_total, mb*1000.0/il_total);
+    printf("  native  %8.2f ms  %7.1f MB/s  (%.2fx)\n", native_total, mb*1000.0/native_total, il_total/native_total);
+    if(mismatch > 0)
+        printf("  WARNING: %u images differ from DevIL output\n", mismatch);
+    return mismatch > 0 ? 1 : 0;
+}
+
+
+/**
+****************************************************************************************************
+@brief Benchmark of environment cube map prefiltering (GGX roughness levels and SH9 irradiance) on
+cube map from data/tex/cubemaps, serial and in thread pool
+@return 0 on success
+****************************************************************************************************/
+int BenchCubemapPrefilter()
+{
+    const char *files[] = { "data/tex/cubemaps/posx.tga", "data/tex/cubemaps/negx.tga",
+                            "data/tex/cubemaps/posy.tga", "data/tex/cubemaps/negy.tga",
+                            "data/tex/cubemaps/posz.tga", "data/tex/cubemaps/negz.tga" };
+    Texture::InitImageLibrary();
+
+    GLubyte *pixels[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+    GLuint size = 0, height = 0, bpp = 0;
+    for(int i=0; i<6; i++)
+    {
+        const char *err = Texture::DecodeImage(files[i], &pixels[i], &size, &height, &bpp);
+        if(err != NULL)
+        {
+            cerr<<files[i]<<": "<<err<<endl;
+            for(int j=0; j<i; j++)
+                delete [] pixels[j];
+            return 1;
+        }
+    }
+
+    cout<<"Cube map prefilter benchmark, "<<size<<"x"<<size<<" faces, "<<CUBEMAP_SAMPLES<<" samples per texel, "
+        <<TThreadPool::Instance()->GetThreadCount()<<" threads"
+#ifdef USE_SSE
+        <<", SSE2"
+#endif
+        <<endl;
+
+    TPrefilteredCube cube;
+    TPrefilterStats serial, parallel;
+    serial.ms = parallel.ms = 1e30;
+    for(int r=0; r<BENCH_REPEAT; r++)
+    {
+        TPrefilterStats s = PrefilterCubemap((const GLubyte**)pixels, size, bpp, cube, false);
+        if(s.ms < serial.ms)
+            serial = s;
+        s = PrefilterCubemap((const GLubyte**)pixels, size, bpp, cube, true);
+        if(s.ms < parallel.ms)
+            parallel = s;
+    }
+    printf("  %u levels, %.2f M texels, %.2f M samples\n", cube.levels, serial.texels/1e6, serial.samples/1e6);
+    printf("  serial   %8.2f ms  %7.2f M samples/s\n", serial.ms, serial.samples/1e3/serial.ms);
+    printf("  parallel %8.2f ms  %7.2f M samples/s  (%.2fx)\n", parallel.ms, parallel.samples/1e3/parallel.ms,
+           serial.ms/parallel.ms);
+    printf("  irradiance (SH0): %.3f %.3f %.3f\n", cube.sh[0].x, cube.sh[0].y, cube.sh[0].z);
+
+    for(int i=0; i<6; i++)
+        delete [] pixels[i];
+    return 0;
+}
+
+
+/**
+****************************************************************************************************
+@brief Benchmark of clustered lighting: street lights of square city (lights along both sides of
+streets every 30 units, range 30 units) are assigned to view frustum clusters from street level
+cameras looking in several directions, serial and in thread pool
+@return 0 on success
+****************************************************************************************************/
+int BenchLightClusters()
+{
+    const int sizes[] = { 16, 32, 64 };     //streets in each direction
+    const float spacing = 30.0f, block = 120.0f, height = 20.0f;
+    const int views = 8;
+    cout<<"Clustered lighting benchmark, "<<CLUSTER_X<<"x"<<CLUSTER_Y<<"x"<<CLUSTER_Z<<" clusters, "
+        <<TThreadPool::Instance()->GetThreadCount()<<" threads"<<endl;
+
+    for(unsigned s=0; s<sizeof(sizes)/sizeof(int); s++)
+    {
+        //lights on both sides of streets in x and z direction
+        TLightClusters clusters;
+        float extent = sizes[s]*block;
+        for(int i=0; i<sizes[s]; i++)
+        {
+            for(float t=0.0f; t<extent; t+=spacing)
+            {
+                float street = i*block;
+                glm::vec3 color(1.0f, 0.8f, 0.5f);
+                clusters.AddLight(glm::vec3(t, height, street - 8.0f), color, spacing);
+                clusters.AddLight(glm::vec3(t, height, street + 8.0f), color, spacing);
+                clusters.AddLight(glm::vec3(street - 8.0f, height, t), color, spacing);
+                clusters.AddLight(glm::vec3(street + 8.0f, height, t), color, spacing);
+            }
+        }
+
+        double serial = 0.0, parallel = 0.0;
+        unsigned visible = 0, items = 0, used = 0;
+        for(int v=0; v<views; v++)
+        {
+            //camera in the middle of city, turning around
+            float angle = 2.0f*PI*v/views;
+            glm::vec3 eye(extent*0.5f + 4.0f, 2.0f, extent*0.5f + 4.0f);
+            glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(cos(angle), -0.1f, sin(angle)), glm::vec3(0.0f, 1.0f, 0.0f));
+            double best_s = 1e30, best_p = 1e30;
+            for(int r=0; r<BENCH_REPEAT; r++)
+            {
+                clusters.Assign(view, 45.0f, 16.0f/9.0f, 0.1f, 10000.0f, false);
+                best_s = min(best_s, (double)clusters.GetStats().assign_ms);
+                clusters.Assign(view, 45.0f, 16.0f/9.0f, 0.1f, 10000.0f, true);
+                best_p = min(best_p, (double)clusters.GetStats().assign_ms);
+            }
+            serial += best_s;
+            parallel += best_p;
+            visible += clusters.GetStats().visible;
+            items += clusters.GetStats().items;
+            used += clusters.GetStats().clusters_used;
+        }
+        printf("  %5u lights: %6u visible, %7u references in %4u clusters (average of %d views)\n", clusters.GetLightCount(),
+               visible/views, items/views, used/views, views);
+        printf("    serial   %8.3f ms\n", serial/views);
+        printf("    parallel %8.3f ms  (%.2fx)\n", parallel/views, serial/parallel);
+    }
+    return 0;
+}
+
+///@brief Averages of frames rendered by one path
+struct TPathTimes{
+    double frame_ms, opaque_ms, lights_ms, pixels;
+};
+
+/**
+****************************************************************************************************
+@brief Render frames with forward or deferred lighting and average their times
+@param s scene
+@param deferred accumulate local lights from G-buffer
+@param frames measured frames
+@return average times
+****************************************************************************************************/
+static TPathTimes RenderPath(TScene *s, bool deferred, int frames)
+{
+    s->UseDeferredLighting(deferred);
+    for(int i=0; i<BENCH_WARMUP_FRAMES; i++)
+        s->Redraw();
+    glFinish();
+
+    TPathTimes t = {0.0, 0.0, 0.0, 0.0};
+    HRTimer timer;
+    for(int i=0; i<frames; i++)
+    {
+        s->Redraw();
+        t.opaque_ms += s->GetStats().gpu_opaque_ms;
+        t.lights_ms += s->GetStats().gpu_lights_ms;
+        t.pixels += s->GetStats().deferred_pixels;
+    }
+    glFinish();
+    t.frame_ms = timer.GetElapsedTimeMilliseconds() / frames;
+    t.opaque_ms /= frames;
+    t.lights_ms /= frames;
+    t.pixels /= frames;
+    return t;
+}
+
+/**
+****************************************************************************************************
+@brief Benchmark of deferred lighting - city with street lights is rendered from the same view with
+forward path (light loops of materials) and deferred path (G-buffer and light pass). Frame time
+(CPU, with finished GPU work) and GPU times of opaque and light pass are reported.
+@param s initialized scene with G-buffer
+@param frames measured frames of each path
+****************************************************************************************************/
+int BenchDeferredLighting(TScene *s, int frames)
+{
+    s->UseDeferredLighting(true);
+    if(!s->IsDeferredLighting())
+    {
+        cerr<<"WARNING (BenchDeferredLighting): G-buffer isn't available\n";
+        return 1;
+    }
+    frames = max(frames, 1);
+    printf("Deferred lighting: %u street lights, %dx%d, %d frames per path\n", s->GetPointLightCount(),
+           s->GetResX(), s->GetResY(), frames);
+
+    TPathTimes forward = RenderPath(s, false, frames);
+    TPathTimes deferred = RenderPath(s, true, frames);
+    printf("  forward   frame %8.3f ms  opaque GPU %7.3f ms\n", forward.frame_ms, forward.opaque_ms);
+    printf("  deferred  frame %8.3f ms  opaque GPU %7.3f ms  lights GPU %7.3f ms  %.0f lit pixels\n",
+           deferred.frame_ms, deferred.opaque_ms, deferred.lights_ms, deferred.pixels);
+    printf("  frame time %.2fx, lit GPU time %.2fx\n", forward.frame_ms / deferred.frame_ms,
+           forward.opaque_ms / max(deferred.opaque_ms + deferred.lights_ms, 0.001));
+    return 0;
+}
@@ -0,0 +1,27 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: benchmarks.h
+@brief command line benchmarks of engine CPU paths (run without opening a window) and of
+rendering paths of city scene
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _BENCHMARKS_H_
+#define _BENCHMARKS_H_
+
+class TScene;
+
+//DiTO-14 OBB fitting: copying reference path vs. strided SIMD/parallel path
+int BenchDiTO();
+//BC1/BC3/BC4/BC5 texture compression: throughput (serial/parallel) and quality
+int BenchBlockCompression();
+//TGA/PNG decoding: DevIL vs. native decoder over data/tex
+int BenchImageDecoding();
+//environment cube map prefiltering: throughput (serial/parallel) of GGX levels and SH9
+int BenchCubemapPrefilter();
+//clustered lighting: assignment of street lights to view frustum clusters (serial/parallel)
+int BenchLightClusters();
+//deferred lighting: frame and GPU times of forward and deferred path (scene must be initialized)
+int BenchDeferredLighting(TScene *s, int frames);
+
+#endif
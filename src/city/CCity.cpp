@@ -140,6 +140,52 @@ float CBuilding::AngleY(){
 	return glm::atan(this->Size[0][0],this->Size[0][2])+3.141592653/2;
 }
 
+/**
+ * @brief Integer hash used by facade generator
+ *
+ * @param x value
+ *
+ * @return hashed value
+ */
+static unsigned FacadeHash(unsigned x){
+	x^=x>>16;
+	x*=0x7feb352d;
+	x^=x>>15;
+	x*=0x846ca68b;
+	x^=x>>16;
+	return x;
+}
+
+void CBuilding::GetFacadeColor(float u,float v,unsigned char*Color){
+	//building seed from its position
+	unsigned Seed=FacadeHash((unsigned)(int)(this->Start[0]*100000)^FacadeHash((unsigned)(int)(this->Start[2]*100000)));
+	//one floor is 0.001 of city high, window column is 0.0008 wide
+	unsigned Floors=glm::max(1u,(unsigned)(glm::length(this->Size[1])/0.001f));
+	unsigned Columns=glm::max(1u,(unsigned)(glm::length(this->Size[0])/0.0008f));
+	float Wall[3]={
+		0.45f+0.3f*((Seed&0xff)/255.f),
+		0.4f+0.3f*(((Seed>>8)&0xff)/255.f),
+		0.35f+0.3f*(((Seed>>16)&0xff)/255.f)
+	};
+	float Result[3]={Wall[0],Wall[1],Wall[2]};
+	float x=u*Columns,y=v*Floors;
+	float fx=x-floor(x),fy=y-floor(y);
+	if(fx>0.2f&&fx<0.8f&&fy>0.25f&&fy<0.75f){
+		//every window is lit or dark
+		unsigned Window=FacadeHash(Seed^((unsigned)x*7919u)^((unsigned)y*104729u));
+		if((Window&3)==0){
+			Result[0]=1.f;Result[1]=0.85f;Result[2]=0.5f;
+		}else{
+			Result[0]=0.15f;Result[1]=0.2f;Result[2]=0.25f;
+		}
+	}else if(fy>0.9f){//floor ledge
+		for(unsigned k=0;k<3;++k)Result[k]*=0.7f;
+	}
+	for(unsigned k=0;k<3;++k)
+		Color[k]=(unsigned char)(glm::clamp(Result[k],0.f,1.f)*255);
+	Color[3]=255;
+}
+
 void CBuilding::Draw(){
 	glColor3f(1,1,0);
 	glm::vec3 Corner[8];
@@ -136,6 +136,15 @@ class CBuilding{
 		 */
 		int IsCollision(CStreet*S);
 		float AngleY();
+		/**
+		 * @brief This function computes color of the facade (walls with grid of windows).
+		 * Pattern depends on size and position of the building only.
+		 *
+		 * @param u horizontal position on the facade (0-1)
+		 * @param v vertical position on the facade (0-1)
+		 * @param Color output RGBA color
+		 */
+		void GetFacadeColor(float u,float v,unsigned char*Color);
 		void Draw();
 };
 
@@ -5,20 +5,28 @@
 #include "dito.h"
 
 
-//TODO - shader pre kreslenie staticky!
+//copy unique positions from vertex array (for triangle soups), returns their count
+int DeduplicatePositions(const float* vertices, int num, int stride, std::vector<float> &unique);
 
+//Oriented bounding box of object in object space. Only CPU-side data is kept, visualization is
+//done by scene for all boxes at once (TScene::drawBoundingVolumes)
 class BoundingVolume
 {
 public:	
 	//BoundingVolume(glm::vec3 center, glm::vec3 axis0, glm::vec3 axis1, glm::vec3 axis2, glm::vec3 extents);
-	BoundingVolume(float* vertices, int num);
-	~BoundingVolume();
+	//vertices are read in place, stride in bytes (0 = tightly packed positions)
+	BoundingVolume(const float* vertices, int num, int stride = 0, bool dedup = false);
+	//box with corner points and planes
 	Box getOBB();
-	void drawBV();
+	//transformation of unit cube <-1,1> to bounding box
+	glm::mat4 getTransform();
+
+	glm::vec3 getCenter(){ return center; }
+	glm::vec3 getExtents(){ return extents; }
+	glm::vec3 getAxis(int i){ return axis[i]; }
 
 private:
-	Box obb;
-	GLuint vao;
-	GLuint vbo;
-	GLuint ebo;
+	glm::vec3 center;
+	glm::vec3 axis[3];
+	glm::vec3 extents;
 };
\ No newline at end of file
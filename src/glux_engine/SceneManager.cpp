@@ -1,4 +1,7 @@
 #include "SceneManager.h"
+#include "texture_streamer.h"
+#include "program_cache.h"
+#include "shader_source.h"
 
 SceneManager * SceneManager::Instance()
 {
@@ -11,9 +14,619 @@ SceneManager * SceneManager::Instance()
 SceneManager::SceneManager(void) :
 	Singleton()
 {
+    m_texture_budget = 0;
+    m_frame = 0;
+    memset(&m_texture_stats, 0, sizeof(TTextureStats));
+    memset(&m_program_stats, 0, sizeof(TProgramStats));
 }
 
 
 SceneManager::~SceneManager(void)
 {
+    //decoding threads mustn't outlive texture records
+    TTextureStreamer::Destroy();
+}
+
+/**
+****************************************************************************************************
+@brief FNV-1a hash of data block
+****************************************************************************************************/
+static unsigned long long HashBytes(unsigned long long h, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    for(size_t i = 0; i < size; i++)
+        h = (h ^ bytes[i]) * 1099511628211ULL;
+    return h;
+}
+
+/**
+****************************************************************************************************
+@brief Compute hash of mesh content (all vertex attributes, indices and primitive type)
+@return 64-bit FNV-1a hash
+****************************************************************************************************/
+unsigned long long SceneManager::HashGeometry(const vector<GLfloat> &vertices, const vector<GLfloat> &normals,
+                                              const vector<GLfloat> &texcoords, const vector<GLuint> &indices, GLenum drawmode)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    unsigned sizes[5] = { (unsigned)vertices.size(), (unsigned)normals.size(), (unsigned)texcoords.size(),
+                          (unsigned)indices.size(), (unsigned)drawmode };
+    h = HashBytes(h, sizes, sizeof(sizes));
+    if(!vertices.empty())
+        h = HashBytes(h, &vertices[0], vertices.size()*sizeof(GLfloat));
+    if(!normals.empty())
+        h = HashBytes(h, &normals[0], normals.size()*sizeof(GLfloat));
+    if(!texcoords.empty())
+        h = HashBytes(h, &texcoords[0], texcoords.size()*sizeof(GLfloat));
+    if(!indices.empty())
+        h = HashBytes(h, &indices[0], indices.size()*sizeof(GLuint));
+    return h;
+}
+
+/**
+****************************************************************************************************
+@brief Find geometry loaded from given source and add reference to it
+@param name source name (file)
+@return geometry or NULL if it hasn't been loaded
+****************************************************************************************************/
+TGeometry* SceneManager::AcquireGeometry(const string &name)
+{
+    m_ign = m_geometry_names.find(name);
+    if(m_ign == m_geometry_names.end())
+        return NULL;
+    m_ign->second->refs++;
+    return m_ign->second;
+}
+
+/**
+****************************************************************************************************
+@brief Order of triangles (lexicographic by indices)
+****************************************************************************************************/
+static bool LessTriangle(const glm::uvec3 &a, const glm::uvec3 &b)
+{
+    if(a.x != b.x)
+        return a.x < b.x;
+    if(a.y != b.y)
+        return a.y < b.y;
+    return a.z < b.z;
+}
+
+/**
+****************************************************************************************************
+@brief Read beginning of buffer object
+@param buffer buffer object
+@param bytes size of read data
+@param exact buffer must have exactly given size (otherwise it can be larger)
+@param data read data
+@return false if buffer size doesn't match
+****************************************************************************************************/
+static bool ReadBuffer(GLuint buffer, size_t bytes, bool exact, vector<GLubyte> &data)
+{
+    GLint size = 0;
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+    bool fits = exact ? (size_t)size == bytes : (size_t)size >= bytes;
+    data.resize(bytes);
+    if(fits && bytes > 0)
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, bytes, &data[0]);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    return fits;
+}
+
+/**
+****************************************************************************************************
+@brief Compare buffer object with data
+@param buffer buffer object
+@param src expected content (buffer has exactly the same size)
+****************************************************************************************************/
+static bool SameBuffer(GLuint buffer, const vector<GLfloat> &src)
+{
+    vector<GLubyte> data;
+    size_t bytes = src.size()*sizeof(GLfloat);
+    return ReadBuffer(buffer, bytes, true, data) && (bytes == 0 || memcmp(&data[0], &src[0], bytes) == 0);
+}
+
+/**
+****************************************************************************************************
+@brief Compare triangles of index buffer with indices. Buffer starts with full detail level, which
+can be reordered by clusters (BuildMeshlets()) - triangles are compared as sorted lists, other
+primitives must be equal.
+@param buffer index buffer
+@param src expected indices
+@param drawmode primitive type
+****************************************************************************************************/
+static bool SameIndices(GLuint buffer, const vector<GLuint> &src, GLenum drawmode)
+{
+    vector<GLubyte> data;
+    if(!ReadBuffer(buffer, src.size()*sizeof(GLuint), false, data))
+        return false;
+    if(src.empty())
+        return true;
+    vector<GLuint> indices(src.size());
+    memcpy(&indices[0], &data[0], data.size());
+    if(drawmode != GL_TRIANGLES || src.size() % 3 != 0)
+        return indices == src;
+
+    vector<glm::uvec3> a(src.size()/3), b(src.size()/3);
+    for(unsigned i = 0; i < a.size(); i++)
+    {
+        a[i] = glm::uvec3(src[3*i], src[3*i+1], src[3*i+2]);
+        b[i] = glm::uvec3(indices[3*i], indices[3*i+1], indices[3*i+2]);
+    }
+    sort(a.begin(), a.end(), LessTriangle);
+    sort(b.begin(), b.end(), LessTriangle);
+    return a == b;
+}
+
+/**
+****************************************************************************************************
+@brief Find geometry with the same content and add reference to it. Hash is only a hint: content
+of found geometry is read back and compared, colliding geometry isn't shared.
+@param hash content hash (HashGeometry())
+@param vertices, normals, texcoords, indices mesh content
+@param drawmode primitive type
+@return geometry or NULL if there is no such geometry
+****************************************************************************************************/
+TGeometry* SceneManager::AcquireGeometry(unsigned long long hash, const vector<GLfloat> &vertices, const vector<GLfloat> &normals,
+                                         const vector<GLfloat> &texcoords, const vector<GLuint> &indices, GLenum drawmode)
+{
+    m_ig = m_geometry.find(hash);
+    if(m_ig == m_geometry.end())
+        return NULL;
+
+    TGeometry *g = m_ig->second;
+    if(g->drawmode != drawmode || !SameBuffer(g->vbo.buffer[P_VERTEX], vertices) || !SameBuffer(g->vbo.buffer[P_NORMAL], normals) ||
+       !SameBuffer(g->vbo.buffer[P_TEXCOORD], texcoords) || !SameIndices(g->vbo.buffer[P_INDEX], indices, drawmode))
+    {
+        cerr<<"WARNING (SceneManager::AcquireGeometry): hash collision of different meshes, geometry isn't shared\n";
+        return NULL;
+    }
+    g->refs++;
+    return g;
+}
+
+/**
+****************************************************************************************************
+@brief Register geometry stored in buffers. Manager becomes owner of buffers, clusters and copy of
+bounding volume
+@param name source name (empty - geometry is found only by content)
+@param hash content hash
+@param vbo buffers and mesh parameters
+@param obb object space bounding volume (copied, can be NULL)
+@param drawmode primitive type
+@param element_indices are element indices used?
+@param bytes size of buffers in bytes
+@return new geometry with one reference
+****************************************************************************************************/
+TGeometry* SceneManager::AddGeometry(const string &name, unsigned long long hash, const VBO &vbo, BoundingVolume *obb,
+                                     GLenum drawmode, bool element_indices, size_t bytes)
+{
+    TGeometry *g = new TGeometry;
+    g->vbo = vbo;
+    g->obb = obb ? new BoundingVolume(*obb) : NULL;
+    g->drawmode = drawmode;
+    g->element_indices = element_indices;
+    g->hash = hash;
+    g->refs = 1;
+    g->bytes = bytes;
+    g->name = name;
+
+    m_geometry[hash] = g;
+    if(!name.empty())
+        m_geometry_names[name] = g;
+    return g;
+}
+
+/**
+****************************************************************************************************
+@brief Make existing geometry accessible by another source name
+****************************************************************************************************/
+void SceneManager::AliasGeometry(const string &name, TGeometry *geometry)
+{
+    if(!name.empty())
+        m_geometry_names[name] = geometry;
+}
+
+/**
+****************************************************************************************************
+@brief Remove reference to geometry. Buffers are deleted when geometry isn't used anymore
+@param geometry released geometry
+****************************************************************************************************/
+void SceneManager::ReleaseGeometry(TGeometry *geometry)
+{
+    if(geometry == NULL || --geometry->refs > 0)
+        return;
+
+    //remove all names and hash of geometry
+    for(m_ign = m_geometry_names.begin(); m_ign != m_geometry_names.end(); )
+    {
+        if(m_ign->second == geometry)
+            m_geometry_names.erase(m_ign++);
+        else
+            ++m_ign;
+    }
+    m_ig = m_geometry.find(geometry->hash);
+    if(m_ig != m_geometry.end() && m_ig->second == geometry)
+        m_geometry.erase(m_ig);
+
+    //free buffers and CPU data
+    glDeleteVertexArrays(1, &geometry->vbo.vao);
+    glDeleteBuffers(4, geometry->vbo.buffer);
+    delete geometry->vbo.meshlets;
+    delete geometry->obb;
+    delete geometry;
+}
+
+/**
+****************************************************************************************************
+@brief Return total size of geometry buffers
+****************************************************************************************************/
+size_t SceneManager::GetGeometryBytes()
+{
+    size_t bytes = 0;
+    for(m_ig = m_geometry.begin(); m_ig != m_geometry.end(); ++m_ig)
+        bytes += m_ig->second->bytes;
+    return bytes;
+}
+
+/**
+****************************************************************************************************
+@brief Print resident geometry: number of meshes, references and buffer sizes
+@param verbose print every mesh
+****************************************************************************************************/
+void SceneManager::ReportGeometry(bool verbose)
+{
+    unsigned refs = 0;
+    for(m_ig = m_geometry.begin(); m_ig != m_geometry.end(); ++m_ig)
+    {
+        TGeometry *g = m_ig->second;
+        refs += g->refs;
+        if(verbose)
+            cout<<"  "<<(g->name.empty() ? "(unnamed)" : g->name)<<": "<<g->bytes/1024<<" kB, "<<g->refs<<" objects\n";
+    }
+    cout<<"Geometry: "<<m_geometry.size()<<" meshes used by "<<refs<<" objects, "<<GetGeometryBytes()/1024<<" kB\n";
+}
+
+/**
+****************************************************************************************************
+@brief Register texture loaded from file. Texture size is set by TextureUploaded().
+@param id OpenGL texture
+@param target GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP
+@param file source file used for reloading (empty - texture is never demoted)
+@param textype texture type
+@param mipmap has texture mip chain?
+@param compress is texture loaded from compressed texture cache?
+@return new texture record with one reference
+****************************************************************************************************/
+TTextureResidency* SceneManager::AddTexture(GLuint id, GLenum target, const char *file, int textype, bool mipmap, bool compress)
+{
+    TTextureResidency *t = new TTextureResidency;
+    t->id = id;
+    t->target = target;
+    t->file = file;
+    t->textype = textype;
+    t->mipmap = mipmap;
+    t->compress = compress;
+    t->width = t->height = 0;
+    t->dropped = 0;
+    t->evicted = t->reloading = false;
+    t->bytes = t->full_bytes = 0;
+    t->last_used = m_frame;
+    t->refs = 1;
+    t->env_levels = 0;
+
+    m_textures[id] = t;
+    return t;
+}
+
+/**
+****************************************************************************************************
+@brief Find texture record and add reference to it
+@param id OpenGL texture
+@return texture record or NULL if texture isn't registered
+****************************************************************************************************/
+TTextureResidency* SceneManager::AcquireTexture(GLuint id)
+{
+    m_it = m_textures.find(id);
+    if(m_it == m_textures.end())
+        return NULL;
+    m_it->second->refs++;
+    return m_it->second;
+}
+
+/**
+****************************************************************************************************
+@brief Remove reference to texture. Texture is deleted when it isn't used anymore
+@param texture released texture
+****************************************************************************************************/
+void SceneManager::ReleaseTexture(TTextureResidency *texture)
+{
+    if(texture == NULL || --texture->refs > 0)
+        return;
+
+    m_textures.erase(texture->id);
+    if(texture->reloading)
+        TTextureStreamer::Instance()->Cancel(texture->id);
+    glDeleteTextures(1, &texture->id);
+    if(texture->target == GL_TEXTURE_2D_ARRAY)
+        Texture::InvalidateArrayBindings();
+    delete texture;
+}
+
+/**
+****************************************************************************************************
+@brief Full resolution image of texture was specified - update its size and residency
+@param id OpenGL texture
+@param success false if image couldn't be loaded (texture won't be reloaded anymore)
+****************************************************************************************************/
+void SceneManager::TextureUploaded(GLuint id, bool success)
+{
+    m_it = m_textures.find(id);
+    if(m_it == m_textures.end())
+        return;
+    TTextureResidency *t = m_it->second;
+    t->reloading = false;
+    if(!success)
+    {
+        t->file.clear();
+        return;
+    }
+
+    t->dropped = 0;
+    t->evicted = false;
+    t->bytes = t->full_bytes = Texture::GetVideoBytes(id, t->target);
+    GLint w = 0, h = 0;
+    GLenum face = t->target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : t->target;
+    glBindTexture(t->target, id);
+    glGetTexLevelParameteriv(face, 0, GL_TEXTURE_WIDTH, &w);
+    glGetTexLevelParameteriv(face, 0, GL_TEXTURE_HEIGHT, &h);
+    glBindTexture(t->target, 0);
+    t->width = w;
+    t->height = h;
+}
+
+/**
+****************************************************************************************************
+@brief Was texture used in current or last frame? (unregistered textures are considered unused)
+@param id OpenGL texture
+****************************************************************************************************/
+bool SceneManager::IsTextureUsed(GLuint id)
+{
+    m_it = m_textures.find(id);
+    return m_it != m_textures.end() && m_it->second->last_used + 1 >= m_frame;
+}
+
+/**
+****************************************************************************************************
+@brief Start new frame. Demoted textures used in last frame are reloaded (through texture streamer)
+when their full size fits into budget with some headroom. Then, while textures exceed budget,
+least recently used texture loses its top mip level. Small textures and textures without mipmaps
+are replaced by placeholder.
+****************************************************************************************************/
+void SceneManager::UpdateTextureResidency()
+{
+    m_frame++;
+
+    //reloaded textures are counted in full size
+    size_t total = 0;
+    for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
+        total += m_it->second->reloading ? m_it->second->full_bytes : m_it->second->bytes;
+
+    ///1. reload used textures
+    for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
+    {
+        TTextureResidency *t = m_it->second;
+        if(t->reloading || t->file.empty() || (t->dropped == 0 && !t->evicted) || t->last_used + 1 < m_frame)
+            continue;
+        size_t grow = t->full_bytes - t->bytes;
+        if(m_texture_budget > 0 && total + grow > m_texture_budget*TEXTURE_RELOAD_HEADROOM)
+            continue;
+
+        t->reloading = true;
+        total += grow;
+        m_texture_stats.reloads++;
+        //demoted texture keeps its levels until whole chain is uploaded
+        TTextureStreamer::Instance()->Request(t->id, t->file.c_str(), t->textype, t->mipmap, t->compress, t->evicted);
+    }
+    if(m_texture_budget == 0)
+        return;
+
+    ///2. demote least recently used textures
+    while(total > m_texture_budget)
+    {
+        TTextureResidency *lru = NULL;
+        for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
+        {
+            TTextureResidency *t = m_it->second;
+            if(t->reloading || t->evicted || t->file.empty())
+                continue;
+            if(lru == NULL || t->last_used < lru->last_used)
+                lru = t;
+        }
+        if(lru == NULL)
+            break;
+
+        size_t before = lru->bytes;
+        GLuint size = max(lru->width, lru->height) >> lru->dropped;
+        if(lru->mipmap && size/2 >= TEXTURE_MIN_DEMOTED_SIZE && Texture::DropTopLevel(lru->id))
+        {
+            lru->dropped++;
+            m_texture_stats.demotions++;
+        }
+        else
+        {
+            glBindTexture(GL_TEXTURE_2D, lru->id);
+            Texture::SpecifyPlaceholder(lru->textype);
+            unsigned levels = 1;
+            while((size >> levels) > 0)
+                levels++;
+            Texture::FreeLevels(1, levels);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            lru->evicted = true;
+            m_texture_stats.evictions++;
+        }
+        lru->bytes = Texture::GetVideoBytes(lru->id, GL_TEXTURE_2D);
+        total = total - before + lru->bytes;
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Return texture memory statistics
+****************************************************************************************************/
+TTextureStats SceneManager::GetTextureStats()
+{
+    TTextureStats stats = m_texture_stats;
+    stats.textures = m_textures.size();
+    stats.budget = m_texture_budget;
+    stats.bytes = 0;
+    stats.demoted = stats.evicted = 0;
+    for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
+    {
+        stats.bytes += m_it->second->bytes;
+        if(m_it->second->evicted)
+            stats.evicted++;
+        else if(m_it->second->dropped > 0)
+            stats.demoted++;
+    }
+    stats.cpu_bytes = TTextureStreamer::Instance()->GetDecodedBytes();
+    return stats;
+}
+
+/**
+****************************************************************************************************
+@brief Print resident textures: count, references and video memory
+@param verbose print every texture
+****************************************************************************************************/
+void SceneManager::ReportTextures(bool verbose)
+{
+    unsigned refs = 0;
+    for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
+    {
+        TTextureResidency *t = m_it->second;
+        refs += t->refs;
+        if(verbose)
+            cout<<"  "<<(!t->file.empty() ? t->file : t->target == GL_TEXTURE_2D_ARRAY ? "(texture array)" : "(cube map)")<<": "<<t->bytes/1024<<" kB, "<<t->refs<<" materials"
+                <<(t->reloading ? ", loading" : "")<<"\n";
+    }
+    TTextureStats stats = GetTextureStats();
+    cout<<"Textures: "<<stats.textures<<" textures used by "<<refs<<" materials, "<<stats.bytes/1024<<" kB";
+    if(stats.budget > 0)
+        cout<<" (budget "<<stats.budget/1024<<" kB)";
+    cout<<"\n";
+}
+
+/**
+****************************************************************************************************
+@brief Find program generated from the same source and add reference to it
+@param key canonical source of program
+@return program or NULL if it hasn't been compiled yet
+****************************************************************************************************/
+TShaderProgram* SceneManager::AcquireProgram(const string &key)
+{
+    m_ip = m_programs.find(key);
+    if(m_ip == m_programs.end())
+        return NULL;
+    m_ip->second->refs++;
+    m_program_stats.reused++;
+    m_program_stats.saved_ms += m_ip->second->compile_ms;
+    return m_ip->second;
+}
+
+/**
+****************************************************************************************************
+@brief Register submitted program. Manager becomes owner of program and its shaders. Program is
+ready after FinishProgram() of material generator.
+@param key canonical source of program
+@param program program (linking may be in progress)
+@param v_shader vertex shader
+@param f_shader fragment shader
+@param compile_ms time of compilation and linking (saved by every reuse)
+@return new program with one reference
+****************************************************************************************************/
+TShaderProgram* SceneManager::AddProgram(const string &key, GLuint program, GLuint v_shader, GLuint f_shader, float compile_ms)
+{
+    TShaderProgram *p = new TShaderProgram;
+    p->program = program;
+    p->v_shader = v_shader;
+    p->f_shader = f_shader;
+    p->key = key;
+    p->refs = 1;
+    p->owner = NULL;
+    p->compile_ms = compile_ms;
+    //program isn't ready nor linked until it is finished (see FinishProgram())
+    p->ready = false;
+    p->linked = false;
+
+    m_programs[key] = p;
+    m_program_stats.compiled++;
+    m_program_stats.compile_ms += compile_ms;
+    return p;
+}
+
+/**
+****************************************************************************************************
+@brief Mark program as linked (shaders compiled in background are finished)
+@param program linked program
+@param ms time spent by finishing program (added to compile time)
+****************************************************************************************************/
+void SceneManager::ProgramLinked(TShaderProgram *program, float ms)
+{
+    program->ready = true;
+    program->compile_ms += ms;
+    m_program_stats.compile_ms += ms;
+}
+
+/**
+****************************************************************************************************
+@brief Remove reference to program. Program and shaders are deleted when no material uses them
+@param program released program
+****************************************************************************************************/
+void SceneManager::ReleaseProgram(TShaderProgram *program)
+{
+    if(program == NULL || --program->refs > 0)
+        return;
+
+    m_programs.erase(program->key);
+    //program loaded from binary cache has no shaders
+    if(program->v_shader != 0)
+    {
+        glDetachShader(program->program, program->v_shader);
+        glDetachShader(program->program, program->f_shader);
+        glDeleteShader(program->v_shader);
+        glDeleteShader(program->f_shader);
+    }
+    glDeleteProgram(program->program);
+    delete program;
+}
+
+/**
+****************************************************************************************************
+@brief Return shader program statistics
+****************************************************************************************************/
+TProgramStats SceneManager::GetProgramStats()
+{
+    TProgramStats stats = m_program_stats;
+    stats.programs = m_programs.size();
+    return stats;
+}
+
+/**
+****************************************************************************************************
+@brief Print generated programs: compiled and reused programs and compile time saved by reuse,
+program binary cache and shader source files
+****************************************************************************************************/
+void SceneManager::ReportPrograms()
+{
+    unsigned refs = 0;
+    for(m_ip = m_programs.begin(); m_ip != m_programs.end(); ++m_ip)
+        refs += m_ip->second->refs;
+    TProgramStats stats = GetProgramStats();
+    cout<<"Programs: "<<stats.programs<<" programs used by "<<refs<<" materials, "<<stats.compiled<<" compiled ("
+        <<stats.compile_ms<<" ms), "<<stats.reused<<" reused (saved "<<stats.saved_ms<<" ms)\n";
+    TProgramCacheStats cache = GetProgramCacheStats();
+    if(cache.hits + cache.misses > 0)
+        cout<<"Program cache: "<<cache.hits<<" binaries loaded ("<<cache.hit_ms<<" ms), "<<cache.misses<<" compiled ("
+            <<cache.compile_ms<<" ms), "<<cache.rejected<<" rejected by driver, "<<cache.stored<<" stored\n";
+    TShaderSourceStats sources = GetShaderSourceStats();
+    cout<<"Shader sources: "<<sources.reads<<" files read ("<<sources.bytes/1024<<" kB), "<<sources.hits<<" loads from cache\n";
 }
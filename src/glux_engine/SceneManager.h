@@ -3,9 +3,64 @@
 
 #include "globals.h"
 #include "object.h"
+#include "texture.h"
 
-enum VBOMembers { VBO_ARRAY, VBO_BUFFER, VBO_INDEX };
+///demoted textures are reloaded only when they fit into this part of texture budget (hysteresis)
+#define TEXTURE_RELOAD_HEADROOM 0.9
+///textures aren't demoted under this size, they are replaced by placeholder instead
+#define TEXTURE_MIN_DEMOTED_SIZE 32
 
+///@brief Texture memory statistics
+struct TTextureStats{
+    ///registered textures, their video memory and budget (0 - unlimited)
+    unsigned textures;
+    size_t bytes, budget;
+    ///decoded images waiting for upload
+    size_t cpu_bytes;
+    ///textures with dropped levels and textures replaced by placeholder
+    unsigned demoted, evicted;
+    ///total count of dropped levels, evictions and reloads
+    unsigned demotions, evictions, reloads;
+};
+
+///@brief Linked program of generated shader. Materials with the same features generate the same
+///source, so they share one program and differ only in uniform values.
+struct TShaderProgram{
+    ///program and its shaders
+    GLuint program, v_shader, f_shader;
+    ///canonical source of program (vertex and fragment shader)
+    string key;
+    ///number of materials using program, material whose uniforms are set in program
+    unsigned refs;
+    const void *owner;
+    ///time of compilation and linking in milliseconds
+    float compile_ms;
+    ///is program linked and are its uniform blocks bound?
+    bool ready;
+    ///link status (valid when program is ready)
+    bool linked;
+};
+
+///@brief Shader program statistics
+struct TProgramStats{
+    ///linked programs, programs compiled and reused since start
+    unsigned programs, compiled, reused;
+    ///total time of compilation and estimated time saved by reuse (milliseconds)
+    float compile_ms, saved_ms;
+};
+
+/**
+@class SceneManager
+@brief Owner of shared scene resources. Geometry (vertex/index buffers with their LOD chains,
+clusters and bounding volumes) is reference counted - objects acquire it by source name (file) or
+by content hash, so identical meshes share one copy of buffers. Buffers are freed when last object
+using them releases them.
+Programs of generated shaders are reference counted by their canonical source, materials with
+the same features share one program.
+Textures loaded from files are reference counted by OpenGL texture ID. Their video memory is kept
+under budget by dropping top mip levels of least recently used textures (or replacing them by
+placeholder), demoted textures are reloaded from file or compressed cache when used again.
+***************************************************************************************************/
 class SceneManager : public Singleton
 { 
 
@@ -15,49 +70,93 @@ protected:
 public:
     static SceneManager * Instance();
 
+    //hash of mesh content (used to find byte-identical meshes)
+    static unsigned long long HashGeometry(const vector<GLfloat> &vertices, const vector<GLfloat> &normals,
+                                           const vector<GLfloat> &texcoords, const vector<GLuint> &indices, GLenum drawmode);
+
 //-- Public methods and members
 protected:
-	///associative array with all VBOs
-	map<string,VBO> m_vbos;
-    ///iterator for vbos container
-    map<string,VBO>::iterator m_ivbo;
+    ///geometry by source name (file) and by content hash
+    map<string,TGeometry*> m_geometry_names;
+    map<unsigned long long,TGeometry*> m_geometry;
+    ///iterators for geometry containers
+    map<string,TGeometry*>::iterator m_ign;
+    map<unsigned long long,TGeometry*>::iterator m_ig;
+
+    ///textures by OpenGL ID
+    map<GLuint,TTextureResidency*> m_textures;
+    map<GLuint,TTextureResidency*>::iterator m_it;
+    ///video memory budget for textures (0 - unlimited)
+    size_t m_texture_budget;
+    ///current frame (for least recently used textures), counters of evictions and reloads
+    unsigned m_frame;
+    TTextureStats m_texture_stats;
+
+    ///generated shader programs by canonical source
+    map<string,TShaderProgram*> m_programs;
+    map<string,TShaderProgram*>::iterator m_ip;
+    TProgramStats m_program_stats;
 
 public:
 	SceneManager(void);
 	virtual ~SceneManager(void);
 
-	void setVBO( string _name, VBO _vbo )
-	{
-		m_vbos[_name] = _vbo;
-	}
-
-	///@brief Return given type of VBO according to its name. The third parameter is used as index for VBO_BUFFER type
-	GLuint getVBO( VBOMembers _type, string _name, int _i = 0 )
-	{
-		assert(_i<4);
-
-		GLuint ret;
-
-		switch(_type)
-		{
-		case VBO_ARRAY:
-			ret = m_vbos[_name].vao;
-			break;
-		case VBO_BUFFER:
-			ret = m_vbos[_name].buffer[_i];
-			break;
-		case VBO_INDEX:
-			ret = m_vbos[_name].indices;
-			break;
-		default:
-			ret = 0;
-			break;
-		}
-		
-		return ret;
-	}
+    //find geometry by source name, adds reference (NULL if not found)
+    TGeometry* AcquireGeometry(const string &name);
+    //find geometry by content hash and compare its content, adds reference (NULL if not found)
+    TGeometry* AcquireGeometry(unsigned long long hash, const vector<GLfloat> &vertices, const vector<GLfloat> &normals,
+                               const vector<GLfloat> &texcoords, const vector<GLuint> &indices, GLenum drawmode);
+    //register new geometry, returned geometry has one reference
+    TGeometry* AddGeometry(const string &name, unsigned long long hash, const VBO &vbo, BoundingVolume *obb,
+                           GLenum drawmode, bool element_indices, size_t bytes);
+    //make geometry accessible by another source name
+    void AliasGeometry(const string &name, TGeometry *geometry);
+    //remove reference, free geometry when unused
+    void ReleaseGeometry(TGeometry *geometry);
+
+    //total size of geometry buffers in video memory
+    size_t GetGeometryBytes();
+    //print resident geometry (per mesh when verbose)
+    void ReportGeometry(bool verbose = false);
 
+    //register texture loaded from file, returned record has one reference
+    TTextureResidency* AddTexture(GLuint id, GLenum target, const char *file, int textype, bool mipmap, bool compress);
+    //find texture record and add reference (NULL if texture isn't registered)
+    TTextureResidency* AcquireTexture(GLuint id);
+    //remove reference, delete texture when unused
+    void ReleaseTexture(TTextureResidency *texture);
+    //update size of texture after its full resolution image was uploaded (or loading failed)
+    void TextureUploaded(GLuint id, bool success = true);
+    //was texture used in current or last frame?
+    bool IsTextureUsed(GLuint id);
+    //start new frame - demote least recently used textures over budget, reload used demoted textures
+    void UpdateTextureResidency();
+
+    ///@brief Set video memory budget for textures in bytes (0 - unlimited)
+    void SetTextureBudget(size_t bytes){
+        m_texture_budget = bytes;
+    }
+    ///@brief Return current frame number (textures remember frame of their last use)
+    unsigned GetFrame(){
+        return m_frame;
+    }
+    //texture memory statistics
+    TTextureStats GetTextureStats();
+    //print resident textures (per texture when verbose)
+    void ReportTextures(bool verbose = false);
+
+    //find program with given canonical source and add reference (NULL if not found)
+    TShaderProgram* AcquireProgram(const string &key);
+    //register linked program, returned program has one reference
+    TShaderProgram* AddProgram(const string &key, GLuint program, GLuint v_shader, GLuint f_shader, float compile_ms);
+    //remove reference, delete program when unused
+    void ReleaseProgram(TShaderProgram *program);
+    //mark program as linked, add time spent by waiting for linking
+    void ProgramLinked(TShaderProgram *program, float ms);
+    //shader program statistics
+    TProgramStats GetProgramStats();
+    //print compiled and reused programs
+    void ReportPrograms();
 };
 
 #endif
-
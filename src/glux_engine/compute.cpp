@@ -8,6 +8,7 @@ Code adapted from: ATI Stream SDK, http://developer.amd.com/gpu/ATIStreamSDK/Pag
 ***************************************************************************************************/
 
 #include "compute.h"
+#include "shader_source.h"
 
 /****************************************************************************************************
 @brief Set some basic values
@@ -27,19 +28,14 @@ TCompute::TCompute()
 ***************************************************************************************************/
 string TCompute::LoadSource(const char* source)
 {
-  ifstream fin(source);
-  if(!fin)
+  string data;
+  if(!LoadShaderSource(source, data))
   {
     string msg = "Cannot open kernel source ";
     msg += source;
     ShowMessage(msg.c_str(), false);
     return "null";
   }
-  string data;
-  char ch;
-  while(fin.get(ch))
-    data+=ch;
-
   return data;
 }
 
@@ -37,6 +37,7 @@ Version: 1.0
 
 #include "dito.h"
 #include <cmath>
+#include "thread_pool.h"
 
 namespace DiTO
 {
@@ -516,4 +517,337 @@ void DiTO_14(Vector<F> vertArr[], int nv, OBB<F>& obb)
 	else { finalizeAxisAlignedOBB(alMid, alLen, obb); } // otherwise, assign all OBB params using the intial AABB
 }
 
-}
\ No newline at end of file
+
+/*
+Strided variant of DiTO-14. Only the passes over all vertices (extremal points along the 7 fixed
+directions and the final box dimensions) are reimplemented, the steps working with the 14 selected
+points are shared with the generic implementation above.
+*/
+
+// Inputs with more vertices are split among worker threads, in chunks of DITO_CHUNK_SIZE vertices
+#define DITO_PARALLEL_MIN_VERTICES 65536
+#define DITO_CHUNK_SIZE 32768
+
+inline const float * stridedVertex(const float * posArr, int stride, int i)
+{	return (const float *)((const char *)posArr + (size_t)i * stride);
+}
+
+inline Vector<float> stridedVector(const float * posArr, int stride, int i)
+{	const float * v = stridedVertex(posArr, stride, i);
+	return createVector(v[0], v[1], v[2]);
+}
+
+// Extremal projections and indices of extremal vertices of a vertex range
+struct ExtremalRange
+{	float minProj[7], maxProj[7];
+	int minIndex[7], maxIndex[7];
+};
+
+// Merge results of two ranges. On ties the lower index wins, so the result matches the serial loop
+inline void mergeExtremalRange(ExtremalRange & dst, const ExtremalRange & src)
+{	for (int k = 0; k < 7; k++)
+	{	if (src.minProj[k] < dst.minProj[k] || (src.minProj[k] == dst.minProj[k] && src.minIndex[k] < dst.minIndex[k]))
+		{	dst.minProj[k] = src.minProj[k]; dst.minIndex[k] = src.minIndex[k]; }
+		if (src.maxProj[k] > dst.maxProj[k] || (src.maxProj[k] == dst.maxProj[k] && src.maxIndex[k] < dst.maxIndex[k]))
+		{	dst.maxProj[k] = src.maxProj[k]; dst.maxIndex[k] = src.maxIndex[k]; }
+	}
+}
+
+inline void projectOnFixedDirs(const float * v, float proj[7])
+{	proj[0] = v[0];
+	proj[1] = v[1];
+	proj[2] = v[2];
+	proj[3] = v[0] + v[1] + v[2];
+	proj[4] = v[0] + v[1] - v[2];
+	proj[5] = v[0] - v[1] + v[2];
+	proj[6] = v[0] - v[1] - v[2];
+}
+
+void findExtremalPoints_7FixedDirs_Range(const float * posArr, int stride, int begin, int end, ExtremalRange & r)
+{	float proj[7];
+	int i = begin;
+
+	projectOnFixedDirs(stridedVertex(posArr, stride, i), proj);
+	for (int k = 0; k < 7; k++)
+	{	r.minProj[k] = r.maxProj[k] = proj[k];
+		r.minIndex[k] = r.maxIndex[k] = i;
+	}
+	i++;
+
+#ifdef USE_SSE
+	// 4 vertices at once, every lane keeps its own extremes and their indices
+	if (end - i >= 4)
+	{	__m128 tMin[7], tMax[7];
+		__m128i tMinIndex[7], tMaxIndex[7];
+		for (int k = 0; k < 7; k++)
+		{	tMin[k] = _mm_set1_ps(r.minProj[k]);
+			tMax[k] = _mm_set1_ps(r.maxProj[k]);
+			tMinIndex[k] = tMaxIndex[k] = _mm_set1_epi32(begin);
+		}
+
+		__m128i index = _mm_setr_epi32(i, i + 1, i + 2, i + 3);
+		const __m128i four = _mm_set1_epi32(4);
+		for (; i + 4 <= end; i += 4)
+		{	const float * v0 = stridedVertex(posArr, stride, i);
+			const float * v1 = stridedVertex(posArr, stride, i + 1);
+			const float * v2 = stridedVertex(posArr, stride, i + 2);
+			const float * v3 = stridedVertex(posArr, stride, i + 3);
+			__m128 x = _mm_setr_ps(v0[0], v1[0], v2[0], v3[0]);
+			__m128 y = _mm_setr_ps(v0[1], v1[1], v2[1], v3[1]);
+			__m128 z = _mm_setr_ps(v0[2], v1[2], v2[2], v3[2]);
+			__m128 xpy = _mm_add_ps(x, y);
+			__m128 xmy = _mm_sub_ps(x, y);
+			__m128 p[7] = { x, y, z, _mm_add_ps(xpy, z), _mm_sub_ps(xpy, z), _mm_add_ps(xmy, z), _mm_sub_ps(xmy, z) };
+
+			for (int k = 0; k < 7; k++)
+			{	__m128i less = _mm_castps_si128(_mm_cmplt_ps(p[k], tMin[k]));
+				__m128i greater = _mm_castps_si128(_mm_cmpgt_ps(p[k], tMax[k]));
+				tMin[k] = _mm_min_ps(p[k], tMin[k]);
+				tMax[k] = _mm_max_ps(p[k], tMax[k]);
+				tMinIndex[k] = _mm_or_si128(_mm_and_si128(less, index), _mm_andnot_si128(less, tMinIndex[k]));
+				tMaxIndex[k] = _mm_or_si128(_mm_and_si128(greater, index), _mm_andnot_si128(greater, tMaxIndex[k]));
+			}
+			index = _mm_add_epi32(index, four);
+		}
+
+		// Reduce lanes
+		ExtremalRange lane;
+		float laneMin[7][4], laneMax[7][4];
+		int laneMinIndex[7][4], laneMaxIndex[7][4];
+		for (int k = 0; k < 7; k++)
+		{	_mm_storeu_ps(laneMin[k], tMin[k]);
+			_mm_storeu_ps(laneMax[k], tMax[k]);
+			_mm_storeu_si128((__m128i *)laneMinIndex[k], tMinIndex[k]);
+			_mm_storeu_si128((__m128i *)laneMaxIndex[k], tMaxIndex[k]);
+		}
+		for (int l = 0; l < 4; l++)
+		{	for (int k = 0; k < 7; k++)
+			{	lane.minProj[k] = laneMin[k][l]; lane.minIndex[k] = laneMinIndex[k][l];
+				lane.maxProj[k] = laneMax[k][l]; lane.maxIndex[k] = laneMaxIndex[k][l];
+			}
+			mergeExtremalRange(r, lane);
+		}
+	}
+#endif
+
+	for (; i < end; i++)
+	{	projectOnFixedDirs(stridedVertex(posArr, stride, i), proj);
+		for (int k = 0; k < 7; k++)
+		{	if (proj[k] < r.minProj[k]) { r.minProj[k] = proj[k]; r.minIndex[k] = i; }
+			if (proj[k] > r.maxProj[k]) { r.maxProj[k] = proj[k]; r.maxIndex[k] = i; }
+		}
+	}
+}
+
+// Extremal projections of a vertex range onto 3 directions
+struct ProjectionRange
+{	float minProj[3], maxProj[3];
+};
+
+void findExtremalProjs_3Dirs_Range(const float * posArr, int stride, int begin, int end, const Vector<float> dir[3], ProjectionRange & r)
+{	int i = begin;
+	for (int k = 0; k < 3; k++)
+		r.minProj[k] = r.maxProj[k] = dot(stridedVector(posArr, stride, i), dir[k]);
+	i++;
+
+#ifdef USE_SSE
+	if (end - i >= 4)
+	{	__m128 tMin[3], tMax[3], dx[3], dy[3], dz[3];
+		for (int k = 0; k < 3; k++)
+		{	tMin[k] = _mm_set1_ps(r.minProj[k]);
+			tMax[k] = _mm_set1_ps(r.maxProj[k]);
+			dx[k] = _mm_set1_ps(dir[k].x);
+			dy[k] = _mm_set1_ps(dir[k].y);
+			dz[k] = _mm_set1_ps(dir[k].z);
+		}
+
+		for (; i + 4 <= end; i += 4)
+		{	const float * v0 = stridedVertex(posArr, stride, i);
+			const float * v1 = stridedVertex(posArr, stride, i + 1);
+			const float * v2 = stridedVertex(posArr, stride, i + 2);
+			const float * v3 = stridedVertex(posArr, stride, i + 3);
+			__m128 x = _mm_setr_ps(v0[0], v1[0], v2[0], v3[0]);
+			__m128 y = _mm_setr_ps(v0[1], v1[1], v2[1], v3[1]);
+			__m128 z = _mm_setr_ps(v0[2], v1[2], v2[2], v3[2]);
+			for (int k = 0; k < 3; k++)
+			{	__m128 p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, dx[k]), _mm_mul_ps(y, dy[k])), _mm_mul_ps(z, dz[k]));
+				tMin[k] = _mm_min_ps(p, tMin[k]);
+				tMax[k] = _mm_max_ps(p, tMax[k]);
+			}
+		}
+
+		float laneMin[4], laneMax[4];
+		for (int k = 0; k < 3; k++)
+		{	_mm_storeu_ps(laneMin, tMin[k]);
+			_mm_storeu_ps(laneMax, tMax[k]);
+			for (int l = 0; l < 4; l++)
+			{	if (laneMin[l] < r.minProj[k]) r.minProj[k] = laneMin[l];
+				if (laneMax[l] > r.maxProj[k]) r.maxProj[k] = laneMax[l];
+			}
+		}
+	}
+#endif
+
+	for (; i < end; i++)
+	{	Vector<float> v = stridedVector(posArr, stride, i);
+		for (int k = 0; k < 3; k++)
+		{	float proj = dot(v, dir[k]);
+			if (proj < r.minProj[k]) r.minProj[k] = proj;
+			if (proj > r.maxProj[k]) r.maxProj[k] = proj;
+		}
+	}
+}
+
+// Data of a parallel pass - input, chunks and per-chunk results
+struct StridedPass
+{	const float * posArr;
+	int nv, stride;
+	const Vector<float> * dir;
+	std::vector<ExtremalRange> extremal;
+	std::vector<ProjectionRange> projection;
+};
+
+inline int chunkEnd(int chunk, int nv)
+{	int end = (chunk + 1) * DITO_CHUNK_SIZE;
+	return end < nv ? end : nv;
+}
+
+void extremalPointsJob(int begin, int end, void * data)
+{	StridedPass * pass = (StridedPass *)data;
+	for (int c = begin; c < end; c++)
+		findExtremalPoints_7FixedDirs_Range(pass->posArr, pass->stride, c * DITO_CHUNK_SIZE,
+			chunkEnd(c, pass->nv), pass->extremal[c]);
+}
+
+void extremalProjsJob(int begin, int end, void * data)
+{	StridedPass * pass = (StridedPass *)data;
+	for (int c = begin; c < end; c++)
+		findExtremalProjs_3Dirs_Range(pass->posArr, pass->stride, c * DITO_CHUNK_SIZE,
+			chunkEnd(c, pass->nv), pass->dir, pass->projection[c]);
+}
+
+inline int chunkCount(int nv, bool parallel)
+{	return (parallel && nv >= DITO_PARALLEL_MIN_VERTICES) ? (nv + DITO_CHUNK_SIZE - 1) / DITO_CHUNK_SIZE : 1;
+}
+
+void findExtremalPoints_7FixedDirs_Strided(const float * posArr, int nv, int stride, bool parallel,
+	float minProj[7], float maxProj[7], Vector<float> minVert[7], Vector<float> maxVert[7])
+{	ExtremalRange r;
+	int chunks = chunkCount(nv, parallel);
+	if (chunks == 1)
+		findExtremalPoints_7FixedDirs_Range(posArr, stride, 0, nv, r);
+	else
+	{	StridedPass pass;
+		pass.posArr = posArr; pass.nv = nv; pass.stride = stride; pass.dir = NULL;
+		pass.extremal.resize(chunks);
+		TThreadPool::Instance()->ParallelFor(chunks, 1, extremalPointsJob, &pass);
+		r = pass.extremal[0];
+		for (int c = 1; c < chunks; c++)
+			mergeExtremalRange(r, pass.extremal[c]);
+	}
+
+	for (int k = 0; k < 7; k++)
+	{	minProj[k] = r.minProj[k];
+		maxProj[k] = r.maxProj[k];
+		minVert[k] = stridedVector(posArr, stride, r.minIndex[k]);
+		maxVert[k] = stridedVector(posArr, stride, r.maxIndex[k]);
+	}
+}
+
+void computeObbDimensions_Strided(const float * posArr, int nv, int stride, bool parallel,
+	Vector<float> & v0, Vector<float> & v1, Vector<float> & v2, Vector<float> & min, Vector<float> & max)
+{	Vector<float> dir[3] = { v0, v1, v2 };
+	ProjectionRange r;
+	int chunks = chunkCount(nv, parallel);
+	if (chunks == 1)
+		findExtremalProjs_3Dirs_Range(posArr, stride, 0, nv, dir, r);
+	else
+	{	StridedPass pass;
+		pass.posArr = posArr; pass.nv = nv; pass.stride = stride; pass.dir = dir;
+		pass.projection.resize(chunks);
+		TThreadPool::Instance()->ParallelFor(chunks, 1, extremalProjsJob, &pass);
+		r = pass.projection[0];
+		for (int c = 1; c < chunks; c++)
+			for (int k = 0; k < 3; k++)
+			{	if (pass.projection[c].minProj[k] < r.minProj[k]) r.minProj[k] = pass.projection[c].minProj[k];
+				if (pass.projection[c].maxProj[k] > r.maxProj[k]) r.maxProj[k] = pass.projection[c].maxProj[k];
+			}
+	}
+
+	min = createVector(r.minProj[0], r.minProj[1], r.minProj[2]);
+	max = createVector(r.maxProj[0], r.maxProj[1], r.maxProj[2]);
+}
+
+void finalizeLineAlignedOBB_Strided(Vector<float> & u, const float * posArr, int nv, int stride, bool parallel, OBB<float> & obb)
+{	// Same as finalizeLineAlignedOBB, box dimensions are computed from strided vertices
+	Vector<float> r, v, w;
+
+	r = u;
+	if (fabs(u.x) > fabs(u.y) && fabs(u.x) > fabs(u.z)) { r.x = 0; }
+	else if (fabs(u.y) > fabs(u.z) ) { r.y = 0; }
+	else { r.z = 0; }
+
+	float eps = 0.000001f;
+	float sqLen = sqLength(r);
+	if (sqLen < eps) { r.x = r.y = r.z = 1; }
+
+	v = normalize(cross(u, r));
+	w = normalize(cross(u, v));
+
+	Vector<float> bMin, bMax, bLen;
+	computeObbDimensions_Strided(posArr, nv, stride, parallel, u, v, w, bMin, bMax);
+	bLen = sub(bMax, bMin);
+	finalizeOBB(u, v, w, bMin, bMax, bLen, obb);
+}
+
+void DiTO_14_Strided(const float * posArr, int nv, int stride, OBB<float>& obb, bool parallel)
+{	const int ns = 7;
+	int np = ns * 2;
+	Vector<float> selVert[ns * 2];
+	Vector<float> * minVert = selVert;
+	Vector<float> * maxVert = selVert + ns;
+	float minProj[ns];
+	float maxProj[ns];
+	Vector<float> p0, p1, p2, e0, e1, e2, n;
+	Vector<float> alLen, alMid;
+	Vector<float> b0, b1, b2;
+	float alVal, bestVal;
+	Vector<float> bMin, bMax, bLen;
+
+	if (stride == 0)
+		stride = 3 * sizeof(float);
+
+	// Few vertices are processed by the generic implementation, which uses all of them as selected points
+	if (nv <= np)
+	{	for (int i = 0; i < nv; i++)
+			selVert[i] = stridedVector(posArr, stride, i);
+		DiTO_14(selVert, nv, obb);
+		return;
+	}
+
+	findExtremalPoints_7FixedDirs_Strided(posArr, nv, stride, parallel, minProj, maxProj, minVert, maxVert);
+
+	alMid = createVector((minProj[0] + maxProj[0]) * 0.5f, (minProj[1] + maxProj[1]) * 0.5f, (minProj[2] + maxProj[2]) * 0.5f);
+	alLen = createVector(maxProj[0] - minProj[0], maxProj[1] - minProj[1], maxProj[2] - minProj[2]);
+	alVal = getQualityValue(alLen);
+
+	bestVal = alVal;
+	b0 = createVector<float>(1, 0, 0);
+	b1 = createVector<float>(0, 1, 0);
+	b2 = createVector<float>(0, 0, 1);
+
+	int baseTriangleConstr = findBestObbAxesFromBaseTriangle(minVert, maxVert, ns, selVert, np, n, p0, p1, p2, e0, e1, e2, b0, b1, b2, bestVal, obb);
+	if (baseTriangleConstr == 1) { finalizeAxisAlignedOBB(alMid, alLen, obb); return; }
+	if (baseTriangleConstr == 2) { finalizeLineAlignedOBB_Strided(e0, posArr, nv, stride, parallel, obb); return; }
+
+	findImprovedObbAxesFromUpperAndLowerTetrasOfBaseTriangle(selVert, np, n, p0, p1, p2, e0, e1, e2, b0, b1, b2, bestVal, obb);
+
+	computeObbDimensions_Strided(posArr, nv, stride, parallel, b0, b1, b2, bMin, bMax);
+	bLen = sub(bMax, bMin);
+	bestVal = getQualityValue(bLen);
+
+	if (bestVal < alVal) { finalizeOBB(b0, b1, b2, bMin, bMax, bLen, obb); }
+	else { finalizeAxisAlignedOBB(alMid, alLen, obb); }
+}
+
+}
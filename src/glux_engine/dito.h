@@ -76,4 +76,17 @@ top of the .cpp file.
 template <typename F>
 extern void DiTO_14(Vector<F> vertArr[], int nv, OBB<F>& obb);
 
+/*
+Variant of DiTO_14 for float positions stored with an arbitrary stride (e.g. interleaved vertex
+buffers). Positions are read in place, passes over all vertices use SSE2 when available and
+large inputs are split among engine worker threads. The result is the same as of DiTO_14.
+Parameters:
+	posArr - Pointer to the first vertex position (x, y, z floats)
+	nv - The number of vertices
+	stride - Distance between consecutive positions in bytes (0 = tightly packed)
+	obb - Output parameter for the resulting OBB
+	parallel - Allow splitting of large inputs among worker threads
+*/
+extern void DiTO_14_Strided(const float *posArr, int nv, int stride, OBB<float>& obb, bool parallel = true);
+
 }
@@ -16,27 +16,51 @@ for every object)
 ***************************************************************************************************/
 void TScene::Redraw(bool delete_buffer)
 {
-    GLenum mrt[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    GLenum mrt[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+    //local lights accumulated from G-buffer (scene is rendered to texture)
+    bool deferred = IsDeferredLighting();
 
-    ///draw all lights
-    unsigned i;
-    for(i=0, m_il = m_lights.begin(); m_il != m_lights.end(), i<m_lights.size(); ++m_il, i++)
+    //reset frame statistics
+    m_stats.triangles = m_stats.triangles_full = 0;
+    m_stats.objects_reduced = 0;
+    m_stats.objects_lit = m_stats.object_lights = 0;
+    //bindings may be changed between frames (UI, passes rendered outside scene)
+    Texture::InvalidateArrayBindings();
+
+    ///upload textures decoded in background (limited amount of data per frame)
+    TTextureStreamer *streamer = TTextureStreamer::Instance();
+    bool streaming = streamer->GetPendingCount() > 0;
+    m_stats.texture_upload_ms = streamer->Update();
+    m_stats.textures_streaming = streamer->GetPendingCount();
+    ///keep textures in video memory budget
+    SceneManager::Instance()->UpdateTextureResidency();
+    ///switch materials with linked programs from uber-shader
+    UpdateMaterials();
+    m_stats.materials_pending = m_pending_materials.size();
+    m_stats.materials_deferred = m_deferred_materials;
+    m_stats.programs_compiled = SceneManager::Instance()->GetProgramStats().compiled;
+
+    ///render shadow maps of lights whose regions of shadow atlas were invalidated (light or caster moved)
+    UpdateShadowAtlas();
+
+    ///find visible tiles of virtual texture, generate tiles missing in previous frame (after shadow
+    ///passes, which restore camera projection)
+    if(m_virtual)
     {
-        ///if light has a shadow, render scene from light view to texture (TScene::RenderShadowMap())
-        if((*m_il)->IsCastingShadow())
-        {
-            //render shadow map
-            if((*m_il)->GetType() == OMNI)
-            {
-				RenderShadowMapOmni(*m_il);
-            }
-            else 
-                RenderShadowMap(*m_il);
-        }
+        m_virtual->BeginFeedback();
+        DrawSceneFeedback();
+        m_virtual->EndFeedback();
+        unsigned uploaded = m_virtual->GetStats().uploaded;
+        m_virtual->Update();
+
+        TVirtualTextureStats vt_stats = m_virtual->GetStats();
+        m_stats.vt_uploaded = vt_stats.uploaded - uploaded;
+        m_stats.vt_resident = vt_stats.resident;
+        m_stats.vt_requested = vt_stats.requested;
     }
 
-    //HDR/SSAO renderer - render to texture
-    if(m_useHDR || m_useSSAO)
+    //HDR/SSAO/deferred renderer - render to texture
+    if(m_useHDR || m_useSSAO || deferred)
     {
         //render target viewport size
         glViewport(0,0,m_RT_resX,m_RT_resY);
@@ -51,13 +75,20 @@ void TScene::Redraw(bool delete_buffer)
             glBindFramebuffer(GL_FRAMEBUFFER, m_f_bufferMSAA);
 
 
-        //multiple render targets - only when using SSAO and/or normal buffer
-        if(m_useNormalBuffer)    
+        //multiple render targets - only when using SSAO and/or normal buffer, G-buffer is attached
+        //for opaque pass of deferred lighting
+        if(deferred)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, m_tex_cache["gbuffer_albedo"], 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, m_tex_cache["gbuffer_normal"], 0);
+            glDrawBuffers(4, mrt);
+        }
+        else if(m_useNormalBuffer)    
             glDrawBuffers(2, mrt);
 
         //clear screen (if desired)
         if(delete_buffer)
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | (m_useGBuffer ? GL_STENCIL_BUFFER_BIT : 0));
     }
     else        //else render to default framebuffer, clear it(if desired)
     {
@@ -70,8 +101,53 @@ void TScene::Redraw(bool delete_buffer)
 
     glViewport(0,0,m_RT_resX,m_RT_resY);
 
-    //render all opaque objects
+    //cull clusters of large meshes, assign local lights to view frustum clusters, then render all opaque objects
+    CullClusters();
+    UpdateLightClusters();
+    //GPU time of opaque pass - result of previous frame is read, so query doesn't stall
+    bool gpu_timer = GLEW_ARB_timer_query != GL_FALSE;
+    if(gpu_timer)
+    {
+        if(m_gpu_timer[0] == 0)
+            glGenQueries(2, m_gpu_timer);
+        glBeginQuery(GL_TIME_ELAPSED, m_gpu_timer[m_frames % 2]);
+    }
+    //opaque pixels of G-buffer are marked in stencil buffer
+    if(deferred)
+    {
+        glEnable(GL_STENCIL_TEST);
+        glStencilFunc(GL_ALWAYS, 1, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    }
     DrawScene(DRAW_OPAQUE);
+    if(gpu_timer)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        GLint available = GL_FALSE;
+        if(m_frames > 0)
+            glGetQueryObjectiv(m_gpu_timer[(m_frames + 1) % 2], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available)
+        {
+            GLuint64 elapsed;
+            glGetQueryObjectui64v(m_gpu_timer[(m_frames + 1) % 2], GL_QUERY_RESULT, &elapsed);
+            m_stats.gpu_opaque_ms = elapsed / 1000000.0f;
+        }
+    }
+    //add local lights to lit pixels, then restore targets of forward rendering
+    if(deferred)
+    {
+        DrawDeferredLights();
+        glDisable(GL_STENCIL_TEST);
+        if(m_useNormalBuffer)
+            glDrawBuffers(2, mrt);
+    }
+    else
+    {
+        m_stats.deferred_pixels = 0;
+        m_stats.gpu_lights_ms = 0.0f;
+        //results of pass rendered before switch to forward mode are stale
+        memset(m_deferred_issued, 0, sizeof(m_deferred_issued));
+    }
 
     //then transparent objects
     glBlendFunc(GL_SRC_ALPHA, GL_ONE);
@@ -128,40 +204,145 @@ void TScene::Redraw(bool delete_buffer)
         glViewport(0,0,m_resx,m_resy);  //restore original scene viewport
         RenderPass("mat_tonemap");
     }
+    //deferred lighting only - copy scene color to screen
+    else if(deferred)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+        glViewport(0,0,m_resx,m_resy);
+        glDisable(GL_DEPTH_TEST);
+        RenderPass("mat_deferred_compose");
+        glEnable(GL_DEPTH_TEST);
+    }
 
-    //show shadow maps
-    if(m_draw_shadow_map)
+    //show shadow atlas (depth is read without comparison)
+    if(m_draw_shadow_map && m_shadow_atlas != NULL)
     {
-        for(int i=0; i<2; i++)
-        {
-            const float q_size = 0.5f;
-            if(m_lights[0]->GetType() == OMNI)
-            {
-                SetUniform("show_depth_omni", "far_plane", SHADOW_FAR);
-                SetUniform("show_depth_omni", "index", float(i));
-                RenderSmallQuad("show_depth_omni", 0.0f, i*q_size, q_size);
-            }
-            else
-            {
-                SetUniform("show_depth", "far_plane", SHADOW_FAR);
-                RenderSmallQuad("show_depth", 0.0f, 0.0f, q_size);
-                break;
-            }
-        }
+        const float q_size = 0.5f;
+        const char *show_mat = m_lights[0]->GetType() == OMNI ? "show_depth_omni" : "show_depth";
+        m_shadow_atlas->SetCompare(false);
+        SetUniform(show_mat, "far_plane", SHADOW_FAR);
+        RenderSmallQuad(show_mat, 0.0f, 0.0f, q_size);
+        m_shadow_atlas->SetCompare(true);
     }
 
     //finish drawing, restore buffers
     glBindVertexArray(0);
+
+    m_stats.lights_per_object = m_stats.objects_lit > 0 ? (float)m_stats.object_lights / m_stats.objects_lit : 0.0f;
+    Texture::PopArrayBinds(&m_stats.array_binds, &m_stats.array_binds_skipped);
+
+    //loading times
+    if(m_frames++ == 0)
+        cout<<"First frame after "<<m_load_timer.GetElapsedTimeMilliseconds()<<" ms ("
+            <<m_stats.textures_streaming<<" textures still streaming, "<<m_stats.materials_pending<<" materials baking, "
+            <<m_stats.materials_deferred<<" deferred, "<<m_stats.programs_compiled<<" programs compiled)\n";
+    if(streaming && m_stats.textures_streaming == 0)
+        cout<<"Texture streaming finished after "<<m_load_timer.GetElapsedTimeMilliseconds()<<" ms ("
+            <<streamer->GetUploadedCount()<<" textures, longest upload stall "<<streamer->GetMaxStall()<<" ms)\n";
+}
+
+/**
+****************************************************************************************************
+@brief Deferred lighting - add clustered point lights to scene color. Screen pass reads G-buffer
+written by opaque pass and loops over light list of pixel's cluster, so shading cost depends on lit
+pixels instead of objects x lights. Pass is limited to pixels of G-buffer (stencil) and to depth
+range of visible lights (depth bounds test, when supported).
+***************************************************************************************************/
+void TScene::DrawDeferredLights()
+{
+    //G-buffer is read by pass, only scene color is written
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, 0, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, 0, 0);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+    //no light in view frustum
+    const glm::vec2 &range = m_clusters->GetDepthRange();
+    if(range.x > range.y)
+    {
+        m_stats.deferred_pixels = 0;
+        m_stats.gpu_lights_ms = 0.0f;
+        memset(m_deferred_issued, 0, sizeof(m_deferred_issued));
+        return;
+    }
+
+    //stencil: only pixels of G-buffer, depth bounds: window depth of lights depth range
+    glStencilFunc(GL_EQUAL, 1, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    if(GLEW_EXT_depth_bounds_test)
+    {
+        glm::vec4 z_min = m_projMatrix * glm::vec4(0.0f, 0.0f, -range.x, 1.0f);
+        glm::vec4 z_max = m_projMatrix * glm::vec4(0.0f, 0.0f, -range.y, 1.0f);
+        glDepthBoundsEXT(0.5 * z_min.z / z_min.w + 0.5, 0.5 * z_max.z / z_max.w + 0.5);
+        glEnable(GL_DEPTH_BOUNDS_TEST_EXT);
+    }
+    //lights are added to scene color
+    glBlendFunc(GL_ONE, GL_ONE);
+    glEnable(GL_BLEND);
+
+    //GPU time and shaded pixels - results of previous frame are read, so queries don't stall
+    if(m_deferred_queries[0] == 0)
+        glGenQueries(4, m_deferred_queries);
+    bool gpu_timer = GLEW_ARB_timer_query != GL_FALSE;
+    unsigned cur = m_frames % 2, prev = (m_frames + 1) % 2;
+    if(gpu_timer)
+        glBeginQuery(GL_TIME_ELAPSED, m_deferred_queries[cur]);
+    glBeginQuery(GL_SAMPLES_PASSED, m_deferred_queries[2 + cur]);
+
+    SetUniform("mat_deferred_lights", "cluster", m_clusters->GetParams());
+    RenderPass("mat_deferred_lights");
+
+    glEndQuery(GL_SAMPLES_PASSED);
+    m_deferred_issued[2 + cur] = true;
+    if(gpu_timer)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        m_deferred_issued[cur] = true;
+    }
+    //only queries issued in previous frame have results, each result is checked separately
+    GLint available = GL_FALSE;
+    if(m_deferred_issued[2 + prev])
+        glGetQueryObjectiv(m_deferred_queries[2 + prev], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(available)
+    {
+        GLuint samples;
+        glGetQueryObjectuiv(m_deferred_queries[2 + prev], GL_QUERY_RESULT, &samples);
+        m_stats.deferred_pixels = samples;
+        m_deferred_issued[2 + prev] = false;
+    }
+    available = GL_FALSE;
+    if(m_deferred_issued[prev])
+        glGetQueryObjectiv(m_deferred_queries[prev], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(available)
+    {
+        GLuint64 elapsed;
+        glGetQueryObjectui64v(m_deferred_queries[prev], GL_QUERY_RESULT, &elapsed);
+        m_stats.gpu_lights_ms = elapsed / 1000000.0f;
+        m_deferred_issued[prev] = false;
+    }
+
+    //restore state of forward rendering
+    glDisable(GL_BLEND);
+    if(GLEW_EXT_depth_bounds_test)
+        glDisable(GL_DEPTH_BOUNDS_TEST_EXT);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_TEST);
 }
 
 /**
 ****************************************************************************************************
-@brief Draw all objects in scene. Drawing is done in material manner because shader switching is slow
+@brief Draw all objects in scene. Drawing is done in material manner because shader switching is slow.
+Distant objects of material are drawn after the others with its reduced shading variant.
 ***************************************************************************************************/
 void TScene::DrawScene(int drawmode)
 {
 	glEnable(GL_CULL_FACE);
 	glCullFace(GL_BACK);
+    //view frustum planes for lazy baking (any material without program tests its objects)
+    glm::vec4 planes[6];
+    ExtractFrustumPlanes(m_projMatrix, planes);
     for(m_im = m_materials.begin(); m_im != m_materials.end(); ++m_im)
     {
         if(!m_im->second->IsScreenSpace()) //don't render shaders working in screen space!
@@ -175,31 +356,95 @@ void TScene::DrawScene(int drawmode)
             else if(drawmode == DRAW_ALPHA && !m_im->second->IsAlpha())
                 continue;
 
+            unsigned matID = m_im->second->GetID();
+            ///lazy baking: bake material when its first object is visible, until then nothing is drawn
+            ///(only objects of deferred material are tested)
+            if(!m_im->second->HasProgram())
+            {
+                map<unsigned, vector<TObject*> >::iterator d = m_deferred_objects.find(matID);
+                if(d == m_deferred_objects.end())
+                    continue;
+                bool visible = false;
+                for(unsigned i = 0; i < d->second.size() && !visible; i++)
+                    visible = d->second[i]->GetMatID() == matID &&
+                              IsVisible(d->second[i], m_viewMatrix * d->second[i]->GetMatrix(), planes);
+                if(!visible)
+                    continue;
+                BakeOnDemand(m_im->second);
+            }
+
             ///attach material shader
             m_im->second->RenderMaterial();
-            unsigned matID = m_im->second->GetID();
+            bool is_virtual = m_virtual && m_im->second->IsVirtual();
+            bool shading_lod = m_shading_lod > 0.0f && m_im->second->HasShadingLOD();
 
             ///render all objects attached to this material
+            m_reduced_objects.clear();
             for(m_io = m_objects.begin(); m_io != m_objects.end(); ++m_io)
             {
                 if(m_io->second->GetSceneID() == m_sceneID && m_io->second->GetMatID() == matID)
                 {
                     //update matrix
                     glm::mat4 m = m_viewMatrix * m_io->second->GetMatrix();
-
-                    m_im->second->SetUniform("in_ModelViewMatrix", m);
-                    m_io->second->Draw(m_im->second->IsTessellated()); //draw object
+                    if(shading_lod && SelectShading(m_io->second, m) == SHADING_REDUCED && m_im->second->RequestShadingLOD())
+                        m_reduced_objects.push_back(m_io->second);
+                    else
+                        DrawObject(m_im->second, m_io->second, m, is_virtual);
                 }
             }
+
+            ///render distant objects with reduced shading
+            if(!m_reduced_objects.empty())
+            {
+                m_im->second->RenderMaterial(SHADING_REDUCED);
+                for(unsigned i=0; i<m_reduced_objects.size(); i++)
+                    DrawObject(m_im->second, m_reduced_objects[i], m_viewMatrix * m_reduced_objects[i]->GetMatrix(), is_virtual);
+                m_stats.objects_reduced += m_reduced_objects.size();
+            }
         }
     }
 }
 
+/**
+****************************************************************************************************
+@brief Draw object with bound material in selected detail level
+@param mat bound material
+@param obj object
+@param modelview object modelview matrix
+@param is_virtual is material textured by virtual texture?
+***************************************************************************************************/
+void TScene::DrawObject(TMaterial *mat, TObject *obj, const glm::mat4 &modelview, bool is_virtual)
+{
+    int lod = SelectLOD(obj, modelview);
+
+    glm::mat4 m = modelview;
+    mat->SetDrawUniform("in_ModelViewMatrix", m);
+    if(m_object_lights > 0)
+    {
+        GLint lights[MAX_OBJECT_LIGHTS];
+        glm::vec3 ambient;
+        int count = SelectLights(obj, lights, ambient);
+        mat->SetObjectLights(lights, count, ambient);
+        m_stats.objects_lit++;
+        m_stats.object_lights += count;
+    }
+    if(is_virtual)
+        mat->SetDrawUniform("in_VirtualRect", obj->GetVirtualRect());
+    obj->Draw(mat->IsTessellated(), lod, true); //draw object
+
+    m_stats.triangles += obj->GetTriangles(lod, true);
+    m_stats.triangles_full += obj->GetTriangles();
+}
+
 /**
 *********************************************************************************************************
 @brief Draw all objects in scene. Only depth values are outputted (drawing into shadow map for spot light)
+@param shadow_mat depth-only material
+@param lightMatrix light view matrix
+@param casters drawn shadow casters (all, static or dynamic - see TObject::IsDynamic())
+@param planes light frustum planes in light view space (NULL - objects aren't culled)
 ********************************************************************************************************/
-void TScene::DrawSceneDepth(const char* shadow_mat, glm::mat4& lightMatrix)
+void TScene::DrawSceneDepth(const char* shadow_mat, glm::mat4& lightMatrix, int casters, const glm::vec4 *planes)
 {
     //then other with depth-only shader
     m_materials[shadow_mat]->RenderMaterial();
@@ -226,10 +471,20 @@ void TScene::DrawSceneDepth(const char* shadow_mat, glm::mat4& lightMatrix)
                 if(m_io->second->IsShadow() && m_io->second->GetSceneID() == m_sceneID 
                 && m_io->second->GetMatID() == matID)
                 {
+                    if((casters == SHADOW_CASTERS_STATIC && m_io->second->IsDynamic()) ||
+                       (casters == SHADOW_CASTERS_DYNAMIC && !m_io->second->IsDynamic()))
+                        continue;
                     //update matrix
                     glm::mat4 m = lightMatrix * m_io->second->GetMatrix();
+                    if(planes != NULL && !IsVisible(m_io->second, m, planes))
+                        continue;
+                    //detail level is selected from camera view with shadow bias
+                    int lod = SelectLOD(m_io->second, m_viewMatrix * m_io->second->GetMatrix(), m_lod_shadow_bias);
                     m_materials[shadow_mat]->SetUniform("in_ModelViewMatrix", m );
-                    m_io->second->Draw(tess);
+                    m_io->second->Draw(tess, lod);
+
+                    m_stats.triangles += m_io->second->GetTriangles(lod);
+                    m_stats.triangles_full += m_io->second->GetTriangles();
                 }
             }
             //disable alpha test (if was enabled)
@@ -240,6 +495,248 @@ void TScene::DrawSceneDepth(const char* shadow_mat, glm::mat4& lightMatrix)
 }
 
 
+/**
+*********************************************************************************************************
+@brief Draw objects with virtual texture into feedback buffer of virtual texture (page and mip level
+required by each pixel). Other objects are drawn too (without output), so they occlude hidden pages.
+********************************************************************************************************/
+void TScene::DrawSceneFeedback()
+{
+    TMaterial *feedback = m_materials["mat_vt_feedback"];
+    feedback->RenderMaterial();
+    feedback->SetUniform("vt_pages", (float)m_virtual->GetPages());
+    //feedback is smaller than screen, so screen space derivatives are larger
+    feedback->SetUniform("vt_lod_bias", -log((float)VT_FEEDBACK_DIVISOR)/log(2.0f));
+
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+    for(m_im = m_materials.begin(); m_im != m_materials.end(); ++m_im)
+    {
+        if(m_im->second->IsScreenSpace() || m_im->second->GetTransparency() > 0.0)
+            continue;
+
+        bool is_virtual = m_im->second->IsVirtual();
+        if(!is_virtual)
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        unsigned matID = m_im->second->GetID();
+        for(m_io = m_objects.begin(); m_io != m_objects.end(); ++m_io)
+        {
+            if(m_io->second->GetSceneID() == m_sceneID && m_io->second->GetMatID() == matID)
+            {
+                glm::mat4 m = m_viewMatrix * m_io->second->GetMatrix();
+                int lod = SelectLOD(m_io->second, m);
+                feedback->SetUniform("in_ModelViewMatrix", m);
+                feedback->SetUniform("in_VirtualRect", m_io->second->GetVirtualRect());
+                m_io->second->Draw(false, lod);
+
+                m_stats.triangles += m_io->second->GetTriangles(lod);
+            }
+        }
+        if(!is_virtual)
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+}
+
+
+/**
+****************************************************************************************************
+@brief Select lights with the largest contribution to object. Light spheres (falloff radius) are
+intersected with world space bounding sphere of object, intersecting lights are ranked by attenuation
+at the nearest point of bounding sphere weighted by luminance of light. Ambient color of lights
+which aren't selected is summed (ambient isn't attenuated by distance).
+@param obj object to draw
+@param lights output light indices (m_object_lights at most)
+@param ambient output ambient color of other lights
+@return number of selected lights
+***************************************************************************************************/
+int TScene::SelectLights(TObject *obj, GLint *lights, glm::vec3 &ambient)
+{
+    glm::mat4 m = obj->GetMatrix();
+    glm::vec3 center = glm::vec3(m * glm::vec4(obj->GetBoundingCenter(), 1.0));
+    float radius = obj->GetBoundingRadius() * max(glm::length(glm::vec3(m[0])), 
+                                                  max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+    const glm::vec3 lum(0.299f, 0.587f, 0.114f);
+    float weights[MAX_OBJECT_LIGHTS];
+    int count = 0, size = m_object_lights;
+    ambient = glm::vec3(0.0);
+
+    for(unsigned i = 0; i < m_lights.size(); i++)
+    {
+        TLight *l = m_lights[i];
+        float r = l->GetRadius();
+        float dist = max(0.0f, glm::length(l->GetPos() - center) - radius) / r;
+        float w = (1.0f - dist*dist) * glm::dot(l->GetColor(DIFFUSE) + l->GetColor(SPECULAR), lum);
+        ambient += l->GetColor(AMBIENT);
+        if(dist >= 1.0f || (count == size && w <= weights[count - 1]))
+            continue;
+
+        //insert into list sorted by weight
+        int j = (count < size) ? count++ : count - 1;
+        for(; j > 0 && weights[j - 1] < w; j--)
+        {
+            weights[j] = weights[j - 1];
+            lights[j] = lights[j - 1];
+        }
+        weights[j] = w;
+        lights[j] = i;
+    }
+    for(int j = 0; j < count; j++)
+        ambient -= m_lights[lights[j]]->GetColor(AMBIENT);
+    return count;
+}
+
+/**
+****************************************************************************************************
+@brief Test bounding sphere of object against view frustum
+@param obj object to draw
+@param modelview object's modelview matrix (camera view)
+@param planes view frustum planes in view space (see ExtractFrustumPlanes())
+@return false if object is completely outside frustum
+***************************************************************************************************/
+bool TScene::IsVisible(TObject *obj, const glm::mat4 &modelview, const glm::vec4 planes[6])
+{
+    glm::vec3 center = glm::vec3(modelview * glm::vec4(obj->GetBoundingCenter(), 1.0));
+    float scale = max(glm::length(glm::vec3(modelview[0])), 
+                      max(glm::length(glm::vec3(modelview[1])), glm::length(glm::vec3(modelview[2]))));
+    float radius = obj->GetBoundingRadius() * scale;
+    for(int i = 0; i < 6; i++)
+        if(glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+            return false;
+    return true;
+}
+
+/**
+****************************************************************************************************
+@brief Return projected size of object's bounding sphere (relative to screen height)
+@param obj object to draw
+@param modelview object's modelview matrix (camera view)
+@return projected size, negative when camera is inside bounding sphere
+***************************************************************************************************/
+float TScene::ProjectedSize(TObject *obj, const glm::mat4 &modelview)
+{
+    //bounding sphere in view space (radius scaled by largest axis scale)
+    glm::vec4 center = modelview * glm::vec4(obj->GetBoundingCenter(), 1.0);
+    float scale = max(glm::length(glm::vec3(modelview[0])), 
+                      max(glm::length(glm::vec3(modelview[1])), glm::length(glm::vec3(modelview[2]))));
+    float radius = obj->GetBoundingRadius() * scale;
+    float dist = glm::length(glm::vec3(center));
+    if(dist <= radius)
+        return -1.0f;
+
+    return radius / (dist * tan(m_fovy * PI / 360.0f));
+}
+
+/**
+****************************************************************************************************
+@brief Select detail level of object. Level is chosen by projected size of object's bounding sphere
+(relative to screen height) and LOD thresholds
+@param obj object to draw
+@param modelview object's modelview matrix (camera view)
+@param bias projected size multiplier (shadow passes use coarser levels)
+@return detail level (0 = full detail)
+***************************************************************************************************/
+int TScene::SelectLOD(TObject *obj, const glm::mat4 &modelview, float bias)
+{
+    int lods = obj->GetLodCount();
+    if(!m_useLOD || lods < 2)
+        return 0;
+
+    float size = ProjectedSize(obj, modelview);
+    if(size < 0.0f)
+        return 0;
+
+    size *= bias;
+    int lod = 0;
+    while(lod < lods - 1 && size < m_lod_threshold[lod])
+        lod++;
+    return lod;
+}
+
+/**
+****************************************************************************************************
+@brief Select shading variant of object by projected size of its bounding sphere. Object selected
+in previous frame is kept with hysteresis, so objects near threshold don't switch every frame.
+@param obj object to draw
+@param modelview object's modelview matrix (camera view)
+@return SHADING_FULL or SHADING_REDUCED
+***************************************************************************************************/
+int TScene::SelectShading(TObject *obj, const glm::mat4 &modelview)
+{
+    float size = ProjectedSize(obj, modelview);
+    float threshold = m_shading_lod;
+    if(obj->GetShading() == SHADING_REDUCED)
+        threshold *= SHADING_LOD_HYSTERESIS;
+
+    int shading = (size >= 0.0f && size < threshold) ? SHADING_REDUCED : SHADING_FULL;
+    obj->SetShading(shading);
+    return shading;
+}
+
+
+/**
+****************************************************************************************************
+@brief Cluster culling job - cull ranges of object clusters
+@param begin first job
+@param end last job + 1
+@param data array of jobs
+***************************************************************************************************/
+static void CullClustersJob(int begin, int end, void *data)
+{
+    TClusterJob *jobs = (TClusterJob*)data;
+    for(int i=begin; i<end; i++)
+        jobs[i].obj->CullClusters(jobs[i].begin, jobs[i].end);
+}
+
+/**
+****************************************************************************************************
+@brief Cull clusters of all clustered objects against camera frustum and their normal cones.
+Clusters of all objects are split into jobs which are processed by worker threads. Visible
+clusters are then used in DrawScene() when object is drawn in full detail
+***************************************************************************************************/
+void TScene::CullClusters()
+{
+    m_stats.clusters = m_stats.clusters_culled = m_stats.cluster_triangles_culled = 0;
+    m_cluster_jobs.clear();
+    m_cluster_objects.clear();
+
+    glm::mat4 viewproj = m_projMatrix * m_viewMatrix;
+    glm::vec3 camera = glm::vec3(glm::inverse(m_viewMatrix)[3]);
+
+    //prepare jobs
+    for(m_io = m_objects.begin(); m_io != m_objects.end(); ++m_io)
+    {
+        TObject *o = m_io->second;
+        o->ResetClusters();
+        unsigned count = o->GetClusterCount();
+        if(!m_useClusterCulling || count == 0 || o->GetSceneID() != m_sceneID)
+            continue;
+
+        o->PrepareClusterCulling(viewproj, camera);
+        m_cluster_objects.push_back(o);
+        for(unsigned i=0; i<count; i+=CLUSTER_JOB_SIZE)
+        {
+            TClusterJob job = { o, i, min(i + CLUSTER_JOB_SIZE, count) };
+            m_cluster_jobs.push_back(job);
+        }
+        m_stats.clusters += count;
+    }
+    if(m_cluster_jobs.empty())
+        return;
+
+    //cull in parallel
+    TThreadPool *pool = TThreadPool::Instance();
+    int grain = max(1, int(m_cluster_jobs.size()) / (4*pool->GetThreadCount()));
+    pool->ParallelFor(m_cluster_jobs.size(), grain, CullClustersJob, &m_cluster_jobs[0]);
+
+    //build draw lists
+    for(unsigned i=0; i<m_cluster_objects.size(); i++)
+    {
+        m_stats.clusters_culled += m_cluster_objects[i]->BuildClusterList();
+        m_stats.cluster_triangles_culled += m_cluster_objects[i]->GetTriangles() - m_cluster_objects[i]->GetTriangles(0, true);
+    }
+}
+
+
 /**
 ****************************************************************************************************
 @brief Draw loading screen
@@ -264,8 +761,8 @@ void TScene::LoadScreen(bool swap)
     
     GLfloat vertattribs[] = { -0.7f,-0.2f, loaded,-0.2f, -0.7f,-0.3f, loaded,-0.3f };
 
-    glBindVertexArray(SceneManager::Instance()->getVBO(VBO_ARRAY, "progress_bar"));
-    glBindBuffer(GL_ARRAY_BUFFER, SceneManager::Instance()->getVBO(VBO_BUFFER, "progress_bar"));
+    glBindVertexArray(m_progress_bar.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, m_progress_bar.buffer[0]);
     glBufferData(GL_ARRAY_BUFFER, 8 * sizeof(GLfloat), &vertattribs, GL_STREAM_DRAW); 
     glVertexAttribPointer(GLuint(0), 2, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(0);
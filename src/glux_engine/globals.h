@@ -58,6 +58,7 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <set>
 #include <cmath>
 #include <algorithm>
 
@@ -75,6 +76,12 @@
 ///verbose mode
 //#define VERBOSE
 
+///SSE2 intrinsics (enabled by compiler settings on x86/x64)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define USE_SSE
+    #include <emmintrin.h>
+#endif
+
 using namespace std;
 ///Error code
 const int ERR = -1;					
@@ -98,7 +105,7 @@ enum ShaderTypes{VERTEX, TESS_CONTROL, TESS_EVAL, GEOMETRY, FRAGMENT};
 
 ///Texture types
 enum TextureTypes{BASE,ENV,BUMP,PARALLAX,DISPLACE,CUBEMAP,CUBEMAP_ENV, ALPHA, SHADOW, SHADOW_OMNI, 
-                  RENDER_TEXTURE, RENDER_TEXTURE_MULTISAMPLE};
+                  RENDER_TEXTURE, RENDER_TEXTURE_MULTISAMPLE, VIRTUAL};
 ///Texture mixing mods
 enum TextureMods{ADD,MODULATE,DECAL,BLEND,REPLACE};
 
@@ -107,6 +114,9 @@ enum font_type{NORMAL,TIMES,HELVETICA};
 ///Font sizes
 enum font_size{SMALL,MEDIUM,LARGE};
 
+///Shading variants of generated materials (reduced - cheaper shader for distant objects)
+enum ShadingVariants{SHADING_FULL, SHADING_REDUCED, SHADING_VARIANTS};
+
 ///Scene draw mode
 enum DrawMode{DRAW_ALL, DRAW_TRANSPARENT, DRAW_OPAQUE, DRAW_ALPHA};
 
@@ -24,7 +24,15 @@ private:
 	#endif
 
 	#ifdef __LINUX
-	ulong startCount, stopCount, timeElapsed;
+	unsigned long long startCount, stopCount, timeElapsed;	//in nanoseconds
+
+	//monotonic time including seconds (tv_nsec alone wraps every second)
+	static unsigned long long GetNanoseconds()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+	}
 	#endif
 
 public:
@@ -46,9 +54,7 @@ public:
 		#endif
 		
 		#ifdef __LINUX
-		timespec ts;
-		clock_gettime(CLOCK_REALTIME, &ts);
-		startCount = ts.tv_nsec;	//in nanoseconds
+		startCount = GetNanoseconds();
 		#endif
 
 	}
@@ -67,12 +73,10 @@ public:
 		#endif
 
 		#ifdef __LINUX
-		timespec ts;
-		clock_gettime(CLOCK_REALTIME, &ts);
-		stopCount = ts.tv_nsec;
+		stopCount = GetNanoseconds();
 		timeElapsed = stopCount - startCount;
 
-		return (double) timeElapsed/10e9;
+		return (double) timeElapsed/1e9;
 		#endif
 	}
 	inline double GetElapsedTimeMilliseconds()
@@ -84,12 +88,10 @@ public:
 		#endif
 
 		#ifdef __LINUX
-		timespec ts;
-		clock_gettime(CLOCK_REALTIME, &ts);
-		stopCount = ts.tv_nsec;
+		stopCount = GetNanoseconds();
 		timeElapsed = stopCount - startCount;
 
-		return (double) timeElapsed/10e6;
+		return (double) timeElapsed/1e6;
 		#endif
 	}
 };	
@@ -0,0 +1,798 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: image_decoder.cpp
+@brief native decoders of TGA (uncompressed and RLE, 24/32 bits) and PNG (8 bits RGB/RGBA) images
+from memory mapped files. Other formats are loaded by DevIL.
+****************************************************************************************************
+***************************************************************************************************/
+#include "image_decoder.h"
+
+#ifdef _LINUX_
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+//TGA files store BGR(A) pixels, PNG files RGB(A). Output order is given by upload format
+#ifdef _WIN_
+    static const bool SWAP_TGA = true;
+    static const bool SWAP_PNG = false;
+#else
+    static const bool SWAP_TGA = false;
+    static const bool SWAP_PNG = true;
+#endif
+
+///size of TGA file header
+#define TGA_HEADER_SIZE 18
+///bits of Huffman code resolved by one table lookup
+#define HUFFMAN_FAST_BITS 9
+
+
+////////////////////////////////////////////////////////////////////////////////
+//************************* TMappedFile methods ******************************//
+////////////////////////////////////////////////////////////////////////////////
+
+TMappedFile::TMappedFile()
+{
+    m_data = NULL;
+    m_size = 0;
+#ifdef _WIN_
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+#else
+    m_file = -1;
+#endif
+}
+
+TMappedFile::~TMappedFile()
+{
+    Close();
+}
+
+/**
+****************************************************************************************************
+@brief Map whole file into memory (read only)
+@param filename file name
+@return false if file can't be opened or is empty
+****************************************************************************************************/
+bool TMappedFile::Open(const char *filename)
+{
+    Close();
+#ifdef _WIN_
+    m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(m_file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+    {
+        Close();
+        return false;
+    }
+    m_size = (size_t)size.QuadPart;
+    m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(m_mapping != NULL)
+        m_data = (const GLubyte*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+    m_file = open(filename, O_RDONLY);
+    if(m_file < 0)
+        return false;
+    struct stat st;
+    if(fstat(m_file, &st) != 0 || st.st_size == 0)
+    {
+        Close();
+        return false;
+    }
+    m_size = (size_t)st.st_size;
+    void *ptr = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+    if(ptr != MAP_FAILED)
+    {
+        m_data = (const GLubyte*)ptr;
+        madvise(ptr, m_size, MADV_SEQUENTIAL);
+    }
+#endif
+    if(m_data == NULL)
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+/**
+****************************************************************************************************
+@brief Unmap and close file
+****************************************************************************************************/
+void TMappedFile::Close()
+{
+#ifdef _WIN_
+    if(m_data != NULL)
+        UnmapViewOfFile(m_data);
+    if(m_mapping != NULL)
+        CloseHandle(m_mapping);
+    if(m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+#else
+    if(m_data != NULL)
+        munmap((void*)m_data, m_size);
+    if(m_file >= 0)
+        close(m_file);
+    m_file = -1;
+#endif
+    m_data = NULL;
+    m_size = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//************************* pixel swizzling **********************************//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef USE_SSE
+/**
+****************************************************************************************************
+@brief Swap red and blue in 16 RGB pixels (48 bytes in three registers). Red and blue are two bytes
+apart, so every byte is taken from source shifted by two bytes to the left (blue positions), to the
+right (red positions) or unshifted (green positions). Masks repeat with period of 3 registers.
+****************************************************************************************************/
+static inline void SwapRedBlue48(const GLubyte *src, GLubyte *dest)
+{
+    //position of byte in pixel: 0 - red, 1 - green, 2 - blue
+    const __m128i green[3] = {
+        _mm_setr_epi8(0,-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1,0,0),
+        _mm_setr_epi8(-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1),
+        _mm_setr_epi8(0,0,-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1,0) };
+    const __m128i blue[3] = {
+        _mm_setr_epi8(0,0,-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1,0),
+        _mm_setr_epi8(0,-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1,0,0),
+        _mm_setr_epi8(-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1,0,0,-1) };
+
+    __m128i a = _mm_loadu_si128((const __m128i*)src);
+    __m128i b = _mm_loadu_si128((const __m128i*)(src + 16));
+    __m128i c = _mm_loadu_si128((const __m128i*)(src + 32));
+
+    //source shifted by two bytes (blue gets red, red gets blue)
+    __m128i la = _mm_slli_si128(a, 2);
+    __m128i lb = _mm_or_si128(_mm_slli_si128(b, 2), _mm_srli_si128(a, 14));
+    __m128i lc = _mm_or_si128(_mm_slli_si128(c, 2), _mm_srli_si128(b, 14));
+    __m128i ra = _mm_or_si128(_mm_srli_si128(a, 2), _mm_slli_si128(b, 14));
+    __m128i rb = _mm_or_si128(_mm_srli_si128(b, 2), _mm_slli_si128(c, 14));
+    __m128i rc = _mm_srli_si128(c, 2);
+
+    //red positions are the rest of bytes
+    #define SELECT(x, l, r, i) _mm_or_si128(_mm_or_si128(_mm_and_si128(x, green[i]), _mm_and_si128(l, blue[i])), \
+                                            _mm_andnot_si128(_mm_or_si128(green[i], blue[i]), r))
+    _mm_storeu_si128((__m128i*)dest, SELECT(a, la, ra, 0));
+    _mm_storeu_si128((__m128i*)(dest + 16), SELECT(b, lb, rb, 1));
+    _mm_storeu_si128((__m128i*)(dest + 32), SELECT(c, lc, rc, 2));
+    #undef SELECT
+}
+#endif
+
+/**
+****************************************************************************************************
+@brief Swap red and blue channel of pixels (RGB <-> BGR). SSE2 version processes 16 RGB pixels or
+4 RGBA pixels at once.
+@param src source pixels
+@param dest destination pixels (can be the same as source)
+@param pixels number of pixels
+@param bpp bytes per pixel (3 or 4)
+****************************************************************************************************/
+void SwapRedBlue(const GLubyte *src, GLubyte *dest, unsigned pixels, unsigned bpp)
+{
+    unsigned i = 0;
+#ifdef USE_SSE
+    if(bpp == 4)
+    {
+        const __m128i ga = _mm_set1_epi32((int)0xFF00FF00), r = _mm_set1_epi32(0x000000FF);
+        for(; i + 4 <= pixels; i += 4)
+        {
+            __m128i p = _mm_loadu_si128((const __m128i*)(src + 4*i));
+            __m128i rb = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), r), _mm_slli_epi32(_mm_and_si128(p, r), 16));
+            _mm_storeu_si128((__m128i*)(dest + 4*i), _mm_or_si128(_mm_and_si128(p, ga), rb));
+        }
+    }
+    else
+    {
+        for(; i + 16 <= pixels; i += 16)
+            SwapRedBlue48(src + 3*i, dest + 3*i);
+    }
+#endif
+    for(; i<pixels; i++)
+    {
+        const GLubyte *s = src + i*bpp;
+        GLubyte *d = dest + i*bpp;
+        GLubyte red = s[0];
+        d[0] = s[2];
+        d[1] = s[1];
+        d[2] = red;
+        if(bpp == 4)
+            d[3] = s[3];
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Copy pixels and optionally swap red and blue channel
+****************************************************************************************************/
+static inline void CopyPixels(const GLubyte *src, GLubyte *dest, unsigned pixels, unsigned bpp, bool swap)
+{
+    if(swap)
+        SwapRedBlue(src, dest, pixels, bpp);
+    else
+        memcpy(dest, src, pixels*bpp);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//************************* inflate (RFC 1950, 1951) *************************//
+////////////////////////////////////////////////////////////////////////////////
+
+///@brief Canonical Huffman code - fast lookup table for short codes, counts and sorted symbols
+///for the rest
+struct THuffman{
+    ///symbol << 4 | code length, 0 - code is longer than HUFFMAN_FAST_BITS
+    unsigned short fast[1 << HUFFMAN_FAST_BITS];
+    unsigned short count[16];
+    unsigned short symbol[288];
+};
+
+///@brief Bit stream reader and output of inflate
+struct TInflateState{
+    const GLubyte *in, *in_end;
+    GLubyte *out, *out_start, *out_end;
+    unsigned bits, count;
+    ///zero bytes read after end of input
+    unsigned padding;
+
+    ///@brief Fill bit buffer with at least 25 bits
+    void Refill(){
+        while(count <= 24)
+        {
+            if(in < in_end)
+                bits |= (unsigned)(*in++) << count;
+            else
+                padding++;
+            count += 8;
+        }
+    }
+    ///@brief Read n bits (n <= 16)
+    unsigned GetBits(unsigned n){
+        Refill();
+        unsigned v = bits & ((1u << n) - 1);
+        bits >>= n;
+        count -= n;
+        return v;
+    }
+    ///@brief Were bits read after end of input?
+    bool Overflow(){
+        return padding*8 > count;
+    }
+};
+
+/**
+****************************************************************************************************
+@brief Build canonical Huffman code from code lengths
+@return false for over-subscribed code
+****************************************************************************************************/
+static bool BuildHuffman(THuffman &h, const GLubyte *lengths, unsigned n)
+{
+    memset(h.count, 0, sizeof(h.count));
+    for(unsigned i=0; i<n; i++)
+        h.count[lengths[i]]++;
+    h.count[0] = 0;
+
+    int left = 1;
+    for(int len=1; len<16; len++)
+    {
+        left = (left << 1) - h.count[len];
+        if(left < 0)
+            return false;
+    }
+
+    //symbols sorted by code length
+    unsigned short offsets[16];
+    offsets[1] = 0;
+    for(int len=1; len<15; len++)
+        offsets[len + 1] = offsets[len] + h.count[len];
+    for(unsigned i=0; i<n; i++)
+        if(lengths[i] != 0)
+            h.symbol[offsets[lengths[i]]++] = i;
+
+    //lookup table indexed by bit reversed codes (deflate stores codes from most significant bit)
+    memset(h.fast, 0, sizeof(h.fast));
+    unsigned code = 0, k = 0;
+    for(unsigned len=1; len<=HUFFMAN_FAST_BITS; len++, code <<= 1)
+    {
+        for(unsigned i=0; i<h.count[len]; i++, k++, code++)
+        {
+            unsigned rev = 0;
+            for(unsigned b=0; b<len; b++)
+                rev |= ((code >> b) & 1) << (len - 1 - b);
+            for(unsigned j=rev; j < (1u << HUFFMAN_FAST_BITS); j += 1u << len)
+                h.fast[j] = (unsigned short)(h.symbol[k] << 4 | len);
+        }
+    }
+    return true;
+}
+
+/**
+****************************************************************************************************
+@brief Decode one symbol. Short codes use lookup table, long codes are decoded bit by bit.
+@return symbol or -1 for invalid code
+****************************************************************************************************/
+static inline int DecodeSymbol(TInflateState &s, const THuffman &h)
+{
+    s.Refill();
+    unsigned e = h.fast[s.bits & ((1 << HUFFMAN_FAST_BITS) - 1)];
+    if(e != 0)
+    {
+        s.bits >>= e & 15;
+        s.count -= e & 15;
+        return e >> 4;
+    }
+
+    int code = 0, first = 0, index = 0;
+    for(int len=1; len<16; len++)
+    {
+        code |= s.GetBits(1);
+        int count = h.count[len];
+        if(code - count < first)
+            return h.symbol[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+/**
+****************************************************************************************************
+@brief Decode compressed block with given literal/length and distance codes
+****************************************************************************************************/
+static bool InflateCodes(TInflateState &s, const THuffman &lencode, const THuffman &distcode)
+{
+    static const unsigned short len_base[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const unsigned char len_extra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const unsigned short dist_base[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+        4097, 6145, 8193, 12289, 16385, 24577};
+    static const unsigned char dist_extra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    for(;;)
+    {
+        int sym = DecodeSymbol(s, lencode);
+        if(sym < 0 || s.Overflow())
+            return false;
+        if(sym < 256)       //literal
+        {
+            if(s.out == s.out_end)
+                return false;
+            *s.out++ = (GLubyte)sym;
+        }
+        else if(sym == 256) //end of block
+            return true;
+        else                //match
+        {
+            sym -= 257;
+            if(sym >= 29)
+                return false;
+            unsigned len = len_base[sym] + s.GetBits(len_extra[sym]);
+            int dsym = DecodeSymbol(s, distcode);
+            if(dsym < 0 || dsym >= 30)
+                return false;
+            unsigned dist = dist_base[dsym] + s.GetBits(dist_extra[dsym]);
+            if(dist > (unsigned)(s.out - s.out_start) || len > (unsigned)(s.out_end - s.out))
+                return false;
+            //regions can overlap (repeated pattern)
+            const GLubyte *from = s.out - dist;
+            for(unsigned i=0; i<len; i++)
+                s.out[i] = from[i];
+            s.out += len;
+        }
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Read code lengths of dynamic block and build its codes
+****************************************************************************************************/
+static bool ReadDynamicCodes(TInflateState &s, THuffman &lencode, THuffman &distcode)
+{
+    static const unsigned char order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    unsigned nlen = s.GetBits(5) + 257;
+    unsigned ndist = s.GetBits(5) + 1;
+    unsigned ncode = s.GetBits(4) + 4;
+    if(nlen > 286 || ndist > 30)
+        return false;
+
+    GLubyte lengths[286 + 30];
+    memset(lengths, 0, sizeof(lengths));
+    for(unsigned i=0; i<ncode; i++)
+        lengths[order[i]] = (GLubyte)s.GetBits(3);
+    if(!BuildHuffman(lencode, lengths, 19))
+        return false;
+
+    //literal/length and distance code lengths (run length coded)
+    unsigned index = 0;
+    while(index < nlen + ndist)
+    {
+        int sym = DecodeSymbol(s, lencode);
+        if(sym < 0 || s.Overflow())
+            return false;
+        if(sym < 16)
+        {
+            lengths[index++] = (GLubyte)sym;
+            continue;
+        }
+        GLubyte len = 0;
+        unsigned repeat;
+        if(sym == 16)
+        {
+            if(index == 0)
+                return false;
+            len = lengths[index - 1];
+            repeat = 3 + s.GetBits(2);
+        }
+        else if(sym == 17)
+            repeat = 3 + s.GetBits(3);
+        else
+            repeat = 11 + s.GetBits(7);
+        if(index + repeat > nlen + ndist)
+            return false;
+        while(repeat--)
+            lengths[index++] = len;
+    }
+    //end of block code is mandatory
+    if(lengths[256] == 0)
+        return false;
+
+    return BuildHuffman(lencode, lengths, nlen) && BuildHuffman(distcode, lengths + nlen, ndist);
+}
+
+/**
+****************************************************************************************************
+@brief Decompress zlib stream (deflate with zlib header). Checksum isn't verified.
+@param src compressed data
+@param src_size size of compressed data
+@param dest output buffer
+@param dest_size expected size of decompressed data
+@return false for corrupted stream or different size of output
+****************************************************************************************************/
+bool Inflate(const GLubyte *src, size_t src_size, GLubyte *dest, size_t dest_size)
+{
+    //zlib header: deflate method, no preset dictionary
+    if(src_size < 2 || (src[0] & 0x0F) != 8 || (src[0] << 8 | src[1]) % 31 != 0 || (src[1] & 0x20))
+        return false;
+
+    TInflateState s;
+    s.in = src + 2;
+    s.in_end = src + src_size;
+    s.out = s.out_start = dest;
+    s.out_end = dest + dest_size;
+    s.bits = s.count = s.padding = 0;
+
+    THuffman *lencode = new THuffman, *distcode = new THuffman;
+    bool ok = true, last = false;
+    while(ok && !last)
+    {
+        last = s.GetBits(1) != 0;
+        unsigned type = s.GetBits(2);
+        if(type == 0)           //stored block
+        {
+            //skip to byte boundary, then read bytes from bit buffer and input
+            s.GetBits(s.count & 7);
+            unsigned len = s.GetBits(16), nlen = s.GetBits(16);
+            if(len != (~nlen & 0xFFFF) || len > (unsigned)(s.out_end - s.out))
+                ok = false;
+            else
+            {
+                for(; len > 0 && s.count >= 8; len--)
+                {
+                    *s.out++ = (GLubyte)(s.bits & 0xFF);
+                    s.bits >>= 8;
+                    s.count -= 8;
+                }
+                if(len > (unsigned)(s.in_end - s.in))
+                    ok = false;
+                else
+                {
+                    memcpy(s.out, s.in, len);
+                    s.out += len;
+                    s.in += len;
+                }
+            }
+        }
+        else if(type == 1)      //fixed codes
+        {
+            GLubyte lengths[288];
+            memset(lengths, 8, 144);
+            memset(lengths + 144, 9, 112);
+            memset(lengths + 256, 7, 24);
+            memset(lengths + 280, 8, 8);
+            BuildHuffman(*lencode, lengths, 288);
+            memset(lengths, 5, 30);
+            BuildHuffman(*distcode, lengths, 30);
+            ok = InflateCodes(s, *lencode, *distcode);
+        }
+        else if(type == 2)      //dynamic codes
+            ok = ReadDynamicCodes(s, *lencode, *distcode) && InflateCodes(s, *lencode, *distcode);
+        else
+            ok = false;
+        if(s.Overflow())
+            ok = false;
+    }
+    delete lencode;
+    delete distcode;
+
+    return ok && s.out == s.out_end;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//************************* TImageFile methods *******************************//
+////////////////////////////////////////////////////////////////////////////////
+
+TImageFile::TImageFile()
+{
+    m_format = TGA_RAW;
+    m_width = m_height = m_bpp = 0;
+    m_offset = 0;
+}
+
+/**
+****************************************************************************************************
+@brief Read big endian 32-bit value
+****************************************************************************************************/
+static inline GLuint ReadBE32(const GLubyte *p)
+{
+    return (GLuint)p[0] << 24 | (GLuint)p[1] << 16 | (GLuint)p[2] << 8 | p[3];
+}
+
+/**
+****************************************************************************************************
+@brief Map image file and read its header. Supported are true color TGA images (uncompressed or RLE,
+24 or 32 bits, without color map and mirroring) and non-interlaced 8-bit RGB/RGBA PNG images.
+@param filename image file
+@return false when file can't be opened or its format isn't supported (use DevIL then)
+****************************************************************************************************/
+bool TImageFile::Open(const char *filename)
+{
+    if(!m_file.Open(filename))
+        return false;
+
+    //format is selected by extension (TGA has no signature)
+    string ext = filename;
+    ext = ext.substr(ext.find_last_of('.') + 1);
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    bool ok = false;
+    if(ext == "png")
+        ok = OpenPNG();
+    else if(ext == "tga")
+        ok = OpenTGA();
+
+    if(!ok || m_width == 0 || m_height == 0)
+    {
+        m_file.Close();
+        return false;
+    }
+    return true;
+}
+
+/**
+****************************************************************************************************
+@brief Read TGA header
+****************************************************************************************************/
+bool TImageFile::OpenTGA()
+{
+    const GLubyte *h = m_file.GetData();
+    if(m_file.GetSize() < TGA_HEADER_SIZE)
+        return false;
+    //image types 2 (true color) and 10 (RLE true color) without color map
+    if(h[1] != 0 || (h[2] != 2 && h[2] != 10) || (h[16] != 24 && h[16] != 32))
+        return false;
+    //right-to-left pixel order
+    if(h[17] & 0x10)
+        return false;
+
+    m_format = h[2] == 2 ? TGA_RAW : TGA_RLE;
+    m_width = h[12] | h[13] << 8;
+    m_height = h[14] | h[15] << 8;
+    m_bpp = h[16] / 8;
+    m_offset = TGA_HEADER_SIZE + h[0];
+    return m_offset <= m_file.GetSize();
+}
+
+/**
+****************************************************************************************************
+@brief Read PNG signature and header chunk
+****************************************************************************************************/
+bool TImageFile::OpenPNG()
+{
+    static const GLubyte signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    const GLubyte *p = m_file.GetData();
+    if(m_file.GetSize() < 33 || memcmp(p, signature, 8) != 0 || memcmp(p + 12, "IHDR", 4) != 0)
+        return false;
+
+    //bit depth 8, color type 2 (RGB) or 6 (RGBA), no interlacing
+    const GLubyte *ihdr = p + 16;
+    if(ihdr[8] != 8 || (ihdr[9] != 2 && ihdr[9] != 6) || ihdr[10] != 0 || ihdr[11] != 0 || ihdr[12] != 0)
+        return false;
+
+    m_format = PNG;
+    m_width = ReadBE32(ihdr);
+    m_height = ReadBE32(ihdr + 4);
+    m_bpp = ihdr[9] == 2 ? 3 : 4;
+    return m_width < 65536 && m_height < 65536;
+}
+
+/**
+****************************************************************************************************
+@brief Decode image into destination buffer
+@param dest destination of GetDataSize() bytes (can be mapped pixel buffer)
+@return false for corrupted image
+****************************************************************************************************/
+bool TImageFile::Decode(GLubyte *dest)
+{
+    if(m_file.GetData() == NULL)
+        return false;
+    bool ok = m_format == PNG ? DecodePNG(dest) : DecodeTGA(dest);
+    m_file.Close();
+    return ok;
+}
+
+/**
+****************************************************************************************************
+@brief Decode TGA pixels - uncompressed images are copied directly, RLE packets are expanded.
+Destination is only written (it can be write-only mapping of pixel buffer).
+****************************************************************************************************/
+bool TImageFile::DecodeTGA(GLubyte *dest)
+{
+    const GLubyte *src = m_file.GetData() + m_offset;
+    const GLubyte *end = m_file.GetData() + m_file.GetSize();
+    unsigned pixels = m_width * m_height;
+
+    if(m_format == TGA_RAW)
+    {
+        if((size_t)(end - src) < GetDataSize())
+            return false;
+        CopyPixels(src, dest, pixels, m_bpp, SWAP_TGA);
+        return true;
+    }
+
+    //RLE packets: header with count, then one pixel (run) or count pixels (raw)
+    unsigned i = 0;
+    while(i < pixels)
+    {
+        if(src >= end)
+            return false;
+        unsigned count = (*src & 0x7F) + 1;
+        bool run = (*src & 0x80) != 0;
+        src++;
+        if(i + count > pixels || (size_t)(end - src) < (run ? 1 : count) * m_bpp)
+            return false;
+
+        GLubyte *d = dest + i*m_bpp;
+        if(run)
+        {
+            GLubyte pixel[4];
+            CopyPixels(src, pixel, 1, m_bpp, SWAP_TGA);
+            for(unsigned j=0; j<count; j++)
+                memcpy(d + j*m_bpp, pixel, m_bpp);
+            src += m_bpp;
+        }
+        else
+        {
+            CopyPixels(src, d, count, m_bpp, SWAP_TGA);
+            src += count*m_bpp;
+        }
+        i += count;
+    }
+    return true;
+}
+
+/**
+****************************************************************************************************
+@brief Decode PNG - image data chunks are decompressed and rows are reconstructed from filters.
+Filters read previous pixels, so rows are reconstructed in client memory and finished rows are
+copied into destination (it can be write-only mapping of pixel buffer).
+****************************************************************************************************/
+bool TImageFile::DecodePNG(GLubyte *dest)
+{
+    const GLubyte *p = m_file.GetData() + 8;
+    const GLubyte *end = m_file.GetData() + m_file.GetSize();
+
+    //find image data chunks - single chunk is decompressed directly from mapped file
+    const GLubyte *idat = NULL;
+    size_t idat_size = 0;
+    vector<GLubyte> joined;
+    while(end - p >= 12)
+    {
+        GLuint len = ReadBE32(p);
+        if((size_t)(end - p) < 12 + (size_t)len)
+            return false;
+        if(memcmp(p + 4, "IDAT", 4) == 0)
+        {
+            if(idat == NULL)
+            {
+                idat = p + 8;
+                idat_size = len;
+            }
+            else
+            {
+                if(joined.empty())
+                    joined.assign(idat, idat + idat_size);
+                joined.insert(joined.end(), p + 8, p + 8 + len);
+            }
+        }
+        else if(memcmp(p + 4, "IEND", 4) == 0)
+            break;
+        p += 12 + len;
+    }
+    if(idat == NULL)
+        return false;
+    if(!joined.empty())
+    {
+        idat = &joined[0];
+        idat_size = joined.size();
+    }
+
+    //every row starts with filter type
+    size_t stride = m_width * m_bpp;
+    vector<GLubyte> filtered((stride + 1) * m_height);
+    if(!Inflate(idat, idat_size, &filtered[0], filtered.size()))
+        return false;
+
+    //reconstruct rows in two scratch rows, previous row of first row is zero
+    vector<GLubyte> rows(2*stride, 0);
+    GLubyte *prev = &rows[0], *row = &rows[stride];
+    for(GLuint y=0; y<m_height; y++)
+    {
+        const GLubyte *f = &filtered[y*(stride + 1)];
+        unsigned bpp = m_bpp;
+        switch(*f++)
+        {
+        case 0:     //none
+            memcpy(row, f, stride);
+            break;
+        case 1:     //sub
+            memcpy(row, f, bpp);
+            for(size_t x=bpp; x<stride; x++)
+                row[x] = f[x] + row[x - bpp];
+            break;
+        case 2:     //up
+            for(size_t x=0; x<stride; x++)
+                row[x] = f[x] + prev[x];
+            break;
+        case 3:     //average
+            for(size_t x=0; x<bpp; x++)
+                row[x] = f[x] + (prev[x] >> 1);
+            for(size_t x=bpp; x<stride; x++)
+                row[x] = f[x] + ((row[x - bpp] + prev[x]) >> 1);
+            break;
+        case 4:     //Paeth
+            for(size_t x=0; x<bpp; x++)
+                row[x] = f[x] + prev[x];
+            for(size_t x=bpp; x<stride; x++)
+            {
+                int a = row[x - bpp], b = prev[x], c = prev[x - bpp];
+                int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2*c);
+                row[x] = f[x] + (GLubyte)((pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c));
+            }
+            break;
+        default:
+            return false;
+        }
+        //filters work with file channel order, so pixels are swapped when row is copied
+        CopyPixels(row, dest + y*stride, m_width, m_bpp, SWAP_PNG);
+        swap(prev, row);
+    }
+    return true;
+}
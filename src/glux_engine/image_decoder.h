@@ -0,0 +1,101 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: image_decoder.h
+@brief native decoders of TGA (uncompressed and RLE, 24/32 bits) and PNG (8 bits RGB/RGBA) images
+from memory mapped files. Other formats are loaded by DevIL.
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _IMAGE_DECODER_H_
+#define _IMAGE_DECODER_H_
+
+#include "globals.h"
+
+///@class TMappedFile
+///@brief Read-only memory mapped file
+class TMappedFile
+{
+public:
+    TMappedFile();
+    ~TMappedFile();
+
+    //map whole file into memory
+    bool Open(const char *filename);
+    //unmap file
+    void Close();
+
+    ///@brief Return mapped file contents
+    const GLubyte* GetData(){
+        return m_data;
+    }
+    ///@brief Return file size in bytes
+    size_t GetSize(){
+        return m_size;
+    }
+
+private:
+    const GLubyte *m_data;
+    size_t m_size;
+#ifdef _WIN_
+    HANDLE m_file, m_mapping;
+#else
+    int m_file;
+#endif
+};
+
+
+/**
+@class TImageFile
+@brief Image file decoded without DevIL. Open() maps file and reads header, so destination buffer
+can be allocated (or mapped from pixel buffer) before Decode(). Pixels are stored in order expected
+by Texture::GetUploadFormat() (RGB(A) on Windows, BGR(A) on Linux), rows are kept in file order
+like DevIL does.
+***************************************************************************************************/
+class TImageFile
+{
+public:
+    TImageFile();
+
+    //map image file and read its header, false when format isn't supported natively
+    bool Open(const char *filename);
+    //decode pixels into destination buffer (GetDataSize() bytes)
+    bool Decode(GLubyte *dest);
+
+    ///@brief Return image width
+    GLuint GetWidth(){
+        return m_width;
+    }
+    ///@brief Return image height
+    GLuint GetHeight(){
+        return m_height;
+    }
+    ///@brief Return bytes per pixel (3 or 4)
+    GLuint GetBpp(){
+        return m_bpp;
+    }
+    ///@brief Return size of decoded image
+    size_t GetDataSize(){
+        return (size_t)m_width * m_height * m_bpp;
+    }
+
+private:
+    enum{TGA_RAW, TGA_RLE, PNG};
+
+    bool OpenTGA();
+    bool OpenPNG();
+    bool DecodeTGA(GLubyte *dest);
+    bool DecodePNG(GLubyte *dest);
+
+    TMappedFile m_file;
+    int m_format;
+    GLuint m_width, m_height, m_bpp;
+    ///offset of pixel data in TGA file
+    size_t m_offset;
+};
+
+//swap red and blue channel of pixels (src and dest can be the same buffer)
+void SwapRedBlue(const GLubyte *src, GLubyte *dest, unsigned pixels, unsigned bpp);
+//decompress zlib stream, output must have exactly expected size
+bool Inflate(const GLubyte *src, size_t src_size, GLubyte *dest, size_t dest_size);
+
+#endif
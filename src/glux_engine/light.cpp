@@ -16,7 +16,9 @@ TLight::TLight()
     m_light = 0;
     m_pos = glm::vec3(0.0);
     m_shadow = false;
-    fbo = 0;
+    m_shadow_tex = 0;
+    m_shadow_region = -1;
+    m_shadow_rect[0] = m_shadow_rect[1] = glm::vec4(0.0f);
     m_light_type = SPOT;
 }
 
@@ -26,9 +28,6 @@ TLight::TLight()
 ***************************************************************************************************/
 TLight::~TLight()
 {
-    ///delete framebuffer
-    if(fbo != 0)
-        glDeleteFramebuffers(1, &fbo);
 }
 
 /**
@@ -75,6 +74,9 @@ void TLight::Set(GLint lights, glm::vec3 amb, glm::vec3 diff, glm::vec3 spec, gl
     m_pos = lpos;
     m_radius = radius;
     m_shadow = false;
+    m_shadow_tex = 0;
+    m_shadow_region = -1;
+    m_shadow_rect[0] = m_shadow_rect[1] = glm::vec4(0.0f);
 
     //other
     m_light_type = SPOT;
@@ -25,11 +25,13 @@ private:
     GLfloat m_shadow_intensity;  //intensity of shadow
     int m_light_type;        //shadow type (spot, omni)
     GLuint m_shadow_tex;    //shadow texture
+    string m_obj_name;      //object showing light position
 
-public:
-    ///to calculate shadows, we need framebuffer for shadow map
-    GLuint fbo;       
+    //first shadow atlas region (omni light has two - front and back paraboloid) and their rectangles
+    int m_shadow_region;
+    glm::vec4 m_shadow_rect[2];
 
+public:
     TLight();
     ~TLight();
     /**
@@ -68,6 +70,14 @@ public:
     GLint GetOrd(){ 
         return m_light; 
     }
+    ///@brief Set name of object showing light position
+    void SetObjName(const string &name){
+        m_obj_name = name;
+    }
+    ///@brief Get name of object showing light position
+    const string& GetObjName(){
+        return m_obj_name;
+    }
     ///@brief Get light radius
     GLfloat GetRadius(){ 
         return m_radius; 
@@ -96,10 +106,6 @@ public:
     GLfloat ShadowIntensity(){ 
         return m_shadow_intensity; 
     } 
-    ///@brief Get FBO for shadow map rendering
-    GLuint GetFBO(){ 
-        return fbo; 
-    }
     ///@brief get light type
     int GetType(){ 
         return m_light_type; 
@@ -112,6 +118,23 @@ public:
     GLuint* GetShadowTexID(){
         return &m_shadow_tex;
     }
+    ///@brief Set first region of shadow map in shadow atlas
+    void SetShadowRegion(int region){
+        m_shadow_region = region;
+    }
+    ///@brief Get first region of shadow map in shadow atlas (-1 - light hasn't got shadow map)
+    int GetShadowRegion(){
+        return m_shadow_region;
+    }
+    ///@brief Get number of shadow atlas regions (omni light has front and back paraboloid)
+    int GetShadowRegionCount(){
+        return m_light_type == OMNI ? 2 : 1;
+    }
+    ///@brief Get rectangles of shadow map regions in atlas texture (offset, size), shadow
+    ///textures of materials read them when textures are activated
+    glm::vec4* GetShadowRect(){
+        return m_shadow_rect;
+    }
 };
 
 #endif
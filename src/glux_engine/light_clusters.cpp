@@ -0,0 +1,272 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: light_clusters.cpp
+@brief clustered forward lighting - local point lights (e.g. street lights) are assigned to clusters
+of view frustum grid (froxels) on CPU, light lists are read by generated shaders from buffer textures
+****************************************************************************************************
+***************************************************************************************************/
+#include "light_clusters.h"
+#include "thread_pool.h"
+#include "hires_timer.h"
+
+/**
+****************************************************************************************************
+@brief Create cluster lists, buffer textures are created on first upload
+****************************************************************************************************/
+TLightClusters::TLightClusters()
+{
+    m_buffers[0] = m_buffers[1] = m_buffers[2] = 0;
+    m_textures[0] = m_textures[1] = m_textures[2] = 0;
+    m_grid.assign(2*CLUSTER_X*CLUSTER_Y*CLUSTER_Z, 0);
+    m_params = glm::vec4(0.0f);
+    m_depth_range = glm::vec2(1.0f, 0.0f);
+    m_ndc_x = m_ndc_y = 1.0f;
+    memset(&m_stats, 0, sizeof(TClusterStats));
+}
+
+/**
+****************************************************************************************************
+@brief Delete buffer textures
+****************************************************************************************************/
+TLightClusters::~TLightClusters()
+{
+    if(m_buffers[0] != 0)
+    {
+        glDeleteTextures(3, m_textures);
+        glDeleteBuffers(3, m_buffers);
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Add point light
+@param position world space position
+@param color light color (diffuse and specular)
+@param radius distance where light attenuates to zero
+@return light index
+****************************************************************************************************/
+unsigned TLightClusters::AddLight(const glm::vec3 &position, const glm::vec3 &color, float radius)
+{
+    TPointLight l;
+    l.position = position;
+    l.color = color;
+    l.radius = radius;
+    m_lights.push_back(l);
+    return m_lights.size() - 1;
+}
+
+/**
+****************************************************************************************************
+@brief Job function - assign lights to clusters of depth slices
+****************************************************************************************************/
+static void AssignSlicesJob(int begin, int end, void *data)
+{
+    TLightClusters *clusters = (TLightClusters*)data;
+    for(int i = begin; i < end; i++)
+        clusters->AssignSlice(i);
+}
+
+/**
+****************************************************************************************************
+@brief Assign lights to clusters of view frustum. Lights are transformed into view space and culled
+by frustum, bounding spheres of visible lights are then assigned to clusters of their depth slices.
+@param view view matrix
+@param fovy vertical field of view in degrees
+@param aspect aspect ratio of viewport
+@param near_p near plane
+@param far_p far plane
+@param parallel assign depth slices in thread pool
+****************************************************************************************************/
+void TLightClusters::Assign(const glm::mat4 &view, float fovy, float aspect, float near_p, float far_p, bool parallel)
+{
+    HRTimer timer;
+
+    ///1 depth slices: d(s) = near * (far/near)^(s/CLUSTER_Z)
+    float tan_y = tan(fovy * PI / 360.0f);
+    m_ndc_y = 1.0f / tan_y;
+    m_ndc_x = 1.0f / (tan_y * aspect);
+    float log_ratio = log(far_p / near_p);
+    for(int s = 0; s <= CLUSTER_Z; s++)
+        m_slice_depth[s] = near_p * exp(log_ratio * s / CLUSTER_Z);
+    float scale = CLUSTER_Z / log_ratio;
+    m_params = glm::vec4(m_ndc_x, m_ndc_y, scale, -scale * log(near_p));
+
+    ///2 lights intersecting frustum (sphere against near/far and side planes)
+    m_visible.clear();
+    m_visible_slices.clear();
+    m_visible_index.clear();
+    m_depth_range = glm::vec2(far_p, near_p);
+    glm::vec2 side_x = glm::normalize(glm::vec2(1.0f, 1.0f / m_ndc_x));     //plane normals (x or y, depth)
+    glm::vec2 side_y = glm::normalize(glm::vec2(1.0f, 1.0f / m_ndc_y));
+    for(unsigned i = 0; i < m_lights.size(); i++)
+    {
+        const TPointLight &l = m_lights[i];
+        glm::vec3 p = glm::vec3(view * glm::vec4(l.position, 1.0f));
+        float depth = -p.z, r = l.radius;
+        if(depth + r < near_p || depth - r > far_p)
+            continue;
+        if(fabs(p.x) * side_x.x - depth * side_x.y > r || fabs(p.y) * side_y.x - depth * side_y.y > r)
+            continue;
+
+        int s0 = 0, s1 = CLUSTER_Z - 1;
+        if(depth - r > near_p)
+            s0 = min(CLUSTER_Z - 1, (int)(log((depth - r) / near_p) * scale));
+        if(depth + r < far_p)
+            s1 = min(CLUSTER_Z - 1, (int)(log((depth + r) / near_p) * scale));
+        m_depth_range.x = min(m_depth_range.x, max(depth - r, near_p));
+        m_depth_range.y = max(m_depth_range.y, min(depth + r, far_p));
+        m_visible.push_back(glm::vec4(p, r));
+        m_visible_slices.push_back(glm::ivec2(s0, s1));
+        m_visible_index.push_back(i);
+    }
+
+    ///3 light lists of depth slices
+    if(parallel)
+        TThreadPool::Instance()->ParallelFor(CLUSTER_Z, 1, AssignSlicesJob, this);
+    else
+        AssignSlicesJob(0, CLUSTER_Z, this);
+
+    ///4 merge slices into one list
+    m_items.clear();
+    m_stats.clusters_used = 0;
+    for(int s = 0; s < CLUSTER_Z; s++)
+    {
+        TClusterSlice &slice = m_slices[s];
+        unsigned base = m_items.size();
+        for(int t = 0; t < CLUSTER_X*CLUSTER_Y; t++)
+        {
+            unsigned c = s*CLUSTER_X*CLUSTER_Y + t;
+            m_grid[2*c] = base + slice.offset[t];
+            m_grid[2*c + 1] = slice.count[t];
+            if(slice.count[t] > 0)
+                m_stats.clusters_used++;
+        }
+        m_items.insert(m_items.end(), slice.items.begin(), slice.items.end());
+    }
+
+    m_stats.lights = m_lights.size();
+    m_stats.visible = m_visible.size();
+    m_stats.items = m_items.size();
+    m_stats.assign_ms = (float)timer.GetElapsedTimeMilliseconds();
+}
+
+/**
+****************************************************************************************************
+@brief Assign visible lights to clusters of depth slice. Light is added to all tiles overlapped by
+bounding box of its sphere in depth range of slice (conservative). Lists of full clusters are
+truncated to CLUSTER_MAX_LIGHTS lights.
+@param slice depth slice
+****************************************************************************************************/
+void TLightClusters::AssignSlice(int slice)
+{
+    TClusterSlice &sl = m_slices[slice];
+    sl.pairs.clear();
+    memset(sl.count, 0, sizeof(sl.count));
+
+    for(unsigned i = 0; i < m_visible.size(); i++)
+    {
+        if(slice < m_visible_slices[i].x || slice > m_visible_slices[i].y)
+            continue;
+        const glm::vec4 &l = m_visible[i];
+        //depth range of sphere in slice
+        float d0 = max(-l.z - l.w, m_slice_depth[slice]);
+        float d1 = min(-l.z + l.w, m_slice_depth[slice + 1]);
+        if(d0 > d1)
+            continue;
+
+        //range of x/depth and y/depth over box -> tiles
+        glm::vec2 lo(l.x - l.w, l.y - l.w), hi(l.x + l.w, l.y + l.w);
+        float x0 = lo.x / (lo.x < 0.0f ? d0 : d1) * m_ndc_x, x1 = hi.x / (hi.x > 0.0f ? d0 : d1) * m_ndc_x;
+        float y0 = lo.y / (lo.y < 0.0f ? d0 : d1) * m_ndc_y, y1 = hi.y / (hi.y > 0.0f ? d0 : d1) * m_ndc_y;
+        if(x1 < -1.0f || x0 > 1.0f || y1 < -1.0f || y0 > 1.0f)
+            continue;
+        int tx0 = max(0, (int)((x0*0.5f + 0.5f) * CLUSTER_X)), tx1 = min(CLUSTER_X - 1, (int)((x1*0.5f + 0.5f) * CLUSTER_X));
+        int ty0 = max(0, (int)((y0*0.5f + 0.5f) * CLUSTER_Y)), ty1 = min(CLUSTER_Y - 1, (int)((y1*0.5f + 0.5f) * CLUSTER_Y));
+
+        for(int ty = ty0; ty <= ty1; ty++)
+        {
+            for(int tx = tx0; tx <= tx1; tx++)
+            {
+                unsigned t = ty*CLUSTER_X + tx;
+                if(sl.count[t] >= CLUSTER_MAX_LIGHTS)
+                    continue;
+                sl.count[t]++;
+                sl.pairs.push_back(t);
+                sl.pairs.push_back(i);
+            }
+        }
+    }
+
+    //sort light indices by tile (counting sort)
+    unsigned offset = 0;
+    for(int t = 0; t < CLUSTER_X*CLUSTER_Y; t++)
+    {
+        sl.offset[t] = offset;
+        offset += sl.count[t];
+    }
+    unsigned next[CLUSTER_X*CLUSTER_Y];
+    memcpy(next, sl.offset, sizeof(next));
+    sl.items.resize(offset);
+    for(unsigned i = 0; i < sl.pairs.size(); i += 2)
+        sl.items[next[sl.pairs[i]]++] = sl.pairs[i + 1];
+}
+
+/**
+****************************************************************************************************
+@brief Upload cluster ranges, light indices and visible lights (view space) into buffer textures.
+Buffers are orphaned every frame.
+****************************************************************************************************/
+void TLightClusters::Upload()
+{
+    HRTimer timer;
+    if(m_buffers[0] == 0)
+    {
+        GLenum formats[3] = { GL_RG32UI, GL_R32UI, GL_RGBA32F };
+        glGenBuffers(3, m_buffers);
+        glGenTextures(3, m_textures);
+        for(int i = 0; i < 3; i++)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), NULL, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_buffers[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    //visible lights: position and radius, color
+    m_light_data.resize(2*m_visible.size());
+    for(unsigned i = 0; i < m_visible.size(); i++)
+    {
+        m_light_data[2*i] = m_visible[i];
+        m_light_data[2*i + 1] = glm::vec4(m_lights[m_visible_index[i]].color, 0.0f);
+    }
+
+    //empty lists leave previous data in buffer (nothing is read from it)
+    const void *data[3] = { &m_grid[0], m_items.empty() ? NULL : &m_items[0], m_light_data.empty() ? NULL : &m_light_data[0] };
+    size_t size[3] = { m_grid.size()*sizeof(GLuint), m_items.size()*sizeof(GLuint), m_light_data.size()*sizeof(glm::vec4) };
+    for(int i = 0; i < 3; i++)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+        if(size[i] > 0)
+            glBufferData(GL_TEXTURE_BUFFER, size[i], data[i], GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    m_stats.upload_ms = (float)timer.GetElapsedTimeMilliseconds();
+}
+
+/**
+****************************************************************************************************
+@brief Bind buffer textures to units CLUSTER_UNIT (grid), CLUSTER_UNIT+1 (light indices) and
+CLUSTER_UNIT+2 (lights)
+****************************************************************************************************/
+void TLightClusters::Bind()
+{
+    for(int i = 0; i < 3; i++)
+    {
+        glActiveTexture(GL_TEXTURE0 + CLUSTER_UNIT + i);
+        glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
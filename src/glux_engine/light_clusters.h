@@ -0,0 +1,124 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: light_clusters.h
+@brief clustered forward lighting - local point lights (e.g. street lights) are assigned to clusters
+of view frustum grid (froxels) on CPU, light lists are read by generated shaders from buffer textures
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _LIGHT_CLUSTERS_H_
+#define _LIGHT_CLUSTERS_H_
+
+#include "globals.h"
+
+///cluster grid: tiles of screen and exponential depth slices
+#define CLUSTER_X 16
+#define CLUSTER_Y 8
+#define CLUSTER_Z 24
+///maximal number of lights in one cluster (bounds light loop of shaders)
+#define CLUSTER_MAX_LIGHTS 64
+///first texture unit of cluster buffers (grid, light indices, lights) - materials bind their
+///textures from unit 0, so the highest units are used
+#define CLUSTER_UNIT 13
+
+///@brief Local point light (light without shadows and light object)
+struct TPointLight{
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+};
+
+///@brief Statistics of last light assignment
+struct TClusterStats{
+    ///all lights, lights intersecting view frustum
+    unsigned lights, visible;
+    ///light references in cluster lists, clusters with at least one light
+    unsigned items, clusters_used;
+    ///time of assignment and upload in milliseconds
+    float assign_ms, upload_ms;
+};
+
+/**
+@class TLightClusters
+@brief Light lists of view frustum clusters. Frustum is divided into CLUSTER_X x CLUSTER_Y tiles
+and CLUSTER_Z exponential depth slices. Assign() transforms lights into view space and assigns their
+bounding spheres to clusters (depth slices are processed in parallel), Upload() stores cluster
+ranges, light indices and lights into buffer textures bound to units CLUSTER_UNIT..CLUSTER_UNIT+2.
+***************************************************************************************************/
+class TLightClusters
+{
+public:
+    TLightClusters();
+    ~TLightClusters();
+
+    //add light, returns its index
+    unsigned AddLight(const glm::vec3 &position, const glm::vec3 &color, float radius);
+    ///@brief Remove all lights
+    void Clear(){
+        m_lights.clear();
+    }
+    ///@brief Return number of lights
+    unsigned GetLightCount(){
+        return m_lights.size();
+    }
+
+    //assign lights to clusters of view frustum (no OpenGL calls)
+    void Assign(const glm::mat4 &view, float fovy, float aspect, float near_p, float far_p, bool parallel = true);
+    //assign lights to clusters of one depth slice
+    void AssignSlice(int slice);
+    //upload light lists into buffer textures
+    void Upload();
+    //bind buffer textures to their units
+    void Bind();
+
+    ///@brief Return cluster parameters for shaders: x,y - scale of view direction to NDC, z,w -
+    ///scale and bias of log(depth) to depth slice
+    const glm::vec4& GetParams(){
+        return m_params;
+    }
+    ///@brief Return statistics of last assignment
+    const TClusterStats& GetStats(){
+        return m_stats;
+    }
+    ///@brief Return view depth range covered by lights intersecting view frustum (min > max when
+    ///no light is visible)
+    const glm::vec2& GetDepthRange(){
+        return m_depth_range;
+    }
+    ///@brief Return light list of cluster (offset and count in light indices)
+    void GetCluster(int x, int y, int z, unsigned &offset, unsigned &count){
+        unsigned c = (z*CLUSTER_Y + y)*CLUSTER_X + x;
+        offset = m_grid[2*c];
+        count = m_grid[2*c + 1];
+    }
+
+private:
+    ///@brief Light lists of one depth slice
+    struct TClusterSlice{
+        ///(tile, light) pairs, light indices sorted by tile
+        vector<unsigned> pairs, items;
+        unsigned offset[CLUSTER_X*CLUSTER_Y], count[CLUSTER_X*CLUSTER_Y];
+    };
+
+    vector<TPointLight> m_lights;
+    ///lights intersecting view frustum: view space position and radius, range of depth slices
+    vector<glm::vec4> m_visible;
+    vector<glm::ivec2> m_visible_slices;
+    vector<unsigned> m_visible_index;
+    TClusterSlice m_slices[CLUSTER_Z];
+    ///depth of slice boundaries, view direction to NDC
+    float m_slice_depth[CLUSTER_Z + 1];
+    float m_ndc_x, m_ndc_y;
+    glm::vec4 m_params;
+    ///view depth range of visible lights
+    glm::vec2 m_depth_range;
+
+    ///data of buffer textures: cluster ranges (offset, count), light indices, lights (2 texels per light)
+    vector<GLuint> m_grid, m_items;
+    vector<glm::vec4> m_light_data;
+    GLuint m_buffers[3], m_textures[3];
+
+    TClusterStats m_stats;
+};
+
+#endif
@@ -6,107 +6,116 @@
 ****************************************************************************************************
 ***************************************************************************************************/
 #include "object.h"
+#include "SceneManager.h"
 
 
 /**
 ****************************************************************************************************
-@brief Creates object directly from aiMesh
+@brief Append aiMesh data to indexed mesh
 @param mesh aiMesh mesh
-@return pointer to vertex buffer with data
+@param out indexed mesh
 ****************************************************************************************************/
-VBO TObject::Create(aiMesh *mesh)
-{  
-	m_name = mesh->mName.C_Str();
-    m_scale = glm::vec3(1.0);
-    m_shadow_cast = true;
-    m_shadow_receive = true;
-    m_draw_object = true;
-    m_type = EXTERN;
-    m_drawmode = GL_TRIANGLES;
-    m_element_indices = false;
-
-    //count faces
-	m_vbo.indices = mesh->mNumFaces;
+static void AppendMesh(aiMesh *mesh, TIndexedMesh &out)
+{
+    GLuint base = out.vertices.size()/3;
 
-    // Allocate memory for our vertices and normals
-    TVertex *vertices = new TVertex[m_vbo.indices * 3];
-    TVertex *normals = new TVertex[m_vbo.indices * 3];
-    TCoord *texcoords = new TCoord[m_vbo.indices * 3];
-
-    unsigned int FinishedFaces = 0;
-    
-    // Loop through every face
-	for(unsigned curr_face = 0; curr_face < mesh->mNumFaces; curr_face++)
+    //vertex attributes (texture coordinates are zero if not present)
+    for(unsigned i = 0; i < mesh->mNumVertices; i++)
     {
-		aiFace *face = &mesh->mFaces[curr_face];
-
-		//aiProcess_Triangulate is turned on, so looping through 3 vertices
-        for(unsigned i = 0; i < 3; i++)
-        {
-			TVertex v;
-			v[0] = mesh->mVertices[face->mIndices[i]].x;
-			v[1] = mesh->mVertices[face->mIndices[i]].y;
-			v[2] = mesh->mVertices[face->mIndices[i]].z;
-
-            //vertices
-			memcpy(&vertices[FinishedFaces*3 + i], &v, sizeof(TVertex) );
-
-			//normals
-			v[0] = mesh->mNormals[face->mIndices[i]].x;
-			v[1] = mesh->mNormals[face->mIndices[i]].y;
-			v[2] = mesh->mNormals[face->mIndices[i]].z;
+        out.vertices.push_back(mesh->mVertices[i].x);
+        out.vertices.push_back(mesh->mVertices[i].y);
+        out.vertices.push_back(mesh->mVertices[i].z);
 
-			memcpy(&normals[FinishedFaces*3 + i], &v, sizeof(TVertex) );
+        out.normals.push_back(mesh->mNormals[i].x);
+        out.normals.push_back(mesh->mNormals[i].y);
+        out.normals.push_back(mesh->mNormals[i].z);
 
-            //texture coordinates (if present)
-			if(mesh->HasTextureCoords(0))
-			{
-				TCoord c;
-				c[0] = mesh->mTextureCoords[0][face->mIndices[i]].x;
-				c[1] = mesh->mTextureCoords[0][face->mIndices[i]].y;
-                memcpy(&texcoords[FinishedFaces*3 + i], &c, sizeof(TCoord));
-			}
+        if(mesh->HasTextureCoords(0))
+        {
+            out.texcoords.push_back(mesh->mTextureCoords[0][i].x);
+            out.texcoords.push_back(mesh->mTextureCoords[0][i].y);
+        }
+        else
+        {
+            out.texcoords.push_back(0.0f);
+            out.texcoords.push_back(0.0f);
         }
-        FinishedFaces++;
     }
 
-	OBB = new BoundingVolume((float*)vertices, 3*mesh->mNumFaces);
-
-    //Vertex array
-    glGenVertexArrays(1, &m_vbo.vao);
-    glBindVertexArray(m_vbo.vao);
+    //aiProcess_Triangulate is turned on, so looping through 3 vertices
+    for(unsigned curr_face = 0; curr_face < mesh->mNumFaces; curr_face++)
+    {
+        aiFace *face = &mesh->mFaces[curr_face];
+        if(face->mNumIndices != 3)
+            continue;
+        for(unsigned i = 0; i < 3; i++)
+            out.indices.push_back(base + face->mIndices[i]);
+    }
+}
 
-    //Allocate and assign three VBO to our handle (vertices, normals and texture coordinates)
-    glGenBuffers(4, m_vbo.buffer);
+/**
+****************************************************************************************************
+@brief Build LOD chain and store indexed mesh into vertex buffers. If the same mesh has been
+loaded before (e.g. from another file), its buffers are shared instead
+@param mesh indexed mesh (indices are extended by simplified detail levels)
+@param source name of mesh source (file), empty if mesh can't be found by name
+****************************************************************************************************/
+void TObject::CreateBuffers(TIndexedMesh &mesh, const string &source)
+{
+    m_element_indices = true;
+    m_drawmode = GL_TRIANGLES;
 
-    //store vertices into buffer
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_VERTEX]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(TVertex) * 3 * m_vbo.indices, vertices, GL_STATIC_DRAW);
-    // vertices are on index 0 and contains three floats per vertex
-    glVertexAttribPointer(GLuint(0), 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(0);
+    //byte-identical mesh already loaded?
+    unsigned long long hash = SceneManager::HashGeometry(mesh.vertices, mesh.normals, mesh.texcoords, mesh.indices, m_drawmode);
+    TGeometry *g = SceneManager::Instance()->AcquireGeometry(hash, mesh.vertices, mesh.normals, mesh.texcoords, mesh.indices, m_drawmode);
+    if(g != NULL)
+    {
+        SceneManager::Instance()->AliasGeometry(source, g);
+        SetGeometry(g);
+        return;
+    }
 
-    //store normals into buffer
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_NORMAL]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(TVertex) * 3 * m_vbo.indices, normals, GL_STATIC_DRAW);
-    // normals are on index 1 and contains three floats per vertex
-    glVertexAttribPointer(GLuint(1), 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(1);
+    GLuint verts = mesh.vertices.size()/3;
+    ComputeBoundingSphere(&mesh.vertices[0], verts, m_vbo.center, m_vbo.radius);
+    OBB = new BoundingVolume(&mesh.vertices[0], verts);
+
+    //simplified detail levels
+    m_vbo.lod_count = BuildLodChain(mesh, m_vbo.lod);
+    m_vbo.indices = m_vbo.lod[0].count;
+    //split full detail level into clusters
+    m_vbo.meshlets = BuildMeshlets(mesh, m_vbo.lod[0].offset, m_vbo.lod[0].count);
+
+    //store vertices and indices of all detail levels
+    size_t bytes = UploadBuffers(mesh.vertices, mesh.normals, mesh.texcoords, mesh.indices);
+    m_geometry = SceneManager::Instance()->AddGeometry(source, hash, m_vbo, OBB, m_drawmode, m_element_indices, bytes);
+
+#ifdef VERBOSE
+    for(unsigned i = 1; i < m_vbo.lod_count; i++)
+        cout<<"LOD "<<i<<": "<<m_vbo.lod[i].count/3<<" faces, error "<<m_vbo.lod[i].error<<endl;
+    if(m_vbo.meshlets)
+        cout<<m_vbo.meshlets->count<<" clusters\n";
+#endif
+}
 
-    //store texture coordinates
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_TEXCOORD]);    
-    glBufferData(GL_ARRAY_BUFFER, sizeof(TCoord) * 3 * m_vbo.indices, texcoords, GL_STATIC_DRAW);
-   
-	//coordinates are on index 2 and contains two floats per vertex
-    glVertexAttribPointer(GLuint(2), 2, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(2);
 
-    glBindVertexArray(0);
+/**
+****************************************************************************************************
+@brief Creates object directly from aiMesh
+@param mesh aiMesh mesh
+@return pointer to vertex buffer with data
+****************************************************************************************************/
+VBO TObject::Create(aiMesh *mesh)
+{  
+	m_name = mesh->mName.C_Str();
+    m_scale = glm::vec3(1.0);
+    m_shadow_cast = true;
+    m_shadow_receive = true;
+    m_draw_object = true;
+    m_type = EXTERN;
 
-    // Clean up our allocated memory
-    delete [] vertices;
-    delete [] normals;
-    delete [] texcoords;
+    TIndexedMesh data;
+    AppendMesh(mesh, data);
+    CreateBuffers(data);
 
     //return VBO structure
     return m_vbo;
@@ -132,33 +141,11 @@ VBO TObject::Create(const char *name, const char *file, bool load)
     m_draw_object = true;
     m_type = EXTERN;
     m_drawmode = GL_TRIANGLES;
-    m_element_indices = false;
+    m_element_indices = true;
 
-    //don't load object if it has been loaded before
+    //don't load object if it has been loaded before (geometry is set by SetGeometry())
     if(!load) 
-    {
-        //set VAO and VBO from existing data
-        glBindVertexArray(m_vbo.vao);
-        glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_VERTEX]);
-        // vertices are on index 0 and contains three floats per vertex
-        glVertexAttribPointer(GLuint(0), 3, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_NORMAL]);
-        // normals are on index 1 and contains three floats per vertex
-        glVertexAttribPointer(GLuint(1), 3, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(1);
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_TEXCOORD]); 
-        //coordinates are on index 2 and contains two floats per vertex
-        glVertexAttribPointer(GLuint(2), 2, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(2);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_vbo.buffer[P_INDEX]);
-
-        glBindVertexArray(0);
         return m_vbo;
-    }
 
     /////////////////////////////////////////////////////////////////////////////
     //Load 3D Model
@@ -174,102 +161,21 @@ VBO TObject::Create(const char *name, const char *file, bool load)
         throw ERR;
 	}
 
-    //count faces
-    m_vbo.indices = 0;
-    // Loop through every mesh
-	for(int i=0; i < model->mNumMeshes; i++)
-    {
-        // Add the number of faces this mesh has to the total faces
-		m_vbo.indices += model->mMeshes[i]->mNumFaces;
-    }
-
-    // Allocate memory for our vertices and normals
-    TVertex *vertices = new TVertex[m_vbo.indices * 3];
-    TVertex *normals = new TVertex[m_vbo.indices * 3];
-    TCoord *texcoords = new TCoord[m_vbo.indices * 3];
+    //merge all meshes into one indexed mesh
+    TIndexedMesh data;
+	for(unsigned curr_mesh = 0; curr_mesh < model->mNumMeshes; curr_mesh++)
+        AppendMesh(model->mMeshes[curr_mesh], data);
 
-    unsigned int FinishedFaces = 0;
-    // Loop through all the meshes
-	for(int curr_mesh = 0; curr_mesh < model->mNumMeshes; curr_mesh++)
+    if(data.indices.empty())
     {
-		aiMesh *mesh = model->mMeshes[curr_mesh];
-        //lib3ds_mesh_calculate_vertex_normals(mesh, &normals[FinishedFaces*3]);
-        // Loop through every face
-		for(unsigned curr_face = 0; curr_face < mesh->mNumFaces; curr_face++)
-        {
-            aiFace *face = &mesh->mFaces[curr_face];
-            for(unsigned i = 0; i < 3; i++)
-			{
-				TVertex v;
-				v[0] = mesh->mVertices[face->mIndices[i]].x;
-				v[1] = mesh->mVertices[face->mIndices[i]].y;
-				v[2] = mesh->mVertices[face->mIndices[i]].z;
-
-				//vertices
-				memcpy(&vertices[FinishedFaces*3 + i], &v, sizeof(TVertex) );
-
-				//normals
-				v[0] = mesh->mNormals[face->mIndices[i]].x;
-				v[1] = mesh->mNormals[face->mIndices[i]].y;
-				v[2] = mesh->mNormals[face->mIndices[i]].z;
-
-				memcpy(&normals[FinishedFaces*3 + i], &v, sizeof(TVertex) );
-
-				//texture coordinates (if present)
-				if(mesh->HasTextureCoords(0))
-				{
-					TCoord c;
-					c[0] = mesh->mTextureCoords[0][face->mIndices[i]].x;
-					c[1] = mesh->mTextureCoords[0][face->mIndices[i]].y;
-					memcpy(&texcoords[FinishedFaces*3 + i], &c, sizeof(TCoord));
-				}
-			}
-            FinishedFaces++;
-        }
+        ShowMessage("No faces in object file!\n",false);
+        throw ERR;
     }
+    CreateBuffers(data, file);
 
-	OBB = new BoundingVolume((float*)vertices, 3 * m_vbo.indices);
-
-    //Vertex array
-    glGenVertexArrays(1, &m_vbo.vao);
-    glBindVertexArray(m_vbo.vao);
-
-    //Allocate and assign three VBO to our handle (vertices, normals and texture coordinates)
-    glGenBuffers(4, m_vbo.buffer);
-
-    //store vertices into buffer
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_VERTEX]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(TVertex) * 3 * m_vbo.indices, vertices, GL_STATIC_DRAW);
-    // vertices are on index 0 and contains three floats per vertex
-    glVertexAttribPointer(GLuint(0), 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(0);
-
-    //store normals into buffer
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_NORMAL]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(TVertex) * 3 * m_vbo.indices, normals, GL_STATIC_DRAW);
-    // normals are on index 1 and contains three floats per vertex
-    glVertexAttribPointer(GLuint(1), 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(1);
-
-    //store texture coordinates
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_TEXCOORD]);    
-    glBufferData(GL_ARRAY_BUFFER, sizeof(TCoord) * 3 * m_vbo.indices, texcoords, GL_STATIC_DRAW);
-    //coordinates are on index 2 and contains two floats per vertex
-    glVertexAttribPointer(GLuint(2), 2, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(2);
-
-    glBindVertexArray(0);
-
-    // Clean up our allocated memory
-    delete [] vertices;
-    delete [] normals;
-    delete [] texcoords;
-
-    // We no longer need lib3ds
-    //lib3ds_file_free(model);
     model = NULL;
 
-    cout<<"Done(vertices: "<<m_vbo.indices*3<<", faces: "<<m_vbo.indices<<")\n";
+    cout<<"Done(vertices: "<<data.vertices.size()/3<<", faces: "<<m_vbo.indices/3<<", LODs: "<<m_vbo.lod_count<<")\n";
 
     //return VBO structure
     return m_vbo;
@@ -165,7 +165,7 @@ void TScene::LoadScene(const char* file, bool load_materials, bool load_lights,
 		TObject *o = new TObject();
         m_objects[oname] = o;
 
-		m_obj_cache[oname] = m_objects[oname]->Create(mesh);
+		m_objects[oname]->Create(mesh);
 
 		//assign material
 		if(load_materials)
@@ -3,6 +3,15 @@
 @brief material settings, dynamic shader creation
 ***************************************************************************************************/
 #include "material.h"
+#include "SceneManager.h"
+#include "program_cache.h"
+#include "hires_timer.h"
+#include "shader_source.h"
+
+bool TMaterial::m_useShadingLOD = true;
+bool TMaterial::m_useClusteredLights = false;
+int TMaterial::m_objectLights = 0;
+bool TMaterial::m_useGBuffer = false;
 
 /**
 ****************************************************************************************************
@@ -12,19 +21,14 @@
 ***************************************************************************************************/
 string LoadShader(const char* source)
 {
-    ifstream fin(source);
-    if(!fin) 
+    string data;
+    if(!LoadShaderSource(source, data)) 
     {
         string msg = "Cannot open shader ";
         msg += source;
         ShowMessage(msg.c_str(), false);
         return "null";
     }
-    string data;
-    char ch;
-    while(fin.get(ch))
-        data+=ch;
-
     return data;
 }
 
@@ -60,7 +64,20 @@ TMaterial::TMaterial(const char* name, unsigned id, glm::vec3 amb, glm::vec3 dif
     m_sceneID = 0;
 
     m_shader = -1;
+    m_program = NULL;
+    m_lod_program = NULL;
+    m_lod_ready = false;
+    m_variant = SHADING_FULL;
+    for(int i=0; i<SHADING_VARIANTS; i++)
+    {
+        m_ambLoc[i] = m_diffLoc[i] = m_specLoc[i] = m_shinLoc[i] = m_transLoc[i] = -1;
+        m_objLightsLoc[i] = m_objLightCountLoc[i] = m_objAmbientLoc[i] = -1;
+    }
+    m_fallback = NULL;
+    m_uberLoc = -1;
+    m_uber_textured = false;
     m_baked = false;
+    m_link_failed = false;
     m_useMRT = false;
     m_custom_shader = false;
     if(m_lightModel == SCREEN_SPACE)  //screen space quad cannot receive shadows
@@ -77,7 +94,12 @@ TMaterial::TMaterial(const char* name, unsigned id, glm::vec3 amb, glm::vec3 dif
 ***************************************************************************************************/
 TMaterial::~TMaterial()
 {
-    if(m_shader != 0)
+    //shared program is deleted by last material
+    if(m_lod_program != NULL)
+        SceneManager::Instance()->ReleaseProgram(m_lod_program);
+    if(m_program != NULL)
+        SceneManager::Instance()->ReleaseProgram(m_program);
+    else if(m_shader != 0)
     {
         glDetachObjectARB(m_shader,m_f_shader);
         glDetachObjectARB(m_shader,m_g_shader);
@@ -209,6 +231,37 @@ GLint TMaterial::AddTexture(const char **files, GLint textype, GLint texmode, GL
     return m_textures[texname]->Load(texname.c_str(), textype, files, texmode, intensity, tileX, tileY, aniso, cache);
 }
 
+/**
+****************************************************************************************************
+@brief Add virtual texture. Object's part of virtual texture is set by its virtual rectangle
+(see TObject::SetVirtualRect()).
+@param vt created virtual texture
+@param texmode texture addition mode (can be ADD,MODULATE,DECAL,BLEND,REPLACE)
+@param intensity texture color intensity
+@return new texture ID
+****************************************************************************************************/
+GLint TMaterial::AddVirtualTexture(TVirtualTexture *vt, GLint texmode, GLfloat intensity)
+{
+    string texname = NextTexture(m_name + "VirtualA");
+    Texture *t = new Texture();
+    m_textures[texname] = t;
+    return m_textures[texname]->Load(texname.c_str(), vt, texmode, intensity);
+}
+
+/**
+****************************************************************************************************
+@brief Has material virtual texture? (objects with such material are drawn into feedback buffer)
+****************************************************************************************************/
+bool TMaterial::IsVirtual()
+{
+    for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
+    {
+        if(m_it->second->GetType() == VIRTUAL)
+            return true;
+    }
+    return false;
+}
+
 /**
 ****************************************************************************************************
 @brief Add texture from external data.
@@ -242,8 +295,9 @@ GLint TMaterial::AddTextureData(const char *texname, GLint textype, const void *
 @param type shadow type (spot or omni)
 @param map pointer to texture data
 @param intensity shadow intensity (0 - transparent, 1 - opaque)
+@param region rectangles of shadow map in shadow atlas (owned by light)
 ***************************************************************************************************/
-void TMaterial::AddShadowMap(int type, GLuint map, GLfloat intensity)
+void TMaterial::AddShadowMap(int type, GLuint map, GLfloat intensity, const glm::vec4 *region)
 {
     //don't add shadow map for materials whose don't want to receive shadows!
     if(!m_receive_shadows) 
@@ -260,6 +314,7 @@ void TMaterial::AddShadowMap(int type, GLuint map, GLfloat intensity)
     Texture *shadow_tex = new Texture();
     shadow_tex->SetID(map);
     shadow_tex->SetName(texname);
+    shadow_tex->SetRegion(region);
 
     if(type == OMNI)
         shadow_tex->SetType(SHADOW_OMNI);
@@ -293,18 +348,112 @@ void TMaterial::RemoveShadows()
 
 }
 
+/**
+****************************************************************************************************
+@brief Append textures sampled by generated shader (used for packing into texture arrays). Custom
+shaders declare their own samplers, so their textures are not returned.
+@param textures list of textures
+***************************************************************************************************/
+void TMaterial::GetTextures(vector<Texture*> &textures)
+{
+    if(m_custom_shader)
+        return;
+    for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
+        if(!m_it->second->Empty())
+            textures.push_back(m_it->second);
+}
+
+
+/**
+****************************************************************************************************
+@brief Return name of texture uniform in generated shader. Material name is replaced by common
+prefix, so materials with the same textures generate the same source and share program.
+@param texname texture name
+@return uniform name
+***************************************************************************************************/
+string TMaterial::UniformName(const string &texname)
+{
+    if(texname.compare(0, m_name.size(), m_name) == 0)
+        return "tex_" + texname.substr(m_name.size());
+    return texname;
+}
+
+/**
+****************************************************************************************************
+@brief Set material parameters (colors, shininess, transparency) and texture uniforms in program.
+Program must be bound. Shared program remembers material whose parameters it holds.
+@param variant shading variant whose program is bound
+***************************************************************************************************/
+void TMaterial::SetMaterialUniforms(int variant)
+{
+    int i=0;
+    for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
+    {
+        if(!m_it->second->Empty())
+        {
+            m_it->second->ActivateTexture(i,true,variant);
+            i += m_it->second->GetUnits();
+        }
+    }
+    glUniform3fv(m_ambLoc[variant], 1, glm::value_ptr(m_ambColor));
+    glUniform3fv(m_diffLoc[variant], 1, glm::value_ptr(m_diffColor));
+    glUniform3fv(m_specLoc[variant], 1, glm::value_ptr(m_specColor));
+    glUniform1f(m_shinLoc[variant], m_shininess);
+    glUniform1f(m_transLoc[variant], m_transparency);
+
+    //uber-shader samples only base texture
+    if(m_fallback != NULL)
+        glUniform1i(m_uberLoc, m_uber_textured);
+    else if(variant == SHADING_REDUCED)
+        m_lod_program->owner = this;
+    else if(m_program != NULL)
+        m_program->owner = this;
+}
+
+/**
+****************************************************************************************************
+@brief Return program of shading variant
+@param variant shading variant (reduced variant must be ready)
+***************************************************************************************************/
+GLint TMaterial::VariantProgram(int variant)
+{
+    return variant == SHADING_REDUCED ? (GLint)m_lod_program->program : m_shader;
+}
+
+/**
+****************************************************************************************************
+@brief Return program of shading variant bound by RenderMaterial()
+***************************************************************************************************/
+GLint TMaterial::VariantShader()
+{
+    return VariantProgram(m_variant);
+}
 
 /**
 ****************************************************************************************************
 @brief Render material. If hasn't been baked, bake him first(TMaterial::BakeMaterial())
+@param variant shading variant (full shader is used when material has no reduced variant)
 ***************************************************************************************************/
-void TMaterial::RenderMaterial()
+void TMaterial::RenderMaterial(int variant)
 {
 #ifdef VERBOSE
     cout<<"Rendering "<<m_name;
 #endif
     ///enable shader
-    glUseProgram(m_shader);
+    m_variant = (variant == SHADING_REDUCED && m_lod_ready) ? SHADING_REDUCED : SHADING_FULL;
+    TShaderProgram *program = (m_variant == SHADING_REDUCED) ? m_lod_program : m_program;
+    glUseProgram(VariantShader());
+
+    ///program holds parameters of another material - set parameters of this one (uber-shader
+    ///is shared by all materials waiting for their programs)
+    if(m_fallback != NULL || (program != NULL && program->owner != this))
+    {
+        SetMaterialUniforms(m_variant);
+#ifdef VERBOSE
+        cout<<"...done\n";
+#endif
+        return;
+    }
 
     ///activate textures attached to material (Texture::ActivateTexture() )
     int i=0;
@@ -312,8 +461,8 @@ void TMaterial::RenderMaterial()
     {
         if(!m_it->second->Empty())
         {
-            m_it->second->ActivateTexture(i);
-            i++;
+            m_it->second->ActivateTexture(i, false, m_variant);
+            i += m_it->second->GetUnits();
         }
     }
 #ifdef VERBOSE
@@ -343,10 +492,6 @@ bool TMaterial::CustomShader(TShader *vertex, TShader *tess_control, TShader *te
         return false;
     }
 
-    //create shaders for vertex and fragment shader
-    m_v_shader = glCreateShader(GL_VERTEX_SHADER);
-    m_f_shader = glCreateShader(GL_FRAGMENT_SHADER);
-
     //shader version. If OpenGL4 is supported, use 400, else 330
     string version = "#version 330 compatibility\n";
     if(GLEW_ARB_gpu_shader5)
@@ -364,119 +509,146 @@ bool TMaterial::CustomShader(TShader *vertex, TShader *tess_control, TShader *te
     if(vertex_shader == "null" || fragment_shader == "null")
         return false;
 
-    const char *ff = fragment_shader.c_str();
-    const char *vv = vertex_shader.c_str();
-
-    //set shader source
-    glShaderSource(m_v_shader, 1, &vv,NULL);
-    glShaderSource(m_f_shader, 1, &ff,NULL);
-
-    //compile and detect shader errors
-    char log[BUFFER]; int len;
-    glCompileShader(m_v_shader);
-    glCompileShader(m_f_shader);
-
-    //create and link shader program
-    m_shader = glCreateProgram();
-    glAttachShader(m_shader,m_f_shader);
-    glAttachShader(m_shader,m_v_shader);
-
-
-    //do we have tessellation shaders?
-    if(tess_control != NULL && tess_eval != NULL)
+    //load tessellation and geometry shaders
+    bool tessellation = (tess_control != NULL && tess_eval != NULL);
+    if(tessellation)
     {
-        m_is_tessellated = true;
-        //then load, create, compile and attach tessellation shaders
-        m_tc_shader = glCreateShader(GL_TESS_CONTROL_SHADER);
-        m_te_shader = glCreateShader(GL_TESS_EVALUATION_SHADER);
-        string tess_control_shader = version + tess_control->defines;
-        string tess_eval_shader = version + tess_eval->defines;
-
-        //load and link shader
-        tess_control_shader += LoadShader(tess_control->source.c_str());
-        tess_eval_shader += LoadShader(tess_eval->source.c_str());
+        tess_control_shader = version + tess_control->defines + LoadShader(tess_control->source.c_str());
+        tess_eval_shader = version + tess_eval->defines + LoadShader(tess_eval->source.c_str());
         if(tess_control_shader == "null" || tess_eval_shader == "null")
             return false;
-        const char *tc = tess_control_shader.c_str();
-        const char *te = tess_eval_shader.c_str();
-        glShaderSource(m_tc_shader, 1, &tc, NULL);
-        glShaderSource(m_te_shader, 1, &te, NULL);
-        glCompileShader(m_tc_shader);
-        glCompileShader(m_te_shader);
-        glAttachShader(m_shader,m_tc_shader);
-        glAttachShader(m_shader,m_te_shader);
     }
-
-    //do we have geometry shader?
     if(geometry != NULL)
     {
-        //then load, create, compile and attach geometry shader
-        m_g_shader = glCreateShader(GL_GEOMETRY_SHADER);
-        string geometry_shader = version + geometry->defines;
-
-        //load and link shader
-        geometry_shader += LoadShader(geometry->source.c_str());
+        geometry_shader = version + geometry->defines + LoadShader(geometry->source.c_str());
         if(geometry_shader == "null")
             return false;
-        const char *gg = geometry_shader.c_str();
-        glShaderSource(m_g_shader, 1, &gg,NULL);
-        glCompileShader(m_g_shader);
-        glAttachShader(m_shader,m_g_shader);
     }
-
-    //final shader linking
-    glLinkProgram(m_shader);
-    glUseProgram(m_shader);
-
-    //shader creation status: print error if any
-    ofstream fout("shader_log.txt", ios_base::app);
-    glGetShaderInfoLog(m_v_shader, BUFFER, &len, log);
+    m_is_tessellated = tessellation;
+
+    //try program binary from disk cache (key is source of all stages)
+    HRTimer timer;
+    string key = vertex_shader + "\n//TESS_CONTROL\n" + tess_control_shader + "\n//TESS_EVAL\n" + tess_eval_shader + 
+                 "\n//GEOMETRY\n" + geometry_shader + "\n//FRAGMENT\n" + fragment_shader;
+    m_shader = LoadProgramBinary(key);
+    m_v_shader = m_f_shader = m_tc_shader = m_te_shader = m_g_shader = 0;
+    bool cached = (m_shader != 0);
     bool compile_err = false;
-    //log from vertex shader
-    if(strstr(log, "succes") == NULL && len > 0) 
+    if(!cached)
     {
-        fout<<endl<<m_name<<":"<<log;  
-        cout<<endl<<m_name<<":"<<log;  
-        compile_err = true;
-    }
-    //log from tessellation shaders
-    if(tess_control != NULL && tess_eval != NULL)
-    {
-        glGetShaderInfoLog(m_tc_shader, BUFFER, &len, log);
-        if(strstr(log, "succes") == NULL && len > 0) 
+        //create shaders for vertex and fragment shader
+        m_v_shader = glCreateShader(GL_VERTEX_SHADER);
+        m_f_shader = glCreateShader(GL_FRAGMENT_SHADER);
+
+        const char *ff = fragment_shader.c_str();
+        const char *vv = vertex_shader.c_str();
+
+        //set shader source
+        glShaderSource(m_v_shader, 1, &vv,NULL);
+        glShaderSource(m_f_shader, 1, &ff,NULL);
+
+        //compile and detect shader errors
+        char log[BUFFER]; int len;
+        glCompileShader(m_v_shader);
+        glCompileShader(m_f_shader);
+
+        //create and link shader program
+        m_shader = glCreateProgram();
+        glAttachShader(m_shader,m_f_shader);
+        glAttachShader(m_shader,m_v_shader);
+
+
+        //do we have tessellation shaders?
+        if(tessellation)
         {
-            fout<<endl<<m_name<<":"<<log;  
-            cout<<endl<<m_name<<":"<<log;
-            compile_err = true;
+            //then create, compile and attach tessellation shaders
+            m_tc_shader = glCreateShader(GL_TESS_CONTROL_SHADER);
+            m_te_shader = glCreateShader(GL_TESS_EVALUATION_SHADER);
+            const char *tc = tess_control_shader.c_str();
+            const char *te = tess_eval_shader.c_str();
+            glShaderSource(m_tc_shader, 1, &tc, NULL);
+            glShaderSource(m_te_shader, 1, &te, NULL);
+            glCompileShader(m_tc_shader);
+            glCompileShader(m_te_shader);
+            glAttachShader(m_shader,m_tc_shader);
+            glAttachShader(m_shader,m_te_shader);
+        }
+
+        //do we have geometry shader?
+        if(geometry != NULL)
+        {
+            //then create, compile and attach geometry shader
+            m_g_shader = glCreateShader(GL_GEOMETRY_SHADER);
+            const char *gg = geometry_shader.c_str();
+            glShaderSource(m_g_shader, 1, &gg,NULL);
+            glCompileShader(m_g_shader);
+            glAttachShader(m_shader,m_g_shader);
         }
-        glGetShaderInfoLog(m_te_shader, BUFFER, &len, log);
+
+        //final shader linking
+        if(IsProgramCacheEnabled())
+            glProgramParameteri(m_shader, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(m_shader);
+
+        //shader creation status: print error if any
+        ofstream fout("shader_log.txt", ios_base::app);
+        glGetShaderInfoLog(m_v_shader, BUFFER, &len, log);
+        //log from vertex shader
         if(strstr(log, "succes") == NULL && len > 0) 
         {
             fout<<endl<<m_name<<":"<<log;  
-            cout<<endl<<m_name<<":"<<log;
+            cout<<endl<<m_name<<":"<<log;  
             compile_err = true;
         }
-    }
-    //log from geometry shader
-    if(geometry != NULL)
-    {
-        glGetShaderInfoLog(m_g_shader, BUFFER, &len, log);
+        //log from tessellation shaders
+        if(tessellation)
+        {
+            glGetShaderInfoLog(m_tc_shader, BUFFER, &len, log);
+            if(strstr(log, "succes") == NULL && len > 0) 
+            {
+                fout<<endl<<m_name<<":"<<log;  
+                cout<<endl<<m_name<<":"<<log;
+                compile_err = true;
+            }
+            glGetShaderInfoLog(m_te_shader, BUFFER, &len, log);
+            if(strstr(log, "succes") == NULL && len > 0) 
+            {
+                fout<<endl<<m_name<<":"<<log;  
+                cout<<endl<<m_name<<":"<<log;
+                compile_err = true;
+            }
+        }
+        //log from geometry shader
+        if(geometry != NULL)
+        {
+            glGetShaderInfoLog(m_g_shader, BUFFER, &len, log);
+            if(strstr(log, "succes") == NULL && len > 0) 
+            {
+                fout<<endl<<m_name<<":"<<log;  
+                cout<<endl<<m_name<<":"<<log;
+                compile_err = true;
+            }
+        }
+        //log from fragment shader
+        glGetShaderInfoLog(m_f_shader, BUFFER, &len, log);
         if(strstr(log, "succes") == NULL && len > 0) 
         {
-            fout<<endl<<m_name<<":"<<log;  
+            fout<<endl<<m_name<<":"<<log;   
             cout<<endl<<m_name<<":"<<log;
             compile_err = true;
         }
+        fout.close();
+
+        //don't cache programs with errors
+        if(!compile_err)
+            SaveProgramBinary(m_shader, key);
     }
-    //log from fragment shader
-    glGetShaderInfoLog(m_f_shader, BUFFER, &len, log);
-    if(strstr(log, "succes") == NULL && len > 0) 
-    {
-        fout<<endl<<m_name<<":"<<log;   
-        cout<<endl<<m_name<<":"<<log;
-        compile_err = true;
-    }
-    fout.close();
+    glUseProgram(m_shader);
+
+    float ms = (float)timer.GetElapsedTimeMilliseconds();
+    if(!cached)
+        ProgramCompiled(ms);
+    cout<<"Custom shader "<<m_name<<": program "<<(cached ? "loaded from cache" : "compiled")<<" in "<<ms<<" ms\n";
 
 
 
@@ -489,7 +661,7 @@ bool TMaterial::CustomShader(TShader *vertex, TShader *tess_control, TShader *te
         {
             m_it->second->GetUniforms(m_shader);
             m_it->second->ActivateTexture(i,true);
-            i++;
+            i += m_it->second->GetUnits();
         }
     }
 
@@ -6,6 +6,8 @@
 #define _MATERIAL_H_
 
 #include "texture.h"
+#include "shader_report.h"
+#include "light_clusters.h"
 
 ///Aligned buffer size
 #define BUFFER 512
@@ -35,6 +37,13 @@ const glm::vec3 magenta(1.0f,0.0f,1.0f);
 ///cyan color
 const glm::vec3 cyan(0.0f,1.0f,1.0f);
 
+struct TShaderProgram;
+
+//does driver compile shaders in parallel (KHR/ARB_parallel_shader_compile)?
+bool IsParallelCompileSupported();
+//create or acquire generic program used by materials until their programs are linked
+TShaderProgram* AcquireUberShader(int light_count, bool mrt);
+
 ///@struct TShader
 ///@brief structure for shader properties
 struct TShader
@@ -70,14 +79,61 @@ private:
     GLint m_f_shader, m_tc_shader, m_te_shader, m_g_shader, m_v_shader, m_shader;
     map<const char*,GLint> m_shader_locations;
     GLint m_sh_loc;
+    //program shared with materials of the same features (generated shaders only)
+    TShaderProgram *m_program;
+    //reduced shading variant for distant objects, shared like m_program (NULL - not requested yet,
+    //see RequestShadingLOD(), or same as full shader), is it linked with uniform locations?
+    TShaderProgram *m_lod_program;
+    bool m_lod_ready;
+    //shading variant bound by RenderMaterial()
+    int m_variant;
+    //locations of material parameters in shared programs (for every shading variant)
+    GLint m_ambLoc[SHADING_VARIANTS], m_diffLoc[SHADING_VARIANTS], m_specLoc[SHADING_VARIANTS];
+    GLint m_shinLoc[SHADING_VARIANTS], m_transLoc[SHADING_VARIANTS];
+    //locations of per-object light list
+    GLint m_objLightsLoc[SHADING_VARIANTS], m_objLightCountLoc[SHADING_VARIANTS], m_objAmbientLoc[SHADING_VARIANTS];
+    //generated source (between generation and submission of shader)
+    string m_vertex_source, m_fragment_source;
+    string m_lod_vertex_source, m_lod_fragment_source;
+    //uber-shader used until program is linked, does it sample base texture?
+    TShaderProgram *m_fallback;
+    GLint m_uberLoc;
+    bool m_uber_textured;
 
     //other variables
     bool m_baked, m_custom_shader, m_receive_shadows, m_useMRT, m_is_alpha, m_is_tessellated;
+    //program of material failed to link (reported once, fallback program stays bound)
+    bool m_link_failed;
     int m_lightModel;     ///lightModel - also indicates whether algorithm works in screen space
 
     //scene ID - when drawing more scenes than 1
     int m_sceneID;
 
+    //generate reduced shading variants of materials
+    static bool m_useShadingLOD;
+    //light local point lights from cluster lists (see TLightClusters)
+    static bool m_useClusteredLights;
+    //size of per-object light lists (0 - light model loops over all lights)
+    static int m_objectLights;
+    //write G-buffer (albedo, normal and material parameters) with MRT for deferred lighting
+    static bool m_useGBuffer;
+
+    //generate source of one shading variant
+    void GenerateSource(int variant, int light_count, int dpshadow_method, bool use_pcf, 
+                        string &vertex_shader, string &frag_shader);
+    //program of bound shading variant
+    GLint VariantShader();
+    ///@brief Return number of linked shading variants (full, reduced when it is ready)
+    int ProgramCount(){
+        return m_lod_ready ? 2 : 1;
+    }
+    //program of shading variant
+    GLint VariantProgram(int variant);
+    //features of shading variant (for shader report)
+    string ShaderFeatures(int variant);
+    //light constants of generated shaders
+    static string LightDefines(int light_count);
+
 public:
     //material creation
     TMaterial(const char* name, unsigned id, glm::vec3 amb, glm::vec3 diff, glm::vec3 spec, 
@@ -123,6 +179,10 @@ public:
     //from data
     GLint AddTextureData(const char *texname, GLint textype, const void *texdata, glm::vec2 tex_size, GLenum tex_format, GLenum data_type, 
                         GLint texmode, GLfloat intensity, GLfloat tileX, GLfloat tileY, bool mipmap, bool aniso);
+    //from virtual texture
+    GLint AddVirtualTexture(TVirtualTexture *vt, GLint texmode, GLfloat intensity);
+    //has material virtual texture?
+    bool IsVirtual();
 
     //finds next free texture in the list
     string NextTexture(string textype);   
@@ -143,8 +203,11 @@ public:
         m_textures[texname]->SetID(id); 
     }
 
+    //append textures sampled by generated shader
+    void GetTextures(vector<Texture*> &textures);
+
     //add shadow map
-    void AddShadowMap(int type, GLuint map, GLfloat intensity);
+    void AddShadowMap(int type, GLuint map, GLfloat intensity, const glm::vec4 *region);
     //remove all shadow maps
     void RemoveShadows();
 
@@ -158,37 +221,56 @@ public:
     //load custom shader - all stages
     bool CustomShader(TShader *vertex, TShader *tess_control, TShader *tess_eval, TShader *geometry, TShader *fragment);
 
+    //uniforms are set in programs of all shading variants (reduced variant once it is linked),
+    //per-draw uniforms only in variant bound by last RenderMaterial() (SetDrawUniform())
     ///@brief Set float uniform value in shader
     void SetUniform(const char* v_name, float value){
-        glProgramUniform1f(m_shader, glGetUniformLocation(m_shader,v_name), value);
+        for(int v = 0; v < ProgramCount(); v++)
+            glProgramUniform1f(VariantProgram(v), glGetUniformLocation(VariantProgram(v),v_name), value);
     }
     ///@brief Set double uniform value in shader. It is treated like float
     void SetUniform(const char* v_name, double value){
-        glProgramUniform1f(m_shader, glGetUniformLocation(m_shader,v_name), (float)value);
+        for(int v = 0; v < ProgramCount(); v++)
+            glProgramUniform1f(VariantProgram(v), glGetUniformLocation(VariantProgram(v),v_name), (float)value);
     }
     ///@brief Set int uniform value in shader
     void SetUniform(const char* v_name, int value){
-        glProgramUniform1i(m_shader, glGetUniformLocation(m_shader,v_name), value);
+        for(int v = 0; v < ProgramCount(); v++)
+            glProgramUniform1i(VariantProgram(v), glGetUniformLocation(VariantProgram(v),v_name), value);
     }
     ///@brief Set ivec2 value
     void SetUniform(const char* v_name, glm::ivec2 value){
-        glProgramUniform2iv(m_shader, glGetUniformLocation(m_shader,v_name), 1, glm::value_ptr(value));
+        for(int v = 0; v < ProgramCount(); v++)
+            glProgramUniform2iv(VariantProgram(v), glGetUniformLocation(VariantProgram(v),v_name), 1, glm::value_ptr(value));
     }
     ///@brief Set vec2 value
     void SetUniform(const char* v_name, glm::vec2 value){
-        glProgramUniform2fv(m_shader, glGetUniformLocation(m_shader,v_name), 1, glm::value_ptr(value));
+        for(int v = 0; v < ProgramCount(); v++)
+            glProgramUniform2fv(VariantProgram(v), glGetUniformLocation(VariantProgram(v),v_name), 1, glm::value_ptr(value));
     }
     ///@brief Set vec3 value
     void SetUniform(const char* v_name, glm::vec3 value){
-        glProgramUniform3fv(m_shader, glGetUniformLocation(m_shader,v_name), 1, glm::value_ptr(value));
+        for(int v = 0; v < ProgramCount(); v++)
+            glProgramUniform3fv(VariantProgram(v), glGetUniformLocation(VariantProgram(v),v_name), 1, glm::value_ptr(value));
     }
     ///@brief Set vec4 value
     void SetUniform(const char* v_name, glm::vec4 value){
-        glProgramUniform4fv(m_shader, glGetUniformLocation(m_shader,v_name), 1, glm::value_ptr(value));
+        for(int v = 0; v < ProgramCount(); v++)
+            glProgramUniform4fv(VariantProgram(v), glGetUniformLocation(VariantProgram(v),v_name), 1, glm::value_ptr(value));
     }
     ///@brief Set mat4x4 value
     void SetUniform(const char* v_name, glm::mat4 &value){
-        glProgramUniformMatrix4fv(m_shader, glGetUniformLocation(m_shader,v_name), 1, 0, glm::value_ptr(value));
+        for(int v = 0; v < ProgramCount(); v++)
+            glProgramUniformMatrix4fv(VariantProgram(v), glGetUniformLocation(VariantProgram(v),v_name), 1, 0, glm::value_ptr(value));
+    }
+
+    ///@brief Set mat4x4 value in bound shading variant (per-draw uniform)
+    void SetDrawUniform(const char* v_name, const glm::mat4 &value){
+        glProgramUniformMatrix4fv(VariantShader(), glGetUniformLocation(VariantShader(),v_name), 1, 0, glm::value_ptr(value));
+    }
+    ///@brief Set vec4 value in bound shading variant (per-draw uniform)
+    void SetDrawUniform(const char* v_name, const glm::vec4 &value){
+        glProgramUniform4fv(VariantShader(), glGetUniformLocation(VariantShader(),v_name), 1, glm::value_ptr(value));
     }
 
     ///@brief Toggle use of MRT
@@ -196,10 +278,67 @@ public:
         m_useMRT = flag; 
     }
 
+    //name of texture uniform in generated shader (without material name)
+    string UniformName(const string &texname);
+    //set material parameters and texture uniforms in shared program
+    void SetMaterialUniforms(int variant = SHADING_FULL);
+    //get uniform locations of shading variant
+    void GetVariantUniforms(int variant, GLuint program);
+    //generate shader source (no OpenGL calls, can run on worker thread)
+    bool GenerateShader(int light_count, int dpshadow_method = DPSM, bool use_pcf = true);
+    //start compilation of generated shader, render with fallback until it's linked
+    void SubmitShader(TShaderProgram *fallback = NULL);
+    //finish material when its program is linked (wait - block until linking finishes)
+    bool FinishShader(bool wait = true);
+    ///@brief Is program of material still being compiled?
+    bool IsPending(){
+        return m_program != NULL && !m_baked;
+    }
+    ///@brief Has material program (generated shader was submitted or custom shader is linked)?
+    bool HasProgram(){
+        return m_custom_shader || m_program != NULL;
+    }
+    //estimate cost of generated shaders (all shading variants)
+    bool AnalyzeShader(int light_count, unsigned lights, int dpshadow_method, bool use_pcf, vector<TShaderCost> &costs);
     //dynamically generate material shader
     bool BakeMaterial(int light_count, int dpshadow_method = DPSM, bool use_pcf = true);
-    //render material
-    void RenderMaterial();
+    //render material (shading variant - see HasShadingLOD())
+    void RenderMaterial(int variant = SHADING_FULL);
+    ///@brief Has material reduced shading variant? (cheaper shader for distant objects: per-vertex
+    ///lighting, no parallax and bump mapping, single shadow map lookup)
+    bool HasShadingLOD(){
+        return m_baked && (m_lod_program != NULL || !m_lod_vertex_source.empty());
+    }
+    //compile reduced shading variant on demand, is it ready?
+    bool RequestShadingLOD();
+    ///@brief Toggle generation of reduced shading variants (must be set before materials are baked)
+    static void UseShadingLOD(bool flag = true){
+        m_useShadingLOD = flag;
+    }
+    ///@brief Toggle clustered lights in light model (must be set before materials are baked)
+    static void UseClusteredLights(bool flag = true){
+        m_useClusteredLights = flag;
+    }
+    ///@brief Set size of per-object light lists, 0 - all lights (must be set before materials are baked)
+    static void UseObjectLights(int count){
+        m_objectLights = count;
+    }
+    ///@brief Toggle G-buffer outputs of materials rendered with MRT (must be set before materials are baked)
+    static void UseGBuffer(bool flag = true){
+        m_useGBuffer = flag;
+    }
+    ///@brief Do materials with MRT write G-buffer?
+    static bool IsGBufferUsed(){
+        return m_useGBuffer;
+    }
+    ///@brief Set lights of drawn object (indices into light uniform buffer, see SetObjectLights() of scene)
+    ///and ambient color of other lights
+    void SetObjectLights(const GLint *lights, GLint count, const glm::vec3 &ambient){
+        glProgramUniform3fv(VariantShader(), m_objAmbientLoc[m_variant], 1, glm::value_ptr(ambient));
+        glProgramUniform1i(VariantShader(), m_objLightCountLoc[m_variant], count);
+        if(count > 0)
+            glProgramUniform1iv(VariantShader(), m_objLightsLoc[m_variant], count, lights);
+    }
     //is material working in screen space?
     bool IsScreenSpace(){  
         return (m_lightModel == SCREEN_SPACE); 
@@ -4,6 +4,16 @@
 ***************************************************************************************************/
 #include "material.h"
 #include "utils.hpp"
+#include "virtual_texture.h"
+#include "SceneManager.h"
+#include "hires_timer.h"
+#include "program_cache.h"
+#include "shader_source.h"
+
+#ifndef GL_COMPLETION_STATUS_KHR
+///query of KHR_parallel_shader_compile (missing in bundled GLEW)
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 /**
 ****************************************************************************************************
@@ -17,14 +27,9 @@ string LoadFunc(char* func)
     file += "data/shaders/func/";
     file += func;
     file += ".frag";
-    ifstream fin(file.c_str());
-    if(!fin) 
-        return "null";
     string data;
-    char ch;
-    while(fin.get(ch))
-        data+=ch;
-
+    if(!LoadShaderSource(file, data)) 
+        return "null";
     return data;
 }
 
@@ -51,8 +56,16 @@ string computeTexel(Texture *t, string name)
     else if(t->GetType() == CUBEMAP) 
         ret += "  " + name + "_texture = textureCube(" + name + ", " + name + "_cubeCoords);\n";
     //cube map - use reflection vector
+    else if(t->GetType() == CUBEMAP_ENV && t->IsPrefiltered())
+        ret += "  " + name + "_texture = textureLod(" + name + ", reflVec, " + name + "_lod) * " + name + "_intensity;\n";
     else if(t->GetType() == CUBEMAP_ENV) 
         ret += "  " + name + "_texture = textureCube(" + name + ", reflVec) * " + name + "_intensity;\n";
+    //virtual texture - translate coordinates through page table
+    else if(t->GetType() == VIRTUAL)
+        ret += "  " + name + "_texture = VirtualTexture(" + name + ", " + name + "_pages, " + name + "_texcoord);\n";
+    //layer of texture array - layer index is material parameter
+    else if(t->GetLayer() >= 0)
+        ret += "  " + name + "_texture = texture(" + name + ", vec3(" + name + "_texcoord, " + name + "_layer));\n";
     //default 2D texture
     else 
         ret += "  " + name + "_texture = texture(" + name + ", " + name + "_texcoord);\n";
@@ -97,19 +110,118 @@ string computeTexel(Texture *t, string name)
 
 /**
 ****************************************************************************************************
-@brief Dynamically generates shader from all material data (if hasn't been generated before)
-@param light_count light count in scene
-@param parabola_cut should we use paraboloid cutting in DPSM?
-@return success/fail of shader generation
+@brief Apply texel of color texture to G-buffer albedo (color textures combined like with fragment
+color, see computeTexel(); lighting and environment textures don't change albedo)
+@param t texture
+@param name texture name in shader
+@return albedo computation code
 ***************************************************************************************************/
-bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
+string albedoTexel(Texture *t, string name)
+{
+    if(t->GetType() != BASE && t->GetType() != ALPHA && t->GetType() != VIRTUAL)
+        return "";
+    switch(t->GetMode())
+    {
+    case MODULATE:
+        return "  albedo *= " + name + "_texture.rgb;\n";
+    case DECAL:
+        return "  albedo = mix(albedo, " + name + "_texture.rgb, " + name + "_texture.a);\n";
+    case REPLACE:
+        return "  albedo = " + name + "_texture.rgb;\n";
+    default:
+        return "";
+    };
+}
+
+/**
+****************************************************************************************************
+@brief Return light constants of generated shaders: light capacity of scene, size of per-object
+light lists and cluster grid when local lights are clustered (see TLightClusters)
+@param light_count size of light arrays
+***************************************************************************************************/
+string TMaterial::LightDefines(int light_count)
+{
+    string defines = "const int LIGHTS = " + num2str(light_count) + ";\n";     //light capacity of scene
+    if(m_objectLights > 0)
+        defines += "#define OBJECT_LIGHTS " + num2str(min(m_objectLights, light_count)) + "\n";
+    if(m_useClusteredLights)
+        defines += "#define CLUSTERED_LIGHTS\n"
+            "#define CLUSTER_X " + num2str(CLUSTER_X) + "\n"
+            "#define CLUSTER_Y " + num2str(CLUSTER_Y) + "\n"
+            "#define CLUSTER_Z " + num2str(CLUSTER_Z) + "\n";
+    return defines + "\n";
+}
+
+/**
+****************************************************************************************************
+@brief Dynamically generates shader source from all material data. Only material data are read,
+so materials can be generated in parallel (see TMaterial::SubmitShader() for compilation). Reduced
+variant for distant objects is generated too, when it differs from full shader.
+@param light_count size of light arrays (light capacity of scene, actual count is in uniform buffer)
+@param dpshadow_method method of omnidirectional shadows
+@param use_pcf use percentage closer filtering of omnidirectional shadows
+@return false for custom shader (nothing is generated)
+***************************************************************************************************/
+bool TMaterial::GenerateShader(int light_count, int dpshadow_method, bool use_pcf)
 {
     //dont't bake linked custom shader
     if(m_custom_shader)
-        return true;
+        return false;
 
-    cout<<"Baking material "<<m_name<<endl;
+    GenerateSource(SHADING_FULL, light_count, dpshadow_method, use_pcf, m_vertex_source, m_fragment_source);
+    m_lod_vertex_source.clear();
+    m_lod_fragment_source.clear();
+    if(m_useShadingLOD)
+    {
+        GenerateSource(SHADING_REDUCED, light_count, dpshadow_method, use_pcf, m_lod_vertex_source, m_lod_fragment_source);
+        //material has no expensive features - distant objects use full shader
+        if(m_lod_vertex_source == m_vertex_source && m_lod_fragment_source == m_fragment_source)
+        {
+            m_lod_vertex_source.clear();
+            m_lod_fragment_source.clear();
+        }
+    }
+
+    //save shaders to debug file
+    string file; file = "shader_out/" + m_name + ".vert";
+    ofstream fout1(file.c_str());
+    fout1<<m_vertex_source;
+    file = "shader_out/" + m_name + ".frag";
+    ofstream fout2(file.c_str());
+    fout2<<m_fragment_source;
+    if(!m_lod_vertex_source.empty())
+    {
+        file = "shader_out/" + m_name + "_lod.vert";
+        ofstream fout3(file.c_str());
+        fout3<<m_lod_vertex_source;
+        file = "shader_out/" + m_name + "_lod.frag";
+        ofstream fout4(file.c_str());
+        fout4<<m_lod_fragment_source;
+    }
+    return true;
+}
 
+/**
+****************************************************************************************************
+@brief Generate source of one shading variant. Reduced variant (SHADING_REDUCED) drops expensive
+per-pixel work: lighting is computed per-vertex, parallax and bump mapping are skipped and shadow
+maps are sampled once (without PCF).
+@param variant shading variant
+@param light_count size of light arrays
+@param dpshadow_method method of omnidirectional shadows
+@param use_pcf use percentage closer filtering of omnidirectional shadows
+@param vertex_shader output vertex shader source
+@param frag_shader output fragment shader source
+***************************************************************************************************/
+void TMaterial::GenerateSource(int variant, int light_count, int dpshadow_method, bool use_pcf, 
+                               string &vertex_shader, string &frag_shader)
+{
+    bool reduced = (variant == SHADING_REDUCED);
+    //reduced variant lights per-vertex
+    int light_model = (reduced && m_lightModel == PHONG) ? GOURAUD : m_lightModel;
+    //G-buffer for deferred lighting, unlit materials write zero albedo
+    bool gbuffer = m_useMRT && m_useGBuffer;
+    bool lit = (light_model == PHONG || light_model == GOURAUD);
     string tmp = m_name;        //temporary string for comparison
 
     /////////////////////////////////////////////////////////////////////////////
@@ -123,8 +235,7 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
 
     ///1.1 Vertex shader variables
     string vert_vars = "//GLSL vertex shader generated by gluxEngine\n";    //vertex shader variables
-    vert_vars +=    "//Material: \"" + m_name + "\"\n\n"
-        "//generic vertex attributes\n"
+    vert_vars +=    "\n//generic vertex attributes\n"
         "layout(location = 0) in vec3 in_Vertex;\n"
         "layout(location = 1) in vec3 in_Normal;\n"
         "layout(location = 2) in vec2 in_Coord;\n\n"
@@ -137,7 +248,7 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
     //add also shadow matrices into uniform block (for each light). Only if shadow map is bound to material
     for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
         if(m_it->second->GetType() == SHADOW)
-            vert_vars += "  mat4 " + m_it->first + "_texMatrix;\n";
+            vert_vars += "  mat4 " + UniformName(m_it->first) + "_texMatrix;\n";
 
     //finish uniform block and add texture coordinates
     vert_vars +=    "};\n"
@@ -160,7 +271,7 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
     {
         if(m_it->second->GetType() == DISPLACE)
         {
-            string texname = m_it->second->GetName();
+            string texname = UniformName(m_it->second->GetName());
             //add texture samplers: for normal and displacement map (assume that normal map is present)
             if(m_it->second->HasTiles())
                 vert_vars += "uniform float " + texname + "_tileX, " + texname + "_tileY;\n";
@@ -180,14 +291,14 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
             break;
         }
     }
-    //require also normal map
-    if(displace)
+    //require also normal map (reduced variant keeps geometry, but not normal detail)
+    if(displace && !reduced)
     {
         for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
         {
             if(m_it->second->GetType() == BUMP)
             {
-                string texname = m_it->second->GetName();
+                string texname = UniformName(m_it->second->GetName());
                 if(m_it->second->HasTiles())
                     vert_vars += "uniform float " + texname + "_tileX, " + texname + "_tileY;\n";
                 vert_vars += "uniform float " + texname + "_intensity;\n"
@@ -195,10 +306,12 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
                 vert_main	+= "  //displace normal using normal map\n";
                 //tiles: tile texture coordinate
                 if(m_it->second->HasTiles())
-                    vert_main	+= "  dNormal += normalize(texture(" + texname + ",in_Coord*vec2(" + texname + "_tileX, " + texname + "_tileY)).rgb * 2.0 - 1.0);\n\n";
+                    vert_main	+= "  vec2 bumpXY = texture(" + texname + ",in_Coord*vec2(" + texname + "_tileX, " + texname + "_tileY)).rg * 2.0 - 1.0;\n";
                 //no tiles
                 else
-                    vert_main	+= "  dNormal += normalize(texture(" + texname + ",in_Coord).rgb * 2.0 - 1.0);\n\n";
+                    vert_main	+= "  vec2 bumpXY = texture(" + texname + ",in_Coord).rg * 2.0 - 1.0;\n";
+                //normal maps can be compressed to two channels (BC5), reconstruct Z
+                vert_main	+= "  dNormal += normalize(vec3(bumpXY, sqrt(max(1.0 - dot(bumpXY, bumpXY), 0.0))));\n\n";
                 break;
             }
         }
@@ -210,7 +323,7 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
 
     tmp += "Env";
     ///1.2.1 if PHONG, light calculation will be done in fragment shader, so send necessary variables to it (also required for env mapping)
-    if(m_lightModel == PHONG || m_textures.find(tmp) != m_textures.end() )
+    if(light_model == PHONG || (light_model != GOURAUD && m_textures.find(tmp) != m_textures.end()) )
     {
         vert_vars += "out vec3 normal, eyeVec;\n";  //varying variables
         vert_main +=
@@ -219,12 +332,12 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
     }
 
     ///1.2.3 if GOURAUD, done light calculation per-vertex
-    else if(m_lightModel == GOURAUD)
+    else if(light_model == GOURAUD)
     {
         vert_vars += "out vec4 v_color;\n"
             "out vec3 normal, eyeVec;\n";
 
-        vert_func += LoadFunc((char*)"light");
+        vert_func += LightDefines(light_count) + LoadFunc((char*)"light");
         vert_main +=
             "  normal = mat3(in_ModelViewMatrix) * dNormal;  //surface normal\n"
             "  eyeVec = -vec3(in_ModelViewMatrix * vertex);            //eyeview vector\n"
@@ -248,11 +361,12 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
     //iterate through textures
     for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
     {
+        string texname = UniformName(m_it->first);
         ///1.4 calculate shadow matrices for frag. shader (projected shadow and texture matrix)
         if(m_it->second->GetType() == SHADOW)
         {
-            vert_vars += "out vec4 " + m_it->first + "_projShadow;\n";
-            vert_main += "  " + m_it->first + "_projShadow = " + m_it->first + "_texMatrix * in_ModelViewMatrix * vertex;   //calculate shadow texture projection\n";
+            vert_vars += "out vec4 " + texname + "_projShadow;\n";
+            vert_main += "  " + texname + "_projShadow = " + texname + "_texMatrix * in_ModelViewMatrix * vertex;   //calculate shadow texture projection\n";
         }
         //dual-paraboloid shadow map - insert output vertex (only once)
         if(m_it->second->GetType() == SHADOW_OMNI && m_it->first.find("ShadowOMNI_A") != string::npos)
@@ -266,8 +380,8 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
         ///1.5 send 3D coordinates for cube map
         if(m_it->second->GetType() == CUBEMAP)
         {
-            vert_vars += "out vec3 " + m_it->first + "_cubeCoords;\n";
-            vert_main += "  " + m_it->first + "_cubeCoords = vertex.xyz;\n";
+            vert_vars += "out vec3 " + texname + "_cubeCoords;\n";
+            vert_main += "  " + texname + "_cubeCoords = vertex.xyz;\n";
         }
 
         ///1.6 send 3D coordinates for environment cube map
@@ -301,7 +415,7 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
         "}\n"
         "\n";
 
-    string vertex_shader = "#version " + version + " compatibility\n";
+    vertex_shader = "#version " + version + " compatibility\n";
     vertex_shader += vert_vars + vert_func + vert_main;
 
 
@@ -311,15 +425,20 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
 
     ///3.1 fragment shader variables
     string frag_vars = "//GLSL fragment shader generated by gluxEngine\n\n";
-    frag_vars +=    "//Material: \"" + m_name + "\"\n\n"
-        "const int LIGHTS = " + num2str(light_count) + ";\n\n"      //scene light count
+    frag_vars +=    LightDefines(light_count) +
         "//texture coordinate\n"
         "in vec2 fragTexCoord;\n"
         "//fragment depth in world space\n"
         "in float v_depth;\n";
 
-    //fragment shader output
-    if(m_useMRT)
+    //material transparency
+    if(m_transparency > 0.0)
+        frag_vars += "uniform float material_transparency;\n";
+
+    //fragment shader output (G-buffer in targets 2 and 3)
+    if(gbuffer)
+        frag_vars += "out vec4 out_FragData[4];\n\n";
+    else if(m_useMRT)
         frag_vars += "out vec4 out_FragData[2];\n\n";
     else
         frag_vars += "out vec4 out_FragColor;\n\n";
@@ -335,16 +454,16 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
     frag_main += "  vec2 texCoord = fragTexCoord;\n";
 
     //for parallax/depth map, we modify texture coordinate
-    for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
+    for(m_it = m_textures.begin(); m_it != m_textures.end() && !reduced; ++m_it)
     {    
         if(m_it->second->GetType() == PARALLAX)
         {
-            string offset;
-            offset = num2str(m_it->second->GetIntensity());  //parallax offset value
+            //parallax offset is texture intensity (uniform, so program can be shared)
+            string texname = UniformName(m_it->first);
             frag_main +=
                 "  //simple parallax mapping, modify texture coordinates\n"
-                "  float height = texture(" + m_name + "ParallaxA,  texCoord).r;\n"
-                "  float offset = " + offset + " * (2.0 * height - 1.0);\n"
+                "  float height = texture(" + texname + ",  texCoord).r;\n"
+                "  float offset = " + texname + "_intensity * (2.0 * height - 1.0);\n"
                 "  texCoord = texCoord + eyeVec.xy * offset;\n\n";
             break;
         }
@@ -354,36 +473,61 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
     {
         if(!m_it->second->Empty() && m_it->second->GetType() != SHADOW && m_it->second->GetType() != SHADOW_OMNI && m_it->second->GetType() != DISPLACE )
         {
-            frag_main += "\n  vec4 " + m_it->first + "_texture;\n";
+            string texname = UniformName(m_it->first);
+            frag_main += "\n  vec4 " + texname + "_texture;\n";
 
             //cube map, we add different sampler + 3D coordinates
             if(m_it->second->GetType() == CUBEMAP) 
-                frag_vars += "uniform samplerCube "+ m_it->first + ";\nin vec3 " + m_it->first + "_cubeCoords;\n\n";
+                frag_vars += "uniform samplerCube "+ texname + ";\nin vec3 " + texname + "_cubeCoords;\n\n";
             //environment cube map, we need cube sampler and normal + view vector
             else if(m_it->second->GetType() == CUBEMAP_ENV) 
             {
-                frag_vars += "uniform samplerCube "+ m_it->first + ";\n"
-                    "uniform float " + m_it->first + "_intensity;\n"
+                frag_vars += "uniform samplerCube "+ texname + ";\n"
+                    "uniform float " + texname + "_intensity;\n"
                     "in vec3 r_normal, r_eyeVec;\n\n";
+                //prefiltered map: level matching material roughness, irradiance for per-pixel lighting
+                if(m_it->second->IsPrefiltered())
+                {
+                    frag_vars += "uniform float " + texname + "_lod;\n";
+                    if(Texture::IsIrradianceUsed() && light_model == PHONG)
+                        frag_vars += "uniform vec3 " + texname + "_sh[9];\n";
+                }
             }
             //regular 2D texture sampler
             else 
             {
                 //texture intensity
-                frag_vars += "uniform float " + m_it->first + "_intensity;\n";
+                frag_vars += "uniform float " + texname + "_intensity;\n";
                 //texture tiles (if set)
                 if(m_it->second->HasTiles())
                 {
-                    frag_vars += "uniform float " + m_it->first + "_tileX," + m_it->first + "_tileY;\n";
+                    frag_vars += "uniform float " + texname + "_tileX," + texname + "_tileY;\n";
                     frag_main +=
-                        "  //" + m_it->first + ", texture tiles\n"
-                        "  vec2 " + m_it->first + "_texcoord = texCoord * vec2(" + m_it->first + "_tileX, " + m_it->first + "_tileY) ;\n";
+                        "  //" + texname + ", texture tiles\n"
+                        "  vec2 " + texname + "_texcoord = texCoord * vec2(" + texname + "_tileX, " + texname + "_tileY) ;\n";
                 }
                 //no tiles
                 else
-                    frag_main += "  vec2 " + m_it->first + "_texcoord = texCoord;\n";
-
-                frag_vars += "uniform sampler2D "+ m_it->first + ";\n";
+                    frag_main += "  vec2 " + texname + "_texcoord = texCoord;\n";
+
+                //texture packed into texture array
+                if(m_it->second->GetLayer() >= 0)
+                    frag_vars += "uniform sampler2DArray "+ texname + ";\n"
+                        "uniform float " + texname + "_layer;\n";
+                //virtual texture: tile cache and page table (insert lookup function only once)
+                else if(m_it->second->GetType() == VIRTUAL)
+                {
+                    frag_vars += "uniform sampler2D "+ texname + ", " + texname + "_pages;\n";
+                    if(frag_func.find("VirtualTexture") == string::npos)
+                    {
+                        frag_vars +=
+                            "#define VT_TILE_SIZE " + num2str(VT_TILE_SIZE) + ".0\n"
+                            "#define VT_TILE_BORDER " + num2str(VT_TILE_BORDER) + ".0\n";
+                        frag_func += LoadFunc((char*)"virtual");
+                    }
+                }
+                else
+                    frag_vars += "uniform sampler2D "+ texname + ";\n";
             }
         }
     }
@@ -391,7 +535,7 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
 
     //**********************************
     ///3.3.1 if light model is set to PHONG, calculate lighting by using varying variables sent from vertex shader (normal, eye vector...)
-    if(m_lightModel == PHONG)    //PHONG, per-pixel
+    if(light_model == PHONG)    //PHONG, per-pixel
     {  
         frag_vars +=  "in vec3 normal, eyeVec;\n";
         frag_func += LoadFunc((char*)"light");
@@ -411,10 +555,19 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
             frag_main +="  vec4 color = LightModel(normal,eyeVec);\n";
     }
     ///3.3.2 if GOURAUD model is set, only get color value from vertex shader
-    else if(m_lightModel == GOURAUD) 
+    else if(light_model == GOURAUD) 
     {
         frag_vars += "in vec4 v_color;\n"
             "in vec3 normal;\n";
+        //material settings for G-buffer (declared as in light model of vertex shader)
+        if(gbuffer)
+            frag_vars += "\n//material settings\n"
+                "struct Material{\n"
+                "  vec3 ambient;\n"
+                "  vec3 diffuse;\n"
+                "  vec3 specular;\n"
+                "  float shininess;\n};\n"
+                "uniform Material material;\n";
         frag_main += "  vec4 color = v_color;\n";
     }
     ///3.3.3 else constant shading - only material diffuse is in computation
@@ -427,6 +580,13 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
             "uniform Material material;\n";
         frag_main += "  vec4 color = vec4(material.diffuse,0.0);\n";
     }
+    //albedo of G-buffer (material diffuse color modulated by color textures)
+    if(gbuffer)
+    {
+        frag_func += LoadFunc((char*)"gbuffer");
+        if(lit)
+            frag_main += "  vec3 albedo = material.diffuse;\n";
+    }
 
 
     //***************************************************
@@ -436,31 +596,38 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
     {
         if(!m_it->second->Empty())
         {
+            string texname = UniformName(m_it->first);
             //skip displacement map
             if(m_it->second->GetType() == DISPLACE)
                 continue;
             ///3.4.1 shadow maps - set shadow samplers and call function to project and create soft shadows
             else if(m_it->second->GetType() == SHADOW)
             {
-                frag_vars += "in vec4 " + m_it->first + "_projShadow;\n";
+                frag_vars += "in vec4 " + texname + "_projShadow;\n";
                 frag_vars +=
-                    "uniform float " + m_it->first + "_intensity;\n"
-                    "uniform sampler2DShadow " + m_it->first + ";\n";
+                    "uniform float " + texname + "_intensity;\n"
+                    "uniform sampler2DShadow " + texname + ";\n"
+                    "uniform vec4 " + texname + "_region;\n";
 
-                //insert shadow function (only once)
+                //insert shadow function (only once), reduced variant samples shadow map once
                 if(m_it->first.find("ShadowA") != string::npos)
+                {
+                    if(reduced)
+                        frag_vars += "#define SHADOW_SINGLE_TAP\n";
                     frag_func += LoadFunc((char*)"shadow");
+                }
 
                 frag_main += "\n  //Shadow map projection\n"
-                    "  color *= PCFShadow(" + m_it->first + "," + m_it->first + "_projShadow, " + m_it->first + "_intensity);\n";
+                    "  color *= PCFShadow(" + texname + "," + texname + "_projShadow, " + texname + "_region, " + texname + "_intensity);\n";
             }
             else if(m_it->second->GetType() == SHADOW_OMNI)
             {
                 frag_vars +=
-                    "uniform float " + m_it->first + "_intensity;\n"
-                    "uniform sampler2DArray " + m_it->first + ";\n";
+                    "uniform float " + texname + "_intensity;\n"
+                    "uniform sampler2DShadow " + texname + ";\n"
+                    "uniform vec4 " + texname + "_region[2];\n";
 
-                if(use_pcf)
+                if(use_pcf && !reduced)
                     frag_vars += "#define USE_PCF\n";
 
                 //insert shadow function (only once)
@@ -469,7 +636,7 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
 						frag_func += LoadFunc((char*)"shadow_omni");
 
                 frag_main += "\n  //Shadow map projection\n"
-                    "  color *= ShadowOMNI(" + m_it->first + ", " + m_it->first + "_intensity);\n";
+                    "  color *= ShadowOMNI(" + texname + ", " + texname + "_region[0], " + texname + "_region[1], " + texname + "_intensity);\n";
             }
 
             //other texture types
@@ -477,7 +644,7 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
             {
                 //should we use alpha testing?
                 if(m_it->second->GetType() == ALPHA)
-                    alpha_test = "  //alpha test\n  if( all(lessThan(" + m_it->first + "_texture.rgb, vec3(0.25)))) discard;\n";
+                    alpha_test = "  //alpha test\n  if( all(lessThan(" + texname + "_texture.rgb, vec3(0.25)))) discard;\n";
 
                 ///3.4.2 environment maps - add normal and eye vector variables(if per-pixel)
                 if(m_it->second->GetType() == ENV)
@@ -486,7 +653,7 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
                     if(m_it->first.find("EnvB") == string::npos)
                     {
 
-                        if(m_lightModel != PHONG)
+                        if(light_model != PHONG)
                             frag_vars += "in vec3 eyeVec;\n";
                         //add environment map computation
                         frag_func += LoadFunc((char*)"env");
@@ -502,9 +669,22 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
                         frag_main += "  vec3 reflVec = reflect(normalize(r_eyeVec), normalize(r_normal)); //reflection vector for cubemap\n";
                 }
 
+                //diffuse irradiance of environment (function is inserted only once)
+                if(m_it->second->GetType() == CUBEMAP_ENV && m_it->second->IsPrefiltered() && 
+                   Texture::IsIrradianceUsed() && light_model == PHONG)
+                {
+                    if(frag_func.find("IrradianceSH") == string::npos)
+                        frag_func += LoadFunc((char*)"irradiance");
+                    frag_main += "  color.rgb += material.ambient * IrradianceSH(" + texname + "_sh, normalize(r_normal));\n";
+                }
+
                 //compute fragment color from texel(not for bump/parallax map)
                 if(m_it->second->GetType() != BUMP && m_it->second->GetType() != PARALLAX)
-                    frag_main += computeTexel(m_it->second,m_it->first);
+                {
+                    frag_main += computeTexel(m_it->second,texname);
+                    if(gbuffer && lit)
+                        frag_main += albedoTexel(m_it->second,texname);
+                }
 
             }
         }
@@ -522,10 +702,8 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
         //is material transparent?
         if(m_transparency > 0.0)
         {
-            string trans;
-            trans = num2str(m_transparency);
             frag_main += 
-                "  out_FragData[0] = vec4(vec3(color.rgb),  " + trans + ");\n"
+                "  out_FragData[0] = vec4(vec3(color.rgb), material_transparency);\n"
                 "  out_FragData[1].rgb = normal;    //normal;\n";
             frag_main +=
                     "  out_FragData[1].a = v_depth;    //depth\n";
@@ -538,6 +716,15 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
                 "  out_FragData[0].rgb = color.rgb; //color;\n"
                 "  out_FragData[1].rgb = normal;    //normal;\n";
             frag_main += "  out_FragData[1].a = v_depth;    //depth\n";
+            //G-buffer: albedo and specular intensity, octahedral normal, shininess and depth
+            if(gbuffer && lit)
+                frag_main +=
+                    "  out_FragData[2] = vec4(albedo, dot(material.specular, vec3(0.30, 0.59, 0.11)));\n"
+                    "  out_FragData[3] = vec4(OctEncode(normalize(normal)), material.shininess, v_depth);\n";
+            else if(gbuffer)
+                frag_main +=
+                    "  out_FragData[2] = vec4(0.0);\n"
+                    "  out_FragData[3] = vec4(OctEncode(normalize(normal)), 1.0, v_depth);\n";
         }
     }
     else
@@ -545,9 +732,7 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
         //is material transparent?
         if(m_transparency > 0.0)
         {
-            string trans;
-            trans = num2str(m_transparency);
-            frag_main += "  out_FragColor = vec4(vec3(color.rgb),  " + trans + ");\n";
+            frag_main += "  out_FragColor = vec4(vec3(color.rgb), material_transparency);\n";
         }
         else
         {
@@ -559,85 +744,486 @@ bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
     frag_main +=
         "}\n"
         "\n";
-    string frag_shader = "#version " + version + " compatibility\n";
+    frag_shader = "#version " + version + " compatibility\n";
     frag_shader += frag_vars + frag_func + frag_main;
+}
 
-    //////////////////////////////////////////////////////////////////////////////
+/**
+****************************************************************************************************
+@brief Does driver support KHR_parallel_shader_compile or ARB_parallel_shader_compile? Then
+compilation runs on driver threads and completion can be queried without blocking.
+***************************************************************************************************/
+bool IsParallelCompileSupported()
+{
+    static int supported = -1;
+    if(supported < 0)
+        supported = glewIsSupported("GL_KHR_parallel_shader_compile") || glewIsSupported("GL_ARB_parallel_shader_compile");
+    return supported > 0;
+}
 
+/**
+****************************************************************************************************
+@brief Check shader logs and link status, store binary and bind uniform blocks of linked program
+@param p program (linking is finished by first query)
+@param name material name (for error messages)
+@return link status (also stored in program)
+***************************************************************************************************/
+static bool FinishProgram(TShaderProgram *p, const string &name)
+{
+    HRTimer timer;
+    char log[BUFFER]; int len;
+    if(p->v_shader != 0)
+    {
+        //shader creation status
+        glGetShaderInfoLog(p->v_shader, BUFFER, &len, log);
+        if(strstr(log, "succes") == NULL && len > 0) 
+            cout<<endl<<name<<":"<<log;    //print error if any
+        glGetShaderInfoLog(p->f_shader, BUFFER, &len, log);
+        if(strstr(log, "succes") == NULL && len > 0) 
+            cout<<endl<<name<<":"<<log;    //print error if any
+    }
 
-    //save shaders to debug file
-    string file; file = "shader_out/" + m_name + ".vert";
-    ofstream fout1(file.c_str());
-    fout1<<vertex_shader;
-    file = "shader_out/" + m_name + ".frag";
-    ofstream fout2(file.c_str());
-    fout2<<frag_shader;
+    GLint status = GL_FALSE;
+    glGetProgramiv(p->program, GL_LINK_STATUS, &status);
+    p->linked = (status == GL_TRUE);
+    if(!p->linked)
+    {
+        glGetProgramInfoLog(p->program, BUFFER, &len, log);
+        cerr<<"ERROR (FinishProgram): program of "<<name<<" isn't linked\n"<<log<<endl;
+        SceneManager::Instance()->ProgramLinked(p, (float)timer.GetElapsedTimeMilliseconds());
+        return false;
+    }
+    if(p->v_shader != 0)
+        SaveProgramBinary(p->program, p->key);
+
+    //setup uniform buffers (binding isn't part of program binary)
+    GLint uniformIndex = glGetUniformBlockIndex(p->program, "Matrices");
+    if(uniformIndex >= 0)
+        glUniformBlockBinding(p->program, uniformIndex, UNIFORM_MATRICES);
+    uniformIndex = glGetUniformBlockIndex(p->program, "Lights");
+    if(uniformIndex >= 0)
+        glUniformBlockBinding(p->program, uniformIndex, UNIFORM_LIGHTS);
+    //buffer textures of clustered lights are bound to fixed units
+    GLint clusterLoc = glGetUniformLocation(p->program, "cluster_grid");
+    if(clusterLoc >= 0)
+    {
+        glUseProgram(p->program);
+        glUniform1i(clusterLoc, CLUSTER_UNIT);
+        glUniform1i(glGetUniformLocation(p->program, "cluster_items"), CLUSTER_UNIT + 1);
+        glUniform1i(glGetUniformLocation(p->program, "cluster_lights"), CLUSTER_UNIT + 2);
+        glUseProgram(0);
+    }
+
+    float ms = (float)timer.GetElapsedTimeMilliseconds();
+    if(p->v_shader != 0)
+        ProgramCompiled(p->compile_ms + ms);
+    SceneManager::Instance()->ProgramLinked(p, ms);
+    cout<<"  program of "<<name<<(p->v_shader != 0 ? " compiled" : " loaded from cache")<<" in "<<p->compile_ms<<" ms\n";
+    return true;
+}
 
-    ///4 Create, compile and link shaders
-    m_v_shader = glCreateShader(GL_VERTEX_SHADER);
-    m_f_shader = glCreateShader(GL_FRAGMENT_SHADER);
+/**
+****************************************************************************************************
+@brief Find or create program for source. Cached binary is used when available, otherwise shaders
+are compiled and linked without waiting for result. Program isn't ready until FinishProgram().
+@param key complete source (vertex and fragment shader)
+@param vertex_shader vertex shader source
+@param frag_shader fragment shader source
+@return program with added reference
+***************************************************************************************************/
+static TShaderProgram* SubmitProgram(const string &key, const string &vertex_shader, const string &frag_shader)
+{
+    TShaderProgram *p = SceneManager::Instance()->AcquireProgram(key);
+    if(p != NULL)
+        return p;
+
+    HRTimer timer;
+    ///1 Load program binary from disk cache
+    GLuint program = LoadProgramBinary(key);
+    if(program != 0)
+    {
+        p = SceneManager::Instance()->AddProgram(key, program, 0, 0, (float)timer.GetElapsedTimeMilliseconds());
+        return p;
+    }
+
+    ///2 Create, compile and link shaders - status isn't queried, so driver can compile in background
+    GLuint v_shader = glCreateShader(GL_VERTEX_SHADER);
+    GLuint f_shader = glCreateShader(GL_FRAGMENT_SHADER);
 
     //copy shader data
     const char *ff = frag_shader.c_str();
     const char *vv = vertex_shader.c_str();
 
     //set shader source
-    glShaderSource(m_v_shader, 1, &vv,NULL);
-    glShaderSource(m_f_shader, 1, &ff,NULL);
-
-    //compile and detect shader errors
-    char log[BUFFER]; int len;
-    glCompileShader(m_v_shader);
-    glCompileShader(m_f_shader);
+    glShaderSource(v_shader, 1, &vv,NULL);
+    glShaderSource(f_shader, 1, &ff,NULL);
+    glCompileShader(v_shader);
+    glCompileShader(f_shader);
 
     //create and link shader program
-    m_shader = glCreateProgram();
-    glAttachShader(m_shader,m_f_shader);
-    glAttachShader(m_shader,m_v_shader);
+    program = glCreateProgram();
+    glAttachShader(program,f_shader);
+    glAttachShader(program,v_shader);
+    if(IsProgramCacheEnabled())
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+
+    p = SceneManager::Instance()->AddProgram(key, program, v_shader, f_shader, (float)timer.GetElapsedTimeMilliseconds());
+    return p;
+}
 
-    glLinkProgram(m_shader);
-    glUseProgram(m_shader);
+/**
+****************************************************************************************************
+@brief Create generic program for materials whose programs are being compiled: per-pixel lighting
+with material colors, modulated by base texture
+@param light_count size of light arrays (light capacity of scene, actual count is in uniform buffer)
+@param mrt write also normal and depth buffer
+@return program with added reference (release by SceneManager::ReleaseProgram())
+***************************************************************************************************/
+TShaderProgram* AcquireUberShader(int light_count, bool mrt)
+{
+    string version = "330";
+    if(GLEW_ARB_gpu_shader5)
+        version = "400";
 
-    //shader creation status
-    glGetShaderInfoLog(m_v_shader, BUFFER, &len, log);
-    if(strstr(log, "succes") == NULL && len > 0) 
-        cout<<endl<<m_name<<":"<<log;    //print error if any
-    glGetShaderInfoLog(m_f_shader, BUFFER, &len, log);
-    if(strstr(log, "succes") == NULL && len > 0) 
-        cout<<endl<<m_name<<":"<<log;    //print error if any
+    string vertex_shader = "#version " + version + " compatibility\n"
+        "//GLSL uber vertex shader generated by gluxEngine\n\n"
+        "layout(location = 0) in vec3 in_Vertex;\n"
+        "layout(location = 1) in vec3 in_Normal;\n"
+        "layout(location = 2) in vec2 in_Coord;\n\n"
+        "uniform mat4 in_ModelViewMatrix;\n"
+        "layout(std140) uniform Matrices{\n"
+        "  mat4 in_ProjectionMatrix;\n"
+        "};\n"
+        "out vec2 fragTexCoord;\n"
+        "out float v_depth;\n"
+        "out vec3 normal, eyeVec;\n\n"
+        "void main()\n"
+        "{\n"
+        "  vec4 viewPos = in_ModelViewMatrix * vec4(in_Vertex,1.0);\n"
+        "  normal = mat3(in_ModelViewMatrix) * in_Normal;\n"
+        "  eyeVec = -viewPos.xyz;\n"
+        "  fragTexCoord = in_Coord;\n"
+        "  v_depth = -viewPos.z;\n"
+        "  gl_Position = in_ProjectionMatrix * viewPos;\n"
+        "}\n";
+
+    string frag_shader = "#version " + version + " compatibility\n"
+        "//GLSL uber fragment shader generated by gluxEngine\n\n"
+        "const int LIGHTS = " + num2str(light_count) + ";\n\n"
+        "in vec2 fragTexCoord;\n"
+        "in float v_depth;\n"
+        "in vec3 normal, eyeVec;\n"
+        "uniform sampler2D tex_BaseA;\n"
+        "uniform int uber_textured;\n"
+        "uniform float material_transparency;\n";
+    //G-buffer of deferred lighting is written with MRT
+    bool gbuffer = mrt && TMaterial::IsGBufferUsed();
+    frag_shader += gbuffer ? "out vec4 out_FragData[4];\n" : (mrt ? "out vec4 out_FragData[2];\n" : "out vec4 out_FragColor;\n");
+    frag_shader += LoadFunc((char*)"light");
+    if(gbuffer)
+        frag_shader += LoadFunc((char*)"gbuffer");
+    frag_shader +=
+        "\nvoid main()\n"
+        "{\n"
+        "  vec4 color = LightModel(normal,eyeVec);\n"
+        "  if(uber_textured != 0)\n"
+        "    color *= texture(tex_BaseA, fragTexCoord);\n";
+    if(mrt)
+        frag_shader +=
+            "  out_FragData[0] = vec4(color.rgb, material_transparency);\n"
+            "  out_FragData[1] = vec4(normal, v_depth);\n";
+    if(gbuffer)
+        frag_shader +=
+            "  vec3 albedo = material.diffuse;\n"
+            "  if(uber_textured != 0)\n"
+            "    albedo *= texture(tex_BaseA, fragTexCoord).rgb;\n"
+            "  out_FragData[2] = vec4(albedo, dot(material.specular, vec3(0.30, 0.59, 0.11)));\n"
+            "  out_FragData[3] = vec4(OctEncode(normalize(normal)), material.shininess, v_depth);\n";
+    if(!mrt)
+        frag_shader += "  out_FragColor = vec4(color.rgb, material_transparency);\n";
+    frag_shader += "}\n";
+
+    TShaderProgram *p = SubmitProgram(vertex_shader + frag_shader, vertex_shader, frag_shader);
+    if(!p->ready)
+        FinishProgram(p, "uber-shader");
+    return p;
+}
 
+/**
+****************************************************************************************************
+@brief Start compilation of generated shader (TMaterial::GenerateShader()). Materials with the same
+features share one program: generated source doesn't contain material name nor parameter values,
+so equal source means equal program. Material renders with fallback program until its own program
+is linked (see TMaterial::FinishShader()).
+@param fallback uber-shader (AcquireUberShader()), NULL - program is finished by FinishShader() only
+***************************************************************************************************/
+void TMaterial::SubmitShader(TShaderProgram *fallback)
+{
+    if(m_custom_shader || m_vertex_source.empty())
+        return;
 
-    //*************************************
-    ///4 Get uniform variables for textures (using Texture::GetUniforms() )
-    int i=0;
-    for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
+    cout<<"Baking material "<<m_name<<endl;
+    string key = m_vertex_source + m_fragment_source;
+    if(m_program != NULL)
+        SceneManager::Instance()->ReleaseProgram(m_program);
+    m_program = SubmitProgram(key, m_vertex_source, m_fragment_source);
+    m_shader = m_program->program;
+    m_v_shader = m_program->v_shader;
+    m_f_shader = m_program->f_shader;
+    m_vertex_source.clear();
+    m_fragment_source.clear();
+    //reduced shading variant keeps its source until first object requests it (RequestShadingLOD())
+    if(m_lod_program != NULL)
+        SceneManager::Instance()->ReleaseProgram(m_lod_program);
+    m_lod_program = NULL;
+    m_lod_ready = false;
+    m_variant = SHADING_FULL;
+    m_baked = false;
+    m_link_failed = false;
+    m_fallback = NULL;
+
+    ///until program is linked, render with uber-shader (textures are found by their names in it)
+    if(!m_program->ready && fallback != NULL)
     {
-        if(!m_it->second->Empty())
+        m_fallback = fallback;
+        m_shader = fallback->program;
+        m_uber_textured = false;
+        for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
         {
-            m_it->second->GetUniforms(m_shader);
-            m_it->second->ActivateTexture(i,true);
-            i++;
+            if(!m_it->second->Empty())
+            {
+                m_it->second->GetUniforms(m_shader, UniformName(m_it->first));
+                if(UniformName(m_it->first) == "tex_BaseA" && m_it->second->GetLayer() < 0 && m_it->second->GetType() != VIRTUAL)
+                    m_uber_textured = true;
+            }
         }
+        m_ambLoc[SHADING_FULL] = glGetUniformLocation(m_shader, "material.ambient");
+        m_diffLoc[SHADING_FULL] = glGetUniformLocation(m_shader, "material.diffuse");
+        m_specLoc[SHADING_FULL] = glGetUniformLocation(m_shader, "material.specular");
+        m_shinLoc[SHADING_FULL] = glGetUniformLocation(m_shader, "material.shininess");
+        m_transLoc[SHADING_FULL] = glGetUniformLocation(m_shader, "material_transparency");
+        m_objLightsLoc[SHADING_FULL] = glGetUniformLocation(m_shader, "in_ObjectLights");
+        m_objLightCountLoc[SHADING_FULL] = glGetUniformLocation(m_shader, "in_ObjectLightCount");
+        m_objAmbientLoc[SHADING_FULL] = glGetUniformLocation(m_shader, "in_ObjectAmbient");
+        m_uberLoc = glGetUniformLocation(m_shader, "uber_textured");
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Is program linked? Without KHR_parallel_shader_compile completion can't be queried
+@param p program
+***************************************************************************************************/
+static bool IsProgramCompleted(TShaderProgram *p)
+{
+    if(p == NULL || p->ready)
+        return true;
+    GLint completed = GL_FALSE;
+    if(IsParallelCompileSupported())
+        glGetProgramiv(p->program, GL_COMPLETION_STATUS_KHR, &completed);
+    return completed == GL_TRUE;
+}
+
+/**
+****************************************************************************************************
+@brief Get uniform variables for textures (using Texture::GetUniforms() ) and material
+parameters of shading variant
+@param variant shading variant
+@param program linked program of variant
+***************************************************************************************************/
+void TMaterial::GetVariantUniforms(int variant, GLuint program)
+{
+    for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
+        if(!m_it->second->Empty())
+            m_it->second->GetUniforms(program, UniformName(m_it->first), variant);
+    m_ambLoc[variant] = glGetUniformLocation(program, "material.ambient");
+    m_diffLoc[variant] = glGetUniformLocation(program, "material.diffuse");
+    m_specLoc[variant] = glGetUniformLocation(program, "material.specular");
+    m_shinLoc[variant] = glGetUniformLocation(program, "material.shininess");
+    m_transLoc[variant] = glGetUniformLocation(program, "material_transparency");
+    m_objLightsLoc[variant] = glGetUniformLocation(program, "in_ObjectLights");
+    m_objLightCountLoc[variant] = glGetUniformLocation(program, "in_ObjectLightCount");
+    m_objAmbientLoc[variant] = glGetUniformLocation(program, "in_ObjectAmbient");
+}
+
+/**
+****************************************************************************************************
+@brief Finish material when its program is linked: get uniform locations and set material
+parameters. Without wait, program is checked by GL_COMPLETION_STATUS_KHR (parallel shader
+compile), otherwise first query blocks until driver finishes linking.
+Material whose program failed to link keeps rendering with fallback program.
+@param wait block until program is linked
+@return true if material has its own program
+***************************************************************************************************/
+bool TMaterial::FinishShader(bool wait)
+{
+    if(m_program == NULL || m_baked)
+        return true;
+
+    ///1 link status of shared programs is checked only once
+    if(!wait && !IsProgramCompleted(m_program))
+        return false;
+    if(!m_program->ready)
+        FinishProgram(m_program, m_name);
+    if(!m_program->linked)
+    {
+        if(!m_link_failed)
+            cerr<<"ERROR (FinishShader): program of material "<<m_name<<" isn't linked"
+                <<(m_fallback != NULL ? ", material is rendered with uber-shader\n" : "\n");
+        m_link_failed = true;
+        return false;
     }
+    m_shader = m_program->program;
+    m_fallback = NULL;
+    glUseProgram(m_shader);
+
+    //*************************************
+    ///2 Get uniform variables of full shading variant (reduced variant is finished on demand)
+    GetVariantUniforms(SHADING_FULL, m_shader);
+    //glossiness of environment reflection follows material shininess
+    for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
+        if(!m_it->second->Empty() && m_it->second->GetType() == CUBEMAP_ENV)
+            m_it->second->SetRoughness(ShininessToRoughness(m_shininess));
 
     ///set materials parameters
-    SetUniform("material.ambient",m_ambColor);
-    SetUniform("material.diffuse",m_diffColor);
-    SetUniform("material.specular",m_specColor);
-    SetUniform("material.shininess",m_shininess);
+    SetMaterialUniforms();
 
     m_baked = true;
-
-    //setup uniform buffers
-    GLint uniformIndex = glGetUniformBlockIndex(m_shader, "Matrices");
-    if(uniformIndex >= 0)
-        glUniformBlockBinding(m_shader, uniformIndex, UNIFORM_MATRICES);
-    uniformIndex = glGetUniformBlockIndex(m_shader, "Lights");
-    if(uniformIndex >= 0)
-        glUniformBlockBinding(m_shader, uniformIndex, UNIFORM_LIGHTS);
     glUseProgram(0);
 
     //print_uniform_block_info(shader, uniformIndex);
 
     return true;
 }
+
+/**
+****************************************************************************************************
+@brief Return features of shading variant separated by '+': light model, texture types (reduced
+variant skips parallax and bump mapping), transparency and multiple render targets
+@param variant shading variant
+***************************************************************************************************/
+string TMaterial::ShaderFeatures(int variant)
+{
+    const char *models[] = { "gouraud", "phong", "none", "screen_space" };
+    const char *types[] = { "base", "env", "bump", "parallax", "displace", "cubemap", "cubemap_env", "alpha",
+                            "shadow", "shadow_omni", "render_texture", "render_texture_ms", "virtual" };
+    bool reduced = (variant == SHADING_REDUCED);
+    string features = models[(reduced && m_lightModel == PHONG) ? GOURAUD : m_lightModel];
+
+    vector<string> used;
+    for(m_it = m_textures.begin(); m_it != m_textures.end(); ++m_it)
+    {
+        int type = m_it->second->GetType();
+        if(reduced && (type == BUMP || type == PARALLAX))
+            continue;
+        if(type >= 0 && type < (int)(sizeof(types)/sizeof(types[0])) && find(used.begin(), used.end(), types[type]) == used.end())
+            used.push_back(types[type]);
+    }
+    for(unsigned i=0; i<used.size(); i++)
+        features += "+" + used[i];
+    if(m_transparency > 0.0f)
+        features += "+transparent";
+    if(m_useMRT)
+        features += m_useGBuffer ? "+gbuffer" : "+mrt";
+    if(m_useClusteredLights && m_lightModel != NONE && m_lightModel != SCREEN_SPACE)
+        features += "+clustered";
+    return features;
+}
+
+/**
+****************************************************************************************************
+@brief Estimate cost of generated shaders of material (TMaterial::GenerateSource() for every
+shading variant, see AnalyzeShaderSource()). Statistics of compiled programs are added when
+material is baked and driver exposes them.
+@param light_count size of light arrays (light capacity of scene)
+@param lights lights in scene (iterations of light loop)
+@param dpshadow_method method of omnidirectional shadows
+@param use_pcf use percentage closer filtering of omnidirectional shadows
+@param costs output costs (appended)
+@return false for custom shader (nothing to analyze)
+***************************************************************************************************/
+bool TMaterial::AnalyzeShader(int light_count, unsigned lights, int dpshadow_method, bool use_pcf, vector<TShaderCost> &costs)
+{
+    if(m_custom_shader)
+        return false;
+
+    string vertex[SHADING_VARIANTS], fragment[SHADING_VARIANTS];
+    for(int v = 0; v < SHADING_VARIANTS; v++)
+    {
+        GenerateSource(v, light_count, dpshadow_method, use_pcf, vertex[v], fragment[v]);
+        //reduced variant equal to full shader isn't generated
+        if(v == SHADING_REDUCED && (!m_useShadingLOD || (vertex[v] == vertex[SHADING_FULL] && fragment[v] == fragment[SHADING_FULL])))
+            continue;
+
+        TShaderCost cost;
+        cost.material = m_name;
+        cost.variant = v;
+        cost.features = ShaderFeatures(v);
+        AnalyzeShaderSource(vertex[v], fragment[v], lights, cost);
+        TShaderProgram *p = (v == SHADING_REDUCED) ? m_lod_program : m_program;
+        if(m_baked && p != NULL)
+            GetProgramStats(p->program, cost.instructions, cost.registers);
+        costs.push_back(cost);
+    }
+    return true;
+}
+
+/**
+****************************************************************************************************
+@brief Prepare reduced shading variant for distant object. Program is submitted on first request
+(materials without distant objects don't pay its compilation), until it is linked objects are drawn
+with full shader. Variant whose program failed to link is dropped.
+@return true if reduced variant can be rendered
+***************************************************************************************************/
+bool TMaterial::RequestShadingLOD()
+{
+    if(m_lod_ready)
+        return true;
+    if(!HasShadingLOD())
+        return false;
+
+    ///1 submit program of reduced variant, driver compiles it in background
+    if(m_lod_program == NULL)
+    {
+        m_lod_program = SubmitProgram(m_lod_vertex_source + m_lod_fragment_source, m_lod_vertex_source, m_lod_fragment_source);
+        m_lod_vertex_source.clear();
+        m_lod_fragment_source.clear();
+        return false;
+    }
+    //without parallel shader compile, program is finished by next request (blocks until linked)
+    if(IsParallelCompileSupported() && !IsProgramCompleted(m_lod_program))
+        return false;
+
+    ///2 check link status, uniform locations of reduced variant
+    if(!m_lod_program->ready)
+        FinishProgram(m_lod_program, m_name + " (reduced)");
+    if(!m_lod_program->linked)
+    {
+        SceneManager::Instance()->ReleaseProgram(m_lod_program);
+        m_lod_program = NULL;
+        return false;
+    }
+    GetVariantUniforms(SHADING_REDUCED, m_lod_program->program);
+    m_lod_ready = true;
+    //finishing program could unbind program of material
+    glUseProgram(VariantShader());
+    return true;
+}
+
+/**
+****************************************************************************************************
+@brief Dynamically generates shader from all material data, compiles it and waits for linking
+@param light_count size of light arrays (light capacity of scene, actual count is in uniform buffer)
+@param dpshadow_method method of omnidirectional shadows
+@param use_pcf use percentage closer filtering of omnidirectional shadows
+@return success/fail of shader generation
+***************************************************************************************************/
+bool TMaterial::BakeMaterial(int light_count, int dpshadow_method, bool use_pcf)
+{
+    //dont't bake linked custom shader
+    if(!GenerateShader(light_count, dpshadow_method, use_pcf))
+        return true;
+    SubmitShader();
+    return FinishShader(true);
+}
@@ -0,0 +1,565 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: mesh_lod.cpp
+@brief mesh simplification (quadric error metrics) and generation of LOD chains
+Simplification uses half-edge collapses (vertex is collapsed into one of its neighbours), so all
+detail levels can share one vertex buffer and differ in element indices only.
+****************************************************************************************************
+***************************************************************************************************/
+#include "mesh_lod.h"
+#include <queue>
+
+///vertex classes - locked vertices (mesh borders, seam corners) are never collapsed, seam vertices
+///(more vertices with same position but different normal/texcoord) can be collapsed only along the seam
+enum VertexKinds{ V_MANIFOLD, V_SEAM, V_LOCKED };
+
+
+/**
+@brief Symmetric 4x4 quadric matrix (Garland-Heckbert), upper triangle only
+***************************************************************************************************/
+struct TQuadric
+{
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+    ///accumulated weight (area of planes)
+    double w;
+
+    void Zero(){
+        a2 = ab = ac = ad = b2 = bc = bd = c2 = cd = d2 = w = 0.0;
+    }
+    void AddPlane(double a, double b, double c, double d, double weight){
+        a2 += weight*a*a; ab += weight*a*b; ac += weight*a*c; ad += weight*a*d;
+        b2 += weight*b*b; bc += weight*b*c; bd += weight*b*d;
+        c2 += weight*c*c; cd += weight*c*d;
+        d2 += weight*d*d;
+        w += weight;
+    }
+    void Add(const TQuadric &q){
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+        w += q.w;
+    }
+    ///squared distance of point from all planes (weighted)
+    double Eval(const glm::vec3 &p) const{
+        double x = p.x, y = p.y, z = p.z;
+        return a2*x*x + 2.0*ab*x*y + 2.0*ac*x*z + 2.0*ad*x
+                      +     b2*y*y + 2.0*bc*y*z + 2.0*bd*y
+                                   +     c2*z*z + 2.0*cd*z
+                                                +     d2;
+    }
+};
+
+/**
+@brief Candidate edge collapse, stamps are used to detect outdated candidates in queue
+***************************************************************************************************/
+struct TCollapse
+{
+    double cost;
+    unsigned from, to;
+    unsigned stamp_from, stamp_to;
+
+    //inverted comparison - priority_queue returns the cheapest collapse first
+    bool operator<(const TCollapse &c) const{
+        return cost > c.cost;
+    }
+};
+
+///@brief lexicographical comparison of vertex positions
+struct TPositionLess
+{
+    const GLfloat *v;
+    bool operator()(unsigned a, unsigned b) const{
+        const GLfloat *pa = v + 3*a, *pb = v + 3*b;
+        if(pa[0] != pb[0]) return pa[0] < pb[0];
+        if(pa[1] != pb[1]) return pa[1] < pb[1];
+        return pa[2] < pb[2];
+    }
+};
+
+
+/**
+@class TMeshSimplifier
+@brief Working data for one simplification run. Triangles are processed on positions (vertices with
+the same position are merged), attributes are resolved after all collapses.
+***************************************************************************************************/
+class TMeshSimplifier
+{
+public:
+    TMeshSimplifier(const TIndexedMesh &mesh, const vector<GLuint> &src);
+    GLfloat Run(unsigned target_tris, vector<GLuint> &dst);
+
+private:
+    const TIndexedMesh &m_mesh;
+    const vector<GLuint> &m_src;
+
+    //vertices sorted by position, position groups and position ID of every vertex
+    vector<unsigned> m_order, m_group, m_pid;
+    vector<glm::vec3> m_pos;
+    vector<int> m_kind;
+    vector<TQuadric> m_quadric;
+    //neighbours of seam vertices along the seam (edges split in both triangles)
+    vector< vector<unsigned> > m_seam;
+    vector<unsigned> m_stamp;
+    vector<bool> m_collapsed;
+
+    //triangle corners (position IDs) and triangles around every position
+    vector<unsigned> m_corner;
+    vector<bool> m_removed;
+    vector< vector<unsigned> > m_vtris;
+    unsigned m_live;
+
+    //collapse candidates
+    priority_queue<TCollapse> m_heap;
+    vector<unsigned> m_mark;
+    unsigned m_mark_id;
+
+    void PushCollapse(unsigned from, unsigned to);
+    bool Flips(unsigned from, unsigned to);
+    bool IsSeamEdge(unsigned a, unsigned b);
+    void Collapse(unsigned from, unsigned to);
+    GLuint ResolveVertex(unsigned v, unsigned p);
+};
+
+
+/**
+****************************************************************************************************
+@brief Prepare position groups, quadrics, adjacency and vertex classes
+@param mesh mesh with vertex attributes
+@param src triangle indices to simplify
+****************************************************************************************************/
+TMeshSimplifier::TMeshSimplifier(const TIndexedMesh &mesh, const vector<GLuint> &src)
+    : m_mesh(mesh), m_src(src), m_live(0), m_mark_id(0)
+{
+    unsigned vcount = mesh.vertices.size()/3;
+
+    //group vertices with identical positions (normal/texcoord seams)
+    TPositionLess less;
+    less.v = &mesh.vertices[0];
+    m_order.resize(vcount);
+    for(unsigned i=0; i<vcount; i++)
+        m_order[i] = i;
+    sort(m_order.begin(), m_order.end(), less);
+
+    m_pid.resize(vcount);
+    for(unsigned i=0; i<vcount; i++)
+    {
+        if(i == 0 || less(m_order[i-1], m_order[i]))
+        {
+            m_group.push_back(i);
+            const GLfloat *p = &mesh.vertices[3*m_order[i]];
+            m_pos.push_back(glm::vec3(p[0], p[1], p[2]));
+        }
+        m_pid[m_order[i]] = m_group.size() - 1;
+    }
+    unsigned pcount = m_pos.size();
+    m_group.push_back(vcount);
+
+    //triangle corners, degenerated triangles are dropped
+    unsigned tcount = src.size()/3;
+    m_corner.resize(src.size());
+    m_removed.assign(tcount, false);
+    m_vtris.resize(pcount);
+    for(unsigned t=0; t<tcount; t++)
+    {
+        for(int k=0; k<3; k++)
+            m_corner[3*t + k] = m_pid[src[3*t + k]];
+
+        if(m_corner[3*t] == m_corner[3*t+1] || m_corner[3*t] == m_corner[3*t+2] || m_corner[3*t+1] == m_corner[3*t+2])
+        {
+            m_removed[t] = true;
+            continue;
+        }
+        for(int k=0; k<3; k++)
+            m_vtris[m_corner[3*t + k]].push_back(t);
+        m_live++;
+    }
+
+    //plane quadrics (weighted by triangle area)
+    m_quadric.resize(pcount);
+    for(unsigned p=0; p<pcount; p++)
+        m_quadric[p].Zero();
+    for(unsigned t=0; t<tcount; t++)
+    {
+        if(m_removed[t])
+            continue;
+        glm::vec3 p0 = m_pos[m_corner[3*t]], p1 = m_pos[m_corner[3*t+1]], p2 = m_pos[m_corner[3*t+2]];
+        glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+        float len = glm::length(n);
+        if(len <= 0.0f)
+            continue;
+        n /= len;
+        double d = -glm::dot(n, p0);
+        for(int k=0; k<3; k++)
+            m_quadric[m_corner[3*t + k]].AddPlane(n.x, n.y, n.z, d, 0.5*len);
+    }
+
+    //classify vertices: seams by position groups, borders by edges used only once
+    m_kind.resize(pcount);
+    for(unsigned p=0; p<pcount; p++)
+        m_kind[p] = (m_group[p+1] - m_group[p] > 1) ? V_SEAM : V_MANIFOLD;
+
+    //edges on positions with their vertices (in the same order)
+    vector< pair< pair<unsigned,unsigned>, pair<GLuint,GLuint> > > edges;
+    edges.reserve(3*m_live);
+    for(unsigned t=0; t<tcount; t++)
+    {
+        if(m_removed[t])
+            continue;
+        for(int k=0; k<3; k++)
+        {
+            unsigned a = m_corner[3*t + k], b = m_corner[3*t + (k+1)%3];
+            GLuint va = src[3*t + k], vb = src[3*t + (k+1)%3];
+            if(a > b)
+            {
+                swap(a, b);
+                swap(va, vb);
+            }
+            edges.push_back(make_pair(make_pair(a, b), make_pair(va, vb)));
+        }
+    }
+    sort(edges.begin(), edges.end());
+
+    m_stamp.assign(pcount, 0);
+    m_collapsed.assign(pcount, false);
+    m_mark.assign(pcount, 0);
+
+    m_seam.resize(pcount);
+
+    for(unsigned i=0; i<edges.size(); )
+    {
+        unsigned j = i;
+        while(j < edges.size() && edges[j].first == edges[i].first)
+            j++;
+        unsigned a = edges[i].first.first, b = edges[i].first.second;
+        //border or non-manifold edge
+        if(j - i != 2)
+        {
+            m_kind[a] = V_LOCKED;
+            m_kind[b] = V_LOCKED;
+        }
+        //seam edge - both triangles use different vertices at both ends
+        else if(edges[i].second.first != edges[i+1].second.first && edges[i].second.second != edges[i+1].second.second)
+        {
+            m_seam[a].push_back(b);
+            m_seam[b].push_back(a);
+        }
+        i = j;
+    }
+
+    //seam vertex can slide along the seam only if it lies inside one seam (seam corners and ends are locked)
+    for(unsigned p=0; p<pcount; p++)
+        if(m_kind[p] == V_SEAM && m_seam[p].size() != 2)
+            m_kind[p] = V_LOCKED;
+
+    //initial collapse candidates (both directions of every edge)
+    for(unsigned i=0; i<edges.size(); i++)
+    {
+        if(i > 0 && edges[i].first == edges[i-1].first)
+            continue;
+        PushCollapse(edges[i].first.first, edges[i].first.second);
+        PushCollapse(edges[i].first.second, edges[i].first.first);
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Is edge between positions a and b part of normal/texcoord seam?
+****************************************************************************************************/
+bool TMeshSimplifier::IsSeamEdge(unsigned a, unsigned b)
+{
+    return find(m_seam[a].begin(), m_seam[a].end(), b) != m_seam[a].end();
+}
+
+/**
+****************************************************************************************************
+@brief Evaluate and enqueue collapse of vertex 'from' into vertex 'to'. Collapse involving seam vertex
+is allowed only along the seam (both vertices on the same seam edge), otherwise the seam would tear.
+****************************************************************************************************/
+void TMeshSimplifier::PushCollapse(unsigned from, unsigned to)
+{
+    if(m_kind[from] == V_LOCKED)
+        return;
+    if((m_kind[from] == V_SEAM || m_kind[to] == V_SEAM) &&
+        (m_kind[from] != V_SEAM || m_kind[to] == V_MANIFOLD || !IsSeamEdge(from, to)))
+        return;
+
+    TQuadric q = m_quadric[from];
+    q.Add(m_quadric[to]);
+
+    TCollapse c;
+    c.cost = q.w > 0.0 ? max(q.Eval(m_pos[to]), 0.0) / q.w : 0.0;
+    c.from = from;
+    c.to = to;
+    c.stamp_from = m_stamp[from];
+    c.stamp_to = m_stamp[to];
+    m_heap.push(c);
+}
+
+/**
+****************************************************************************************************
+@brief Check if collapse would flip (or degenerate) any of remaining triangles around 'from'
+****************************************************************************************************/
+bool TMeshSimplifier::Flips(unsigned from, unsigned to)
+{
+    const vector<unsigned> &tris = m_vtris[from];
+    for(unsigned i=0; i<tris.size(); i++)
+    {
+        unsigned t = tris[i];
+        if(m_removed[t])
+            continue;
+        const unsigned *c = &m_corner[3*t];
+        if(c[0] == to || c[1] == to || c[2] == to)
+            continue;       //triangle will be removed
+
+        glm::vec3 p[3], q[3];
+        for(int k=0; k<3; k++)
+        {
+            p[k] = m_pos[c[k]];
+            q[k] = (c[k] == from) ? m_pos[to] : p[k];
+        }
+        glm::vec3 n0 = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 n1 = glm::cross(q[1] - q[0], q[2] - q[0]);
+        float l0 = glm::length(n0), l1 = glm::length(n1);
+        if(l1 <= 0.0f || glm::dot(n0, n1) < 0.2f*l0*l1)
+            return true;
+    }
+    return false;
+}
+
+/**
+****************************************************************************************************
+@brief Collapse vertex 'from' into vertex 'to' and update candidates around 'to'
+****************************************************************************************************/
+void TMeshSimplifier::Collapse(unsigned from, unsigned to)
+{
+    vector<unsigned> &tris = m_vtris[from];
+    for(unsigned i=0; i<tris.size(); i++)
+    {
+        unsigned t = tris[i];
+        if(m_removed[t])
+            continue;
+        unsigned *c = &m_corner[3*t];
+        if(c[0] == to || c[1] == to || c[2] == to)
+        {
+            m_removed[t] = true;
+            m_live--;
+            continue;
+        }
+        for(int k=0; k<3; k++)
+            if(c[k] == from)
+                c[k] = to;
+        m_vtris[to].push_back(t);
+    }
+    vector<unsigned>().swap(tris);
+
+    m_collapsed[from] = true;
+    m_quadric[to].Add(m_quadric[from]);
+    m_stamp[to]++;
+
+    //seam continues from 'to' to the other seam neighbour of 'from'
+    for(unsigned i=0; i<m_seam[from].size(); i++)
+    {
+        unsigned n = m_seam[from][i];
+        vector<unsigned> &ns = m_seam[n];
+        ns.erase(remove(ns.begin(), ns.end(), from), ns.end());
+        if(n != to && !IsSeamEdge(n, to))
+        {
+            ns.push_back(to);
+            m_seam[to].push_back(n);
+        }
+    }
+    vector<unsigned>().swap(m_seam[from]);
+
+    //compact triangle list of 'to' and re-evaluate all its edges
+    vector<unsigned> &ttris = m_vtris[to];
+    unsigned n = 0;
+    m_mark_id++;
+    for(unsigned i=0; i<ttris.size(); i++)
+    {
+        unsigned t = ttris[i];
+        if(m_removed[t])
+            continue;
+        ttris[n++] = t;
+        for(int k=0; k<3; k++)
+        {
+            unsigned p = m_corner[3*t + k];
+            if(p == to || m_mark[p] == m_mark_id)
+                continue;
+            m_mark[p] = m_mark_id;
+            PushCollapse(p, to);
+            PushCollapse(to, p);
+        }
+    }
+    ttris.resize(n);
+}
+
+/**
+****************************************************************************************************
+@brief Find vertex with position p which matches attributes of (collapsed) vertex v best
+****************************************************************************************************/
+GLuint TMeshSimplifier::ResolveVertex(unsigned v, unsigned p)
+{
+    unsigned first = m_group[p], last = m_group[p+1];
+    if(last - first == 1)
+        return m_order[first];
+
+    GLuint best = m_order[first];
+    float best_score = -1e30f;
+    for(unsigned i=first; i<last; i++)
+    {
+        unsigned w = m_order[i];
+        float score = 0.0f;
+        if(!m_mesh.normals.empty())
+            score += m_mesh.normals[3*v]*m_mesh.normals[3*w] + m_mesh.normals[3*v+1]*m_mesh.normals[3*w+1]
+                   + m_mesh.normals[3*v+2]*m_mesh.normals[3*w+2];
+        if(!m_mesh.texcoords.empty())
+            score -= fabs(m_mesh.texcoords[2*v] - m_mesh.texcoords[2*w]) + fabs(m_mesh.texcoords[2*v+1] - m_mesh.texcoords[2*w+1]);
+        if(score > best_score)
+        {
+            best_score = score;
+            best = w;
+        }
+    }
+    return best;
+}
+
+/**
+****************************************************************************************************
+@brief Collapse edges (cheapest first) until target triangle count is reached
+@param target_tris desired triangle count
+@param dst output triangle indices
+@return RMS distance of the worst collapse
+****************************************************************************************************/
+GLfloat TMeshSimplifier::Run(unsigned target_tris, vector<GLuint> &dst)
+{
+    double max_error = 0.0;
+    while(m_live > target_tris && !m_heap.empty())
+    {
+        TCollapse c = m_heap.top();
+        m_heap.pop();
+
+        //outdated candidate?
+        if(m_collapsed[c.from] || m_collapsed[c.to] || m_stamp[c.from] != c.stamp_from || m_stamp[c.to] != c.stamp_to)
+            continue;
+        if(Flips(c.from, c.to))
+            continue;
+
+        Collapse(c.from, c.to);
+        max_error = max(max_error, c.cost);
+    }
+
+    //write remaining triangles, collapsed vertices are replaced by vertex with best matching attributes
+    dst.clear();
+    dst.reserve(3*m_live);
+    for(unsigned t=0; t<m_removed.size(); t++)
+    {
+        if(m_removed[t])
+            continue;
+        GLuint v[3];
+        for(int k=0; k<3; k++)
+        {
+            GLuint src_v = m_src[3*t + k];
+            unsigned p = m_corner[3*t + k];
+            v[k] = (m_pid[src_v] == p) ? src_v : ResolveVertex(src_v, p);
+        }
+        if(v[0] == v[1] || v[0] == v[2] || v[1] == v[2])
+            continue;
+        dst.push_back(v[0]); dst.push_back(v[1]); dst.push_back(v[2]);
+    }
+
+    return (GLfloat)sqrt(max_error);
+}
+
+
+/**
+****************************************************************************************************
+@brief Simplify mesh using quadric error metrics
+@param mesh mesh with vertex attributes
+@param src triangle indices to simplify (can be already simplified level)
+@param target_tris desired triangle count
+@param dst output triangle indices (vertices of mesh are reused)
+@return geometric error of simplified mesh (in object space)
+****************************************************************************************************/
+GLfloat SimplifyMesh(const TIndexedMesh &mesh, const vector<GLuint> &src, unsigned target_tris, vector<GLuint> &dst)
+{
+    if(mesh.vertices.empty() || src.empty())
+    {
+        dst = src;
+        return 0.0f;
+    }
+    TMeshSimplifier simplifier(mesh, src);
+    return simplifier.Run(target_tris, dst);
+}
+
+/**
+****************************************************************************************************
+@brief Build chain of detail levels. Every level has about half of the triangles of previous level.
+Indices of all levels are appended to mesh indices, so they can be stored in one element buffer
+@param mesh mesh to simplify (indices contain full detail level)
+@param lods output detail levels
+@return count of detail levels (1 = no simplification)
+****************************************************************************************************/
+int BuildLodChain(TIndexedMesh &mesh, TLodLevel lods[MAX_LODS])
+{
+    lods[0].offset = 0;
+    lods[0].count = mesh.indices.size();
+    lods[0].error = 0.0f;
+
+    int count = 1;
+    if(mesh.indices.size()/3 < LOD_MIN_TRIANGLES)
+        return count;
+
+    vector<GLuint> current(mesh.indices), next;
+    while(count < MAX_LODS)
+    {
+        unsigned target = unsigned(current.size()/3 * LOD_REDUCTION);
+        GLfloat error = SimplifyMesh(mesh, current, target, next);
+
+        //stop when mesh cannot be reduced significantly
+        if(next.empty() || next.size() > 0.85f*current.size())
+            break;
+
+        lods[count].offset = mesh.indices.size();
+        lods[count].count = next.size();
+        lods[count].error = lods[count-1].error + error;
+        mesh.indices.insert(mesh.indices.end(), next.begin(), next.end());
+        current.swap(next);
+        count++;
+    }
+    return count;
+}
+
+/**
+****************************************************************************************************
+@brief Compute bounding sphere of vertices (center of bounding box and farthest vertex)
+@param vertices vertex positions (3 floats per vertex)
+@param count vertex count
+@param center output sphere center
+@param radius output sphere radius
+****************************************************************************************************/
+void ComputeBoundingSphere(const GLfloat *vertices, unsigned count, glm::vec3 &center, GLfloat &radius)
+{
+    center = glm::vec3(0.0);
+    radius = 0.0f;
+    if(count == 0)
+        return;
+
+    glm::vec3 vmin(vertices[0], vertices[1], vertices[2]), vmax = vmin;
+    for(unsigned i=1; i<count; i++)
+    {
+        glm::vec3 v(vertices[3*i], vertices[3*i+1], vertices[3*i+2]);
+        vmin = glm::min(vmin, v);
+        vmax = glm::max(vmax, v);
+    }
+    center = 0.5f*(vmin + vmax);
+
+    float r2 = 0.0f;
+    for(unsigned i=0; i<count; i++)
+    {
+        glm::vec3 d = glm::vec3(vertices[3*i], vertices[3*i+1], vertices[3*i+2]) - center;
+        r2 = max(r2, glm::dot(d, d));
+    }
+    radius = sqrt(r2);
+}
@@ -0,0 +1,43 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: mesh_lod.h
+@brief mesh simplification (quadric error metrics) and generation of LOD chains
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _MESH_LOD_H_
+#define _MESH_LOD_H_
+
+#include "globals.h"
+
+///maximum count of detail levels per mesh (including full detail level)
+#define MAX_LODS 4
+///meshes with less triangles are not simplified
+#define LOD_MIN_TRIANGLES 256
+///triangle ratio between two successive detail levels
+#define LOD_REDUCTION 0.5f
+
+///@brief Indexed triangle mesh (attributes are stored separately, 3/3/2 floats per vertex)
+struct TIndexedMesh{
+    vector<GLfloat> vertices, normals, texcoords;
+    vector<GLuint> indices;
+};
+
+///@brief One level of detail - range in element buffer and its geometric error
+struct TLodLevel{
+    ///first index in element buffer
+    GLuint offset;
+    ///number of indices
+    GLuint count;
+    ///maximal (RMS) distance of simplified surface from original surface in object space
+    GLfloat error;
+};
+
+//simplify mesh to target triangle count, returns reached error
+GLfloat SimplifyMesh(const TIndexedMesh &mesh, const vector<GLuint> &src, unsigned target_tris, vector<GLuint> &dst);
+//build LOD chain, all levels are appended to mesh indices
+int BuildLodChain(TIndexedMesh &mesh, TLodLevel lods[MAX_LODS]);
+//compute bounding sphere from vertex positions
+void ComputeBoundingSphere(const GLfloat *vertices, unsigned count, glm::vec3 &center, GLfloat &radius);
+
+#endif
@@ -0,0 +1,337 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: meshlet.cpp
+@brief decomposition of meshes into triangle clusters (meshlets) and per-cluster culling
+Clusters are grown greedily over triangles sharing vertices (seeds are taken in Morton order of
+triangle centroids), preferring triangles with similar normals to keep normal cones narrow.
+****************************************************************************************************
+***************************************************************************************************/
+#include "meshlet.h"
+
+///maximal size of cluster growing frontier
+#define MESHLET_MAX_FRONTIER 512
+
+///@brief spread 10 bits to every third bit (Morton code)
+static unsigned SpreadBits(unsigned x)
+{
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8))  & 0x0300f00f;
+    x = (x | (x << 4))  & 0x030c30c3;
+    x = (x | (x << 2))  & 0x09249249;
+    return x;
+}
+
+///@brief sort triangles by Morton code
+struct TMortonLess
+{
+    const vector<unsigned> *codes;
+    bool operator()(unsigned a, unsigned b) const{
+        return (*codes)[a] < (*codes)[b];
+    }
+};
+
+
+/**
+****************************************************************************************************
+@brief Split triangles into clusters of MESHLET_MIN_TRIANGLES - MESHLET_MAX_TRIANGLES triangles and
+compute cluster bounding spheres and normal cones. Triangles in given index range are reordered
+so every cluster occupies continuous range
+@param mesh indexed mesh
+@param first first index of range
+@param count index count of range
+@return cluster data or NULL when mesh is too small to be clustered
+****************************************************************************************************/
+TMeshletData* BuildMeshlets(TIndexedMesh &mesh, GLuint first, GLuint count)
+{
+    unsigned tcount = count/3;
+    if(tcount < MESHLET_MIN_CLUSTERS * MESHLET_MIN_TRIANGLES)
+        return NULL;
+
+    const GLuint *idx = &mesh.indices[first];
+    const GLfloat *pos = &mesh.vertices[0];
+    unsigned vcount = mesh.vertices.size()/3;
+
+    //triangle normals and centroids
+    vector<glm::vec3> normal(tcount), centroid(tcount);
+    glm::vec3 bmin(1e30f), bmax(-1e30f);
+    for(unsigned t=0; t<tcount; t++)
+    {
+        glm::vec3 p0(pos[3*idx[3*t]], pos[3*idx[3*t]+1], pos[3*idx[3*t]+2]);
+        glm::vec3 p1(pos[3*idx[3*t+1]], pos[3*idx[3*t+1]+1], pos[3*idx[3*t+1]+2]);
+        glm::vec3 p2(pos[3*idx[3*t+2]], pos[3*idx[3*t+2]+1], pos[3*idx[3*t+2]+2]);
+        glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+        float len = glm::length(n);
+        normal[t] = len > 0.0f ? n/len : glm::vec3(0.0);
+        centroid[t] = (p0 + p1 + p2)/3.0f;
+        bmin = glm::min(bmin, centroid[t]);
+        bmax = glm::max(bmax, centroid[t]);
+    }
+
+    //vertex -> triangles adjacency
+    vector<unsigned> vstart(vcount + 1, 0), vtris(3*tcount);
+    for(unsigned i=0; i<3*tcount; i++)
+        vstart[idx[i] + 1]++;
+    for(unsigned v=0; v<vcount; v++)
+        vstart[v+1] += vstart[v];
+    vector<unsigned> vfill(vstart.begin(), vstart.end() - 1);
+    for(unsigned i=0; i<3*tcount; i++)
+        vtris[vfill[idx[i]]++] = i/3;
+
+    //seed order - Morton code of centroids
+    vector<unsigned> codes(tcount), order(tcount);
+    glm::vec3 extent = glm::max(bmax - bmin, glm::vec3(1e-6f));
+    for(unsigned t=0; t<tcount; t++)
+    {
+        glm::vec3 q = (centroid[t] - bmin)/extent * 1023.0f;
+        codes[t] = (SpreadBits((unsigned)q.x) << 2) | (SpreadBits((unsigned)q.y) << 1) | SpreadBits((unsigned)q.z);
+        order[t] = t;
+    }
+    TMortonLess less;
+    less.codes = &codes;
+    sort(order.begin(), order.end(), less);
+
+    //grow clusters
+    vector<int> cluster_of(tcount, -1);
+    vector<unsigned> frontier_mark(tcount, 0xffffffff);
+    vector<unsigned> reordered;
+    reordered.reserve(3*tcount);
+    vector<GLuint> starts;
+    vector<unsigned> frontier, members;
+
+    for(unsigned s=0; s<tcount; s++)
+    {
+        unsigned seed = order[s];
+        if(cluster_of[seed] >= 0)
+            continue;
+
+        unsigned id = starts.size();
+        starts.push_back(reordered.size()/3);
+        frontier.clear();
+        frontier.push_back(seed);
+        frontier_mark[seed] = id;
+        glm::vec3 normal_sum(0.0);
+
+        while(!frontier.empty() && reordered.size()/3 - starts[id] < MESHLET_MAX_TRIANGLES)
+        {
+            //pick triangle which keeps cluster normals coherent
+            glm::vec3 axis = glm::length(normal_sum) > 0.0f ? glm::normalize(normal_sum) : normal[frontier[0]];
+            unsigned best = 0;
+            float best_score = -2.0f;
+            for(unsigned i=0; i<frontier.size(); i++)
+            {
+                float score = glm::dot(normal[frontier[i]], axis);
+                if(score > best_score)
+                {
+                    best_score = score;
+                    best = i;
+                }
+            }
+            if(reordered.size()/3 - starts[id] >= MESHLET_MIN_TRIANGLES && best_score < 0.5f)
+                break;
+
+            unsigned t = frontier[best];
+            frontier[best] = frontier.back();
+            frontier.pop_back();
+
+            cluster_of[t] = id;
+            normal_sum += normal[t];
+            for(int k=0; k<3; k++)
+            {
+                GLuint v = idx[3*t + k];
+                reordered.push_back(v);
+                //add neighbouring triangles to frontier
+                for(unsigned j=vstart[v]; j<vstart[v+1] && frontier.size() < MESHLET_MAX_FRONTIER; j++)
+                {
+                    unsigned n = vtris[j];
+                    if(cluster_of[n] < 0 && frontier_mark[n] != id)
+                    {
+                        frontier_mark[n] = id;
+                        frontier.push_back(n);
+                    }
+                }
+            }
+        }
+    }
+
+    unsigned clusters = starts.size();
+    if(clusters < MESHLET_MIN_CLUSTERS)
+        return NULL;
+
+    //write reordered triangles back
+    memcpy(&mesh.indices[first], &reordered[0], reordered.size()*sizeof(GLuint));
+    idx = &mesh.indices[first];
+
+    //cluster bounds (arrays padded to multiple of 4)
+    TMeshletData *data = new TMeshletData;
+    data->count = clusters;
+    unsigned padded = (clusters + 3) & ~3u;
+    data->offset.resize(clusters);
+    data->size.resize(clusters);
+    data->cx.assign(padded, 0.0f); data->cy.assign(padded, 0.0f); data->cz.assign(padded, 0.0f);
+    data->radius.assign(padded, 0.0f);
+    data->ax.assign(padded, 0.0f); data->ay.assign(padded, 0.0f); data->az.assign(padded, 0.0f);
+    data->cutoff.assign(padded, 1.0f);
+
+    for(unsigned c=0; c<clusters; c++)
+    {
+        unsigned tfirst = starts[c];
+        unsigned tlast = (c + 1 < clusters) ? starts[c+1] : tcount;
+        data->offset[c] = first + 3*tfirst;
+        data->size[c] = 3*(tlast - tfirst);
+
+        //bounding sphere
+        glm::vec3 cmin(1e30f), cmax(-1e30f);
+        for(unsigned i=3*tfirst; i<3*tlast; i++)
+        {
+            glm::vec3 p(pos[3*idx[i]], pos[3*idx[i]+1], pos[3*idx[i]+2]);
+            cmin = glm::min(cmin, p);
+            cmax = glm::max(cmax, p);
+        }
+        glm::vec3 center = 0.5f*(cmin + cmax);
+        float r2 = 0.0f;
+        for(unsigned i=3*tfirst; i<3*tlast; i++)
+        {
+            glm::vec3 d = glm::vec3(pos[3*idx[i]], pos[3*idx[i]+1], pos[3*idx[i]+2]) - center;
+            r2 = max(r2, glm::dot(d, d));
+        }
+        data->cx[c] = center.x;
+        data->cy[c] = center.y;
+        data->cz[c] = center.z;
+        data->radius[c] = sqrt(r2);
+
+        //normal cone (recompute normals, triangles were reordered)
+        vector<glm::vec3> tn;
+        glm::vec3 sum(0.0);
+        for(unsigned t=tfirst; t<tlast; t++)
+        {
+            glm::vec3 p0(pos[3*idx[3*t]], pos[3*idx[3*t]+1], pos[3*idx[3*t]+2]);
+            glm::vec3 p1(pos[3*idx[3*t+1]], pos[3*idx[3*t+1]+1], pos[3*idx[3*t+1]+2]);
+            glm::vec3 p2(pos[3*idx[3*t+2]], pos[3*idx[3*t+2]+1], pos[3*idx[3*t+2]+2]);
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float len = glm::length(n);
+            if(len > 0.0f)
+            {
+                tn.push_back(n/len);
+                sum += n/len;
+            }
+        }
+        if(tn.empty() || glm::length(sum) <= 0.0f)
+            continue;
+        glm::vec3 axis = glm::normalize(sum);
+        float mindp = 1.0f;
+        for(unsigned i=0; i<tn.size(); i++)
+            mindp = min(mindp, glm::dot(tn[i], axis));
+
+        data->ax[c] = axis.x;
+        data->ay[c] = axis.y;
+        data->az[c] = axis.z;
+        //cone is widened by 90 degrees: cluster is backfacing when view vector is inside inverted cone
+        data->cutoff[c] = mindp <= 0.1f ? 1.0f : sqrt(1.0f - mindp*mindp);
+    }
+
+    return data;
+}
+
+/**
+****************************************************************************************************
+@brief Cull clusters against frustum and normal cones. All values are in object space.
+Cluster is backfacing when dot(center - camera, axis) >= cutoff * |center - camera| + radius
+@param data cluster data
+@param begin first cluster (multiple of 4)
+@param end last cluster + 1
+@param planes normalized frustum planes (inside: dot(plane, point) >= 0)
+@param camera camera position
+@param visible output visibility flags (one per cluster)
+@return number of visible clusters in range
+****************************************************************************************************/
+unsigned CullMeshlets(const TMeshletData *data, unsigned begin, unsigned end, const glm::vec4 planes[6],
+                      const glm::vec3 &camera, unsigned char *visible)
+{
+    unsigned count = 0;
+    end = min(end, data->count);
+
+#ifdef USE_SSE
+    __m128 camx = _mm_set1_ps(camera.x), camy = _mm_set1_ps(camera.y), camz = _mm_set1_ps(camera.z);
+    __m128 zero = _mm_setzero_ps();
+    for(unsigned i=begin; i<end; i+=4)
+    {
+        __m128 cx = _mm_loadu_ps(&data->cx[i]);
+        __m128 cy = _mm_loadu_ps(&data->cy[i]);
+        __m128 cz = _mm_loadu_ps(&data->cz[i]);
+        __m128 r = _mm_loadu_ps(&data->radius[i]);
+        __m128 nr = _mm_sub_ps(zero, r);
+
+        //frustum planes
+        __m128 culled = zero;
+        for(int p=0; p<6; p++)
+        {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(planes[p].x)), _mm_mul_ps(cy, _mm_set1_ps(planes[p].y))),
+                                  _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(planes[p].z)), _mm_set1_ps(planes[p].w)));
+            culled = _mm_or_ps(culled, _mm_cmplt_ps(d, nr));
+        }
+
+        //normal cone
+        __m128 dx = _mm_sub_ps(cx, camx), dy = _mm_sub_ps(cy, camy), dz = _mm_sub_ps(cz, camz);
+        __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(&data->ax[i])), _mm_mul_ps(dy, _mm_loadu_ps(&data->ay[i]))),
+                                _mm_mul_ps(dz, _mm_loadu_ps(&data->az[i])));
+        __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        __m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&data->cutoff[i]), len), r);
+        culled = _mm_or_ps(culled, _mm_cmpge_ps(dot, limit));
+
+        int mask = _mm_movemask_ps(culled);
+        unsigned last = min(i + 4, end);
+        for(unsigned k=i; k<last; k++)
+        {
+            visible[k] = !((mask >> (k - i)) & 1);
+            count += visible[k];
+        }
+    }
+#else
+    for(unsigned i=begin; i<end; i++)
+    {
+        glm::vec3 c(data->cx[i], data->cy[i], data->cz[i]);
+        float r = data->radius[i];
+        bool culled = false;
+        for(int p=0; p<6 && !culled; p++)
+            culled = glm::dot(glm::vec3(planes[p]), c) + planes[p].w < -r;
+
+        glm::vec3 d = c - camera;
+        if(!culled)
+            culled = glm::dot(d, glm::vec3(data->ax[i], data->ay[i], data->az[i])) >= data->cutoff[i]*glm::length(d) + r;
+
+        visible[i] = !culled;
+        count += visible[i];
+    }
+#endif
+    return count;
+}
+
+/**
+****************************************************************************************************
+@brief Extract frustum planes from matrix (Gribb-Hartmann). When model matrix is included,
+planes are in object space
+@param mvp projection * view (* model) matrix
+@param planes output normalized planes (left, right, bottom, top, near, far)
+****************************************************************************************************/
+void ExtractFrustumPlanes(const glm::mat4 &mvp, glm::vec4 planes[6])
+{
+    glm::vec4 row[4];
+    for(int i=0; i<4; i++)
+        row[i] = glm::vec4(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+
+    planes[0] = row[3] + row[0];
+    planes[1] = row[3] - row[0];
+    planes[2] = row[3] + row[1];
+    planes[3] = row[3] - row[1];
+    planes[4] = row[3] + row[2];
+    planes[5] = row[3] - row[2];
+
+    for(int i=0; i<6; i++)
+    {
+        float len = glm::length(glm::vec3(planes[i]));
+        if(len > 0.0f)
+            planes[i] /= len;
+    }
+}
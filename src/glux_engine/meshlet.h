@@ -0,0 +1,46 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: meshlet.h
+@brief decomposition of meshes into triangle clusters (meshlets) and per-cluster culling
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _MESHLET_H_
+#define _MESHLET_H_
+
+#include "globals.h"
+#include "mesh_lod.h"
+
+///maximal count of triangles in cluster
+#define MESHLET_MAX_TRIANGLES 128
+///cluster can be finished after this count of triangles when next triangle would widen normal cone
+#define MESHLET_MIN_TRIANGLES 64
+///meshes with less clusters are drawn as a whole
+#define MESHLET_MIN_CLUSTERS 4
+
+
+/**
+@brief Clusters of one mesh. Bounds are stored as structure of arrays (padded to multiple of 4)
+to allow SIMD culling
+***************************************************************************************************/
+struct TMeshletData
+{
+    ///number of clusters
+    unsigned count;
+    ///element buffer ranges of clusters (first index, index count)
+    vector<GLuint> offset, size;
+    ///bounding spheres
+    vector<float> cx, cy, cz, radius;
+    ///normal cones - axis and cutoff (1.0 = cone culling disabled)
+    vector<float> ax, ay, az, cutoff;
+};
+
+//split triangle range of mesh into clusters (indices in range are reordered)
+TMeshletData* BuildMeshlets(TIndexedMesh &mesh, GLuint first, GLuint count);
+//cull clusters against object space frustum planes and camera position
+unsigned CullMeshlets(const TMeshletData *data, unsigned begin, unsigned end, const glm::vec4 planes[6],
+                      const glm::vec3 &camera, unsigned char *visible);
+//extract normalized frustum planes from (model)view-projection matrix
+void ExtractFrustumPlanes(const glm::mat4 &mvp, glm::vec4 planes[6]);
+
+#endif
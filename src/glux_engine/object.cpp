@@ -6,6 +6,7 @@
 ****************************************************************************************************
 ***************************************************************************************************/
 #include "object.h"
+#include "SceneManager.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 //////////////////////////// TObject methods ///////////////////////////////////
@@ -33,11 +34,22 @@ TObject::TObject()
     m_drawmode = GL_TRIANGLES;
     m_vbo.indices = 0;
     m_vbo.vao = 0;
+    m_vbo.lod_count = 0;
+    m_vbo.radius = 0.0f;
+    m_vbo.meshlets = NULL;
+    m_geometry = NULL;
     m_element_indices = false;
+    m_cluster_ready = false;
+    m_cluster_tris = 0;
+    m_shading = SHADING_FULL;
+    m_transform_dirty = true;
+    m_dynamic = false;
 
     //ID's
     m_sceneID = 0;
     m_matID = 0;
+    //whole virtual texture
+    m_virtual_rect = glm::vec4(0.0, 0.0, 1.0, 1.0);
 
 	OBB = NULL;
 }
@@ -50,12 +62,8 @@ TObject::TObject()
 ****************************************************************************************************/
 TObject::~TObject()
 {
-    ///delete VBO buffers (only if object is not used in future)
-    if(m_vbo.vao != 0)
-    {
-        glDeleteVertexArrays(1, &m_vbo.vao);
-        glDeleteBuffers(4, m_vbo.buffer);
-    }
+    ///release shared buffers (deleted when no other object uses them)
+    SceneManager::Instance()->ReleaseGeometry(m_geometry);
 
 	delete OBB;
 
@@ -83,6 +91,13 @@ void TObject::Create(const char* name, int primitive, GLfloat size, GLfloat heig
     m_draw_object = true;
     m_element_indices = true;
     m_instances = 1;
+    m_vbo.lod_count = 0;
+    m_vbo.meshlets = NULL;
+    m_cluster_ready = false;
+    m_cluster_tris = 0;
+    m_shading = SHADING_FULL;
+    m_transform_dirty = true;
+    m_dynamic = false;
 
     //object type
     m_type = PRIMITIVE;
@@ -193,9 +208,9 @@ void TObject::Create(const char* name, int primitive, GLfloat size, GLfloat heig
                 }
             }
 
+            verts = sliceX * sliceY;
 			OBB = new BoundingVolume(&vertices[0], verts);
 
-            verts = sliceX * sliceY;
             m_vbo.indices = faces.size();
             m_drawmode = GL_TRIANGLES;
         }
@@ -305,45 +320,87 @@ void TObject::Create(const char* name, int primitive, GLfloat size, GLfloat heig
             verts = m_vbo.indices;
             m_drawmode = GL_TRIANGLE_STRIP;
 
-			OBB = new BoundingVolume(&vertices[0], verts);
+			//strip repeats vertices of neighbouring rings
+			OBB = new BoundingVolume(&vertices[0], verts, 0, true);
         }
         break;  
     default:
         break;
     }
+    ComputeBoundingSphere(&vertices[0], vertices.size()/3, m_vbo.center, m_vbo.radius);
+
+    //the same primitive may have been created already
+    unsigned long long hash = SceneManager::HashGeometry(vertices, normals, texcoords, faces, m_drawmode);
+    TGeometry *g = SceneManager::Instance()->AcquireGeometry(hash, vertices, normals, texcoords, faces, m_drawmode);
+    if(g != NULL)
+    {
+        SetGeometry(g);
+        return;
+    }
+
     //create vertex buffer with data
+    size_t bytes = UploadBuffers(vertices, normals, texcoords, faces);
+    m_geometry = SceneManager::Instance()->AddGeometry("", hash, m_vbo, OBB, m_drawmode, m_element_indices, bytes);
+}
+
+/**
+****************************************************************************************************
+@brief Create vertex array and store vertices, normals, texture coordinates and indices into buffers
+@return size of buffers in bytes
+****************************************************************************************************/
+size_t TObject::UploadBuffers(const vector<GLfloat> &vertices, const vector<GLfloat> &normals,
+                              const vector<GLfloat> &texcoords, const vector<GLuint> &indices)
+{
     glGenVertexArrays(1, &m_vbo.vao);
     glBindVertexArray(m_vbo.vao);
 
-    //Allocate and assign three VBO to our handle
+    //Allocate and assign four VBO to our handle (vertices, normals, texture coordinates and indices)
     glGenBuffers(4, m_vbo.buffer);
 
-    //Bind our first VBO as being the active buffer and storing vertex attributes (coordinates) and copy buffer data
+    //store vertices into buffer
     glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_VERTEX]);
-    glBufferData(GL_ARRAY_BUFFER, 3 * verts * sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW);  
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.empty() ? NULL : &vertices[0], GL_STATIC_DRAW);
     // vertices are on index 0 and contains three floats per vertex
     glVertexAttribPointer(GLuint(0), 3, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(0);
 
     //store normals
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_NORMAL]);    
-    glBufferData(GL_ARRAY_BUFFER, 3 * verts * sizeof(GLfloat), &normals[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_NORMAL]);
+    glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(GLfloat), normals.empty() ? NULL : &normals[0], GL_STATIC_DRAW);
     // normals are on index 1 and contains three floats per vertex
     glVertexAttribPointer(GLuint(1), 3, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(1);
 
     //store texture coordinates
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_TEXCOORD]);    
-    glBufferData(GL_ARRAY_BUFFER, 2 * verts * sizeof(GLfloat), &texcoords[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo.buffer[P_TEXCOORD]);
+    glBufferData(GL_ARRAY_BUFFER, texcoords.size() * sizeof(GLfloat), texcoords.empty() ? NULL : &texcoords[0], GL_STATIC_DRAW);
     //coordinates are on index 2 and contains two floats per vertex
     glVertexAttribPointer(GLuint(2), 2, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(2);
 
     //store vertex array indices
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_vbo.buffer[P_INDEX]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_vbo.indices * sizeof(GLuint), &faces[0], GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.empty() ? NULL : &indices[0], GL_STATIC_DRAW);
 
     glBindVertexArray(0);
+
+    return (vertices.size() + normals.size() + texcoords.size()) * sizeof(GLfloat) + indices.size() * sizeof(GLuint);
+}
+
+/**
+****************************************************************************************************
+@brief Use shared geometry - buffers, mesh parameters and bounding volume (if object hasn't got own)
+@param geometry geometry with reference already acquired for this object
+****************************************************************************************************/
+void TObject::SetGeometry(TGeometry *geometry)
+{
+    SceneManager::Instance()->ReleaseGeometry(m_geometry);
+    m_geometry = geometry;
+    m_vbo = geometry->vbo;
+    m_drawmode = geometry->drawmode;
+    m_element_indices = geometry->element_indices;
+    if(OBB == NULL && geometry->obb != NULL)
+        OBB = new BoundingVolume(*geometry->obb);
 }
 
 /**
@@ -354,6 +411,12 @@ void TObject::CreateInstance(const TObject &ref)
 {
     *this = ref;
     m_type = INSTANCE;
+    //instance shares geometry
+    if(m_geometry)
+        m_geometry->refs++;
+    //instance owns its copy of bounding volume
+    if(ref.OBB)
+        OBB = new BoundingVolume(*ref.OBB);
 }
 
 
@@ -364,8 +427,10 @@ it's current position. Then attached material is rendered(TMaterial::RenderMater
 There are specific types of settings, when object is not rendered (e.g. when rendering into shadow map
 is active and object don't cast shadows)
 @param tessellate draw object with HW tessellation enabled?
+@param lod detail level (used only when object has LOD chain)
+@param clusters draw only visible clusters (when cluster culling was done for this frame)
 ****************************************************************************************************/
-void TObject::Draw(bool tessellate)
+void TObject::Draw(bool tessellate, int lod, bool clusters)
 {
     //don't draw object with draw_object flag set to false
     if(!m_draw_object)
@@ -388,14 +453,28 @@ void TObject::Draw(bool tessellate)
          patch = GL_PATCHES;
     }      
 
+    //draw visible clusters of full detail level
+    if(clusters && lod == 0 && m_cluster_ready)
+    {
+        if(!m_cluster_count.empty())
+            glMultiDrawElements(patch, &m_cluster_count[0], GL_UNSIGNED_INT, (const GLvoid**)&m_cluster_offset[0], m_cluster_count.size());
+    }
     //different drawing mode: simple vertex array or array with element indices
-    if(m_element_indices) 
+    else if(m_element_indices) 
     {
+        //select range of detail level in element buffer
+        GLuint count = m_vbo.indices;
+        GLvoid *offset = 0;
+        if(lod > 0 && (unsigned)lod < m_vbo.lod_count)
+        {
+            count = m_vbo.lod[lod].count;
+            offset = (GLvoid*)(m_vbo.lod[lod].offset * sizeof(GLuint));
+        }
         //it's possible to use geometry instancing (if there is more than 1 object instance)
         if(m_instances > 1)
-            glDrawElementsInstanced(patch, m_vbo.indices, GL_UNSIGNED_INT , 0, m_instances);
+            glDrawElementsInstanced(patch, count, GL_UNSIGNED_INT , offset, m_instances);
         else
-            glDrawElements(patch, m_vbo.indices, GL_UNSIGNED_INT , 0);
+            glDrawElements(patch, count, GL_UNSIGNED_INT , offset);
     }
     else 
     {
@@ -410,6 +489,84 @@ void TObject::Draw(bool tessellate)
 }
 
 
+/**
+****************************************************************************************************
+@brief Return number of triangles which are drawn in selected detail level (including instances)
+@param lod detail level
+@param clusters count only visible clusters (if cluster culling was done)
+****************************************************************************************************/
+unsigned TObject::GetTriangles(int lod, bool clusters)
+{
+    if(!m_draw_object)
+        return 0;
+    if(clusters && lod == 0 && m_cluster_ready)
+        return m_cluster_tris;
+
+    GLuint count = m_vbo.indices;
+    if(m_element_indices && lod > 0 && (unsigned)lod < m_vbo.lod_count)
+        count = m_vbo.lod[lod].count;
+    else if(!m_element_indices)
+        count *= 3;
+
+    unsigned tris;
+    if(m_drawmode == GL_TRIANGLE_STRIP)
+        tris = count > 2 ? count - 2 : 0;
+    else
+        tris = count/3;
+    return tris * m_instances;
+}
+
+
+/**
+****************************************************************************************************
+@brief Transform camera frustum and position into object space before cluster culling
+@param viewproj camera projection * view matrix
+@param camera camera position in world space
+****************************************************************************************************/
+void TObject::PrepareClusterCulling(const glm::mat4 &viewproj, const glm::vec3 &camera)
+{
+    ExtractFrustumPlanes(viewproj * m_transform, m_cluster_planes);
+    m_cluster_camera = glm::vec3(glm::inverse(m_transform) * glm::vec4(camera, 1.0));
+    m_cluster_visible.resize(m_vbo.meshlets->count);
+}
+
+/**
+****************************************************************************************************
+@brief Build multi-draw list from visible clusters. Neighbouring visible clusters are merged into
+one range.
+@return number of culled clusters
+****************************************************************************************************/
+unsigned TObject::BuildClusterList()
+{
+    const TMeshletData *data = m_vbo.meshlets;
+    m_cluster_count.clear();
+    m_cluster_offset.clear();
+    m_cluster_tris = 0;
+
+    unsigned culled = 0;
+    GLuint range_end = 0xffffffff;
+    for(unsigned i=0; i<data->count; i++)
+    {
+        if(!m_cluster_visible[i])
+        {
+            culled++;
+            continue;
+        }
+        m_cluster_tris += data->size[i]/3;
+        if(data->offset[i] == range_end)
+            m_cluster_count.back() += data->size[i];
+        else
+        {
+            m_cluster_count.push_back(data->size[i]);
+            m_cluster_offset.push_back((const GLvoid*)(data->offset[i] * sizeof(GLuint)));
+        }
+        range_end = data->offset[i] + data->size[i];
+    }
+    m_cluster_ready = true;
+    return culled;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 /////////////////////////// OBJECT TRANSFORMATIONS /////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -429,6 +586,7 @@ void TObject::Move(GLfloat wx, GLfloat wy, GLfloat wz)
 
     //update matrix
     m_transform = glm::translate(m_transform, glm::vec3(wx,wy,wz));
+    m_transform_dirty = true;
 }
 
 /**
@@ -451,6 +609,7 @@ void TObject::MoveAbs(GLfloat wx, GLfloat wy, GLfloat wz)
     m_transform = glm::rotate(m_transform, m_rot.y, glm::vec3(0.0,1.0,0.0) );
     m_transform = glm::rotate(m_transform, m_rot.z, glm::vec3(0.0,0.0,1.0) );
     m_transform = glm::scale(m_transform, m_scale);
+    m_transform_dirty = true;
 }
 
 /**
@@ -477,6 +636,7 @@ void TObject::Rotate(GLfloat angle, GLint axis)
         break;
     default: break;
     }
+    m_transform_dirty = true;
 }
 
 /**
@@ -508,6 +668,7 @@ void TObject::RotateAbs(GLfloat angle, GLint axis)
     m_transform = glm::rotate(m_transform, m_rot.y, glm::vec3(0.0,1.0,0.0) );
     m_transform = glm::rotate(m_transform, m_rot.z, glm::vec3(0.0,0.0,1.0) );
     m_transform = glm::scale(m_transform, m_scale);
+    m_transform_dirty = true;
 }
 
 /**
@@ -525,4 +686,5 @@ void TObject::Resize(GLfloat sx, GLfloat sy, GLfloat sz)
 
     //update matrix
     m_transform = glm::scale(m_transform, m_scale);
+    m_transform_dirty = true;
 }
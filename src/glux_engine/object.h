@@ -11,6 +11,8 @@ Uses lib3DS to load 3D objects/scenes: http://code.google.com/p/lib3ds/
 
 #include "globals.h"
 #include "BoundingVolume.h"
+#include "mesh_lod.h"
+#include "meshlet.h"
 
 ///Object types
 enum Obj_types{PRIMITIVE,EXTERN,INSTANCE};
@@ -32,6 +34,32 @@ struct VBO{
     GLuint vao;
     ///number of indice
     GLuint indices;
+    ///number of detail levels stored in element buffer (0/1 - no LOD chain)
+    GLuint lod_count;
+    ///element ranges of detail levels
+    TLodLevel lod[MAX_LODS];
+    ///object space bounding sphere
+    glm::vec3 center;
+    GLfloat radius;
+    ///triangle clusters of full detail level (NULL - mesh is not clustered)
+    TMeshletData *meshlets;
+};
+
+///@brief Geometry resource - buffers shared by all objects with the same mesh (owned by SceneManager)
+struct TGeometry{
+    ///buffers and mesh parameters
+    VBO vbo;
+    ///object space bounding volume
+    BoundingVolume *obb;
+    ///primitive type and usage of element indices
+    GLenum drawmode;
+    bool element_indices;
+    ///content hash, number of objects using geometry, size of buffers in bytes
+    unsigned long long hash;
+    unsigned refs;
+    size_t bytes;
+    ///source name (file)
+    string name;
 };
 
 
@@ -57,6 +85,7 @@ private:
     string m_name;					//object name
     unsigned m_matID;				//attached material ID
     VBO m_vbo;						//vertex buffer object
+    TGeometry *m_geometry;			//shared geometry which owns buffers
     GLenum m_drawmode;				//VBO drawing mode
     bool m_element_indices;			//do we  have element indices instead of vertex array?
 
@@ -66,21 +95,45 @@ private:
     //scene ID - when drawing more scenes than 1
     int m_sceneID;
 
+    //object's rectangle in virtual texture (offset, size)
+    glm::vec4 m_virtual_rect;
+
 	//Object's OBB
 	BoundingVolume* OBB;
 
+    //cluster culling results for current frame: visibility, object space frustum and camera
+    vector<unsigned char> m_cluster_visible;
+    vector<GLsizei> m_cluster_count;
+    vector<const GLvoid*> m_cluster_offset;
+    glm::vec4 m_cluster_planes[6];
+    glm::vec3 m_cluster_camera;
+    bool m_cluster_ready;
+    unsigned m_cluster_tris;
+
+    //shading variant selected in last frame (switching uses hysteresis)
+    int m_shading;
+
+    //transformation changed since last shadow update, object moved after its shadow was cached
+    bool m_transform_dirty, m_dynamic;
+
 public:
 
     //constructors
     TObject();
     TObject(const char *name, int primitive, GLfloat size, GLfloat height, GLint sliceX, GLint sliceY){
-        m_sceneID = 0; m_matID = 0;        
+        m_sceneID = 0; m_matID = 0; m_geometry = NULL; OBB = NULL;
         Create(name, primitive, size, height, sliceX, sliceY);
     }
 
     //free dynamic data
     ~TObject();
 
+private:
+    //create vertex array with buffers of vertices, normals, texture coordinates and indices
+    size_t UploadBuffers(const vector<GLfloat> &vertices, const vector<GLfloat> &normals,
+                         const vector<GLfloat> &texcoords, const vector<GLuint> &indices);
+public:
+
     //create object as primitive
     void Create(const char *name, int primitive, GLfloat size, GLfloat height, GLint sliceX, GLint sliceY);
     //create object from 3DS file
@@ -89,11 +142,14 @@ public:
     VBO Create(aiMesh *mesh);
     //create object as instance from existing object
     void CreateInstance(const TObject &ref);
-    ///@brief Set new VBO data
-    ///@param data already loaded VBO data
-    void SetVBOdata(VBO &data){ 
-        m_vbo = data; 
-    }    
+    //create vertex buffers from indexed mesh (with LOD chain)
+    void CreateBuffers(TIndexedMesh &mesh, const string &source = "");
+    //use shared geometry (reference must be already acquired)
+    void SetGeometry(TGeometry *geometry);
+    ///@brief Return shared geometry of object
+    TGeometry* GetGeometry(){
+        return m_geometry;
+    }
     ///@brief Attach material to object
     ///@param _matID material ID
     void SetMaterial(int _matID){ 
@@ -107,10 +163,49 @@ public:
     GLint GetVertexBuffer(){ 
         return m_vbo.buffer[0]; 
     }
+    ///@brief Return number of detail levels
+    int GetLodCount(){
+        return m_vbo.lod_count > 1 ? m_vbo.lod_count : 1;
+    }
+    //return number of triangles drawn in selected detail level
+    unsigned GetTriangles(int lod = 0, bool clusters = false);
+
+    ///@brief Return number of triangle clusters (0 - object is not clustered)
+    unsigned GetClusterCount(){
+        return (m_vbo.meshlets && m_instances == 1) ? m_vbo.meshlets->count : 0;
+    }
+    ///@brief Return shading variant selected in last frame
+    int GetShading(){
+        return m_shading;
+    }
+    ///@brief Set selected shading variant
+    void SetShading(int shading){
+        m_shading = shading;
+    }
+    ///@brief Invalidate cluster culling results
+    void ResetClusters(){
+        m_cluster_ready = false;
+    }
+    //prepare cluster culling for current camera
+    void PrepareClusterCulling(const glm::mat4 &viewproj, const glm::vec3 &camera);
+    ///@brief Cull range of clusters (can be called from worker threads)
+    void CullClusters(unsigned begin, unsigned end){
+        CullMeshlets(m_vbo.meshlets, begin, end, m_cluster_planes, m_cluster_camera, &m_cluster_visible[0]);
+    }
+    //build draw list from visible clusters, returns number of culled clusters
+    unsigned BuildClusterList();
+    ///@brief Return object space bounding sphere center
+    glm::vec3 GetBoundingCenter(){
+        return m_vbo.center;
+    }
+    ///@brief Return object space bounding sphere radius
+    GLfloat GetBoundingRadius(){
+        return m_vbo.radius;
+    }
 
 
     //draw object (with or without materials)
-    void Draw(bool tessellate = false);
+    void Draw(bool tessellate = false, int lod = 0, bool clusters = false);
     //draw screen aligned quad
     void DrawScreenQuad();
     ///@brief turn on/off object drawing
@@ -118,10 +213,9 @@ public:
         m_draw_object = flag; 
     }
 
-	void drawBV()
-	{
-		if(OBB)
-			OBB->drawBV();
+	///@brief Return object's oriented bounding box (NULL if object hasn't got any)
+	BoundingVolume* GetBoundingVolume(){
+		return OBB;
 	}
 
     //object transformation
@@ -138,6 +232,23 @@ public:
     //object resize
     void Resize(GLfloat sx, GLfloat sy, GLfloat sz);
 
+    ///@brief Has transformation changed since last ClearTransformDirty()?
+    bool IsTransformDirty(){
+        return m_transform_dirty;
+    }
+    ///@brief Reset transformation change flag (shadow regions were updated)
+    void ClearTransformDirty(){
+        m_transform_dirty = false;
+    }
+    ///@brief Set object as dynamic shadow caster (it is not cached with static casters)
+    void SetDynamic(bool flag = true){
+        m_dynamic = flag;
+    }
+    ///@brief Is object dynamic shadow caster?
+    bool IsDynamic(){
+        return m_dynamic;
+    }
+
     ///@brief Enable/disable shadow casting by object
     void CastShadow(bool flag = true){ 
         m_shadow_cast = flag; 
@@ -164,6 +275,18 @@ public:
         return m_transform; 
     }
 
+    ///Get object type (PRIMITIVE, EXTERN, INSTANCE)
+    int GetType(){
+        return m_type;
+    }
+    ///@brief Set object's rectangle in virtual texture (offset and size in 0..1)
+    void SetVirtualRect(glm::vec4 rect){
+        m_virtual_rect = rect;
+    }
+    ///@brief Return object's rectangle in virtual texture
+    glm::vec4 GetVirtualRect(){
+        return m_virtual_rect;
+    }
     ///Get scene ID
     int GetSceneID(){  
         return m_sceneID; 
@@ -0,0 +1,212 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: program_cache.cpp
+@brief disk cache of linked shader programs (ARB_get_program_binary). Binaries are keyed by hash of
+complete shader source and driver identity, binaries rejected by driver are recompiled.
+****************************************************************************************************
+***************************************************************************************************/
+#include "program_cache.h"
+#include "texture_compress.h"
+#include "hires_timer.h"
+
+#ifdef _WIN_
+    #include <direct.h>
+#else
+    #include <sys/stat.h>
+#endif
+
+///@brief Header of program binary file (followed by binary)
+struct TProgramHeader{
+    char magic[4];
+    unsigned version;
+    ///binary format and size, size of source (guards against hash collisions)
+    unsigned format, length, source_length;
+};
+
+static string cache_dir = PROGRAM_CACHE_DIR;
+static TProgramCacheStats cache_stats = {0, 0, 0, 0, 0.0f, 0.0f};
+
+/**
+****************************************************************************************************
+@brief Set directory of program binaries
+@param dir directory (with trailing slash), NULL or empty string disables cache
+****************************************************************************************************/
+void SetProgramCacheDir(const char *dir)
+{
+    cache_dir = dir != NULL ? dir : "";
+    if(!cache_dir.empty() && cache_dir[cache_dir.size() - 1] != '/' && cache_dir[cache_dir.size() - 1] != '\\')
+        cache_dir += "/";
+}
+
+/**
+****************************************************************************************************
+@brief Return directory of program binaries (empty - cache disabled)
+****************************************************************************************************/
+const string& GetProgramCacheDir()
+{
+    return cache_dir;
+}
+
+/**
+****************************************************************************************************
+@brief Is cache enabled and does driver support at least one binary format?
+****************************************************************************************************/
+bool IsProgramCacheEnabled()
+{
+    if(cache_dir.empty() || !GLEW_ARB_get_program_binary)
+        return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+/**
+****************************************************************************************************
+@brief Return path of cache file. Binary is valid only for driver which created it, so driver
+identity is part of hash.
+@param source complete source of all program stages
+****************************************************************************************************/
+static string CachePath(const string &source)
+{
+    string key;
+    const char *ids[3] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER),
+                           (const char*)glGetString(GL_VERSION) };
+    for(int i=0; i<3; i++)
+    {
+        if(ids[i] != NULL)
+            key += ids[i];
+        key += "\n";
+    }
+    key += source;
+
+    char name[32];
+    sprintf(name, "%016llx.glb", HashData(vector<char>(key.begin(), key.end())));
+    return cache_dir + name;
+}
+
+/**
+****************************************************************************************************
+@brief Create program from cached binary. Driver can reject binary (e.g. after driver update),
+such binary is deleted and program must be compiled.
+@param source complete source of all program stages
+@return linked program or 0 on cache miss
+****************************************************************************************************/
+GLuint LoadProgramBinary(const string &source)
+{
+    if(!IsProgramCacheEnabled())
+        return 0;
+
+    HRTimer timer;
+    string path = CachePath(source);
+    ifstream fin(path.c_str(), ios::binary);
+    size_t length = fin ? CacheFileLength(fin) : 0;
+    TProgramHeader header;
+    //binary must fill rest of file (truncated or damaged entry is a miss)
+    if(!fin || !fin.read((char*)&header, sizeof(header)) || memcmp(header.magic, "GXPB", 4) != 0 ||
+        header.version != PROGRAM_CACHE_VERSION || header.source_length != source.size() || header.length == 0 ||
+        (size_t)header.length != length - sizeof(header))
+    {
+        cache_stats.misses++;
+        return 0;
+    }
+    vector<char> binary(header.length);
+    if(!fin.read(&binary[0], binary.size()))
+    {
+        cache_stats.misses++;
+        return 0;
+    }
+    fin.close();
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, &binary[0], binary.size());
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if(status != GL_TRUE)
+    {
+        glDeleteProgram(program);
+        remove(path.c_str());
+        cache_stats.rejected++;
+        cache_stats.misses++;
+        return 0;
+    }
+
+    cache_stats.hits++;
+    cache_stats.hit_ms += (float)timer.GetElapsedTimeMilliseconds();
+    return program;
+}
+
+/**
+****************************************************************************************************
+@brief Store binary of linked program into cache (cache directory is created when missing)
+@param program linked program (GL_PROGRAM_BINARY_RETRIEVABLE_HINT set before linking)
+@param source complete source of all program stages
+@return true if binary was stored
+****************************************************************************************************/
+bool SaveProgramBinary(GLuint program, const string &source)
+{
+    if(!IsProgramCacheEnabled())
+        return false;
+
+    GLint status = GL_FALSE, length = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(status != GL_TRUE || length <= 0)
+        return false;
+
+    vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(program, length, &length, &format, &binary[0]);
+
+#ifdef _WIN_
+    _mkdir(cache_dir.c_str());
+#else
+    mkdir(cache_dir.c_str(), 0755);
+#endif
+    string path = CachePath(source);
+    string temp = TempCachePath(path);
+    ofstream fout(temp.c_str(), ios::binary);
+    if(!fout)
+    {
+        cerr<<"WARNING (SaveProgramBinary): cannot write "<<path<<"\n";
+        return false;
+    }
+    TProgramHeader header;
+    memcpy(header.magic, "GXPB", 4);
+    header.version = PROGRAM_CACHE_VERSION;
+    header.format = format;
+    header.length = length;
+    header.source_length = source.size();
+    fout.write((const char*)&header, sizeof(header));
+    fout.write(&binary[0], length);
+    //complete file replaces cache entry (readers never see partial binary)
+    fout.close();
+    if(fout.fail() || !CommitCacheFile(temp, path))
+    {
+        remove(temp.c_str());
+        cerr<<"WARNING (SaveProgramBinary): cannot write "<<path<<"\n";
+        return false;
+    }
+
+    cache_stats.stored++;
+    return true;
+}
+
+/**
+****************************************************************************************************
+@brief Record time of program compilation and linking
+@param ms compile time in milliseconds
+****************************************************************************************************/
+void ProgramCompiled(float ms)
+{
+    cache_stats.compile_ms += ms;
+}
+
+/**
+****************************************************************************************************
+@brief Return cache statistics
+****************************************************************************************************/
+TProgramCacheStats GetProgramCacheStats()
+{
+    return cache_stats;
+}
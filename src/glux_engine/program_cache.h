@@ -0,0 +1,44 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: program_cache.h
+@brief disk cache of linked shader programs (ARB_get_program_binary). Binaries are keyed by hash of
+complete shader source and driver identity, binaries rejected by driver are recompiled.
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _PROGRAM_CACHE_H_
+#define _PROGRAM_CACHE_H_
+
+#include "globals.h"
+
+///default directory with program binaries
+#define PROGRAM_CACHE_DIR "cache/"
+///version of program binary files
+#define PROGRAM_CACHE_VERSION 1
+
+///@brief Program binary cache statistics
+struct TProgramCacheStats{
+    ///programs loaded from cache, cache misses, binaries rejected by driver, binaries stored
+    unsigned hits, misses, rejected, stored;
+    ///time of loading binaries and time of compiling programs (milliseconds)
+    float hit_ms, compile_ms;
+};
+
+//set directory of program binaries (NULL or empty - cache disabled)
+void SetProgramCacheDir(const char *dir);
+//directory of program binaries (empty - cache disabled)
+const string& GetProgramCacheDir();
+//is program binary cache supported and enabled?
+bool IsProgramCacheEnabled();
+
+//create linked program from cached binary (0 if binary is missing or rejected by driver)
+GLuint LoadProgramBinary(const string &source);
+//store binary of linked program (program must be linked with retrievable hint)
+bool SaveProgramBinary(GLuint program, const string &source);
+//record time of program compilation (cache statistics)
+void ProgramCompiled(float ms);
+
+//cache statistics
+TProgramCacheStats GetProgramCacheStats();
+
+#endif
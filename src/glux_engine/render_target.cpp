@@ -213,8 +213,14 @@ void TScene::CreateHDRRenderTarget(int resX, int resY, GLint tex_format, GLenum
         resX = m_resx;
         resY = m_resy;
     }
-    //force use of normal buffer if SSAO or IPSM is enabled
-    if(m_useSSAO || m_dpshadow_method >= IPSM) 
+    //G-buffer lights clustered point lights and isn't multisampled
+    if(m_useGBuffer && (m_clusters == NULL || m_msamples > 1))
+    {
+        cerr<<"WARNING (CreateHDRRenderTarget): G-buffer requires clustered lights and no multisampling, deferred lighting disabled\n";
+        UseGBuffer(false);
+    }
+    //force use of normal buffer if SSAO, IPSM or G-buffer is enabled
+    if(m_useSSAO || m_dpshadow_method >= IPSM || m_useGBuffer) 
         normal_buffer = true;
     m_useNormalBuffer = normal_buffer;
 
@@ -231,11 +237,17 @@ void TScene::CreateHDRRenderTarget(int resX, int resY, GLint tex_format, GLenum
     //create texture - for store normal values
     if(m_useNormalBuffer)
         CreateDataTexture("normal_texture", resX, resY, tex_format, tex_type, GL_TEXTURE_2D);
+    //create G-buffer textures - albedo and specular intensity, octahedral normal, shininess and view depth
+    if(m_useGBuffer)
+    {
+        CreateDataTexture("gbuffer_albedo", resX, resY, GL_RGBA8, GL_UNSIGNED_BYTE, GL_TEXTURE_2D);
+        CreateDataTexture("gbuffer_normal", resX, resY, GL_RGBA16F, GL_FLOAT, GL_TEXTURE_2D);
+    }
 
-    //create renderbuffers
+    //create renderbuffers (stencil marks pixels of G-buffer)
     glGenRenderbuffers(1, &m_r_buffer_depth);
     glBindRenderbuffer(GL_RENDERBUFFER, m_r_buffer_depth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT,resX, resY);
+    glRenderbufferStorage(GL_RENDERBUFFER, m_useGBuffer ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT,resX, resY);
 
     //if MSAA enabled, create also multisampled framebuffer (only when platform supports it)
     if(m_msamples > 1 && GLEW_EXT_framebuffer_multisample)
@@ -284,13 +296,14 @@ void TScene::CreateHDRRenderTarget(int resX, int resY, GLint tex_format, GLenum
     if(m_useNormalBuffer)
         glFramebufferTexture2D(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1,GL_TEXTURE_2D, m_tex_cache["normal_texture"], 0);
     //attach render buffers
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER, m_r_buffer_depth);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER,m_useGBuffer ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER, m_r_buffer_depth);
 
 
     //check FBO creation
     if(!CheckFBO())
     {
         m_useHDR = m_useSSAO = m_useNormalBuffer = false;
+        UseGBuffer(false);
         throw ERR;
     }
 
@@ -334,6 +347,27 @@ void TScene::CreateHDRRenderTarget(int resX, int resY, GLint tex_format, GLenum
     AddTexture("mat_blur_vert","bloom_texture",RENDER_TEXTURE);
     CustomShader("mat_blur_vert","data/shaders/quad.vert","data/shaders/blur.frag", " ", "#define VERTICAL\n");
     SetUniform("mat_blur_vert", "texsize", glm::ivec2(resX, resY));       //send texture size info
+
+    //deferred lighting - accumulation of clustered lights from G-buffer and composition without HDR/SSAO
+    if(m_useGBuffer)
+    {
+        AddMaterial("mat_deferred_lights",white,white,white,0.0,0.0,0.0,SCREEN_SPACE);
+        AddTexture("mat_deferred_lights","gbuffer_albedo",RENDER_TEXTURE);
+        AddTexture("mat_deferred_lights","gbuffer_normal",RENDER_TEXTURE);
+        string cluster_defines = "#define CLUSTER_X " + num2str(CLUSTER_X) + "\n"
+            "#define CLUSTER_Y " + num2str(CLUSTER_Y) + "\n"
+            "#define CLUSTER_Z " + num2str(CLUSTER_Z) + "\n";
+        CustomShader("mat_deferred_lights","data/shaders/quad.vert","data/shaders/deferred_lights.frag", " ", cluster_defines.c_str());
+        //buffer textures of clustered lights are bound to fixed units
+        SetUniform("mat_deferred_lights", "cluster_grid", CLUSTER_UNIT);
+        SetUniform("mat_deferred_lights", "cluster_items", CLUSTER_UNIT + 1);
+        SetUniform("mat_deferred_lights", "cluster_lights", CLUSTER_UNIT + 2);
+
+        //scene color is bound to first unit (sampler "tex")
+        AddMaterial("mat_deferred_compose",white,white,white,0.0,0.0,0.0,SCREEN_SPACE);
+        AddTexture("mat_deferred_compose","render_texture",RENDER_TEXTURE);
+        CustomShader("mat_deferred_compose","data/shaders/quad.vert","data/shaders/quad.frag");
+    }
 }
 
 /**
@@ -360,6 +394,15 @@ void TScene::ResizeHDRRenderTarget(int resX, int resY, GLint tex_format, GLenum
         glTexImage2D(GL_TEXTURE_2D, 0, tex_format, resX, resY, 0, GL_RGBA, tex_type, NULL);
     }
 
+    //resize G-buffer textures
+    if(m_useGBuffer)
+    {
+        glBindTexture(GL_TEXTURE_2D, m_tex_cache["gbuffer_albedo"]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, resX, resY, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D, m_tex_cache["gbuffer_normal"]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, resX, resY, 0, GL_RGBA, GL_FLOAT, NULL);
+    }
+
     //resize texture - for bloom effect
     glBindTexture(GL_TEXTURE_2D, m_tex_cache["bloom_texture"]);
     glTexImage2D(GL_TEXTURE_2D, 0, tex_format, resX, resY, 0, GL_RGBA, tex_type, NULL);
@@ -370,10 +413,10 @@ void TScene::ResizeHDRRenderTarget(int resX, int resY, GLint tex_format, GLenum
 
     //resize renderbuffer storage 
     glBindRenderbuffer(GL_RENDERBUFFER, m_r_buffer_depth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT,resX, resY);
+    glRenderbufferStorage(GL_RENDERBUFFER, m_useGBuffer ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT,resX, resY);
 
     glBindFramebuffer(GL_FRAMEBUFFER, m_f_buffer);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER, m_r_buffer_depth);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER,m_useGBuffer ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER, m_r_buffer_depth);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     //resize renderbuffer storage (multisampled)
@@ -42,6 +42,35 @@ TScene::TScene()
 
 	m_light_flags = 0;
 	m_selected_light = 0;
+    m_light_capacity = LIGHT_BUCKET;
+    m_light_serial = 0;
+    m_uniform_matrices = m_uniform_lights = 0;
+    m_clusters = NULL;
+    m_shadow_atlas = NULL;
+    m_shadow_atlas_size = SHADOW_ATLAS_SIZE;
+
+    //level of detail
+    m_useLOD = true;
+    SetLODThresholds(0.3f, 0.12f, 0.05f);
+    m_lod_shadow_bias = 0.5f;
+    SetShadingLOD(SHADING_LOD_SIZE);
+    SetObjectLights(OBJECT_LIGHT_COUNT);
+    m_gpu_timer[0] = m_gpu_timer[1] = 0;
+    m_useGBuffer = m_useDeferredLights = false;
+    memset(m_deferred_queries, 0, sizeof(m_deferred_queries));
+    memset(m_deferred_issued, 0, sizeof(m_deferred_issued));
+    m_useClusterCulling = true;
+    m_useTextureArrays = false;
+    m_virtual = NULL;
+    m_asyncBaking = false;
+    m_uber = NULL;
+    m_lazyBaking = false;
+    m_deferred_materials = m_lazy_baked = 0;
+    memset(&m_stats, 0, sizeof(TRenderStats));
+    m_frames = 0;
+    m_load_timer.Reset();
+
+    m_bv_vao = 0;
 }
 
 /**
@@ -50,12 +79,28 @@ TScene::TScene()
 ****************************************************************************************************/
 TScene::~TScene()
 {
+    //session statistics of material baking
+    cout<<"Session: "<<SceneManager::Instance()->GetProgramStats().compiled<<" programs compiled";
+    if(m_lazyBaking)
+        cout<<", "<<m_lazy_baked<<" materials baked on first use, "<<m_deferred_materials<<" never used";
+    cout<<"\n";
     Destroy(true);
     //delete font
     glDeleteLists(m_font2D, 256);
     //delete buffers
-	GLuint to_delete[] = { m_screen_quad.vao, SceneManager::Instance()->getVBO(VBO_ARRAY, "progress_bar") };
+	GLuint to_delete[] = { m_screen_quad.vao, m_progress_bar.vao };
     glDeleteVertexArrays(2, to_delete);
+    glDeleteBuffers(1, &m_progress_bar.buffer[0]);
+    if(m_bv_vao)
+    {
+        glDeleteVertexArrays(1, &m_bv_vao);
+        glDeleteBuffers(3, m_bv_buffers);
+    }
+    if(m_gpu_timer[0])
+        glDeleteQueries(2, m_gpu_timer);
+    if(m_deferred_queries[0])
+        glDeleteQueries(4, m_deferred_queries);
+    delete m_clusters;
 
     /*
     materials.clear();
@@ -118,16 +163,13 @@ bool TScene::PreInit(GLint resx, GLint resy, GLfloat _near, GLfloat _far, GLfloa
         BuildFont();
     
     //progress bar and background
-	VBO tmp_vbo;
-    glGenVertexArrays(1, &tmp_vbo.vao);
-    glBindVertexArray(tmp_vbo.vao);
+    glGenVertexArrays(1, &m_progress_bar.vao);
+    glBindVertexArray(m_progress_bar.vao);
 
-    glGenBuffers(1, &tmp_vbo.buffer[0]);
-    glBindBuffer(GL_ARRAY_BUFFER, tmp_vbo.buffer[0]);
+    glGenBuffers(1, &m_progress_bar.buffer[0]);
+    glBindBuffer(GL_ARRAY_BUFFER, m_progress_bar.buffer[0]);
     glBufferData(GL_ARRAY_BUFFER, 8 * sizeof(GLfloat), NULL, GL_STREAM_DRAW); 
     glBindVertexArray(0);
-    
-	SceneManager::Instance()->setVBO("progress_bar", tmp_vbo);
 
     AddMaterial("mat_progress_bar", white, white, white, 0.0, 0.0, 0.0, SCREEN_SPACE);
     AddTexture("mat_progress_bar","data/load.png");
@@ -163,10 +205,13 @@ bool TScene::PostInit()
         ShowMessage("There must be at least one light in the scene. Exiting.");
         return false;
     }
-    glGenBuffers(1, &m_uniform_lights);
-    glBindBuffer(GL_UNIFORM_BUFFER, m_uniform_lights);
-    //buffer size: 4x vec3 values + 1x float value multiplied by lights count; 1 vec3 value
-    glBufferData(GL_UNIFORM_BUFFER, light_count * 6 * align, NULL, GL_STREAM_DRAW);
+    //shaders are generated for light capacity, so lights can be added without rebaking
+    m_light_capacity = LIGHT_BUCKET;
+    while(m_light_capacity < light_count)
+        m_light_capacity *= 2;
+    if(m_uniform_lights == 0)
+        glGenBuffers(1, &m_uniform_lights);
+    UpdateLightBuffer();
 	//attach uniform buffer and associate uniform block to this name
 	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_LIGHTS, m_uniform_lights);
     
@@ -182,7 +227,7 @@ bool TScene::PostInit()
             //add shadow map to all materials (except those who don't receive shadows)
             for(m_im = m_materials.begin(); m_im != m_materials.end(); ++m_im)
                 if(m_im->second->GetSceneID() == m_sceneID && !m_im->second->IsScreenSpace())
-                    m_im->second->AddShadowMap((*m_il)->GetType(), *(*m_il)->GetShadowTexID(), (*m_il)->ShadowIntensity() );
+                    m_im->second->AddShadowMap((*m_il)->GetType(), *(*m_il)->GetShadowTexID(), (*m_il)->ShadowIntensity(), (*m_il)->GetShadowRect() );
 
             //add shader for selecting depth values (IPSM only)
             if((*m_il)->GetType() == OMNI)
@@ -191,47 +236,267 @@ bool TScene::PostInit()
                     CreateHDRRenderTarget(-1, -1, GL_RGBA16F, GL_FLOAT, true);
             }
         }
-
-        //fill uniform block with light settings. Be careful to offsets!!!
-        int offset = light_count * align;
-        glBufferSubData(GL_UNIFORM_BUFFER, offset + i*align, sizeof(glm::vec3), glm::value_ptr((*m_il)->GetColor(AMBIENT)));   //ambient
-        offset += light_count * align;
-        glBufferSubData(GL_UNIFORM_BUFFER, offset + i*align, sizeof(glm::vec3), glm::value_ptr((*m_il)->GetColor(DIFFUSE)));   //diffuse
-        offset += light_count * align;
-        glBufferSubData(GL_UNIFORM_BUFFER, offset + i*align, sizeof(glm::vec3), glm::value_ptr((*m_il)->GetColor(SPECULAR)));   //specular
-        offset += light_count * align;
-        GLfloat radius = (*m_il)->GetRadius();
-        glBufferSubData(GL_UNIFORM_BUFFER, offset + i*align, sizeof(float), &radius);   //radius
     }
 
+    //objects placed during scene initialization are static shadow casters (moved objects become dynamic)
+    for(m_io = m_objects.begin(); m_io != m_objects.end(); ++m_io)
+        m_io->second->ClearTransformDirty();
+
+    if(m_useTextureArrays)
+        PackTextures();
+
+    BakeMaterials();
+
+    //add screen quad for render targets
+    AddScreenQuad();
+
+    //update uniform buffer with projection matrix and camera position
+    glBindBuffer(GL_UNIFORM_BUFFER, m_uniform_matrices);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(m_projMatrix));
+    UpdateCameraUniform();
+
+    //bounding volumes keep only box parameters, debug geometry is shared and created on demand
+    unsigned bv_count = 0;
+    for(m_io = m_objects.begin(); m_io != m_objects.end(); ++m_io)
+        if(m_io->second->GetBoundingVolume() && m_io->second->GetType() != INSTANCE)
+            bv_count++;
+    cout<<"Bounding volumes: "<<bv_count<<" boxes, "<<sizeof(BoundingVolume)<<" B each; debug geometry not created for them: "
+        <<3*bv_count<<" GL objects, "<<bv_count*(24*sizeof(float) + 36*sizeof(GLubyte) + sizeof(Box))/1024<<" kB\n";
+
+#ifdef VERBOSE
+    SceneManager::Instance()->ReportGeometry(true);
+    SceneManager::Instance()->ReportTextures(true);
+    SceneManager::Instance()->ReportPrograms();
+#else
+    SceneManager::Instance()->ReportGeometry();
+    SceneManager::Instance()->ReportTextures();
+    SceneManager::Instance()->ReportPrograms();
+#endif
+
+    cout<<"Post Init OK\n";
+    return true;
+}
+
+///@brief Materials generated by parallel job
+struct TMaterialJob{
+    vector<TMaterial*> materials;
+    int light_count, dpshadow_method;
+    bool use_pcf;
+};
+
+/**
+****************************************************************************************************
+@brief Job function - generate shader sources of materials
+****************************************************************************************************/
+static void GenerateShadersJob(int begin, int end, void *data)
+{
+    TMaterialJob *job = (TMaterialJob*)data;
+    for(int i = begin; i < end; i++)
+        job->materials[i]->GenerateShader(job->light_count, job->dpshadow_method, job->use_pcf);
+}
+
+/**
+****************************************************************************************************
+@brief Bake all materials of scene. Shader sources are generated in parallel (pure string work),
+compilation is submitted from rendering thread. With asynchronous baking materials don't wait for
+their programs - they are drawn with uber-shader and finished by UpdateMaterials(), driver compiles
+programs in background (KHR_parallel_shader_compile) or they are finished few per frame.
+@param loading scene is being loaded - synchronous baking updates loading screen (false when
+materials are rebaked in running scene, loading screen would swap buffers in the middle of frame)
+****************************************************************************************************/
+void TScene::BakeMaterials(bool loading)
+{
     cout<<"Baking materials...\n";
-    //assign light count to all materials and then bake them
+    HRTimer timer;
+
+    ///1 generate sources of all scene materials on worker threads
+    TMaterialJob job;
+    job.light_count = m_light_capacity;
+    job.dpshadow_method = m_dpshadow_method;
+    job.use_pcf = m_use_pcf;
+    //lazy baking: materials of objects wait for their first visible use (materials without objects
+    //are used by render passes, they are baked now)
+    map<unsigned, vector<TObject*> > users;
+    if(m_lazyBaking)
+        for(m_io = m_objects.begin(); m_io != m_objects.end(); ++m_io)
+            if(m_io->second->GetSceneID() == m_sceneID)
+                users[m_io->second->GetMatID()].push_back(m_io->second);
+    m_deferred_materials = 0;
+    m_deferred_objects.clear();
     for(m_im = m_materials.begin(); m_im != m_materials.end(); ++m_im)
     {
         if(m_im->second->GetSceneID() == m_sceneID)
         {
+            map<unsigned, vector<TObject*> >::iterator u = users.find(m_im->second->GetID());
+            if(m_lazyBaking && !m_im->second->HasProgram() && !m_im->second->IsScreenSpace() && 
+               u != users.end() && m_preload_materials.find(m_im->first) == m_preload_materials.end())
+            {
+                m_deferred_objects[u->first].swap(u->second);
+                m_deferred_materials++;
+                continue;
+            }
             //set MRT if we use rendering to normal buffer
             if(m_useNormalBuffer)
                 m_im->second->UseMRT(true);
-            //bake material
-            m_im->second->BakeMaterial(m_lights.size(), m_dpshadow_method, m_use_pcf);
-            LoadScreen();
+            job.materials.push_back(m_im->second);
         }
     }
+    TThreadPool::Instance()->ParallelFor(job.materials.size(), 1, GenerateShadersJob, &job);
+    float generate_ms = (float)timer.GetElapsedTimeMilliseconds();
 
-    //add screen quad for render targets
-    AddScreenQuad();
+    ///2 submit compilation, render pending materials with uber-shader
+    timer.Reset();
+    if(m_asyncBaking && m_uber == NULL)
+        m_uber = AcquireUberShader(m_light_capacity, m_useNormalBuffer);
+    for(unsigned i=0; i<job.materials.size(); i++)
+    {
+        job.materials[i]->SubmitShader(m_asyncBaking ? m_uber : NULL);
+        if(!m_asyncBaking)
+        {
+            job.materials[i]->FinishShader(true);
+            if(loading)
+                LoadScreen();
+        }
+        else if(job.materials[i]->IsPending())
+            m_pending_materials.push_back(job.materials[i]);
+    }
+    //don't wait for programs which are already linked
+    UpdateMaterials();
 
-    //update uniform buffer with projection matrix and camera position
-    glBindBuffer(GL_UNIFORM_BUFFER, m_uniform_matrices);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(m_projMatrix));
-    UpdateCameraUniform();
+    cout<<"Materials: "<<job.materials.size()<<" sources generated in "<<generate_ms<<" ms ("
+        <<TThreadPool::Instance()->GetThreadCount()<<" threads), compiled in "<<timer.GetElapsedTimeMilliseconds()
+        <<" ms, "<<m_pending_materials.size()<<" waiting for programs"
+        <<(IsParallelCompileSupported() ? " (parallel compile)" : "");
+    if(m_lazyBaking)
+        cout<<", "<<m_deferred_materials<<" deferred to first use";
+    cout<<"\n";
+}
 
-    cout<<"Post Init OK\n";
+/**
+****************************************************************************************************
+@brief Bake material deferred by lazy baking (first object using it passes culling). With
+asynchronous baking, material is drawn with uber-shader until its program is linked, otherwise
+rendering waits for compilation.
+@param mat material to bake
+****************************************************************************************************/
+void TScene::BakeOnDemand(TMaterial *mat)
+{
+    if(m_useNormalBuffer)
+        mat->UseMRT(true);
+    if(!mat->GenerateShader(m_light_capacity, m_dpshadow_method, m_use_pcf))
+        return;
+    if(m_asyncBaking && m_uber == NULL)
+        m_uber = AcquireUberShader(m_light_capacity, m_useNormalBuffer);
+    mat->SubmitShader(m_asyncBaking ? m_uber : NULL);
+    if(!m_asyncBaking)
+        mat->FinishShader(true);
+    else if(mat->IsPending())
+        m_pending_materials.push_back(mat);
+
+    //material may be baked on demand also when it wasn't deferred (material without objects)
+    if(m_deferred_objects.erase(mat->GetID()) > 0)
+    {
+        m_deferred_materials--;
+        m_lazy_baked++;
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Finish pending materials whose programs are linked. Without parallel shader compile, linked
+state can't be queried without blocking, so only MATERIAL_FINISH_BUDGET materials are finished in
+one frame. Uber-shader is released with last pending material.
+****************************************************************************************************/
+void TScene::UpdateMaterials()
+{
+    if(m_pending_materials.empty())
+        return;
+
+    bool parallel = IsParallelCompileSupported();
+    unsigned finished = 0;
+    list<TMaterial*>::iterator it = m_pending_materials.begin();
+    while(it != m_pending_materials.end())
+    {
+        bool wait = !parallel && finished < MATERIAL_FINISH_BUDGET;
+        if((*it)->FinishShader(wait))
+        {
+            it = m_pending_materials.erase(it);
+            finished++;
+        }
+        else
+            ++it;
+        if(!parallel && finished >= MATERIAL_FINISH_BUDGET)
+            break;
+    }
+
+    if(m_pending_materials.empty())
+    {
+        if(m_frames > 0)
+            cout<<"All materials baked after "<<m_load_timer.GetElapsedTimeMilliseconds()<<" ms\n";
+        SceneManager::Instance()->ReleaseProgram(m_uber);
+        m_uber = NULL;
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Write cost report of generated shaders of all scene materials, ranked by estimated cost
+(see AnalyzeShaderSource()). Light loops are counted with actual number of lights (limited by
+per-object light lists).
+@param path output file (JSON for .json extension, otherwise CSV)
+@return false if report cannot be written
+****************************************************************************************************/
+bool TScene::ReportShaders(const char *path)
+{
+    vector<TShaderCost> costs;
+    for(m_im = m_materials.begin(); m_im != m_materials.end(); ++m_im)
+        if(m_im->second->GetSceneID() == m_sceneID)
+            m_im->second->AnalyzeShader(m_light_capacity, m_object_lights > 0 ? min<unsigned>(m_object_lights, m_lights.size()) : m_lights.size(), 
+                                        m_dpshadow_method, m_use_pcf, costs);
+
+    if(!WriteShaderReport(path, costs))
+    {
+        cerr<<"WARNING (ReportShaders): cannot write "<<path<<"\n";
+        return false;
+    }
+    cout<<"Shader report: "<<costs.size()<<" shaders written to "<<path<<"\n";
     return true;
 }
 
 
+/**
+****************************************************************************************************
+@brief Pack base maps of scene materials into texture arrays (see PackTextureArrays()). Streamed
+textures are loaded first. Generated shaders then sample arrays, so materials must be baked after
+packing. Packed source textures are removed from texture cache (they may be deleted).
+***************************************************************************************************/
+void TScene::PackTextures()
+{
+    if(TTextureStreamer::IsEnabled())
+        TTextureStreamer::Instance()->Flush();
+
+    vector<Texture*> textures;
+    for(m_im = m_materials.begin(); m_im != m_materials.end(); ++m_im)
+        if(m_im->second->GetSceneID() == m_sceneID)
+            m_im->second->GetTextures(textures);
+
+    vector<GLuint> packed;
+    TTextureArrayStats stats = PackTextureArrays(textures, packed);
+    for(unsigned i=0; i<packed.size(); i++)
+    {
+        for(m_it = m_tex_cache.begin(); m_it != m_tex_cache.end(); )
+        {
+            if(m_it->second == packed[i])
+                m_tex_cache.erase(m_it++);
+            else
+                ++m_it;
+        }
+    }
+    cout<<"Texture arrays: "<<stats.textures<<" textures packed into "<<stats.arrays<<" arrays ("
+        <<stats.layers<<" layers, "<<stats.bytes/1024<<" kB)\n";
+}
+
+
 /**
 ****************************************************************************************************
 @brief Resize screen to new dimensions, re-initialize viewport and projection matrices
@@ -244,6 +509,8 @@ void TScene::Resize(GLint resx, GLint resy)
     m_resy = resy;
     glViewport(0,0,resx,resy);        //new viewport settings
     m_projMatrix = glm::perspective(m_fovy,(GLfloat)resx/resy,m_near_p,m_far_p);
+    if(m_virtual)
+        m_virtual->CreateFeedback(resx, resy);
 }
 
 
@@ -256,10 +523,24 @@ uses the same textures)
 ***************************************************************************************************/
 void TScene::Destroy(bool delete_cache)
 {
+    //objects release their geometry
+    for(m_io = m_objects.begin(); m_io != m_objects.end(); ++m_io)
+        delete m_io->second;
     m_objects.clear();
+    m_deferred_objects.clear();
+    m_deferred_materials = 0;
     m_materials.clear();
     m_lights.clear();
     m_fbos.clear();
+    //virtual texture owns its cache and page table
+    delete m_virtual;
+    m_virtual = NULL;
+    //shadow maps of lights are regions of atlas
+    delete m_shadow_atlas;
+    m_shadow_atlas = NULL;
+    m_pending_materials.clear();
+    SceneManager::Instance()->ReleaseProgram(m_uber);
+    m_uber = NULL;
 
     if(delete_cache)
     {
@@ -268,7 +549,6 @@ void TScene::Destroy(bool delete_cache)
             glDeleteTextures(1, &m_it->second);
         
         m_tex_cache.clear();
-        m_obj_cache.clear();
     }
 
     //delete framebuffers
@@ -437,6 +717,76 @@ void TScene::AddTextureData(const char *name, const char *tex_name, const void *
     //LoadScreen();	//update loading screen
 }
 
+/**
+****************************************************************************************************
+@brief Create virtual texture of scene (only one per scene). Objects share it through their virtual
+rectangles (see SetVirtualRect()), visible tiles are found by feedback pass drawn in Redraw().
+Must be called after PreInit().
+@param pages number of pages (tiles) per side of virtual texture, power of two
+@param generator tile generator
+@param data generator's user data
+@return created virtual texture or NULL
+***************************************************************************************************/
+TVirtualTexture* TScene::CreateVirtualTexture(unsigned pages, TTileGenerator generator, void *data)
+{
+    if(m_virtual)
+    {
+        cerr<<"WARNING (CreateVirtualTexture): scene has virtual texture already\n";
+        return m_virtual;
+    }
+    m_virtual = new TVirtualTexture(pages, generator, data);
+    if(!m_virtual->Create(m_resx, m_resy))
+    {
+        delete m_virtual;
+        m_virtual = NULL;
+        return NULL;
+    }
+
+    //feedback shader (screen space, so it doesn't get shadow maps)
+    string defines = "#define VT_TILE_SIZE " + num2str(VT_TILE_SIZE) + ".0\n";
+    AddMaterial("mat_vt_feedback", white, white, white, 0.0, 0.0, 0.0, SCREEN_SPACE);
+    CustomShader("mat_vt_feedback", "data/shaders/vt_feedback.vert", "data/shaders/vt_feedback.frag", " ", defines.c_str());
+    return m_virtual;
+}
+
+/**
+****************************************************************************************************
+@brief Add virtual texture of scene to material
+@param mat_name material name
+@param texmode texture addition mode (can be ADD,MODULATE,DECAL,BLEND,REPLACE)
+@param intensity texture color intensity
+***************************************************************************************************/
+void TScene::AddVirtualTexture(const char *mat_name, GLint texmode, GLfloat intensity)
+{
+    if(m_virtual == NULL)
+    {
+        cerr<<"WARNING (AddVirtualTexture): scene has no virtual texture\n";
+        return;
+    }
+    if(m_materials.find(mat_name) == m_materials.end())
+    {
+        cerr<<"WARNING (AddVirtualTexture): no material with name "<<mat_name<<"\n";
+        return;
+    }
+    m_materials[mat_name]->AddVirtualTexture(m_virtual, texmode, intensity);
+}
+
+/**
+****************************************************************************************************
+@brief Set rectangle of virtual texture mapped on object (texture coordinates 0..1 of object)
+@param obj_name object name
+@param rect offset and size of rectangle in virtual texture (0..1)
+***************************************************************************************************/
+void TScene::SetVirtualRect(const char *obj_name, glm::vec4 rect)
+{
+    if(m_objects.find(obj_name) == m_objects.end())
+    {
+        cerr<<"WARNING (SetVirtualRect): no object with name "<<obj_name<<"\n";
+        return;
+    }
+    m_objects[obj_name]->SetVirtualRect(rect);
+}
+
 /**
 ****************************************************************************************************
 @brief Bind material(identified by mat_name) to object(identified by obj_name)
@@ -458,12 +808,16 @@ void TScene::SetMaterial(const char* obj_name, const char *mat_name)
         return;
     }
     m_objects[obj_name]->SetMaterial(m_materials[mat_name]->GetID());
+    //object of material deferred by lazy baking can make it visible
+    map<unsigned, vector<TObject*> >::iterator d = m_deferred_objects.find(m_materials[mat_name]->GetID());
+    if(d != m_deferred_objects.end())
+        d->second.push_back(m_objects[obj_name]);
 }
 
 /**
 ****************************************************************************************************
-@brief Add 3DS object to scene. If objects has been loaded, a object pointer from cache is used
-instead of reloading from file
+@brief Add 3DS object to scene. If objects has been loaded, its geometry is shared instead of
+reloading from file
 @param name object name
 @param file 3DS file with data
 ***************************************************************************************************/
@@ -474,20 +828,19 @@ void TScene::AddObject(const char *name, const char* file)
     m_objects[name] = o;
 
     ///find out, if object hasn't been loaded yet
-    m_iob = m_obj_cache.find(file);
+    TGeometry *g = SceneManager::Instance()->AcquireGeometry(string(file));
 
     ///if no match, load object normally
-    if( m_iob == m_obj_cache.end() )
+    if(g == NULL)
     {
         VBO vbo_ret = m_objects[name]->Create(name,file,true);
         if(vbo_ret.vao == 0)
             throw ERR;
-        m_obj_cache[file] = vbo_ret;
     }
-    ///else use existing object data
+    ///else share existing geometry
     else
     {
-        m_objects[name]->SetVBOdata(m_iob->second);   //must be called before create!
+        m_objects[name]->SetGeometry(g);   //must be called before create!
         m_objects[name]->Create(name,file,false);
     }
     LoadScreen();	//update loading screen
@@ -498,7 +851,9 @@ void TScene::AddObject(const char *name, const char* file)
 
 /**
 ****************************************************************************************************
-@brief Add new light object. New light is pushed to the end of the list
+@brief Add new light object. New light is pushed to the end of the list. Lights can be added also
+to running scene - shaders read light count from uniform buffer, so materials are rebaked only when
+light capacity (see LIGHT_BUCKET) is exceeded. New lights don't cast shadows.
 @param _lights light index
 @param amb ambient color
 @param diff diffuse color
@@ -509,7 +864,7 @@ void TScene::AddObject(const char *name, const char* file)
 void TScene::AddLight(GLint _lights, glm::vec3 amb, glm::vec3 diff, glm::vec3 spec, glm::vec3 lpos, GLfloat radius)
 { 
     //object for light
-    string m_name = "default_light_" + num2str(m_lights.size());
+    string m_name = "default_light_" + num2str(m_light_serial++);
     AddMaterial(m_name.c_str(), 2.0f*diff, 2.0f*diff, 2.0f*diff, 0.0, 0.0, 0.0);
     AddObject(m_name.c_str(), "data/obj/light.3ds");
     SetMaterial(m_name.c_str(), m_name.c_str());
@@ -518,10 +873,129 @@ void TScene::AddLight(GLint _lights, glm::vec3 amb, glm::vec3 diff, glm::vec3 sp
 
     //create new and push into list
     TLight *l = new TLight(_lights, amb, diff, spec, lpos, radius);
+    l->SetObjName(m_name);
     m_lights.push_back(l);
 
+    //scene is already running (PostInit() created light buffer)
+    if(m_uniform_lights != 0)
+    {
+        if(m_lights.size() > m_light_capacity)
+        {
+            //light arrays are full - all materials (and uber-shader) must be rebaked
+            m_light_capacity *= 2;
+            cout<<"Light capacity increased to "<<m_light_capacity<<", rebaking materials\n";
+            SceneManager::Instance()->ReleaseProgram(m_uber);
+            m_uber = NULL;
+            m_pending_materials.clear();
+            UpdateLightBuffer();
+            BakeMaterials(false);
+        }
+        else
+        {
+            //only material of light object is baked (it shares program with other light objects)
+            if(m_useNormalBuffer)
+                m_materials[m_name]->UseMRT(true);
+            m_materials[m_name]->BakeMaterial(m_light_capacity, m_dpshadow_method, m_use_pcf);
+            UpdateLightBuffer();
+        }
+    }
+
     //update position
-    MoveLight(_lights, lpos);
+    MoveLight(m_lights.size() - 1, lpos);
+}
+
+
+/**
+****************************************************************************************************
+@brief Remove light identified by index, together with object showing its position. Following lights
+are moved by one index down. Materials are not rebaked. Lights casting shadow can't be removed (their
+shadow maps are part of materials).
+@param light light index
+***************************************************************************************************/
+void TScene::RemoveLight(GLint light)
+{
+    if(light < 0 || (unsigned)light >= m_lights.size()) 
+    {
+        cerr<<"WARNING (RemoveLight): no light with index "<<light<<"\n";
+        return;
+    }
+    TLight *l = m_lights[light];
+    if(l->IsCastingShadow())
+    {
+        cerr<<"WARNING (RemoveLight): light "<<light<<" casts shadow, it can't be removed\n";
+        return;
+    }
+
+    //material of light object stays in scene (material IDs are given by material count)
+    m_io = m_objects.find(l->GetObjName());
+    if(m_io != m_objects.end())
+    {
+        map<unsigned, vector<TObject*> >::iterator d = m_deferred_objects.find(m_io->second->GetMatID());
+        if(d != m_deferred_objects.end())
+            d->second.erase(remove(d->second.begin(), d->second.end(), m_io->second), d->second.end());
+        delete m_io->second;
+        m_objects.erase(m_io);
+    }
+    delete l;
+    m_lights.erase(m_lights.begin() + light);
+    if(m_selected_light >= m_lights.size())
+        m_selected_light = 0;
+
+    if(m_uniform_lights != 0)
+        UpdateLightBuffer();
+}
+
+
+/**
+****************************************************************************************************
+@brief Fill uniform buffer with settings of all lights. Light arrays have size of light capacity,
+so their offsets don't depend on light count; count of used lights follows arrays.
+***************************************************************************************************/
+void TScene::UpdateLightBuffer()
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, m_uniform_lights);
+    //buffer size: 4x vec3 arrays + 1x float array (elements aligned to vec4); light count, cluster parameters
+    glBufferData(GL_UNIFORM_BUFFER, (5*m_light_capacity + 2) * align, NULL, GL_STREAM_DRAW);
+
+    //fill uniform block with light settings. Be careful to offsets!!!
+    int offset = m_light_capacity * align;
+    for(unsigned i = 0; i < m_lights.size(); i++)
+    {
+        TLight *l = m_lights[i];
+        glBufferSubData(GL_UNIFORM_BUFFER, i*align, sizeof(glm::vec3), 
+                        glm::value_ptr(glm::vec3(m_viewMatrix * glm::vec4(l->GetPos(), 1.0))));  //position
+        glBufferSubData(GL_UNIFORM_BUFFER, offset + i*align, sizeof(glm::vec3), glm::value_ptr(l->GetColor(AMBIENT)));     //ambient
+        glBufferSubData(GL_UNIFORM_BUFFER, 2*offset + i*align, sizeof(glm::vec3), glm::value_ptr(l->GetColor(DIFFUSE)));   //diffuse
+        glBufferSubData(GL_UNIFORM_BUFFER, 3*offset + i*align, sizeof(glm::vec3), glm::value_ptr(l->GetColor(SPECULAR)));  //specular
+        GLfloat radius = l->GetRadius();
+        glBufferSubData(GL_UNIFORM_BUFFER, 4*offset + i*align, sizeof(float), &radius);   //radius
+    }
+    GLint count = m_lights.size();
+    glBufferSubData(GL_UNIFORM_BUFFER, 5*offset, sizeof(GLint), &count);
+}
+
+/**
+****************************************************************************************************
+@brief Assign local point lights to clusters of current view frustum, upload light lists and bind
+them for drawing. Cluster parameters are stored in light uniform buffer.
+****************************************************************************************************/
+void TScene::UpdateLightClusters()
+{
+    if(m_clusters == NULL)
+        return;
+    m_clusters->Assign(m_viewMatrix, m_fovy, (float)m_resx/m_resy, m_near_p, m_far_p);
+    m_clusters->Upload();
+    m_clusters->Bind();
+
+    //zero parameters skip cluster lights in materials when they are accumulated by deferred pass
+    glm::vec4 params = IsDeferredLighting() ? glm::vec4(0.0f) : m_clusters->GetParams();
+    glBindBuffer(GL_UNIFORM_BUFFER, m_uniform_lights);
+    glBufferSubData(GL_UNIFORM_BUFFER, (5*m_light_capacity + 1) * align, sizeof(glm::vec4), glm::value_ptr(params));
+
+    const TClusterStats &stats = m_clusters->GetStats();
+    m_stats.lights_clustered = stats.visible;
+    m_stats.cluster_items = stats.items;
+    m_stats.cluster_ms = stats.assign_ms + stats.upload_ms;
 }
 
 
@@ -533,12 +1007,12 @@ void TScene::AddLight(GLint _lights, glm::vec3 amb, glm::vec3 diff, glm::vec3 sp
 ***************************************************************************************************/
 void TScene::MoveLight(GLint light, glm::vec3 w)
 {
-    if(light < 0 || (unsigned)light > m_lights.size()) 
+    if(light < 0 || (unsigned)light >= m_lights.size()) 
         cerr<<"WARNING: no light with index "<<light<<"\n";
     else 
     {
         m_lights[light]->Move(w);
-        string l_name = "default_light_" + num2str(light);
+        string l_name = m_lights[light]->GetObjName();
         //update light position
         MoveObjAbs(l_name.c_str(), w.x, w.y, w.z);
         if(m_materials[l_name.c_str()]->IsShaderOK())
@@ -560,41 +1034,107 @@ void TScene::MoveLight(GLint light, glm::vec3 w)
 ***************************************************************************************************/
 void TScene::ChangeLightColor(GLint light, GLint component, glm::vec3 color)
 {
-    if(light < 0 || (unsigned)light > m_lights.size()) 
+    if(light < 0 || (unsigned)light >= m_lights.size()) 
         cerr<<"WARNING: no light with index "<<light<<"\n";
     else 
     {
         m_lights[light]->ChangeColor(component,color);
         //update uniform buffer
-        int offset1 = m_lights.size()*align;
+        int offset1 = m_light_capacity*align;
         int offset2 = light*align;
         glBindBuffer(GL_UNIFORM_BUFFER, m_uniform_lights);
         glBufferSubData(GL_UNIFORM_BUFFER, component*offset1 + offset2, sizeof(glm::vec3), glm::value_ptr(color)); 
     }
 }
 
+/**
+****************************************************************************************************
+@brief Draw wireframe oriented bounding boxes of all visible objects. Boxes are drawn by one
+instanced draw call of unit cube with per-instance transformation
+****************************************************************************************************/
 void TScene::drawBoundingVolumes()
 {
-	//set wireframe render
-	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	glDisable(GL_CULL_FACE);
+	//create shared geometry on first use
+	if(m_bv_vao == 0)
+		CreateBoundingVolumeGeometry();
 
-	//draw all bounding volumes
-	map<string,TObject*>::iterator it;
-	m_materials["__bv_mat"]->RenderMaterial();
+	//collect boxes of objects in current subscene which intersect view frustum
+	glm::vec4 planes[6];
+	ExtractFrustumPlanes(m_projMatrix, planes);
+	m_bv_transforms.clear();
 
+	map<string,TObject*>::iterator it;
 	for(it=m_objects.begin(); it!=m_objects.end(); ++it)
 	{
-		//make MVP
-		glm::mat4 m = m_viewMatrix * it->second->GetMatrix();
-        
-		//attach as uniform
-		m_materials["__bv_mat"]->SetUniform("in_ModelViewMatrix", m);
+		BoundingVolume *bv = it->second->GetBoundingVolume();
+		if(bv == NULL || it->second->GetSceneID() != m_sceneID)
+			continue;
+
+		//unit cube -> box -> eye space
+		glm::mat4 m = m_viewMatrix * it->second->GetMatrix() * bv->getTransform();
+		glm::vec3 center = glm::vec3(m[3]);
+		float radius = glm::length(glm::vec3(m[0])) + glm::length(glm::vec3(m[1])) + glm::length(glm::vec3(m[2]));
+		bool visible = true;
+		for(int i = 0; i < 6 && visible; i++)
+			visible = glm::dot(glm::vec3(planes[i]), center) + planes[i].w >= -radius;
+
+		if(visible)
+			m_bv_transforms.push_back(m);
+	}
+	if(m_bv_transforms.empty())
+		return;
 
-		//Draw BV
-		it->second->drawBV();
+	//upload transformations of all boxes
+	glBindBuffer(GL_ARRAY_BUFFER, m_bv_buffers[2]);
+	glBufferData(GL_ARRAY_BUFFER, m_bv_transforms.size() * sizeof(glm::mat4), &m_bv_transforms[0], GL_STREAM_DRAW);
+
+	//draw all boxes at once
+	m_materials["__bv_mat"]->RenderMaterial();
+	glBindVertexArray(m_bv_vao);
+	glDrawElementsInstanced(GL_LINES, 24, GL_UNSIGNED_BYTE, NULL, m_bv_transforms.size());
+	glBindVertexArray(0);
+}
+
+/**
+****************************************************************************************************
+@brief Create geometry for bounding volume visualization: wireframe unit cube <-1,1> and buffer
+for per-instance box transformations (mat4 in attributes 1-4)
+****************************************************************************************************/
+void TScene::CreateBoundingVolumeGeometry()
+{
+	GLfloat vertices[24] = {
+		-1.0f, -1.0f, -1.0f,	 1.0f, -1.0f, -1.0f,
+		-1.0f,  1.0f, -1.0f,	 1.0f,  1.0f, -1.0f,
+		-1.0f, -1.0f,  1.0f,	 1.0f, -1.0f,  1.0f,
+		-1.0f,  1.0f,  1.0f,	 1.0f,  1.0f,  1.0f
+	};
+	//cube edges
+	GLubyte indices[24] = {
+		0, 1,  2, 3,  4, 5,  6, 7,	//x
+		0, 2,  1, 3,  4, 6,  5, 7,	//y
+		0, 4,  1, 5,  2, 6,  3, 7	//z
+	};
+
+	glGenVertexArrays(1, &m_bv_vao);
+	glBindVertexArray(m_bv_vao);
+	glGenBuffers(3, m_bv_buffers);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_bv_buffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_bv_buffers[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+	//per-instance matrix - one attribute per column
+	glBindBuffer(GL_ARRAY_BUFFER, m_bv_buffers[2]);
+	for(int i = 0; i < 4; i++)
+	{
+		glEnableVertexAttribArray(1 + i);
+		glVertexAttribPointer(1 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (GLvoid*)(i * sizeof(glm::vec4)));
+		glVertexAttribDivisor(1 + i, 1);
 	}
 
-	//set fill mode back to GL_FILL
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	glBindVertexArray(0);
 }
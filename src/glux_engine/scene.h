@@ -18,9 +18,75 @@
 #include "hires_timer.h"
 
 #include "SceneManager.h"
+#include "thread_pool.h"
+#include "texture_streamer.h"
+#include "texture_array.h"
+#include "program_cache.h"
+#include "virtual_texture.h"
+#include "shadow_atlas.h"
 
 const int align = sizeof(glm::vec4);      //BUG: ATI Catalyst 10.12 drivers align uniform block values to vec4
 
+///@brief Rendering statistics of last drawn frame
+struct TRenderStats{
+    ///triangles drawn in all passes and triangles which would be drawn with full detail meshes
+    unsigned triangles, triangles_full;
+    ///tested and culled mesh clusters, triangles of culled clusters
+    unsigned clusters, clusters_culled, cluster_triangles_culled;
+    ///textures waiting for decoding or upload, time spent by texture uploads
+    unsigned textures_streaming;
+    float texture_upload_ms;
+    ///virtual texture tiles in cache, waiting for generation and generated in this frame
+    unsigned vt_resident, vt_requested, vt_uploaded;
+    ///materials rendered with uber-shader until their programs are linked
+    unsigned materials_pending;
+    ///materials waiting for first visible use (lazy baking), programs compiled since start
+    unsigned materials_deferred, programs_compiled;
+    ///objects drawn with reduced shading variant, GPU time of opaque pass (previous frame)
+    unsigned objects_reduced;
+    float gpu_opaque_ms;
+    ///objects drawn with per-object light lists, sum and average of their lights
+    unsigned objects_lit, object_lights;
+    float lights_per_object;
+    ///clustered lights: visible lights, light references in clusters, CPU time of assignment and upload
+    unsigned lights_clustered, cluster_items;
+    float cluster_ms;
+    ///deferred lighting: pixels shaded by light pass, GPU time of light pass (previous frame)
+    unsigned deferred_pixels;
+    float gpu_lights_ms;
+    ///shadow atlas regions rendered in this frame, regions whose static depth was rendered again,
+    ///allocated fraction of atlas
+    unsigned shadow_maps, shadow_maps_static;
+    float atlas_occupancy;
+    ///texture arrays bound in this frame, redundant binds skipped (array already bound to unit)
+    unsigned array_binds, array_binds_skipped;
+};
+
+///materials finished per frame when driver can't report completion of programs
+#define MATERIAL_FINISH_BUDGET 4
+
+///default projected object size (relative to screen height) under which reduced shading is used
+#define SHADING_LOD_SIZE 0.1f
+///object returns to full shading when its projected size exceeds threshold by this factor
+#define SHADING_LOD_HYSTERESIS 1.25f
+
+///default size of per-object light lists (lights with the largest contribution are selected)
+#define OBJECT_LIGHT_COUNT 4
+///maximal size of per-object light lists
+#define MAX_OBJECT_LIGHTS 16
+
+///minimal size of light arrays in shaders, arrays grow in powers of two - lights can be added
+///and removed at runtime without rebaking materials until array size is exceeded
+#define LIGHT_BUCKET 8
+
+///clusters culled in one culling job
+#define CLUSTER_JOB_SIZE 256
+
+///@brief Range of object clusters processed by one culling job
+struct TClusterJob{
+    TObject *obj;
+    unsigned begin, end;
+};
 
 /**
 @class TScene
@@ -69,11 +135,6 @@ protected:
     ///iterator for texture cache container
     map<string,GLuint>::iterator m_it;
 
-    ///3DS objects cache - purpose is the same as texture cache
-    map<string,VBO> m_obj_cache;
-    ///iterator for object cache container
-    map<string,VBO>::iterator m_iob;
-
     ///uniform buffers
     GLuint m_uniform_matrices, m_uniform_lights;
 
@@ -104,13 +165,21 @@ protected:
     glm::mat4 m_viewMatrix, m_projMatrix;
 
     //scene render to texture target (FBO) and progress bar
-    VBO m_screen_quad, m_small_quad;
+    VBO m_screen_quad, m_small_quad, m_progress_bar;
 
     ///shall we use HDR, SSAO or shadows?
     bool m_useHDR, m_useSSAO, m_useShadows, m_useNormalBuffer;
     ///wireframe
     bool m_wireframe;
 
+    ///G-buffer (albedo, normal and material parameters) is rendered with MRT, local lights are
+    ///accumulated by deferred pass (runtime toggle)
+    bool m_useGBuffer, m_useDeferredLights;
+    ///GPU timer and sample queries of deferred light pass (two frames in flight), were they issued
+    ///since their result was read? (pass is skipped without visible lights or in forward mode)
+    GLuint m_deferred_queries[4];
+    bool m_deferred_issued[4];
+
     ///framebuffer/renderbuffer objects for color/depth
     GLuint m_f_buffer, m_r_buffer_depth,
            m_f_bufferMSAA, m_r_buffer_colorMSAA, m_r_buffer_normalMSAA, m_r_buffer_depthMSAA;
@@ -134,6 +203,62 @@ protected:
     glm::vec3 m_avg_normal;
     GLuint m_aerr_f_buffer, m_aerr_f_buffer_color, m_aerr_r_buffer_depth;
 
+    ///level of detail - switch thresholds (projected object size relative to screen height)
+    bool m_useLOD;
+    float m_lod_threshold[MAX_LODS - 1];
+    ///projected size multiplier used in shadow passes (<1.0 selects coarser levels)
+    float m_lod_shadow_bias;
+    ///shading level of detail - projected size under which materials use reduced variant (0 - off)
+    float m_shading_lod;
+    vector<TObject*> m_reduced_objects;
+    ///GPU timer queries of opaque pass (two frames in flight)
+    GLuint m_gpu_timer[2];
+
+    ///bounding volume visualization - unit cube and per-instance box transformations,
+    ///created on first use of drawBoundingVolumes()
+    GLuint m_bv_vao, m_bv_buffers[3];
+    vector<glm::mat4> m_bv_transforms;
+
+    ///cluster culling - jobs and objects culled in current frame
+    bool m_useClusterCulling;
+    vector<TClusterJob> m_cluster_jobs;
+    vector<TObject*> m_cluster_objects;
+
+    ///pack base maps of materials into texture arrays in PostInit()
+    bool m_useTextureArrays;
+
+    ///virtual texture (NULL - not used) and material drawing its feedback
+    TVirtualTexture *m_virtual;
+
+    ///asynchronous baking - materials waiting for their programs render with uber-shader
+    bool m_asyncBaking;
+    TShaderProgram *m_uber;
+    list<TMaterial*> m_pending_materials;
+    ///lazy baking - materials are baked when their first object passes culling, except preloaded ones
+    bool m_lazyBaking;
+    set<string> m_preload_materials;
+    unsigned m_deferred_materials, m_lazy_baked;
+    ///objects of deferred materials by material ID (only they are tested for visibility)
+    map<unsigned, vector<TObject*> > m_deferred_objects;
+
+    ///size of light arrays in shaders and uniform buffer (see LIGHT_BUCKET)
+    unsigned m_light_capacity;
+    ///serial number of light objects (names stay unique when lights are removed)
+    unsigned m_light_serial;
+    ///local point lights assigned to view frustum clusters (NULL - not used)
+    TLightClusters *m_clusters;
+    ///shadow maps of all lights (created with first shadow map), atlas size
+    TShadowAtlas *m_shadow_atlas;
+    int m_shadow_atlas_size;
+    ///size of per-object light lists (0 - shaders loop over all lights)
+    int m_object_lights;
+
+    ///statistics of last frame
+    TRenderStats m_stats;
+    ///time since scene creation - measures time to first frame and to end of texture streaming
+    HRTimer m_load_timer;
+    unsigned m_frames;
+
 public:
 	enum light_events{LIGHT_FORWARD_DOWN=0, LIGHT_BACKWARD_DOWN, LIGHT_LEFT_DOWN, LIGHT_RIGHT_DOWN, LIGHT_UPWARD_DOWN, LIGHT_DOWNWARD_DOWN, LIGHT_FORWARD_UP, LIGHT_BACKWARD_UP, LIGHT_LEFT_UP, LIGHT_RIGHT_UP, LIGHT_UPWARD_UP, LIGHT_DOWNWARD_UP};
 
@@ -146,6 +271,8 @@ public:
     bool PreInit(GLint resx, GLint resy, GLfloat near, GLfloat far, GLfloat fovy, 
                  GLint msamples, bool cust_cam = false, bool load_font = true);
     bool PostInit();
+    //pack textures of materials into texture arrays
+    void PackTextures();
     //resize window
     void Resize(GLint resx, GLint resy);
     //draw scene - setup, render targets and objects
@@ -153,7 +280,36 @@ public:
     //draw all objects in scene
     void DrawScene(int drawmode);
 	void drawBoundingVolumes();
-    void DrawSceneDepth(const char* shadow_mat, glm::mat4& lightMatrix);
+    void CreateBoundingVolumeGeometry();
+    void DrawSceneDepth(const char* shadow_mat, glm::mat4& lightMatrix, int casters = SHADOW_CASTERS_ALL, const glm::vec4 *planes = NULL);
+    //draw objects with virtual texture into feedback buffer
+    void DrawSceneFeedback();
+    //projected object size relative to screen height
+    float ProjectedSize(TObject *obj, const glm::mat4 &modelview);
+    //select object detail level according to its projected size
+    int SelectLOD(TObject *obj, const glm::mat4 &modelview, float bias = 1.0f);
+    //select shading variant of object according to its projected size
+    int SelectShading(TObject *obj, const glm::mat4 &modelview);
+    //draw object with bound material
+    void DrawObject(TMaterial *mat, TObject *obj, const glm::mat4 &modelview, bool is_virtual);
+    //select lights with the largest contribution to object
+    int SelectLights(TObject *obj, GLint *lights, glm::vec3 &ambient);
+    //cull clusters of all clustered objects against camera frustum
+    void CullClusters();
+    //bake materials of scene - generate sources in parallel, then compile them
+    void BakeMaterials(bool loading = true);
+    //finish materials whose programs are linked
+    void UpdateMaterials();
+    //bake material on its first visible use
+    void BakeOnDemand(TMaterial *mat);
+    //is bounding sphere of object in view frustum?
+    bool IsVisible(TObject *obj, const glm::mat4 &modelview, const glm::vec4 planes[6]);
+    //fill uniform buffer with settings of all lights
+    void UpdateLightBuffer();
+    //assign local lights to clusters and upload light lists
+    void UpdateLightClusters();
+    //accumulate local lights from G-buffer into scene color
+    void DrawDeferredLights();
 
     //draw load screen
     void LoadScreen(bool swap = true);
@@ -324,11 +480,7 @@ public:
 
     void AddLight(GLint _lights, glm::vec3 amb, glm::vec3 diff, glm::vec3 spec, glm::vec3 lpos, GLfloat radius = 1000.0);
 
-    ///@brief Remove light identified by number
-    ///@todo remove selected light only, not whole list
-    void RemoveLight(/*int lightnum*/){ 
-        m_lights.clear(); 
-    }
+    void RemoveLight(GLint light);
 
     void MoveLight(GLint light, glm::vec3 w);
     void ChangeLightColor(GLint light, GLint component, glm::vec3 color);
@@ -338,6 +490,19 @@ public:
         return m_lights.size(); 
     }
 
+    ///@brief Add local point light (without shadow and light object), requires clustered lights
+    ///(see UseClusteredLights())
+    void AddPointLight(glm::vec3 lpos, glm::vec3 color, GLfloat radius){
+        if(m_clusters == NULL)
+            cerr<<"WARNING (AddPointLight): clustered lights are disabled\n";
+        else
+            m_clusters->AddLight(lpos, color, radius);
+    }
+    ///@brief Return number of local point lights
+    int GetPointLightCount(){
+        return m_clusters != NULL ? m_clusters->GetLightCount() : 0;
+    }
+
     ///@brief Return light position
     glm::vec3 GetLightPos(int light){
         if(light < 0 || (unsigned)light >= m_lights.size()) { cerr<<"WARNING: no light with index "<<light<<"\n"; return glm::vec3(0.0); }
@@ -352,7 +517,7 @@ public:
             m_lights[light]->SetRadius(radius);
             //update uniform buffer
             glBindBuffer(GL_UNIFORM_BUFFER, m_uniform_lights);
-            glBufferSubData(GL_UNIFORM_BUFFER, m_lights.size()*4*align + light*align, sizeof(float), &radius); 
+            glBufferSubData(GL_UNIFORM_BUFFER, m_light_capacity*4*align + light*align, sizeof(float), &radius); 
         }
     }
 
@@ -422,6 +587,93 @@ public:
         m_objects[obj_name]->SetGInstances(count); 
     }
 
+    ///@brief Toggle use of mesh detail levels
+    void UseLOD(bool flag = true){
+        m_useLOD = flag;
+    }
+    ///@brief Set LOD switch thresholds - projected object size (relative to screen height) under which
+    ///detail levels 1, 2 and 3 are used
+    void SetLODThresholds(float lod1, float lod2, float lod3){
+        m_lod_threshold[0] = lod1;
+        m_lod_threshold[1] = lod2;
+        m_lod_threshold[2] = lod3;
+    }
+    ///@brief Set projected object size (relative to screen height) under which materials use reduced
+    ///shading variant (0 - always full shading). Variants are generated only when shading LOD is on
+    ///before materials are baked
+    void SetShadingLOD(float size = SHADING_LOD_SIZE){
+        m_shading_lod = size;
+        TMaterial::UseShadingLOD(size > 0.0f);
+    }
+    ///@brief Set size of per-object light lists - every object is lit by lights with the largest
+    ///contribution to its bounding sphere (0 - all lights). Must be set before materials are baked
+    void SetObjectLights(int count = OBJECT_LIGHT_COUNT){
+        m_object_lights = min(count, MAX_OBJECT_LIGHTS);
+        TMaterial::UseObjectLights(m_object_lights);
+    }
+    ///@brief Toggle per-cluster frustum and backface culling of large meshes
+    void UseClusterCulling(bool flag = true){
+        m_useClusterCulling = flag;
+    }
+    ///@brief Toggle background loading of textures (must be set before textures are added)
+    void UseTextureStreaming(bool flag = true){
+        TTextureStreamer::Enable(flag);
+    }
+    ///@brief Toggle CPU block compression of textures with disk cache (must be set before textures are added)
+    void UseTextureCompression(bool flag = true){
+        Texture::UseCompression(flag);
+    }
+    ///@brief Set directory of shader program binaries (NULL - don't cache programs). Must be set
+    ///before materials are baked
+    void SetShaderCache(const char *dir){
+        SetProgramCacheDir(dir);
+    }
+    ///@brief Toggle asynchronous baking - first frame doesn't wait for compilation of materials,
+    ///they are drawn with generic uber-shader until their programs are linked
+    void UseAsyncBaking(bool flag = true){
+        m_asyncBaking = flag;
+    }
+    ///@brief Toggle lazy baking - materials of objects are baked when first object using them passes
+    ///view frustum culling (must be set before PostInit())
+    void UseLazyBaking(bool flag = true){
+        m_lazyBaking = flag;
+    }
+    ///@brief Bake material in PostInit() even with lazy baking (critical materials)
+    void PreloadMaterial(const char *name){
+        m_preload_materials.insert(name);
+    }
+    ///@brief Toggle clustered forward lighting of local point lights (must be set before materials
+    ///are baked). Point lights are added by AddPointLight()
+    void UseClusteredLights(bool flag = true){
+        if(flag && m_clusters == NULL)
+            m_clusters = new TLightClusters();
+        else if(!flag)
+        {
+            delete m_clusters;
+            m_clusters = NULL;
+        }
+        TMaterial::UseClusteredLights(flag);
+    }
+    ///@brief Toggle diffuse irradiance of prefiltered environment cube maps in per-pixel lit materials
+    ///(must be set before materials are baked)
+    void UseEnvIrradiance(bool flag = true){
+        Texture::UseIrradiance(flag);
+    }
+    ///@brief Toggle packing of base maps with the same size and format into texture arrays (done in
+    ///PostInit(), streamed textures are finished first)
+    void UseTextureArrays(bool flag = true){
+        m_useTextureArrays = flag;
+    }
+    ///@brief Set video memory budget for textures in megabytes (0 - unlimited). Least recently used
+    ///textures over budget lose top mip levels
+    void SetTextureBudget(unsigned megabytes){
+        SceneManager::Instance()->SetTextureBudget((size_t)megabytes*1024*1024);
+    }
+    ///@brief Set LOD bias for shadow passes (projected size is multiplied by bias, <1.0 - coarser meshes)
+    void SetShadowLODBias(float bias){
+        m_lod_shadow_bias = bias;
+    }
+
 
 
     /////////////////////////////////////// MATERIALS&TEXTURES /////////////////////////////////
@@ -451,6 +703,13 @@ public:
         GLint textype = BASE, GLint texmode = MODULATE, GLfloat intensity = 1.0, GLfloat tileX = 1.0, GLfloat tileY = 1.0, bool mipmap = true, bool aniso = false);
 
 
+    //create virtual texture of scene
+    TVirtualTexture* CreateVirtualTexture(unsigned pages, TTileGenerator generator, void *data);
+    //add virtual texture to material
+    void AddVirtualTexture(const char *mat_name, GLint texmode = MODULATE, GLfloat intensity = 1.0);
+    //set object's rectangle in virtual texture
+    void SetVirtualRect(const char *obj_name, glm::vec4 rect);
+
     //bind material to object
     void SetMaterial(const char* obj_name, const char *mat_name);
     ///@brief Set material transparency
@@ -493,8 +752,10 @@ public:
     ///@brief Force regeneration of all materials
     void BakeAllMaterials(){ 
         for(m_im = m_materials.begin(); m_im != m_materials.end(); ++m_im)
-            m_im->second->BakeMaterial(m_lights.size()); 
+            m_im->second->BakeMaterial(m_light_capacity); 
     }
+    //write cost report of generated shaders (CSV or JSON)
+    bool ReportShaders(const char *path);
 
     ///@brief Set material color
     void SetMaterialColor(const char *name, int component, glm::vec3 color){
@@ -514,13 +775,24 @@ public:
     void RenderShadowMap(TLight *l);
     //render shadow map (omnidirectional, dual-paraboloid)
     void RenderShadowMapOmni(TLight *l);
+    //render invalidated region of shadow atlas
+    void RenderShadowRegion(unsigned region, const char *shadow_mat);
+    //size of shadow atlas region of light
+    int ShadowRegionSize(TLight *l);
+    //update layout and views of shadow atlas, render invalidated shadow maps
+    void UpdateShadowAtlas();
+
+    ///@brief Set size of shadow atlas (before shadow maps are created in TScene::PostInit())
+    void SetShadowAtlasSize(int size){
+        m_shadow_atlas_size = size;
+    }
 
     ///@brief Set shadow parameters(shadow size and intensity) for selected light (by index)
     ///(see TLight::SetShadow()
     void SetShadow(GLint lightNum, GLint shadow_size = 2048, int type = SPOT, 
                    GLfloat _shadow_intensity = 0.5, bool shadow = true){
         m_useShadows = true;
-        if(lightNum < 0 || (unsigned)lightNum > m_lights.size()) 
+        if(lightNum < 0 || (unsigned)lightNum >= m_lights.size()) 
             cerr<<"WARNING: no light with index "<<lightNum<<"\n";
         else 
         {
@@ -631,6 +903,22 @@ public:
         m_useSSAO = flag; 
         m_useNormalBuffer = flag;        
     }
+    ///@brief Toggle G-buffer for deferred lighting of local point lights (must be set before render
+    ///target is created, requires clustered lights and no multisampling). Materials write albedo,
+    ///octahedral normal, material parameters and depth into additional render targets
+    void UseGBuffer(bool flag = true){
+        m_useGBuffer = flag;
+        TMaterial::UseGBuffer(flag);
+    }
+    ///@brief Toggle deferred lighting at runtime - local point lights are accumulated from G-buffer
+    ///by screen pass instead of light loops of materials (forward path is used without G-buffer)
+    void UseDeferredLighting(bool flag = true){
+        m_useDeferredLights = flag;
+    }
+    ///@brief Are local lights accumulated by deferred pass in this frame?
+    bool IsDeferredLighting(){
+        return m_useDeferredLights && m_useGBuffer && m_clusters != NULL && m_f_buffer != 0;
+    }
 
 
     ///////////////////////////////////// TEXT ////////////////////////////////////////////////
@@ -649,6 +937,10 @@ public:
     int GetResY(){ 
         return m_resy; 
     }
+    ///@brief Get rendering statistics of last frame
+    const TRenderStats& GetStats(){
+        return m_stats;
+    }
 
 };
 
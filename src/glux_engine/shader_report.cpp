@@ -0,0 +1,198 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: shader_report.cpp
+@brief cost analysis of generated shaders - source statistics, texture fetches, light loops and
+shadow taps, compiled program statistics (when driver exposes them). Report is ranked by estimated cost.
+****************************************************************************************************
+***************************************************************************************************/
+#include "shader_report.h"
+
+/**
+****************************************************************************************************
+@brief Count calls of function in shader code
+@param code shader code
+@param func function name with opening parenthesis
+@return number of call sites
+****************************************************************************************************/
+static unsigned CountCalls(const string &code, const char *func)
+{
+    unsigned count = 0;
+    size_t len = strlen(func);
+    for(size_t pos = code.find(func); pos != string::npos; pos = code.find(func, pos + len))
+    {
+        //name must not be end of longer identifier
+        if(pos == 0 || !(isalnum((unsigned char)code[pos - 1]) || code[pos - 1] == '_'))
+            count++;
+    }
+    return count;
+}
+
+/**
+****************************************************************************************************
+@brief Return value of integer constant (#define or const int) defined in shader source
+@param source shader source
+@param name constant name
+@return constant value, 1 if constant isn't defined
+****************************************************************************************************/
+static unsigned ParseConstant(const string &source, const char *name)
+{
+    size_t len = strlen(name);
+    for(size_t pos = source.find(name); pos != string::npos; pos = source.find(name, pos + len))
+    {
+        size_t value = source.find_first_not_of(" \t=", pos + len);
+        if(value != string::npos && isdigit((unsigned char)source[value]))
+            return atoi(source.c_str() + value);
+    }
+    return 1;
+}
+
+/**
+****************************************************************************************************
+@brief Return texture fetches of main function. Fetches of library functions (data/shaders/func)
+are counted by their calls.
+@param main main function of shader
+****************************************************************************************************/
+static unsigned CountFetches(const string &main)
+{
+    const char *fetches[] = { "texture(", "textureLod(", "textureProj(", "textureCube(", "texelFetch(", "textureGrad(" };
+    unsigned count = 0;
+    for(unsigned i=0; i<sizeof(fetches)/sizeof(fetches[0]); i++)
+        count += CountCalls(main, fetches[i]);
+    //environment mapping: one fetch, virtual texture: page table and tile cache
+    count += CountCalls(main, "envMapping(");
+    count += 2 * CountCalls(main, "VirtualTexture(");
+    return count;
+}
+
+/**
+****************************************************************************************************
+@brief Analyze generated shader - count texture fetches, shadow taps and light loop iterations
+(light loop runs over lights in scene) and estimate shader cost. Cost is weighted per-fragment work.
+@param vertex vertex shader source
+@param fragment fragment shader source
+@param light_count lights in scene
+@param cost output cost (material, variant and features are set by caller)
+****************************************************************************************************/
+void AnalyzeShaderSource(const string &vertex, const string &fragment, unsigned light_count, TShaderCost &cost)
+{
+    size_t vpos = vertex.find("void main()"), fpos = fragment.find("void main()");
+    string vmain = vpos != string::npos ? vertex.substr(vpos) : "";
+    string fmain = fpos != string::npos ? fragment.substr(fpos) : "";
+
+    cost.vertex_size = vertex.size();
+    cost.fragment_size = fragment.size();
+    cost.texture_fetches = CountFetches(fmain);
+    cost.vertex_fetches = CountFetches(vmain);
+    cost.vertex_lights = CountCalls(vmain, "LightModel(") * light_count;
+    cost.fragment_lights = CountCalls(fmain, "LightModel(") * light_count;
+
+    //shadow maps: PCF kernel of spot (PCFShadow) or omnidirectional lights (ShadowOMNI)
+    unsigned spot = CountCalls(fmain, "PCFShadow("), omni = CountCalls(fmain, "ShadowOMNI(");
+    cost.pcf_kernel = 0;
+    if(spot > 0)
+        cost.pcf_kernel = fragment.find("#define SHADOW_SINGLE_TAP") != string::npos ? 1 : ParseConstant(fragment, "PCF_SAMPLES");
+    else if(omni > 0)
+        cost.pcf_kernel = fragment.find("#define USE_PCF") != string::npos ? ParseConstant(fragment, "PCF_SAMPLES") : 1;
+    cost.shadow_taps = (spot + omni) * cost.pcf_kernel * cost.pcf_kernel;
+
+    cost.instructions = cost.registers = -1;
+    cost.cost = SHADER_COST_FETCH * (cost.texture_fetches + cost.shadow_taps) +
+                SHADER_COST_FRAGMENT_LIGHT * cost.fragment_lights +
+                SHADER_COST_VERTEX * (cost.vertex_lights + cost.vertex_fetches);
+}
+
+/**
+****************************************************************************************************
+@brief Get statistics of compiled program. Driver doesn't have standard query for them, but some
+drivers (NVIDIA) store assembly of every stage into program binary with comment
+"# N instructions, M R-regs". Instructions of stages are summed, registers are maximum.
+@param program linked program
+@param instructions output instruction count
+@param registers output register count
+@return false if driver doesn't expose statistics
+****************************************************************************************************/
+bool GetProgramStats(GLuint program, int &instructions, int &registers)
+{
+    instructions = registers = -1;
+    if(!GLEW_ARB_get_program_binary)
+        return false;
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
+        return false;
+
+    vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(program, length, &length, &format, &binary[0]);
+    string text(binary.begin(), binary.begin() + length);
+
+    const char *tag = " instructions, ";
+    for(size_t pos = text.find(tag); pos != string::npos; pos = text.find(tag, pos + 1))
+    {
+        size_t start = pos;
+        while(start > 0 && isdigit((unsigned char)text[start - 1]))
+            start--;
+        if(start == pos)
+            continue;
+        instructions = max(instructions, 0) + atoi(text.c_str() + start);
+        registers = max(registers, atoi(text.c_str() + pos + strlen(tag)));
+    }
+    return instructions >= 0;
+}
+
+///@brief Sort shaders from the most expensive
+static bool CompareCost(const TShaderCost &a, const TShaderCost &b)
+{
+    return a.cost > b.cost;
+}
+
+/**
+****************************************************************************************************
+@brief Write shader report ranked by estimated cost. Format is chosen by file extension: JSON for
+.json, otherwise CSV.
+@param path output file
+@param costs costs of shaders (sorted by this function)
+@return false if file cannot be written
+****************************************************************************************************/
+bool WriteShaderReport(const char *path, vector<TShaderCost> &costs)
+{
+    ofstream fout(path);
+    if(!fout)
+        return false;
+    sort(costs.begin(), costs.end(), CompareCost);
+
+    string file = path;
+    bool json = file.size() >= 5 && file.compare(file.size() - 5, 5, ".json") == 0;
+    if(json)
+        fout<<"[\n";
+    else
+        fout<<"rank,material,variant,cost,features,vertex_bytes,fragment_bytes,texture_fetches,vertex_fetches,"
+              "shadow_taps,pcf_kernel,vertex_lights,fragment_lights,instructions,registers\n";
+
+    for(unsigned i=0; i<costs.size(); i++)
+    {
+        const TShaderCost &c = costs[i];
+        const char *variant = c.variant == SHADING_REDUCED ? "reduced" : "full";
+        if(json)
+        {
+            fout<<"  {\"rank\": "<<i + 1<<", \"material\": \""<<c.material<<"\", \"variant\": \""<<variant
+                <<"\", \"cost\": "<<c.cost<<", \"features\": \""<<c.features<<"\", \"vertex_bytes\": "<<c.vertex_size
+                <<", \"fragment_bytes\": "<<c.fragment_size<<", \"texture_fetches\": "<<c.texture_fetches
+                <<", \"vertex_fetches\": "<<c.vertex_fetches<<", \"shadow_taps\": "<<c.shadow_taps
+                <<", \"pcf_kernel\": "<<c.pcf_kernel<<", \"vertex_lights\": "<<c.vertex_lights
+                <<", \"fragment_lights\": "<<c.fragment_lights<<", \"instructions\": "<<c.instructions
+                <<", \"registers\": "<<c.registers<<"}"<<(i + 1 < costs.size() ? ",\n" : "\n");
+        }
+        else
+        {
+            fout<<i + 1<<","<<c.material<<","<<variant<<","<<c.cost<<","<<c.features<<","<<c.vertex_size<<","
+                <<c.fragment_size<<","<<c.texture_fetches<<","<<c.vertex_fetches<<","<<c.shadow_taps<<","
+                <<c.pcf_kernel<<","<<c.vertex_lights<<","<<c.fragment_lights<<","<<c.instructions<<","
+                <<c.registers<<"\n";
+        }
+    }
+    if(json)
+        fout<<"]\n";
+    return true;
+}
@@ -0,0 +1,48 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: shader_report.h
+@brief cost analysis of generated shaders - source statistics, texture fetches, light loops and
+shadow taps, compiled program statistics (when driver exposes them). Report is ranked by estimated cost.
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _SHADER_REPORT_H_
+#define _SHADER_REPORT_H_
+
+#include "globals.h"
+
+///weights of estimated cost: texture fetch (also shadow tap), light loop iteration per fragment and
+///per vertex (vertices are much fewer than fragments)
+#define SHADER_COST_FETCH 4.0f
+#define SHADER_COST_FRAGMENT_LIGHT 8.0f
+#define SHADER_COST_VERTEX 1.0f
+
+///@brief Cost of one generated shader (shading variant of material)
+struct TShaderCost{
+    string material;
+    ///shading variant (SHADING_FULL, SHADING_REDUCED)
+    int variant;
+    ///active features separated by '+' (light model, texture types...)
+    string features;
+    ///size of vertex and fragment source in bytes
+    unsigned vertex_size, fragment_size;
+    ///texture fetches per fragment (without shadow maps) and per vertex
+    unsigned texture_fetches, vertex_fetches;
+    ///shadow map lookups per fragment, PCF kernel size (kernel x kernel taps per shadow map)
+    unsigned shadow_taps, pcf_kernel;
+    ///light loop iterations per vertex and per fragment
+    unsigned vertex_lights, fragment_lights;
+    ///instructions and registers of compiled program reported by driver (-1 - not exposed)
+    int instructions, registers;
+    ///estimated cost (see SHADER_COST_* weights)
+    float cost;
+};
+
+//analyze generated shader source
+void AnalyzeShaderSource(const string &vertex, const string &fragment, unsigned light_count, TShaderCost &cost);
+//get statistics of compiled program from its binary (false if driver doesn't expose them)
+bool GetProgramStats(GLuint program, int &instructions, int &registers);
+//write report ranked by estimated cost (CSV, JSON for .json extension)
+bool WriteShaderReport(const char *path, vector<TShaderCost> &costs);
+
+#endif
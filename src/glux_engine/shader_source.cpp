@@ -0,0 +1,159 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: shader_source.cpp
+@brief loading of shader and kernel sources - files are read once and cached by path and
+modification time, #include "file" directives are resolved (relative to including file)
+****************************************************************************************************
+***************************************************************************************************/
+#include "shader_source.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+///@brief Cached source file
+struct TSourceFile{
+    string text;
+    ///modification time of file when it was read
+    time_t mtime;
+};
+
+static map<string,TSourceFile> source_cache;
+static TShaderSourceStats source_stats = {0, 0, 0};
+//materials are generated on worker threads
+static SDL_mutex *source_mutex = SDL_CreateMutex();
+
+/**
+****************************************************************************************************
+@brief Return file content from cache, file is read (in one block) when it isn't cached or has
+been modified since. Caller must hold source_mutex.
+@param path file path
+@param text output file content
+@return false if file cannot be read
+****************************************************************************************************/
+static bool ReadSourceFile(const string &path, string &text)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0)
+        return false;
+
+    map<string,TSourceFile>::iterator it = source_cache.find(path);
+    if(it != source_cache.end() && it->second.mtime == st.st_mtime)
+    {
+        source_stats.hits++;
+        text = it->second.text;
+        return true;
+    }
+
+    ifstream fin(path.c_str(), ios::binary);
+    if(!fin)
+        return false;
+    text.resize((size_t)st.st_size);
+    if(!text.empty())
+    {
+        fin.read(&text[0], text.size());
+        text.resize((size_t)fin.gcount());
+    }
+    source_stats.reads++;
+    source_stats.bytes += text.size();
+
+    TSourceFile &file = source_cache[path];
+    file.text = text;
+    file.mtime = st.st_mtime;
+    return true;
+}
+
+/**
+****************************************************************************************************
+@brief Append file to source and replace its #include "file" lines by content of included files.
+Every file is included only once (guards against include cycles).
+@param path file path
+@param source output source
+@param included files already included into source
+@param depth include depth
+@return false if file or some included file cannot be read
+****************************************************************************************************/
+static bool ResolveSource(const string &path, string &source, vector<string> &included, int depth)
+{
+    string text;
+    if(depth > SHADER_INCLUDE_DEPTH || !ReadSourceFile(path, text))
+    {
+        if(depth > 0)
+            cerr<<"WARNING (LoadShaderSource): cannot include "<<path<<"\n";
+        return false;
+    }
+    included.push_back(path);
+    //included files are relative to including file
+    string dir = path.substr(0, path.find_last_of("/\\") + 1);
+
+    size_t pos = 0;
+    while(pos < text.size())
+    {
+        size_t end = text.find('\n', pos);
+        end = (end == string::npos) ? text.size() : end + 1;
+
+        //#include "file" directive
+        size_t first = text.find_first_not_of(" \t", pos);
+        if(first < end && text.compare(first, 8, "#include") == 0)
+        {
+            size_t q1 = text.find('"', first + 8);
+            size_t q2 = (q1 < end) ? text.find('"', q1 + 1) : string::npos;
+            if(q2 < end)
+            {
+                string file = dir + text.substr(q1 + 1, q2 - q1 - 1);
+                if(find(included.begin(), included.end(), file) == included.end())
+                {
+                    if(!ResolveSource(file, source, included, depth + 1))
+                        return false;
+                    source += "\n";
+                }
+                pos = end;
+                continue;
+            }
+        }
+        source.append(text, pos, end - pos);
+        pos = end;
+    }
+    return true;
+}
+
+/**
+****************************************************************************************************
+@brief Load shader (or kernel) source file with resolved #include "file" directives. Files are
+cached, so shared function libraries are read from disk only once. Can be called from any thread.
+@param path file path
+@param source output source
+@return false if file or some included file cannot be read
+****************************************************************************************************/
+bool LoadShaderSource(const string &path, string &source)
+{
+    vector<string> included;
+    source.clear();
+    SDL_mutexP(source_mutex);
+    bool ok = ResolveSource(path, source, included, 0);
+    SDL_mutexV(source_mutex);
+    return ok;
+}
+
+/**
+****************************************************************************************************
+@brief Drop all cached files (they are read again on next load)
+****************************************************************************************************/
+void ClearShaderSources()
+{
+    SDL_mutexP(source_mutex);
+    source_cache.clear();
+    SDL_mutexV(source_mutex);
+}
+
+/**
+****************************************************************************************************
+@brief Return source statistics
+****************************************************************************************************/
+TShaderSourceStats GetShaderSourceStats()
+{
+    SDL_mutexP(source_mutex);
+    TShaderSourceStats stats = source_stats;
+    SDL_mutexV(source_mutex);
+    return stats;
+}
@@ -0,0 +1,32 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: shader_source.h
+@brief loading of shader and kernel sources - files are read once and cached by path and
+modification time, #include "file" directives are resolved (relative to including file)
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _SHADER_SOURCE_H_
+#define _SHADER_SOURCE_H_
+
+#include "globals.h"
+
+///maximal depth of nested includes
+#define SHADER_INCLUDE_DEPTH 16
+
+///@brief Shader source statistics
+struct TShaderSourceStats{
+    ///files read from disk, loads served from cache
+    unsigned reads, hits;
+    ///bytes read from disk
+    size_t bytes;
+};
+
+//load source file with resolved includes (thread safe)
+bool LoadShaderSource(const string &path, string &source);
+//drop cached files
+void ClearShaderSources();
+//source statistics
+TShaderSourceStats GetShaderSourceStats();
+
+#endif
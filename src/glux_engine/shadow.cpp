@@ -10,7 +10,18 @@
 
 /**
 ****************************************************************************************************
-@brief Creates shadow map for selected light. Shadow map parameters are stored in TLight object
+@brief Return projection of spot light shadow map
+****************************************************************************************************/
+static glm::mat4 SpotProjection()
+{
+    return glm::perspective(90.0f, 1.0f, 1.0f, 1000.0f);
+}
+
+/**
+****************************************************************************************************
+@brief Creates shadow map for selected light. Shadow maps are regions of shadow atlas (created with
+first shadow map), omni light has two regions (front and back paraboloid). Atlas texture and regions
+are stored in TLight object.
 @param ii iterator to lights list
 @return success/fail of shadow creation
 ****************************************************************************************************/
@@ -18,191 +29,294 @@ bool TScene::CreateShadowMap(vector<TLight*>::iterator ii)
 {
     cout<<"Shadow Map for light "<<(*ii)->GetOrd()<<": "<<(*ii)->ShadowSize()<<"x"<<(*ii)->ShadowSize()<<endl;
 
-    ///1. generate depth texture for shadow map with desired dimensions for current light. Use cubemap for omni light
-    ///2. set depth texture parameters
-    if((*ii)->GetType() == SPOT)
+    ///1. create shadow atlas with depth cache of static casters
+    if(m_shadow_atlas == NULL)
     {
-        glGenTextures(1, (*ii)->GetShadowTexID());
-        glBindTexture(GL_TEXTURE_2D, *(*ii)->GetShadowTexID());
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, (*ii)->ShadowSize(), (*ii)->ShadowSize(), 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, NULL);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        m_shadow_atlas = new TShadowAtlas();
+        if(!m_shadow_atlas->Create(m_shadow_atlas_size))
+        {
+            ShowMessage("ERROR: FBO creation for shadow atlas failed!",false);
+            return false;
+        }
     }
-    else if((*ii)->GetType() == OMNI)
+
+    ///2. add regions of light (layout is computed in every frame by TScene::UpdateShadowAtlas())
+    (*ii)->SetShadowRegion(m_shadow_atlas->GetRegionCount());
+    for(int i = 0; i < (*ii)->GetShadowRegionCount(); i++)
+        m_shadow_atlas->AddRegion((*ii)->ShadowSize());
+    (*ii)->SetShadowTexID(m_shadow_atlas->GetTexture());
+
+    return true;
+}
+
+
+/**
+****************************************************************************************************
+@brief Return size of light's shadow atlas region. Requested shadow size is importance of light,
+it is scaled by screen coverage of light (projected radius relative to screen height) and rounded
+to power of two
+@param l light with shadow
+@return region size
+****************************************************************************************************/
+int TScene::ShadowRegionSize(TLight *l)
+{
+    glm::vec3 pos = glm::vec3(m_viewMatrix * glm::vec4(l->GetPos(), 1.0f));
+    float dist = glm::length(pos), radius = l->GetRadius();
+    float coverage = 1.0f;
+    if(dist > radius)
+        coverage = min(1.0f, radius / (dist * tan(m_fovy * PI / 360.0f)));
+
+    int size = SHADOW_ATLAS_MIN;
+    while(size < l->ShadowSize() * coverage)
+        size *= 2;
+    return size;
+}
+
+
+/**
+****************************************************************************************************
+@brief Update shadow atlas. Regions are resized by screen coverage of lights and atlas is repacked,
+light views are updated and regions are invalidated: static depth when light moved or region moved
+in atlas, dynamic casters when caster in region (or drawn into it) changed its transformation.
+Object which moves for the first time becomes dynamic caster and static depth of all regions is
+rendered again. Invalidated regions are rendered, others keep their depth from previous frames.
+****************************************************************************************************/
+void TScene::UpdateShadowAtlas()
+{
+    m_stats.shadow_maps = m_stats.shadow_maps_static = 0;
+    if(m_shadow_atlas == NULL)
+        return;
+
+    ///1. region sizes by importance and screen coverage, repack atlas when they change
+    vector<TLight*> lights;
+    for(m_il = m_lights.begin(); m_il != m_lights.end(); ++m_il)
+    {
+        if((*m_il)->IsCastingShadow() && (*m_il)->GetShadowRegion() >= 0)
+        {
+            lights.push_back(*m_il);
+            int size = ShadowRegionSize(*m_il);
+            for(int i = 0; i < (*m_il)->GetShadowRegionCount(); i++)
+                m_shadow_atlas->Request((*m_il)->GetShadowRegion() + i, size);
+        }
+    }
+    if(m_shadow_atlas->Pack())
     {
-        //Array of shadow textures (front and back for each cascade)
-        glGenTextures(1, (*ii)->GetShadowTexID());
-        glBindTexture(GL_TEXTURE_2D_ARRAY, *(*ii)->GetShadowTexID());
-        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT, (*ii)->ShadowSize(), (*ii)->ShadowSize(), 2, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-        glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        //glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-        //glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        for(unsigned i = 0; i < lights.size(); i++)
+            for(int j = 0; j < lights[i]->GetShadowRegionCount(); j++)
+                lights[i]->GetShadowRect()[j] = m_shadow_atlas->GetRect(lights[i]->GetShadowRegion() + j);
     }
 
-    ///4. create framebuffer object and bind shadow texture into it
-    glGenFramebuffers(1, &(*ii)->fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, (*ii)->GetFBO());
-    //add shadow texture(s)
-    if((*ii)->GetType() == OMNI)
-        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, *(*ii)->GetShadowTexID(), 0, 0);    //attach first texture layer
-    else
-        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, *(*ii)->GetShadowTexID(), 0);
-    glDrawBuffer(GL_NONE); 
-    glReadBuffer(GL_NONE);
-    //check FBO creation
-    if(!CheckFBO())
+    ///2. light views and frustum planes (light moved -> static depth is invalid)
+    for(unsigned i = 0; i < lights.size(); i++)
     {
-        ShowMessage("ERROR: FBO creation for shadow map failed!",false);
-        return false;
+        TLight *l = lights[i];
+        for(int j = 0; j < l->GetShadowRegionCount(); j++)
+        {
+            glm::mat4 view;
+            glm::vec4 planes[6];
+            if(l->GetType() == OMNI)
+            {
+                //look point at original DPSM, paraboloid is rotated by its angle
+                float z_direction = (j == 0) ? 1.0f : -1.0f;
+                view = glm::lookAt(l->GetPos(), l->GetPos() + glm::vec3(m_far_p*z_direction, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+                glm::mat4 Mp = glm::mat4(1.0);
+                Mp = glm::rotate(Mp, z_direction*m_parab_angle.x, glm::vec3(1, 0, 0));
+                Mp = glm::rotate(Mp, m_parab_angle.y, glm::vec3(0, 1, 0));
+                view = Mp * view;
+                //paraboloid covers hemisphere in front of light (clip plane) up to far shadow plane
+                planes[0] = glm::vec4(0.0f, 0.0f, -1.0f, 0.0f);
+                planes[1] = glm::vec4(0.0f, 0.0f, 1.0f, SHADOW_FAR);
+                for(int k = 2; k < 6; k++)
+                    planes[k] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            }
+            else
+            {
+                view = glm::lookAt(l->GetPos(), glm::vec3(0.0), glm::vec3(0.0f, 1.0f, 0.0f));
+                ExtractFrustumPlanes(SpotProjection(), planes);
+            }
+
+            TShadowRegion &r = m_shadow_atlas->GetRegion(l->GetShadowRegion() + j);
+            if(view != r.view)
+                r.static_dirty = true;
+            r.view = view;
+            copy(planes, planes + 6, r.planes);
+        }
     }
 
-    return true;
+    ///3. moved casters invalidate regions
+    vector<TObject*> moved;
+    for(m_io = m_objects.begin(); m_io != m_objects.end(); ++m_io)
+    {
+        TObject *obj = m_io->second;
+        if(!obj->IsTransformDirty())
+            continue;
+        obj->ClearTransformDirty();
+        if(!obj->IsShadow() || obj->GetSceneID() != m_sceneID)
+            continue;
+        //static caster is cached at its previous position in all regions
+        if(!obj->IsDynamic())
+        {
+            obj->SetDynamic();
+            for(unsigned i = 0; i < m_shadow_atlas->GetRegionCount(); i++)
+                m_shadow_atlas->GetRegion(i).static_dirty = true;
+        }
+        moved.push_back(obj);
+    }
+    for(unsigned i = 0; i < m_shadow_atlas->GetRegionCount() && !moved.empty(); i++)
+    {
+        TShadowRegion &r = m_shadow_atlas->GetRegion(i);
+        for(unsigned j = 0; j < moved.size() && !r.dirty; j++)
+        {
+            if(find(r.casters.begin(), r.casters.end(), moved[j]) != r.casters.end() ||
+               IsVisible(moved[j], r.view * moved[j]->GetMatrix(), r.planes))
+                r.dirty = true;
+        }
+    }
+
+    ///4. render invalidated shadow maps
+    for(unsigned i = 0; i < lights.size(); i++)
+    {
+        if(lights[i]->GetType() == OMNI)
+            RenderShadowMapOmni(lights[i]);
+        else 
+            RenderShadowMap(lights[i]);
+    }
+    m_stats.atlas_occupancy = m_shadow_atlas->GetOccupancy();
 }
 
 
 /**
 ****************************************************************************************************
-@brief Draws scene to shadow map (for spotlight)
-@param l current light
+@brief Render invalidated region of shadow atlas. Static casters are rendered into depth cache only
+when region's static depth is invalid, cached depth is then copied into atlas and dynamic casters are
+drawn over it. Light view and shader uniforms must be set.
+@param region region index
+@param shadow_mat depth-only material
 ****************************************************************************************************/
-void TScene::RenderShadowMap(TLight *l)
+void TScene::RenderShadowRegion(unsigned region, const char *shadow_mat)
 {
-    ///1. set light projection and light view matrix
-    glm::mat4 lightProjMatrix = glm::perspective(90.0f, 1.0f, 1.0f, 1000.0f);
-    glm::mat4 lightViewMatrix = glm::lookAt(l->GetPos(), glm::vec3(0.0), glm::vec3(0.0f, 1.0f, 0.0f) );
-
+    TShadowRegion &r = m_shadow_atlas->GetRegion(region);
+    bool static_dirty = r.static_dirty;
+    if(!static_dirty && !r.dirty)
+        return;
+    r.static_dirty = r.dirty = false;
+    //region doesn't fit into atlas - light has no shadow
+    if(r.rect.z == 0)
+        return;
+
+    if(static_dirty)
+    {
+        m_shadow_atlas->BeginStatic(region);
+        DrawSceneDepth(shadow_mat, r.view, SHADOW_CASTERS_STATIC, r.planes);
+        m_stats.shadow_maps_static++;
+    }
+    m_shadow_atlas->BeginDynamic(region);
+    DrawSceneDepth(shadow_mat, r.view, SHADOW_CASTERS_DYNAMIC, r.planes);
+    m_shadow_atlas->End();
+    m_stats.shadow_maps++;
+
+    //dynamic casters in region (region is invalidated when they move)
+    r.casters.clear();
+    for(m_io = m_objects.begin(); m_io != m_objects.end(); ++m_io)
+    {
+        TObject *obj = m_io->second;
+        if(obj->IsDynamic() && obj->IsShadow() && obj->GetSceneID() == m_sceneID &&
+           IsVisible(obj, r.view * obj->GetMatrix(), r.planes))
+            r.casters.push_back(obj);
+    }
+}
 
-    glBindBuffer(GL_UNIFORM_BUFFER, m_uniform_matrices);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(lightProjMatrix));
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-    ///2.bind framebuffer to draw into and draw scene from light point of view
-    glBindFramebuffer(GL_FRAMEBUFFER, l->GetFBO());
+/**
+****************************************************************************************************
+@brief Draws scene to shadow map (for spotlight). Region of shadow atlas is rendered only when it
+was invalidated, shadow matrix is updated every frame (it includes camera).
+@param l current light
+****************************************************************************************************/
+void TScene::RenderShadowMap(TLight *l)
+{
+    ///1. set light projection (light view is set by TScene::UpdateShadowAtlas())
+    glm::mat4 lightProjMatrix = SpotProjection();
+    TShadowRegion &r = m_shadow_atlas->GetRegion(l->GetShadowRegion());
 
-    ///draw only back faces of polygons
-    glCullFace(GL_FRONT);
-    glColorMask(0, 0, 0, 0);      //disable colorbuffer write
-    glClear(GL_DEPTH_BUFFER_BIT);
+    ///2. draw scene from light point of view into atlas region
+    if(r.static_dirty || r.dirty)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, m_uniform_matrices);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(lightProjMatrix));
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-    //set viewport, draw scene
-    glViewport(0, 0, l->ShadowSize(), l->ShadowSize());
+        ///draw only back faces of polygons
+        glCullFace(GL_FRONT);
+        glColorMask(0, 0, 0, 0);      //disable colorbuffer write
 
-    ///All scene is drawn without materials and lighting (only depth values and alpha tests are needed)
-    DrawSceneDepth("_mat_default_shadow", lightViewMatrix);
+        ///All scene is drawn without materials and lighting (only depth values and alpha tests are needed)
+        RenderShadowRegion(l->GetShadowRegion(), "_mat_default_shadow");
 
-    //Finish, restore values
-    glCullFace(GL_BACK);
-    glColorMask(1, 1, 1, 1);
-    glViewport(0, 0, m_resx, m_resy);         //reset viewport
+        //Finish, restore values
+        glCullFace(GL_BACK);
+        glColorMask(1, 1, 1, 1);
+        glViewport(0, 0, m_resx, m_resy);         //reset viewport
+    }
 
-    ///3. Calculate shadow texture matrix
-    glm::mat4 shadowMatrix = biasMatrix * lightProjMatrix * lightViewMatrix * glm::inverse(m_viewMatrix);
+    ///3. Calculate shadow texture matrix (in region coordinates)
+    glm::mat4 shadowMatrix = biasMatrix * lightProjMatrix * r.view * glm::inverse(m_viewMatrix);
 
     //restore projection matrix and set shadow matrices
     glBindBuffer(GL_UNIFORM_BUFFER, m_uniform_matrices);
     glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(m_projMatrix));
     glBufferSubData(GL_UNIFORM_BUFFER, (l->GetOrd() + 1) * sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(shadowMatrix));
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 
 /**
 ****************************************************************************************************
-@brief Draws scene to shadow map with dual-paraboloid mapping (for omnidirectional light)
+@brief Draws scene to shadow map with dual-paraboloid mapping (for omnidirectional light). Front and
+back paraboloids are regions of shadow atlas, they are rendered only when they were invalidated.
 @param l current light
 ****************************************************************************************************/
 void TScene::RenderShadowMapOmni(TLight *l)
 {
-    glm::vec3 l_pos = l->GetPos();
-    glm::mat4 lightViewMatrix[2];
-
-    //position of camera in eye space = 0.0
-    glm::vec3 cam_pos = glm::vec3(0.0);
-    //position of light in eye space
-    glm::vec3 l_pos_eye =  glm::vec3(m_viewMatrix * glm::vec4(l_pos, 1.0));
-    
-    glm::vec3 look_point = glm::vec3( glm::inverse(m_viewMatrix) * glm::vec4(0.0f, 0.0f, 1.0, 1.0));
+    const char *shadow_mat = m_dpshadow_tess ? "_mat_default_shadow_omni_tess" : "_mat_default_shadow_omni";
     float zoom[MAX_CASCADES];
-    bool in_frustum = true;
-
-    //OPTIMAL VIEW FRUSTUM COVERAGE CALCULATION
-    float FOV = 0.0;
+    glm::mat4 lightViewMatrix[2];
+    bool rendered = false;
     
     //TWO PASS - FRONT AND BACK
     for(int i=0; i<2; i++)
     {
-        if(!in_frustum && i == 1)    //if light is outside view frustum, draw only front paraboloid
-            break;
-
         zoom[i] = 1.0f;
+        unsigned region = l->GetShadowRegion() + i;
+        TShadowRegion &r = m_shadow_atlas->GetRegion(region);
+        lightViewMatrix[i] = r.view;
+        if(!r.static_dirty && !r.dirty)
+            continue;
 
-        float z_direction = 1.0;
-        if(i == 1)
-            z_direction = -1.0;                  
-
+        ///draw only back faces of polygons
+        if(!rendered)
         {
-            //look point at original DPSM
-            lightViewMatrix[i] = glm::lookAt(
-                l->GetPos(), 
-                l_pos + glm::vec3(glm::vec4(glm::vec3(m_far_p*z_direction, 0.0f, 0.0f), 1.0f)),                   
-                glm::vec3(0.0f, 1.0f, 0.0f) );
-            FOV = m_dp_FOV;
-
-            glm::mat4 Mp = glm::mat4( 1.0 );
-            Mp = glm::rotate( Mp, z_direction*m_parab_angle.x, glm::vec3(1, 0, 0));
-            Mp = glm::rotate( Mp, m_parab_angle.y, glm::vec3(0, 1, 0));
-
-            lightViewMatrix[i] = Mp * lightViewMatrix[i];
-
+            glCullFace(GL_FRONT);
+            glColorMask(0, 0, 0, 0);      //disable colorbuffer write
+            glEnable(GL_CLIP_PLANE0);
+            rendered = true;
         }
 
-        ///2.bind framebuffer to draw into and draw scene from light point of view
-        glBindFramebuffer(GL_FRAMEBUFFER, l->GetFBO());
-        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, *l->GetShadowTexID(), 0, i);
-
-        ///draw only back faces of polygons
-        glCullFace(GL_FRONT);
-        glColorMask(0, 0, 0, 0);      //disable colorbuffer write
-        glClear(GL_DEPTH_BUFFER_BIT);
-
-        //set viewport, draw scene
-        glViewport(0, 0, l->ShadowSize(), l->ShadowSize());
-        glEnable(GL_CLIP_PLANE0);
-
         ///All scene is drawn without materials and lighting (only depth values and alpha tests are needed)
         //set light position and zoom        
-        if(m_dpshadow_tess)
-        {
-            m_materials["_mat_default_shadow_omni_tess"]->SetUniform("near_far", glm::vec2(SHADOW_NEAR, SHADOW_FAR));
-            m_materials["_mat_default_shadow_omni_tess"]->SetUniform("ZOOM", zoom[i]);
-
-            DrawSceneDepth("_mat_default_shadow_omni_tess", lightViewMatrix[i]);
-        }
-        else
-        {
-            m_materials["_mat_default_shadow_omni"]->SetUniform("near_far", glm::vec2(SHADOW_NEAR, SHADOW_FAR));
-            m_materials["_mat_default_shadow_omni"]->SetUniform("ZOOM", zoom[i]);
-
-            DrawSceneDepth("_mat_default_shadow_omni", lightViewMatrix[i]);
-        }
+        m_materials[shadow_mat]->SetUniform("near_far", glm::vec2(SHADOW_NEAR, SHADOW_FAR));
+        m_materials[shadow_mat]->SetUniform("ZOOM", zoom[i]);
+        RenderShadowRegion(region, shadow_mat);
     }
 
     //Finish, restore values
-    glDisable( GL_CLIP_PLANE0 );
-    glCullFace(GL_BACK);
-    glColorMask(1, 1, 1, 1);
-    glViewport(0, 0, m_resx, m_resy);         //reset viewport
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if(rendered)
+    {
+        glDisable( GL_CLIP_PLANE0 );
+        glCullFace(GL_BACK);
+        glColorMask(1, 1, 1, 1);
+        glViewport(0, 0, m_resx, m_resy);         //reset viewport
+    }
 
     //set light matrices and near/far planes to all materials
     for(m_im = m_materials.begin(); m_im != m_materials.end(); ++m_im)
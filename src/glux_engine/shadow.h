@@ -17,6 +17,9 @@ const float SHADOW_FAR = 5000.0f;
 const int MAX_CASCADES = 5;             //maximum shadow cascade count
 const int F_POINTS = 4;                 //near/far point count
 
+///shadow casters drawn by TScene::DrawSceneDepth() (static casters are cached in shadow atlas)
+enum ShadowCasters{SHADOW_CASTERS_ALL, SHADOW_CASTERS_STATIC, SHADOW_CASTERS_DYNAMIC};
+
 //bias matrix
 const glm::mat4 biasMatrix = glm::mat4( 0.5f, 0.0f, 0.0f, 0.0f,
     0.0f, 0.5f, 0.0f, 0.0f,
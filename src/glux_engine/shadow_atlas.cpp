@@ -0,0 +1,218 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: shadow_atlas.cpp
+@brief shadow atlas - shadow maps of all lights are regions of one depth texture. Depth of static
+casters is cached in second texture, regions are re-rendered only when they are invalidated.
+****************************************************************************************************
+***************************************************************************************************/
+#include "shadow_atlas.h"
+
+/**
+****************************************************************************************************
+@brief Create empty atlas, textures are created by Create()
+****************************************************************************************************/
+TShadowAtlas::TShadowAtlas()
+{
+    m_size = 0;
+    m_textures[0] = m_textures[1] = 0;
+    m_fbos[0] = m_fbos[1] = 0;
+    m_occupancy = 0.0f;
+}
+
+/**
+****************************************************************************************************
+@brief Delete textures and framebuffers
+****************************************************************************************************/
+TShadowAtlas::~TShadowAtlas()
+{
+    if(m_textures[0] != 0)
+    {
+        glDeleteFramebuffers(2, m_fbos);
+        glDeleteTextures(2, m_textures);
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Create depth textures of atlas and static cache with framebuffers
+@param size atlas size in texels (power of two, limited by maximal texture size)
+@return success/fail of framebuffer creation
+****************************************************************************************************/
+bool TShadowAtlas::Create(int size)
+{
+    GLint max_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    m_size = max(min(size, (int)max_size), SHADOW_ATLAS_MIN);
+    cout<<"Shadow atlas: "<<m_size<<"x"<<m_size<<", static depth cache "<<m_size<<"x"<<m_size<<endl;
+
+    glGenTextures(2, m_textures);
+    glGenFramebuffers(2, m_fbos);
+    for(int i = 0; i < 2; i++)
+    {
+        glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, m_size, m_size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[i]);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_textures[i], 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            cerr<<"ERROR (TShadowAtlas::Create): framebuffer of shadow atlas is incomplete\n";
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            return false;
+        }
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return true;
+}
+
+/**
+****************************************************************************************************
+@brief Add region into atlas. Region gets its rectangle by next Pack().
+@param size requested size in texels (power of two)
+@return region index
+****************************************************************************************************/
+unsigned TShadowAtlas::AddRegion(int size)
+{
+    TShadowRegion r;
+    r.request = size;
+    r.rect = glm::ivec3(-1);
+    r.view = glm::mat4(0.0f);
+    r.static_dirty = r.dirty = true;
+    m_regions.push_back(r);
+    return m_regions.size() - 1;
+}
+
+/**
+****************************************************************************************************
+@brief Return coordinate from even bits of Z-order index
+****************************************************************************************************/
+static unsigned CompactBits(unsigned v)
+{
+    v &= 0x55555555;
+    v = (v ^ (v >> 1)) & 0x33333333;
+    v = (v ^ (v >> 2)) & 0x0f0f0f0f;
+    v = (v ^ (v >> 4)) & 0x00ff00ff;
+    v = (v ^ (v >> 8)) & 0x0000ffff;
+    return v;
+}
+
+/**
+****************************************************************************************************
+@brief Pack regions into atlas. Regions are placed from the largest along Z-order curve of
+SHADOW_ATLAS_MIN cells - every region starts at multiple of its cell count, so it is aligned
+quadtree node. Region which doesn't fit is halved (following regions are limited by its size).
+Regions whose rectangle changed must be rendered again.
+@return true if layout changed
+****************************************************************************************************/
+bool TShadowAtlas::Pack()
+{
+    //regions from the largest request (same requests keep their order)
+    vector<pair<int,unsigned> > order(m_regions.size());
+    for(unsigned i = 0; i < m_regions.size(); i++)
+        order[i] = make_pair(-m_regions[i].request, i);
+    sort(order.begin(), order.end());
+
+    unsigned side = m_size / SHADOW_ATLAS_MIN, total = side*side, next = 0, shrunk = 0;
+    int limit = m_size;
+    bool changed = false;
+    for(unsigned i = 0; i < order.size(); i++)
+    {
+        TShadowRegion &r = m_regions[order[i].second];
+        int size = max(SHADOW_ATLAS_MIN, min(r.request, limit));
+        unsigned cells = (size/SHADOW_ATLAS_MIN)*(size/SHADOW_ATLAS_MIN);
+        while(size > SHADOW_ATLAS_MIN && next + cells > total)
+        {
+            size /= 2;
+            cells /= 4;
+        }
+
+        glm::ivec3 rect(0);
+        if(next + cells <= total)
+        {
+            rect = glm::ivec3(CompactBits(next) * SHADOW_ATLAS_MIN, CompactBits(next >> 1) * SHADOW_ATLAS_MIN, size);
+            next += cells;
+            limit = size;
+        }
+        if(rect.z < r.request)
+            shrunk++;
+        if(rect != r.rect)
+        {
+            r.rect = rect;
+            r.static_dirty = true;
+            changed = true;
+        }
+    }
+    m_occupancy = total > 0 ? (float)next / total : 0.0f;
+
+    if(changed && shrunk > 0)
+        cerr<<"WARNING (TShadowAtlas::Pack): "<<shrunk<<" shadow regions don't fit into atlas in requested size\n";
+    return changed;
+}
+
+/**
+****************************************************************************************************
+@brief Bind static cache for rendering of static casters. Viewport and scissor are set to region,
+region depth is cleared.
+@param region region index
+****************************************************************************************************/
+void TShadowAtlas::BeginStatic(unsigned region)
+{
+    const glm::ivec3 &r = m_regions[region].rect;
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[1]);
+    glViewport(r.x, r.y, r.z, r.z);
+    glScissor(r.x, r.y, r.z, r.z);
+    glEnable(GL_SCISSOR_TEST);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+/**
+****************************************************************************************************
+@brief Copy static depth of region into atlas and bind atlas for rendering of dynamic casters
+@param region region index
+****************************************************************************************************/
+void TShadowAtlas::BeginDynamic(unsigned region)
+{
+    const glm::ivec3 &r = m_regions[region].rect;
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbos[1]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbos[0]);
+    glBlitFramebuffer(r.x, r.y, r.x + r.z, r.y + r.z, r.x, r.y, r.x + r.z, r.y + r.z, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[0]);
+    glViewport(r.x, r.y, r.z, r.z);
+    glScissor(r.x, r.y, r.z, r.z);
+    glEnable(GL_SCISSOR_TEST);
+}
+
+/**
+****************************************************************************************************
+@brief Finish rendering of regions, bind default framebuffer
+****************************************************************************************************/
+void TShadowAtlas::End()
+{
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/**
+****************************************************************************************************
+@brief Enable/disable depth comparison of atlas texture (debug view reads depth values)
+@param flag compare depth with reference (sampler2DShadow)
+****************************************************************************************************/
+void TShadowAtlas::SetCompare(bool flag)
+{
+    glBindTexture(GL_TEXTURE_2D, m_textures[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, flag ? GL_COMPARE_REF_TO_TEXTURE : GL_NONE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
@@ -0,0 +1,105 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: shadow_atlas.h
+@brief shadow atlas - shadow maps of all lights are regions of one depth texture. Depth of static
+casters is cached in second texture, regions are re-rendered only when they are invalidated.
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _SHADOW_ATLAS_H_
+#define _SHADOW_ATLAS_H_
+
+#include "globals.h"
+
+class TObject;
+
+///default size of shadow atlas (texels)
+#define SHADOW_ATLAS_SIZE 4096
+///minimal size of region, regions are squares with power of two size
+#define SHADOW_ATLAS_MIN 128
+
+///@brief Region of shadow atlas (shadow map of spot light or one paraboloid of omni light)
+struct TShadowRegion{
+    ///requested size in texels (power of two), allocated rectangle (x, y, size; size 0 - no space)
+    int request;
+    glm::ivec3 rect;
+    ///light view matrix of cached depth, frustum planes in light view space
+    glm::mat4 view;
+    glm::vec4 planes[6];
+    ///depth of static casters must be rendered again (light moved, region was moved in atlas)
+    bool static_dirty;
+    ///dynamic casters must be merged with static depth again
+    bool dirty;
+    ///dynamic casters drawn into region
+    vector<TObject*> casters;
+};
+
+/**
+@class TShadowAtlas
+@brief Shadow maps of all lights in one depth texture. Regions are squares with power of two size
+packed in Z-order (quadtree without fragmentation, larger regions first), regions which don't fit
+are shrunk. Depth of static casters is rendered into cache texture with the same layout
+(BeginStatic()), BeginDynamic() copies cached depth into atlas and dynamic casters are drawn over it.
+Both textures compare depth (sampler2DShadow).
+***************************************************************************************************/
+class TShadowAtlas
+{
+public:
+    TShadowAtlas();
+    ~TShadowAtlas();
+
+    //create atlas and static cache textures
+    bool Create(int size);
+    //add region, returns its index
+    unsigned AddRegion(int size);
+    //pack regions into atlas
+    bool Pack();
+
+    //bind cache texture for rendering of static casters into region
+    void BeginStatic(unsigned region);
+    //copy cached static depth into atlas, bind atlas for rendering of dynamic casters
+    void BeginDynamic(unsigned region);
+    //restore default framebuffer
+    void End();
+    //enable/disable depth comparison of atlas texture
+    void SetCompare(bool flag);
+
+    ///@brief Return region of atlas
+    TShadowRegion& GetRegion(unsigned region){
+        return m_regions[region];
+    }
+    ///@brief Return number of regions
+    unsigned GetRegionCount(){
+        return m_regions.size();
+    }
+    ///@brief Return region rectangle in texture coordinates (offset, size)
+    glm::vec4 GetRect(unsigned region){
+        glm::vec3 r = glm::vec3(m_regions[region].rect) / (float)m_size;
+        return glm::vec4(r.x, r.y, r.z, r.z);
+    }
+    ///@brief Set requested size of region (power of two, layout is changed by next Pack())
+    void Request(unsigned region, int size){
+        m_regions[region].request = size;
+    }
+    ///@brief Return atlas texture
+    GLuint GetTexture(){
+        return m_textures[0];
+    }
+    ///@brief Return atlas size
+    int GetSize(){
+        return m_size;
+    }
+    ///@brief Return allocated fraction of atlas area
+    float GetOccupancy(){
+        return m_occupancy;
+    }
+
+private:
+    int m_size;
+    ///atlas and static cache: depth textures and framebuffers
+    GLuint m_textures[2], m_fbos[2];
+    vector<TShadowRegion> m_regions;
+    float m_occupancy;
+};
+
+#endif
@@ -8,8 +8,19 @@ Loading TGA texture code adapted from: http://nehe.gamedev.net/data/lessons/less
 ****************************************************************************************************
 ***************************************************************************************************/
 #include "texture.h"
+#include "texture_streamer.h"
+#include "image_decoder.h"
+#include "virtual_texture.h"
+#include "SceneManager.h"
+#include <SDL/SDL_mutex.h>
 
 bool Texture::isILInitialized = false;
+SDL_mutex *Texture::m_ilMutex = NULL;
+bool Texture::m_useCompression = true;
+bool Texture::m_useIrradiance = false;
+GLuint Texture::m_boundArrays[ARRAY_BIND_UNITS] = {0};
+unsigned Texture::m_arrayBinds = 0;
+unsigned Texture::m_arrayBindsSkipped = 0;
 
 /**
 ****************************************************************************************************
@@ -23,7 +34,15 @@ Texture::Texture()
     m_texID = m_width = m_height = m_bpp = 0;
     m_texmode = MODULATE;
     m_tileX = m_tileY = 1.0;
-    m_texLoc = m_tileXLoc = m_tileYLoc = -1;
+    for(int i=0; i<SHADING_VARIANTS; i++)
+        m_texLoc[i] = m_tileXLoc[i] = m_tileYLoc[i] = m_intensityLoc[i] = m_layerLoc[i] = m_pagesLoc[i] = 
+            m_envLodLoc[i] = m_envSHLoc[i] = m_regionLoc[i] = -1;
+    m_layer = -1;
+    m_pageTable = 0;
+    m_envLevels = 0;
+    m_envLod = 0.0f;
+    m_region = NULL;
+    m_residency = NULL;
 }
 
 /**
@@ -33,7 +52,12 @@ Texture::Texture()
 ****************************************************************************************************/
 Texture::~Texture()
 {
-    glDeleteTextures(1,&m_texID);
+    //shared textures from files are deleted with last reference
+    if(m_residency)
+        SceneManager::Instance()->ReleaseTexture(m_residency);
+    //virtual texture owns its textures
+    else if(m_textype != VIRTUAL)
+        glDeleteTextures(1,&m_texID);
 }
 
 /**
@@ -59,11 +83,35 @@ GLint Texture::Load(const char *texname, int textype, const char *filename, int
     if(cache != -1)
     {
         m_texID = cache;
+        m_residency = SceneManager::Instance()->AcquireTexture(m_texID);
     }
     else      //load texture from file
     {
-        if(!LoadImage(filename))
+        ///when streaming, image is decoded in background and texture gets placeholder texel meanwhile
+        bool stream = TTextureStreamer::IsEnabled();
+        bool compress = CanCompress(textype);
+        TCompressedImage compressed;
+        GLuint pbo = 0;
+        if(stream)
+        {
+            //file must exist, so missing textures are reported at load time
+            ifstream fin(filename);
+            if(!fin)
+            {
+                ShowMessage("Cannot open texture file!");
+                return ERR;
+            }
+        }
+        ///block compressed textures are loaded from cache (or compressed by CPU and cached)
+        else if(compress && LoadCompressedTexture(filename, textype, mipmap, compressed))
+            cout<<"Image Loaded: "<< filename <<" (compressed)\n";
+        ///other TGA/PNG images are decoded straight into pixel buffer
+        else if(!compress && DecodeToPixelBuffer(filename, &pbo, &m_width, &m_height, &m_bpp))
+            cout<<"Image Loaded: "<< filename <<"\n";
+        else if(!LoadImage(filename))
             return ERR;
+        else
+            compress = false;
 
         //texture generation
         glGenTextures(1, &m_texID);
@@ -92,24 +140,42 @@ GLint Texture::Load(const char *texname, int textype, const char *filename, int
         else
             glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
 
-        if(textype == BUMP)	//don't compress bump maps
-#ifdef _LINUX_
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, m_width, m_height, 0, GL_BGR, GL_UNSIGNED_BYTE, m_imageData);
-#else
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, m_width, m_height, 0, GL_RGB, GL_UNSIGNED_BYTE, m_imageData);
-#endif
-        else					//compress color maps
-#ifdef _LINUX_
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGB, m_width, m_height, 0, GL_BGR, GL_UNSIGNED_BYTE, m_imageData);
-#else
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGB, m_width, m_height, 0, GL_RGB, GL_UNSIGNED_BYTE, m_imageData);
-#endif
+        if(stream)
+            SpecifyPlaceholder(textype);
+        else if(compress)
+            SpecifyCompressed(compressed, &compressed.data[0]);
+        else
+        {
+            //bump maps are not compressed
+            GLenum internal_format, format;
+            GetUploadFormat(textype, m_bpp, &internal_format, &format);
+            glTexImage2D(GL_TEXTURE_2D, 0, internal_format, m_width, m_height, 0, format, GL_UNSIGNED_BYTE, m_imageData);
+            if(pbo != 0)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                glDeleteBuffers(1, &pbo);
+            }
+        }
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        if(mipmap)
-            glGenerateMipmap(GL_TEXTURE_2D);
 
-        delete [] m_imageData;      //don't need image data after texture was created
+        if(!stream && !compress)
+        {
+            if(mipmap)
+                glGenerateMipmap(GL_TEXTURE_2D);
+            delete [] m_imageData;      //don't need image data after texture was created
+            m_imageData = NULL;
+        }
+
+        ///register texture for residency management (it can be reloaded from file later)
+        m_residency = SceneManager::Instance()->AddTexture(m_texID, GL_TEXTURE_2D, filename, textype, mipmap, CanCompress(textype));
+        if(stream)
+        {
+            m_residency->reloading = true;
+            TTextureStreamer::Instance()->Request(m_texID, filename, textype, mipmap, m_residency->compress);
+        }
+        else
+            SceneManager::Instance()->TextureUploaded(m_texID);
     }
 
     //texture mode and type
@@ -149,6 +215,14 @@ GLint Texture::Load(const char *texname, int textype,
     if(cache != -1)
     {
         m_texID = cache;
+        m_residency = SceneManager::Instance()->AcquireTexture(m_texID);
+        //levels and irradiance of shared environment map are stored with its record
+        if(m_residency != NULL && m_residency->env_levels > 0)
+        {
+            m_envLevels = m_residency->env_levels;
+            for(int i = 0; i < 9; i++)
+                m_envSH[i] = m_residency->env_sh[i];
+        }
     }
     else      //load texture from file
     {
@@ -156,11 +230,44 @@ GLint Texture::Load(const char *texname, int textype,
         glGenTextures(1, &m_texID);
         glBindTexture(GL_TEXTURE_CUBE_MAP, m_texID);
 
+        ///environment map is prefiltered into roughness levels (see LoadPrefilteredCubemap())
+        if(textype == CUBEMAP_ENV)
+        {
+            TPrefilteredCube cube;
+            if(!LoadPrefilteredCubemap(cube_files, cube))
+            {
+                glDeleteTextures(1, &m_texID);
+                m_texID = 0;
+                return ERR;
+            }
+            for(unsigned l=0; l<cube.levels; l++)
+            {
+                GLsizei size = cube.size >> l;
+                for(int i = 0; i < 6; i++)
+                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, l, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                                 &cube.data[cube.offsets[l] + i*size*size*4]);
+            }
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, cube.levels - 1);
+            //rough levels are small, filter across faces
+            glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+            m_envLevels = cube.levels;
+            for(int i = 0; i < 9; i++)
+                m_envSH[i] = cube.sh[i];
+        }
+
         //load 6 images for cube map
-        for(int i = 0; i < 6; i++)
+        for(int i = 0; i < 6 && textype != CUBEMAP_ENV; i++)
         {
             if(!LoadImage(cube_files[i]))
+            {
+                glDeleteTextures(1, &m_texID);
+                m_texID = 0;
                 return ERR;
+            }
 
             //texture with anisotropic filtering
             if(aniso)
@@ -186,7 +293,15 @@ GLint Texture::Load(const char *texname, int textype,
 #endif
 
             delete [] m_imageData;      //don't need image data after texture was created
+            m_imageData = NULL;
         }
+
+        //cube maps are counted in texture memory, but they aren't demoted
+        m_residency = SceneManager::Instance()->AddTexture(m_texID, GL_TEXTURE_CUBE_MAP, "", textype, false, false);
+        m_residency->env_levels = m_envLevels;
+        for(int i = 0; i < 9; i++)
+            m_residency->env_sh[i] = m_envSH[i];
+        SceneManager::Instance()->TextureUploaded(m_texID);
     }
 
     //texture mode and type
@@ -202,6 +317,27 @@ GLint Texture::Load(const char *texname, int textype,
     return m_texID;
 }
 
+/**
+****************************************************************************************************
+@brief Use virtual texture. Texture ID is physical tile cache, page table is bound to next texture
+unit (see ActivateTexture()). Both textures are owned by virtual texture.
+@param texname texture name
+@param vt virtual texture (must be created)
+@param texmode texture addition mode (can be ADD,MODULATE,DECAL,BLEND)
+@param intensity texture color intensity
+@return new texture ID
+****************************************************************************************************/
+GLint Texture::Load(const char *texname, TVirtualTexture *vt, int texmode, GLfloat intensity)
+{
+    m_texname = texname;
+    m_textype = VIRTUAL;
+    m_texmode = texmode;
+    m_intensity = intensity;
+    m_texID = vt->GetCacheTexture();
+    m_pageTable = vt->GetPageTable();
+    return m_texID;
+}
+
 /**
 ****************************************************************************************************
 @brief Create picture directly from data
@@ -283,116 +419,562 @@ GLint Texture::Load(const char *texname, int textype, const void *texdata, glm::
 ****************************************************************************************************/
 bool Texture::LoadImage(const char* filename)
 {
-	if(!filename)
-		return false;
+    const char *err = DecodeImage(filename, &m_imageData, &m_width, &m_height, &m_bpp);
+    if(err != NULL)
+    {
+        ShowMessage(err);
+        return false;
+    }
+    cout<<"Image Loaded: "<< filename <<"\n";
+    return true;
+}
 
-	//Opens image
+/**
+****************************************************************************************************
+@brief Init DevIL and lock guarding it. Must be called before decoding threads are created.
+****************************************************************************************************/
+void Texture::InitImageLibrary()
+{
 	if(!Texture::isILInitialized)
     {
 		ilInit();
+        m_ilMutex = SDL_CreateMutex();
 		Texture::isILInitialized = true;
 	}
+}
+
+/**
+****************************************************************************************************
+@brief Decode image file into newly allocated RGB or RGBA array. Common TGA and PNG images are
+decoded natively from memory mapped file (see TImageFile), other formats by DevIL. Can be called
+from any thread, image library access is serialized.
+@param filename file with image data
+@param data decoded pixels (caller deletes them)
+@param width image width
+@param height image height
+@param bpp bytes per pixel (3 or 4)
+@return NULL on success, error message otherwise
+****************************************************************************************************/
+const char* Texture::DecodeImage(const char *filename, GLubyte **data, GLuint *width, GLuint *height, GLuint *bpp)
+{
+	if(!filename)
+		return "Cannot open texture file!";
+
+    TImageFile img;
+    if(img.Open(filename))
+    {
+        *data = new GLubyte[img.GetDataSize()];
+        if(img.Decode(*data))
+        {
+            *width = img.GetWidth();
+            *height = img.GetHeight();
+            *bpp = img.GetBpp();
+            return NULL;
+        }
+        //corrupted file - let DevIL report it
+        delete [] *data;
+        *data = NULL;
+    }
+    return DecodeImageIL(filename, data, width, height, bpp);
+}
+
+/**
+****************************************************************************************************
+@brief Decode image file by DevIL (fallback of DecodeImage() for formats without native decoder).
+Image library is locked during decoding.
+@param filename file with image data
+@param data decoded pixels (caller deletes them)
+@param width image width
+@param height image height
+@param bpp bytes per pixel (3 or 4)
+@return NULL on success, error message otherwise
+****************************************************************************************************/
+const char* Texture::DecodeImageIL(const char *filename, GLubyte **data, GLuint *width, GLuint *height, GLuint *bpp)
+{
+	//Opens image
+    InitImageLibrary();
+    SDL_mutexP(m_ilMutex);
 
 	ILuint id = 0;
 	ilGenImages(1, &id);
 	ilBindImage(id);
 	
+    const char *err = NULL;
 	if(!ilLoadImage(filename))
-	{
-		ShowMessage("Cannot open texture file!");
-		return false;
-	}
+		err = "Cannot open texture file!";
+    else
+    {
+	    //Get image attributes
+	    *width = ilGetInteger(IL_IMAGE_WIDTH);
+	    *height = ilGetInteger(IL_IMAGE_HEIGHT);
+	    *bpp = ilGetInteger(IL_IMAGE_BPP);
 
-	//Get image attributes
-	m_width = ilGetInteger(IL_IMAGE_WIDTH);
-	m_height = ilGetInteger(IL_IMAGE_HEIGHT);
-	m_bpp = ilGetInteger(IL_IMAGE_BPP);
+	    if((*width <= 0) || (*height <= 0) || ((*bpp != 3) && (*bpp != 4)) )
+            err = "Unknown image type!";
+        else
+        {
+	        //Allocate memory for image and copy pixels
+            *data = new GLubyte[(*bpp) * (*width) * (*height)];
+	        if(*bpp == 3)
+		        ilCopyPixels(0, 0, 0, *width, *height, 1, IL_RGB, IL_UNSIGNED_BYTE, *data);
+	        else
+		        ilCopyPixels(0, 0, 0, *width, *height, 1, IL_RGBA, IL_UNSIGNED_BYTE, *data);
+        }
+    }
+
+	//Unbind and free
+	ilBindImage(0);
+	ilDeleteImage(id);
+    SDL_mutexV(m_ilMutex);
 
-	if((m_width <= 0) || (m_height <= 0) || ((m_bpp != 3) && (m_bpp != 4)) )
+    return err;
+}
+
+/**
+****************************************************************************************************
+@brief Decode TGA or PNG image directly into mapped pixel unpack buffer, so texture is specified
+without copy of image in client memory. Buffer stays bound, texture data pointer must be NULL.
+@param filename file with image data
+@param pbo created pixel buffer (caller deletes it)
+@param width image width
+@param height image height
+@param bpp bytes per pixel (3 or 4)
+@return false when image can't be decoded natively or buffer can't be mapped
+****************************************************************************************************/
+bool Texture::DecodeToPixelBuffer(const char *filename, GLuint *pbo, GLuint *width, GLuint *height, GLuint *bpp)
+{
+    TImageFile img;
+    if(!GLEW_VERSION_2_1 || !img.Open(filename))
+        return false;
+
+    glGenBuffers(1, pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, *pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, img.GetDataSize(), NULL, GL_STREAM_DRAW);
+    GLubyte *ptr = (GLubyte*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, img.GetDataSize(), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    bool ok = ptr != NULL && img.Decode(ptr);
+    //buffer contents can be lost during mapping
+    if(ptr != NULL && !glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+        ok = false;
+    if(!ok)
     {
-        ShowMessage("Unknown image type!");
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, pbo);
+        *pbo = 0;
+        return false;
+    }
+
+    *width = img.GetWidth();
+    *height = img.GetHeight();
+    *bpp = img.GetBpp();
+    return true;
+}
+
+/**
+****************************************************************************************************
+@brief Return OpenGL formats used for upload of decoded image. Bump maps are not compressed.
+@param textype texture type
+@param bpp bytes per pixel of decoded image
+@param internal_format texture internal format
+@param format pixel data format
+****************************************************************************************************/
+void Texture::GetUploadFormat(int textype, GLuint bpp, GLenum *internal_format, GLenum *format)
+{
+    if(textype == BUMP)
+        *internal_format = bpp == 4 ? GL_RGBA : GL_RGB;
+    else
+        *internal_format = bpp == 4 ? GL_COMPRESSED_RGBA : GL_COMPRESSED_RGB;
+#ifdef _LINUX_
+    *format = bpp == 4 ? GL_BGRA : GL_BGR;
+#else
+    *format = bpp == 4 ? GL_RGBA : GL_RGB;
+#endif
+}
+
+/**
+****************************************************************************************************
+@brief Can texture type be block compressed? Requires S3TC support (RGTC is core in OpenGL 3.0).
+@param textype texture type
+****************************************************************************************************/
+bool Texture::CanCompress(int textype)
+{
+    if(!m_useCompression || !GLEW_EXT_texture_compression_s3tc)
         return false;
+    return textype == BASE || textype == ALPHA || textype == ENV || textype == BUMP ||
+           textype == PARALLAX || textype == DISPLACE;
+}
+
+/**
+****************************************************************************************************
+@brief Specify all mip levels of texture bound to GL_TEXTURE_2D from block compressed image
+@param img compressed image
+@param data pointer to image data, or NULL when data are in bound pixel unpack buffer
+****************************************************************************************************/
+void Texture::SpecifyCompressed(const TCompressedImage &img, const GLubyte *data)
+{
+    unsigned levels = img.GetLevels();
+    for(unsigned l=0; l<levels; l++)
+    {
+        GLsizei w = max(img.width >> l, 1u), h = max(img.height >> l, 1u);
+        glCompressedTexImage2D(GL_TEXTURE_2D, l, img.format, w, h, 0, img.offsets[l + 1] - img.offsets[l], data + img.offsets[l]);
+    }
+    //mip chain is complete without glGenerateMipmap()
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+}
+
+/**
+****************************************************************************************************
+@brief Specify 1x1 placeholder image of texture bound to GL_TEXTURE_2D (image is mipmap complete)
+@param textype texture type - bump maps get flat normal, other maps neutral grey
+****************************************************************************************************/
+void Texture::SpecifyPlaceholder(int textype)
+{
+    GLubyte texel[4] = {128, 128, 128, 255};
+    if(textype == BUMP)
+        texel[2] = 255;
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+}
+
+/**
+****************************************************************************************************
+@brief Return video memory used by texture. Compressed levels report their exact size, uncompressed
+texels are counted as 4 bytes (drivers store RGB as RGBA).
+@param id texture
+@param target GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY or GL_TEXTURE_CUBE_MAP
+@return size in bytes
+****************************************************************************************************/
+size_t Texture::GetVideoBytes(GLuint id, GLenum target)
+{
+    glBindTexture(target, id);
+    GLenum face = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+    GLint max_level = 0;
+    glGetTexParameteriv(target, GL_TEXTURE_MAX_LEVEL, &max_level);
+
+    size_t bytes = 0;
+    for(GLint l=0; l<=max_level; l++)
+    {
+        GLint w = 0, h = 0, d = 1, compressed = 0, size = 0;
+        glGetTexLevelParameteriv(face, l, GL_TEXTURE_WIDTH, &w);
+        glGetTexLevelParameteriv(face, l, GL_TEXTURE_HEIGHT, &h);
+        if(w == 0 || h == 0)
+            break;
+        //layers of texture array
+        glGetTexLevelParameteriv(face, l, GL_TEXTURE_DEPTH, &d);
+        glGetTexLevelParameteriv(face, l, GL_TEXTURE_COMPRESSED, &compressed);
+        if(compressed)
+            glGetTexLevelParameteriv(face, l, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+        else
+            size = w*h*d*4;
+        bytes += size;
     }
+    glBindTexture(target, 0);
+    return target == GL_TEXTURE_CUBE_MAP ? 6*bytes : bytes;
+}
 
-	//Allocate memory for image
-    unsigned imageSize = (m_bpp * m_width * m_height);
-    m_imageData = new GLubyte[imageSize];
-    if(m_imageData == NULL)
+/**
+****************************************************************************************************
+@brief Free levels of texture bound to GL_TEXTURE_2D by specifying them with zero size
+@param first first freed level
+@param last level after last freed level
+****************************************************************************************************/
+void Texture::FreeLevels(unsigned first, unsigned last)
+{
+    for(unsigned l=first; l<last; l++)
+        glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+}
+
+/**
+****************************************************************************************************
+@brief Specify empty level of bound 2D texture (storage for GPU-side copy)
+****************************************************************************************************/
+static void SpecifyEmptyLevel(GLint level, GLint internal_format, bool compressed, GLsizei w, GLsizei h, GLsizei size)
+{
+    if(compressed)
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format, w, h, 0, size, NULL);
+    else
+        glTexImage2D(GL_TEXTURE_2D, level, internal_format, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+}
+
+/**
+****************************************************************************************************
+@brief Halve resolution of mipmapped 2D texture - lower levels are specified one level up, so video
+memory of top level is freed (about 3/4 of texture). Texture name is kept. Levels never leave video
+memory: they are copied through temporary texture (ARB_copy_image) or pixel buffer (glGetTexImage into
+GL_PIXEL_PACK_BUFFER doesn't wait for GPU).
+@param id texture
+@return false when texture has only one level
+****************************************************************************************************/
+bool Texture::DropTopLevel(GLuint id)
+{
+    glBindTexture(GL_TEXTURE_2D, id);
+    GLint max_level = 0, compressed = 0, internal_format = 0;
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &max_level);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 1, GL_TEXTURE_COMPRESSED, &compressed);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 1, GL_TEXTURE_INTERNAL_FORMAT, &internal_format);
+
+    //sizes of levels 1..n-1 (they become levels 0..n-2)
+    vector<GLint> width, height, size;
+    vector<size_t> offset;
+    size_t total = 0;
+    for(GLint l=1; l<=max_level; l++)
+    {
+        GLint w = 0, h = 0, s = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, l, GL_TEXTURE_WIDTH, &w);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, l, GL_TEXTURE_HEIGHT, &h);
+        if(w == 0 || h == 0)
+            break;
+        if(compressed)
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, l, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &s);
+        else
+            s = w*h*4;
+        width.push_back(w);
+        height.push_back(h);
+        size.push_back(s);
+        offset.push_back(total);
+        total += s;
+    }
+    unsigned levels = width.size();
+    if(levels == 0)
     {
-        ShowMessage("Can't allocate image data!");
+        glBindTexture(GL_TEXTURE_2D, 0);
         return false;
     }
 
-	//Copy pixels
-	if(m_bpp==3)
-		ilCopyPixels(0, 0, 0, m_width, m_height, 1, IL_RGB, IL_UNSIGNED_BYTE, m_imageData);
-	else
-		ilCopyPixels(0, 0, 0, m_width, m_height, 1, IL_RGBA, IL_UNSIGNED_BYTE, m_imageData);
+    if(GLEW_ARB_copy_image)
+    {
+        ///1. copy levels into temporary texture
+        GLuint temp;
+        glGenTextures(1, &temp);
+        glBindTexture(GL_TEXTURE_2D, temp);
+        for(unsigned l=0; l<levels; l++)
+            SpecifyEmptyLevel(l, internal_format, compressed != 0, width[l], height[l], size[l]);
+        for(unsigned l=0; l<levels; l++)
+            glCopyImageSubData(id, GL_TEXTURE_2D, l + 1, 0, 0, 0, temp, GL_TEXTURE_2D, l, 0, 0, 0, width[l], height[l], 1);
+
+        ///2. respecify texture one level up and copy levels back
+        glBindTexture(GL_TEXTURE_2D, id);
+        for(unsigned l=0; l<levels; l++)
+            SpecifyEmptyLevel(l, internal_format, compressed != 0, width[l], height[l], size[l]);
+        for(unsigned l=0; l<levels; l++)
+            glCopyImageSubData(temp, GL_TEXTURE_2D, l, 0, 0, 0, id, GL_TEXTURE_2D, l, 0, 0, 0, width[l], height[l], 1);
+        glDeleteTextures(1, &temp);
+    }
+    else
+    {
+        ///1. read levels into pixel buffer
+        GLuint pbo;
+        glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, total, NULL, GL_STREAM_COPY);
+        for(unsigned l=0; l<levels; l++)
+        {
+            if(compressed)
+                glGetCompressedTexImage(GL_TEXTURE_2D, l + 1, (GLvoid*)offset[l]);
+            else
+                glGetTexImage(GL_TEXTURE_2D, l + 1, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)offset[l]);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        ///2. specify them one level up from the same buffer
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        for(unsigned l=0; l<levels; l++)
+        {
+            const GLvoid *src = (const GLvoid*)offset[l];
+            if(compressed)
+                glCompressedTexImage2D(GL_TEXTURE_2D, l, internal_format, width[l], height[l], 0, size[l], src);
+            else
+                glTexImage2D(GL_TEXTURE_2D, l, internal_format, width[l], height[l], 0, GL_RGBA, GL_UNSIGNED_BYTE, src);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &pbo);
+    }
 
-	//Unbind and free
-	ilBindImage(0);
-	ilDeleteImage(id);
-	
-    cout<<"Image Loaded: "<< filename <<"\n";
+    //free the last level
+    FreeLevels(levels, levels + 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
     return true;
 }
 
+/**
+****************************************************************************************************
+@brief Can texture be packed into texture array? Only fully loaded base maps are packed - they are
+sampled by generated shaders only (alpha maps are bound also to depth shaders as 2D textures).
+****************************************************************************************************/
+bool Texture::CanPack()
+{
+    if(m_layer >= 0 || m_textype != BASE || m_residency == NULL || m_residency->target != GL_TEXTURE_2D)
+        return false;
+    return !m_residency->file.empty() && !m_residency->reloading && !m_residency->evicted && m_residency->dropped == 0;
+}
+
+/**
+****************************************************************************************************
+@brief Replace texture by layer of texture array. Reference to previous texture is released.
+@param array array texture
+@param layer layer with texture image
+@param residency residency record of array (already referenced for this texture)
+****************************************************************************************************/
+void Texture::SetArrayLayer(GLuint array, GLint layer, TTextureResidency *residency)
+{
+    SceneManager::Instance()->ReleaseTexture(m_residency);
+    m_residency = residency;
+    m_texID = array;
+    m_layer = layer;
+}
+
 
 /**
 ****************************************************************************************************
 @brief Activates texture map for use by shader
 @param tex_unit multitexture unit used for texture application
 @param set_uniforms shall we also set uniform locations to shader?
+@param variant shading variant of material whose program is bound
 ****************************************************************************************************/
-void Texture::ActivateTexture(GLint tex_unit, bool set_uniforms)
+void Texture::ActivateTexture(GLint tex_unit, bool set_uniforms, int variant)
 {
     ///1. set uniform values in shader (tiles, texture unit, texture matrix and intensity)
     if(set_uniforms)
     {
-        if(m_tileXLoc > 0 && m_tileYLoc > 0)
+        if(m_tileXLoc[variant] > 0 && m_tileYLoc[variant] > 0)
         {
-            glUniform1f(m_tileXLoc, m_tileX);
-            glUniform1f(m_tileYLoc, m_tileY);
+            glUniform1f(m_tileXLoc[variant], m_tileX);
+            glUniform1f(m_tileYLoc[variant], m_tileY);
         }
-        glUniform1f(m_intensityLoc, m_intensity);
+        glUniform1f(m_intensityLoc[variant], m_intensity);
+        if(m_layerLoc[variant] >= 0)
+            glUniform1f(m_layerLoc[variant], (GLfloat)m_layer);
     }
     //texture location must be updated regularly
-    if(m_texLoc >= 0)
-        glUniform1i(m_texLoc, tex_unit);
+    if(m_texLoc[variant] >= 0)
+        glUniform1i(m_texLoc[variant], tex_unit);
+    if(m_pagesLoc[variant] >= 0)
+        glUniform1i(m_pagesLoc[variant], tex_unit + 1);
+    //shadow atlas region changes when atlas is repacked
+    if(m_regionLoc[variant] >= 0)
+        glUniform4fv(m_regionLoc[variant], m_textype == SHADOW_OMNI ? 2 : 1, glm::value_ptr(m_region[0]));
+    //level and irradiance of prefiltered environment map
+    if(set_uniforms && m_envLodLoc[variant] >= 0)
+        glUniform1f(m_envLodLoc[variant], m_envLod);
+    if(set_uniforms && m_envSHLoc[variant] >= 0)
+        glUniform3fv(m_envSHLoc[variant], 9, glm::value_ptr(m_envSH[0]));
 
     ///2. activate and bind texture
     glActiveTexture(GL_TEXTURE0 + tex_unit);
+    //mark texture as recently used
+    if(m_residency)
+        m_residency->last_used = SceneManager::Instance()->GetFrame();
     //Various texture targets
     if(m_textype == CUBEMAP || m_textype == CUBEMAP_ENV)        //for cube map
         glBindTexture(GL_TEXTURE_CUBE_MAP, m_texID);
-    else if(m_textype == SHADOW_OMNI)                         //for texture array
-        glBindTexture(GL_TEXTURE_2D_ARRAY, m_texID);
+    else if(m_layer >= 0)                                   //for texture array
+    {
+        //materials packed into one array share it, bind it only when unit holds another texture
+        if(tex_unit < ARRAY_BIND_UNITS && m_boundArrays[tex_unit] == m_texID)
+            m_arrayBindsSkipped++;
+        else
+        {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, m_texID);
+            if(tex_unit < ARRAY_BIND_UNITS)
+                m_boundArrays[tex_unit] = m_texID;
+            m_arrayBinds++;
+        }
+    }
     else if(m_textype == RENDER_TEXTURE_MULTISAMPLE)          //for multisampled texture
         glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, m_texID);
     else                                                    //for regular 2D texture
         glBindTexture(GL_TEXTURE_2D, m_texID);
+
+    //page table of virtual texture uses next unit
+    if(m_textype == VIRTUAL)
+    {
+        glActiveTexture(GL_TEXTURE0 + tex_unit + 1);
+        glBindTexture(GL_TEXTURE_2D, m_pageTable);
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Forget texture arrays bound to texture units. Must be called when array binding is changed
+outside ActivateTexture() or bound array is deleted (its name can be reused).
+****************************************************************************************************/
+void Texture::InvalidateArrayBindings()
+{
+    memset(m_boundArrays, 0, sizeof(m_boundArrays));
+}
+
+/**
+****************************************************************************************************
+@brief Return number of texture array binds and redundant binds skipped by ActivateTexture() since
+last call, counters are reset
+@param binds texture arrays bound
+@param skipped binds skipped (array was already bound to unit)
+****************************************************************************************************/
+void Texture::PopArrayBinds(unsigned *binds, unsigned *skipped)
+{
+    *binds = m_arrayBinds;
+    *skipped = m_arrayBindsSkipped;
+    m_arrayBinds = m_arrayBindsSkipped = 0;
 }
 
 /**
 ****************************************************************************************************
 @brief Gets uniform variables froms shader
 @param shader handle to shader to bound with texture
+@param name name of texture in shader (empty - texture name)
+@param variant shading variant of material (locations are stored for every variant)
 ****************************************************************************************************/
-void Texture::GetUniforms(GLuint shader)
+void Texture::GetUniforms(GLuint shader, const string &name, int variant)
 {
+    string uniform = name.empty() ? m_texname : name;
     if(HasTiles())
     {
-        string tileX_str = m_texname + "_tileX";
-        string tileY_str = m_texname + "_tileY";
-        m_tileXLoc = glGetUniformLocation(shader,tileX_str.c_str() );
-        m_tileYLoc = glGetUniformLocation(shader,tileY_str.c_str() );
+        string tileX_str = uniform + "_tileX";
+        string tileY_str = uniform + "_tileY";
+        m_tileXLoc[variant] = glGetUniformLocation(shader,tileX_str.c_str() );
+        m_tileYLoc[variant] = glGetUniformLocation(shader,tileY_str.c_str() );
     }
 
     ///1. to avoid mismatch variable names, use texture name as variable prefix
-    string intensity_str = m_texname + "_intensity";
+    string intensity_str = uniform + "_intensity";
 
     ///2. get uniforms location
-    m_texLoc = glGetUniformLocation(shader,m_texname.c_str());
-    m_intensityLoc = glGetUniformLocation(shader,intensity_str.c_str() );
+    m_texLoc[variant] = glGetUniformLocation(shader,uniform.c_str());
+    m_intensityLoc[variant] = glGetUniformLocation(shader,intensity_str.c_str() );
+    if(m_layer >= 0)
+    {
+        string layer_str = uniform + "_layer";
+        m_layerLoc[variant] = glGetUniformLocation(shader,layer_str.c_str() );
+    }
+    if(m_region != NULL)
+    {
+        string region_str = uniform + "_region";
+        m_regionLoc[variant] = glGetUniformLocation(shader,region_str.c_str() );
+    }
+    if(m_textype == VIRTUAL)
+    {
+        string pages_str = uniform + "_pages";
+        m_pagesLoc[variant] = glGetUniformLocation(shader,pages_str.c_str() );
+    }
+    if(m_envLevels > 0)
+    {
+        string lod_str = uniform + "_lod";
+        string sh_str = uniform + "_sh";
+        m_envLodLoc[variant] = glGetUniformLocation(shader,lod_str.c_str() );
+        m_envSHLoc[variant] = glGetUniformLocation(shader,sh_str.c_str() );
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Select level of prefiltered environment cube map, levels are filtered with linearly
+increasing roughness. Uniform is updated by next ActivateTexture() with uniforms.
+@param roughness perceptual roughness (0..1)
+****************************************************************************************************/
+void Texture::SetRoughness(float roughness)
+{
+    if(m_envLevels > 0)
+        m_envLod = min(max(roughness, 0.0f), 1.0f)*(m_envLevels - 1);
 }
 
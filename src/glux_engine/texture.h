@@ -9,10 +9,40 @@
 #ifndef _TEXTURE_H_
 #define _TEXTURE_H_
 #include "globals.h"
+#include "texture_compress.h"
+#include "texture_cubemap.h"
+
+class TVirtualTexture;
+
+///texture units whose bound texture array is tracked (redundant binds are skipped)
+#define ARRAY_BIND_UNITS 32
 
 ///Two possible types of TGA image
 enum TGAtypes{COMPRESSED,UNCOMPRESSED};
 
+///@brief Residency of texture loaded from file. Textures sharing one OpenGL texture (texture cache)
+///share one record, texture is deleted with last reference (see SceneManager::ReleaseTexture())
+struct TTextureResidency{
+    GLuint id;
+    GLenum target;
+    ///source used for reloading (empty - texture is never demoted)
+    string file;
+    int textype;
+    bool mipmap, compress;
+    ///size of full resolution texture
+    GLuint width, height;
+    ///dropped top mip levels, texture replaced by placeholder, full texture is being loaded
+    unsigned dropped;
+    bool evicted, reloading;
+    ///video memory of current and full resolution texture
+    size_t bytes, full_bytes;
+    ///frame of last use, number of textures using this record
+    unsigned last_used, refs;
+    ///roughness levels and irradiance (SH9) of prefiltered environment map (0 levels - other texture)
+    unsigned env_levels;
+    glm::vec3 env_sh[9];
+};
+
 ///@class Texture 
 ///@brief holds texture parameters and contains functions to load texture from external file
 ///Textures are connected to shaders via uniform variables
@@ -29,10 +59,35 @@ private:
 
     GLfloat m_intensity;            //texture intensity
     GLfloat m_tileX, m_tileY;       //texture tiles
-    //shader uniform variables
-    GLint m_texLoc, m_tileXLoc, m_tileYLoc, m_intensityLoc;
+    //layer in texture array (-1 - regular texture)
+    GLint m_layer;
+    //shader uniform variables (for every shading variant of material)
+    GLint m_texLoc[SHADING_VARIANTS], m_tileXLoc[SHADING_VARIANTS], m_tileYLoc[SHADING_VARIANTS];
+    GLint m_intensityLoc[SHADING_VARIANTS], m_layerLoc[SHADING_VARIANTS];
+    //page table of virtual texture (texture ID is its tile cache) and its uniform
+    GLuint m_pageTable;
+    GLint m_pagesLoc[SHADING_VARIANTS];
+    //prefiltered environment cube map: roughness levels, sampled level and irradiance (SH9)
+    GLuint m_envLevels;
+    GLfloat m_envLod;
+    glm::vec3 m_envSH[9];
+    GLint m_envLodLoc[SHADING_VARIANTS], m_envSHLoc[SHADING_VARIANTS];
+    //shadow map region in shadow atlas (offset, size; omni light has two) and its uniform
+    const glm::vec4 *m_region;
+    GLint m_regionLoc[SHADING_VARIANTS];
+    //residency record (textures loaded from files only)
+    TTextureResidency *m_residency;
 
 	static bool isILInitialized;
+    //use block compressed textures from cache
+    static bool m_useCompression;
+    //add irradiance of environment cube maps to materials
+    static bool m_useIrradiance;
+    //DevIL is not reentrant, decoding threads must lock it (formats without native decoder)
+    static SDL_mutex *m_ilMutex;
+    //texture arrays bound to units by ActivateTexture(), binds and skipped binds since last query
+    static GLuint m_boundArrays[ARRAY_BIND_UNITS];
+    static unsigned m_arrayBinds, m_arrayBindsSkipped;
 
 public:    
     Texture();
@@ -59,18 +114,77 @@ public:
     GLint Load(const char *texname, int textype, const void *texdata, glm::vec2 tex_size, GLenum tex_format, GLenum data_type,
                int texmode, GLfloat intensity, GLfloat tileX, GLfloat tileY, bool mipmap, bool aniso);
 
+    //use virtual texture (tile cache and page table are owned by virtual texture)
+    GLint Load(const char *texname, TVirtualTexture *vt, int texmode, GLfloat intensity);
+
     //load TGA texture from file
     bool LoadImage(const char *filename);
 
+    //init image library (must be called from main thread before decoding threads are started)
+    static void InitImageLibrary();
+    //decode image file into new RGB(A) array, thread safe. Returns error message or NULL
+    static const char* DecodeImage(const char *filename, GLubyte **data, GLuint *width, GLuint *height, GLuint *bpp);
+    //decode image file by DevIL (formats without native decoder)
+    static const char* DecodeImageIL(const char *filename, GLubyte **data, GLuint *width, GLuint *height, GLuint *bpp);
+    //decode TGA/PNG image into new pixel unpack buffer, which stays bound
+    static bool DecodeToPixelBuffer(const char *filename, GLuint *pbo, GLuint *width, GLuint *height, GLuint *bpp);
+    //OpenGL formats used to upload decoded image
+    static void GetUploadFormat(int textype, GLuint bpp, GLenum *internal_format, GLenum *format);
+
+    ///@brief Toggle use of CPU compressed textures (driver compresses color maps when disabled)
+    static void UseCompression(bool flag = true){
+        m_useCompression = flag;
+    }
+    ///@brief Toggle diffuse irradiance (SH9) of environment cube maps in generated shaders
+    static void UseIrradiance(bool flag = true){
+        m_useIrradiance = flag;
+    }
+    ///@brief Is irradiance of environment cube maps used?
+    static bool IsIrradianceUsed(){
+        return m_useIrradiance;
+    }
+    //select level of prefiltered environment cube map by surface roughness
+    void SetRoughness(float roughness);
+    ///@brief Is texture prefiltered environment cube map?
+    bool IsPrefiltered(){
+        return m_envLevels > 0;
+    }
+    //can texture type be loaded from compressed texture cache?
+    static bool CanCompress(int textype);
+    //specify all levels of bound 2D texture from compressed image (data can be pixel buffer offset)
+    static void SpecifyCompressed(const TCompressedImage &img, const GLubyte *data);
+    //specify 1x1 placeholder image of bound 2D texture
+    static void SpecifyPlaceholder(int textype);
+    //video memory used by texture (all levels and faces)
+    static size_t GetVideoBytes(GLuint id, GLenum target);
+    //halve resolution of mipmapped 2D texture by dropping its top level
+    static bool DropTopLevel(GLuint id);
+    //free levels [first, last) of bound 2D texture
+    static void FreeLevels(unsigned first, unsigned last);
+
+    //forget texture arrays bound to units (bound or deleted outside ActivateTexture())
+    static void InvalidateArrayBindings();
+    //return binds of texture arrays and skipped redundant binds since last call
+    static void PopArrayBinds(unsigned *binds, unsigned *skipped);
+
+    //can texture be packed into texture array? (see PackTextureArrays())
+    bool CanPack();
+    //replace texture by layer of texture array
+    void SetArrayLayer(GLuint array, GLint layer, TTextureResidency *residency);
+    ///@brief Get layer in texture array (-1 when texture isn't packed)
+    GLint GetLayer(){
+        return m_layer;
+    }
+
     ///@brief do we have image data?
     bool Empty(){ 
         return (m_texID == 0); 
     } 
 
     //activate texture for use by shader
-    void ActivateTexture(GLint tex_unit, bool set_uniforms = false);
+    void ActivateTexture(GLint tex_unit, bool set_uniforms = false, int variant = SHADING_FULL);
     //get uniform variables for texture
-    void GetUniforms(GLuint shader);
+    void GetUniforms(GLuint shader, const string &name = "", int variant = SHADING_FULL);
  
     ///@brief set texture intensity
     void SetIntensity(GLfloat _intensity){ 
@@ -87,6 +201,11 @@ public:
     void SetType(int type){ 
         m_textype = type; 
     }
+    ///@brief Set rectangles of shadow map region in shadow atlas (owned by light, uniform is
+    ///updated whenever texture is activated)
+    void SetRegion(const glm::vec4 *region){
+        m_region = region;
+    }
 
     ///@brief Get OpenGL texture ID
     GLuint GetID(){ 
@@ -100,6 +219,10 @@ public:
     int GetMode(){ 
         return m_texmode; 
     }
+    ///@brief Get number of texture units used by texture (virtual texture binds also its page table)
+    int GetUnits(){
+        return m_textype == VIRTUAL ? 2 : 1;
+    }
     ///@brief Has texture tiles?
     bool HasTiles(){ 
         return (m_tileX > 1 || m_tileY > 1); 
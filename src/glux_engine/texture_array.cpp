@@ -0,0 +1,205 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: texture_array.cpp
+@brief packing of material textures with the same size and format into 2D texture arrays, so
+materials share one texture object and select their image by layer index
+****************************************************************************************************
+***************************************************************************************************/
+#include "texture_array.h"
+#include "SceneManager.h"
+
+///@brief Layout of 2D texture - textures with equal layout can be layers of one array
+struct TArrayLayout{
+    GLint width, height, levels;
+    GLint internal_format, compressed, min_filter;
+
+    bool operator<(const TArrayLayout &l) const {
+        return memcmp(this, &l, sizeof(TArrayLayout)) < 0;
+    }
+};
+
+/**
+****************************************************************************************************
+@brief Query layout of 2D texture
+@param id texture
+@param layout returned layout (levels sampled by texture filter)
+****************************************************************************************************/
+static void GetLayout(GLuint id, TArrayLayout &layout)
+{
+    memset(&layout, 0, sizeof(TArrayLayout));
+    glBindTexture(GL_TEXTURE_2D, id);
+    GLint max_level = 0;
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &max_level);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &layout.min_filter);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &layout.width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &layout.height);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &layout.internal_format);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &layout.compressed);
+
+    //textures without mipmap filter sample top level only
+    if(layout.min_filter == GL_LINEAR || layout.min_filter == GL_NEAREST)
+        layout.levels = 1;
+    else
+    {
+        for(layout.levels = 0; layout.levels <= max_level; layout.levels++)
+        {
+            GLint w = 0;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, layout.levels, GL_TEXTURE_WIDTH, &w);
+            if(w == 0)
+                break;
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/**
+****************************************************************************************************
+@brief Create texture array and copy source textures into its layers. Copy is done on GPU when
+ARB_copy_image is supported, otherwise levels are read back and uploaded.
+@param layout common layout of source textures
+@param ids source textures
+@param count number of source textures (layers)
+@return new array texture
+****************************************************************************************************/
+static GLuint CreateArray(const TArrayLayout &layout, const GLuint *ids, unsigned count)
+{
+    GLuint array;
+    glGenTextures(1, &array);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+
+    ///1. allocate all levels, compressed level size is taken from first source texture
+    for(GLint l=0; l<layout.levels; l++)
+    {
+        GLsizei w = max(layout.width >> l, 1), h = max(layout.height >> l, 1);
+        if(layout.compressed)
+        {
+            GLint size = 0;
+            glBindTexture(GL_TEXTURE_2D, ids[0]);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, l, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, l, layout.internal_format, w, h, count, 0, size*count, NULL);
+        }
+        else
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, l, layout.internal_format, w, h, count, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+
+    ///2. sampling parameters (anisotropy is the highest of source textures)
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, layout.levels - 1);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, layout.min_filter);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    if(GLEW_EXT_texture_filter_anisotropic)
+    {
+        float aniso = 1.0f;
+        for(unsigned i=0; i<count; i++)
+        {
+            float a = 1.0f;
+            glBindTexture(GL_TEXTURE_2D, ids[i]);
+            glGetTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, &a);
+            aniso = max(aniso, a);
+        }
+        glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT, aniso);
+    }
+
+    ///3. copy source textures into layers
+    vector<GLubyte> data;
+    for(unsigned i=0; i<count; i++)
+    {
+        glBindTexture(GL_TEXTURE_2D, ids[i]);
+        for(GLint l=0; l<layout.levels; l++)
+        {
+            GLsizei w = max(layout.width >> l, 1), h = max(layout.height >> l, 1);
+            if(GLEW_ARB_copy_image)
+                glCopyImageSubData(ids[i], GL_TEXTURE_2D, l, 0, 0, 0, array, GL_TEXTURE_2D_ARRAY, l, 0, 0, i, w, h, 1);
+            else if(layout.compressed)
+            {
+                GLint size = 0;
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, l, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+                data.resize(size);
+                glGetCompressedTexImage(GL_TEXTURE_2D, l, &data[0]);
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, i, w, h, 1, layout.internal_format, size, &data[0]);
+            }
+            else
+            {
+                data.resize(w*h*4);
+                glGetTexImage(GL_TEXTURE_2D, l, GL_RGBA, GL_UNSIGNED_BYTE, &data[0]);
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, i, w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE, &data[0]);
+            }
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    Texture::InvalidateArrayBindings();
+    return array;
+}
+
+/**
+****************************************************************************************************
+@brief Pack 2D textures into texture arrays. Textures with the same size, format and mip chain are
+copied into layers of one array (textures sharing one OpenGL texture get the same layer). Textures
+are moved to the array and their source textures are released. Textures which can't be packed
+(see Texture::CanPack()) and layouts used by a single texture stay unchanged.
+Must be called before materials are baked, generated shaders sample arrays by layer index.
+@param textures textures of materials
+@param packed returned source textures moved into arrays (deleted unless used by other textures)
+@return packing statistics
+****************************************************************************************************/
+TTextureArrayStats PackTextureArrays(const vector<Texture*> &textures, vector<GLuint> &packed)
+{
+    TTextureArrayStats stats;
+    memset(&stats, 0, sizeof(TTextureArrayStats));
+    GLint max_layers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+
+    ///1. group distinct source textures by layout
+    map<GLuint, vector<Texture*> > users;
+    map<TArrayLayout, vector<GLuint> > groups;
+    for(unsigned i=0; i<textures.size(); i++)
+    {
+        if(!textures[i]->CanPack())
+            continue;
+        GLuint id = textures[i]->GetID();
+        if(users.find(id) == users.end())
+        {
+            TArrayLayout layout;
+            GetLayout(id, layout);
+            groups[layout].push_back(id);
+        }
+        users[id].push_back(textures[i]);
+    }
+
+    ///2. copy groups into arrays (groups larger than maximal layer count are split)
+    for(map<TArrayLayout, vector<GLuint> >::iterator g = groups.begin(); g != groups.end(); ++g)
+    {
+        const vector<GLuint> &ids = g->second;
+        for(unsigned first = 0; first + TEXTURE_ARRAY_MIN_LAYERS <= ids.size(); first += max_layers)
+        {
+            unsigned count = min((unsigned)ids.size() - first, (unsigned)max_layers);
+            GLuint array = CreateArray(g->first, &ids[first], count);
+
+            ///3. move textures to array - array is registered without source file, so it's never demoted
+            TTextureResidency *residency = NULL;
+            for(unsigned i=0; i<count; i++)
+            {
+                vector<Texture*> &layer_users = users[ids[first + i]];
+                for(unsigned j=0; j<layer_users.size(); j++)
+                {
+                    if(residency == NULL)
+                        residency = SceneManager::Instance()->AddTexture(array, GL_TEXTURE_2D_ARRAY, "", BASE, g->first.levels > 1, false);
+                    else
+                        SceneManager::Instance()->AcquireTexture(array);
+                    layer_users[j]->SetArrayLayer(array, i, residency);
+                    stats.textures++;
+                }
+                packed.push_back(ids[first + i]);
+            }
+            SceneManager::Instance()->TextureUploaded(array);
+
+            stats.arrays++;
+            stats.layers += count;
+            stats.bytes += residency->bytes;
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,28 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: texture_array.h
+@brief packing of material textures with the same size and format into 2D texture arrays, so
+materials share one texture object and select their image by layer index
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _TEXTURE_ARRAY_H_
+#define _TEXTURE_ARRAY_H_
+
+#include "texture.h"
+
+///minimal number of textures with the same layout packed into an array
+#define TEXTURE_ARRAY_MIN_LAYERS 2
+
+///@brief Result of texture packing
+struct TTextureArrayStats{
+    ///created arrays, source textures copied into layers, material textures moved to arrays
+    unsigned arrays, layers, textures;
+    ///video memory of created arrays
+    size_t bytes;
+};
+
+//pack fully loaded 2D textures of materials into texture arrays
+TTextureArrayStats PackTextureArrays(const vector<Texture*> &textures, vector<GLuint> &packed);
+
+#endif
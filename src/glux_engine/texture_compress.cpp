@@ -0,0 +1,755 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: texture_compress.cpp
+@brief CPU block compression of textures (BC1, BC3, BC4, BC5) and disk cache of compressed
+mip chains.
+BC1 endpoints are fitted along principal axis of block colors and refined by least squares,
+BC4 blocks use range of values with 8 interpolated levels.
+****************************************************************************************************
+***************************************************************************************************/
+#include "texture_compress.h"
+#include "texture.h"
+#include "thread_pool.h"
+#include "texture_mipmap.h"
+
+#include <SDL/SDL_thread.h>
+
+#ifdef _WIN_
+    #include <direct.h>
+#else
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+///@brief Header of compressed texture file (followed by level offsets and blocks)
+struct TCompressedHeader{
+    char magic[4];
+    unsigned version;
+    unsigned format;
+    unsigned width, height, levels;
+};
+
+
+/**
+****************************************************************************************************
+@brief Return size of one 4x4 block in bytes
+****************************************************************************************************/
+unsigned GetBlockSize(GLenum format)
+{
+    if(format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RED_RGTC1)
+        return 8;
+    return 16;
+}
+
+/**
+****************************************************************************************************
+@brief Select compressed format. Bump maps store normal X and Y in BC5 (Z is reconstructed in
+shader), height maps use single channel BC4, color maps BC1 or BC3 (with alpha).
+@param textype texture type
+@param channels used image channels (3 or 4)
+****************************************************************************************************/
+GLenum GetCompressedFormat(int textype, GLuint channels)
+{
+    if(textype == BUMP)
+        return GL_COMPRESSED_RG_RGTC2;
+    if(textype == PARALLAX || textype == DISPLACE)
+        return GL_COMPRESSED_RED_RGTC1;
+    if(channels == 4)
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
+
+
+/**
+****************************************************************************************************
+@brief Quantize color to RGB565
+****************************************************************************************************/
+static inline unsigned PackRGB565(const float c[3])
+{
+    int r = (int)(c[0]*(31.0f/255.0f) + 0.5f);
+    int g = (int)(c[1]*(63.0f/255.0f) + 0.5f);
+    int b = (int)(c[2]*(31.0f/255.0f) + 0.5f);
+    r = r < 0 ? 0 : (r > 31 ? 31 : r);
+    g = g < 0 ? 0 : (g > 63 ? 63 : g);
+    b = b < 0 ? 0 : (b > 31 ? 31 : b);
+    return (r << 11) | (g << 5) | b;
+}
+
+/**
+****************************************************************************************************
+@brief Expand RGB565 color to 8 bits per channel
+****************************************************************************************************/
+static inline void UnpackRGB565(unsigned v, int c[3])
+{
+    int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+    c[0] = (r << 3) | (r >> 2);
+    c[1] = (g << 2) | (g >> 4);
+    c[2] = (b << 3) | (b >> 2);
+}
+
+/**
+****************************************************************************************************
+@brief Select nearest palette color for every pixel of block
+@param r,g,b block colors
+@param c0,c1 endpoints (RGB565)
+@param idx output indices
+@return squared error of block
+****************************************************************************************************/
+static float SelectBC1Indices(const float *r, const float *g, const float *b, unsigned c0, unsigned c1, unsigned char *idx)
+{
+    //four color palette: c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+    int e0[3], e1[3];
+    UnpackRGB565(c0, e0);
+    UnpackRGB565(c1, e1);
+    float pal[4][3];
+    for(int k=0; k<3; k++)
+    {
+        pal[0][k] = (float)e0[k];
+        pal[1][k] = (float)e1[k];
+        pal[2][k] = (2.0f*e0[k] + e1[k])/3.0f;
+        pal[3][k] = (e0[k] + 2.0f*e1[k])/3.0f;
+    }
+
+    float error = 0.0f;
+#ifdef USE_SSE
+    //four pixels at once
+    for(int i=0; i<16; i+=4)
+    {
+        __m128 pr = _mm_loadu_ps(r + i), pg = _mm_loadu_ps(g + i), pb = _mm_loadu_ps(b + i);
+        __m128 best = _mm_set1_ps(1e30f);
+        __m128i best_idx = _mm_setzero_si128();
+        for(int p=0; p<4; p++)
+        {
+            __m128 dr = _mm_sub_ps(pr, _mm_set1_ps(pal[p][0]));
+            __m128 dg = _mm_sub_ps(pg, _mm_set1_ps(pal[p][1]));
+            __m128 db = _mm_sub_ps(pb, _mm_set1_ps(pal[p][2]));
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+            best = _mm_min_ps(d, best);
+            best_idx = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)), _mm_andnot_si128(closer, best_idx));
+        }
+        int ids[4];
+        float errs[4];
+        _mm_storeu_si128((__m128i*)ids, best_idx);
+        _mm_storeu_ps(errs, best);
+        for(int j=0; j<4; j++)
+        {
+            idx[i + j] = (unsigned char)ids[j];
+            error += errs[j];
+        }
+    }
+#else
+    for(int i=0; i<16; i++)
+    {
+        float best = 1e30f;
+        for(int p=0; p<4; p++)
+        {
+            float dr = r[i] - pal[p][0], dg = g[i] - pal[p][1], db = b[i] - pal[p][2];
+            float d = dr*dr + dg*dg + db*db;
+            if(d < best)
+            {
+                best = d;
+                idx[i] = (unsigned char)p;
+            }
+        }
+        error += best;
+    }
+#endif
+    return error;
+}
+
+/**
+****************************************************************************************************
+@brief Compress 4x4 block of RGBA pixels to BC1 (alpha is ignored)
+@param rgba 16 pixels in row order
+@param out 8 bytes of compressed block
+****************************************************************************************************/
+void EncodeBC1Block(const GLubyte *rgba, GLubyte *out)
+{
+    float r[16], g[16], b[16];
+    float mean[3] = {0.0f, 0.0f, 0.0f};
+    for(int i=0; i<16; i++)
+    {
+        r[i] = rgba[4*i];
+        g[i] = rgba[4*i + 1];
+        b[i] = rgba[4*i + 2];
+        mean[0] += r[i];
+        mean[1] += g[i];
+        mean[2] += b[i];
+    }
+    for(int k=0; k<3; k++)
+        mean[k] /= 16.0f;
+
+    ///1. principal axis of colors (power iteration on covariance matrix)
+    float cov[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    for(int i=0; i<16; i++)
+    {
+        float dr = r[i] - mean[0], dg = g[i] - mean[1], db = b[i] - mean[2];
+        cov[0] += dr*dr; cov[1] += dr*dg; cov[2] += dr*db;
+        cov[3] += dg*dg; cov[4] += dg*db; cov[5] += db*db;
+    }
+    float axis[3] = {1.0f, 1.0f, 1.0f};
+    for(int it=0; it<8; it++)
+    {
+        float a0 = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+        float a1 = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+        float a2 = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+        float m = max(fabs(a0), max(fabs(a1), fabs(a2)));
+        if(m < 1e-6f)
+            break;
+        axis[0] = a0/m; axis[1] = a1/m; axis[2] = a2/m;
+    }
+    float len = sqrt(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+    axis[0] /= len; axis[1] /= len; axis[2] /= len;
+
+    ///2. endpoints from extremal projections, inset by 1/16 of range to reduce error of outliers
+    float pmin = 1e30f, pmax = -1e30f;
+    for(int i=0; i<16; i++)
+    {
+        float p = (r[i] - mean[0])*axis[0] + (g[i] - mean[1])*axis[1] + (b[i] - mean[2])*axis[2];
+        pmin = min(pmin, p);
+        pmax = max(pmax, p);
+    }
+    float inset = (pmax - pmin)/16.0f;
+    float e0[3], e1[3];
+    for(int k=0; k<3; k++)
+    {
+        e0[k] = mean[k] + axis[k]*(pmax - inset);
+        e1[k] = mean[k] + axis[k]*(pmin + inset);
+    }
+    unsigned c0 = PackRGB565(e0), c1 = PackRGB565(e1);
+    unsigned char idx[16];
+    float error = SelectBC1Indices(r, g, b, c0, c1, idx);
+
+    ///3. refine endpoints by least squares fit to selected indices
+    static const float weight[4] = {1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f};
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[3] = {0.0f, 0.0f, 0.0f}, bx[3] = {0.0f, 0.0f, 0.0f};
+    for(int i=0; i<16; i++)
+    {
+        float a = weight[idx[i]], w = 1.0f - a;
+        float x[3] = { r[i], g[i], b[i] };
+        aa += a*a; ab += a*w; bb += w*w;
+        for(int k=0; k<3; k++)
+        {
+            ax[k] += a*x[k];
+            bx[k] += w*x[k];
+        }
+    }
+    float det = aa*bb - ab*ab;
+    if(fabs(det) > 1e-4f)
+    {
+        for(int k=0; k<3; k++)
+        {
+            e0[k] = (bb*ax[k] - ab*bx[k])/det;
+            e1[k] = (aa*bx[k] - ab*ax[k])/det;
+        }
+        unsigned r0 = PackRGB565(e0), r1 = PackRGB565(e1);
+        unsigned char ridx[16];
+        float rerror = SelectBC1Indices(r, g, b, r0, r1, ridx);
+        if(rerror < error)
+        {
+            c0 = r0;
+            c1 = r1;
+            memcpy(idx, ridx, 16);
+        }
+    }
+
+    ///4. four color mode requires c0 > c1 - swap endpoints (and indices 0<->1, 2<->3)
+    if(c0 < c1)
+    {
+        unsigned tmp = c0; c0 = c1; c1 = tmp;
+        for(int i=0; i<16; i++)
+            idx[i] ^= 1;
+    }
+    else if(c0 == c1)
+        memset(idx, 0, 16);
+
+    unsigned bits = 0;
+    for(int i=0; i<16; i++)
+        bits |= idx[i] << (2*i);
+    out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+    out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+    for(int i=0; i<4; i++)
+        out[4 + i] = (bits >> (8*i)) & 0xFF;
+}
+
+/**
+****************************************************************************************************
+@brief Compress 16 single channel values to BC4 (range of values divided into 8 levels)
+@param values first value
+@param stride bytes between values
+@param out 8 bytes of compressed block
+****************************************************************************************************/
+void EncodeBC4Block(const GLubyte *values, int stride, GLubyte *out)
+{
+    int vmin = 255, vmax = 0;
+    for(int i=0; i<16; i++)
+    {
+        vmin = min(vmin, (int)values[i*stride]);
+        vmax = max(vmax, (int)values[i*stride]);
+    }
+    //a0 > a1 selects mode with 6 interpolated values
+    out[0] = (GLubyte)vmax;
+    out[1] = (GLubyte)vmin;
+
+    unsigned long long bits = 0;
+    if(vmax > vmin)
+    {
+        float scale = 7.0f/(vmax - vmin);
+        for(int i=0; i<16; i++)
+        {
+            //position between min (0) and max (7), index 0 is a0, 1 is a1, 2..7 go from a0 to a1
+            int p = (int)((values[i*stride] - vmin)*scale + 0.5f);
+            unsigned long long index = p == 7 ? 0 : (p == 0 ? 1 : 8 - p);
+            bits |= index << (3*i);
+        }
+    }
+    for(int i=0; i<6; i++)
+        out[2 + i] = (GLubyte)((bits >> (8*i)) & 0xFF);
+}
+
+/**
+****************************************************************************************************
+@brief Compress 4x4 block of RGBA pixels to BC3 (BC4 alpha block followed by BC1 color block)
+****************************************************************************************************/
+void EncodeBC3Block(const GLubyte *rgba, GLubyte *out)
+{
+    EncodeBC4Block(rgba + 3, 4, out);
+    EncodeBC1Block(rgba, out + 8);
+}
+
+/**
+****************************************************************************************************
+@brief Compress red and green channel of 4x4 block of RGBA pixels to BC5 (two BC4 blocks)
+****************************************************************************************************/
+void EncodeBC5Block(const GLubyte *rgba, GLubyte *out)
+{
+    EncodeBC4Block(rgba, 4, out);
+    EncodeBC4Block(rgba + 1, 4, out + 8);
+}
+
+/**
+****************************************************************************************************
+@brief Decompress BC1 block into 16 RGBA pixels
+****************************************************************************************************/
+void DecodeBC1Block(const GLubyte *block, GLubyte *rgba)
+{
+    unsigned c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+    int pal[4][4];
+    UnpackRGB565(c0, pal[0]);
+    UnpackRGB565(c1, pal[1]);
+    pal[0][3] = pal[1][3] = pal[2][3] = pal[3][3] = 255;
+    for(int k=0; k<3; k++)
+    {
+        if(c0 > c1)
+        {
+            pal[2][k] = (2*pal[0][k] + pal[1][k])/3;
+            pal[3][k] = (pal[0][k] + 2*pal[1][k])/3;
+        }
+        else
+        {
+            pal[2][k] = (pal[0][k] + pal[1][k])/2;
+            pal[3][k] = 0;
+        }
+    }
+    if(c0 <= c1)
+        pal[3][3] = 0;
+
+    unsigned bits = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned)block[7] << 24);
+    for(int i=0; i<16; i++)
+    {
+        int p = (bits >> (2*i)) & 3;
+        for(int k=0; k<4; k++)
+            rgba[4*i + k] = (GLubyte)pal[p][k];
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Decompress BC4 block into 16 values
+@param block compressed block
+@param values first output value
+@param stride bytes between values
+****************************************************************************************************/
+void DecodeBC4Block(const GLubyte *block, GLubyte *values, int stride)
+{
+    int a0 = block[0], a1 = block[1];
+    int pal[8] = { a0, a1, 0, 0, 0, 0, 0, 255 };
+    if(a0 > a1)
+    {
+        for(int i=2; i<8; i++)
+            pal[i] = ((8 - i)*a0 + (i - 1)*a1)/7;
+    }
+    else
+    {
+        for(int i=2; i<6; i++)
+            pal[i] = ((6 - i)*a0 + (i - 1)*a1)/5;
+    }
+
+    unsigned long long bits = 0;
+    for(int i=0; i<6; i++)
+        bits |= (unsigned long long)block[2 + i] << (8*i);
+    for(int i=0; i<16; i++)
+        values[i*stride] = (GLubyte)pal[(bits >> (3*i)) & 7];
+}
+
+/**
+****************************************************************************************************
+@brief Decompress one level into RGBA pixels. Missing channels of BC4/BC5 are set to 0, alpha to 255.
+@param blocks compressed blocks
+@param width level width
+@param height level height
+@param format compressed format
+@param rgba output image (width*height*4 bytes)
+****************************************************************************************************/
+void DecompressImage(const GLubyte *blocks, GLuint width, GLuint height, GLenum format, GLubyte *rgba)
+{
+    unsigned bs = GetBlockSize(format);
+    GLuint bw = (width + 3)/4, bh = (height + 3)/4;
+    for(GLuint by=0; by<bh; by++)
+    {
+        for(GLuint bx=0; bx<bw; bx++)
+        {
+            const GLubyte *block = blocks + (by*bw + bx)*bs;
+            GLubyte px[64];
+            memset(px, 0, sizeof(px));
+            if(format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+                DecodeBC1Block(block, px);
+            else if(format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+            {
+                DecodeBC1Block(block + 8, px);
+                DecodeBC4Block(block, px + 3, 4);
+            }
+            else
+            {
+                DecodeBC4Block(block, px, 4);
+                if(format == GL_COMPRESSED_RG_RGTC2)
+                    DecodeBC4Block(block + 8, px + 1, 4);
+                for(int i=0; i<16; i++)
+                    px[4*i + 3] = 255;
+            }
+
+            //copy pixels inside image
+            for(int y=0; y<4; y++)
+                for(int x=0; x<4; x++)
+                    if(bx*4 + x < width && by*4 + y < height)
+                        memcpy(rgba + ((by*4 + y)*width + bx*4 + x)*4, px + (y*4 + x)*4, 4);
+        }
+    }
+}
+
+
+///@brief Compression of one image level - rows of blocks are processed in parallel
+struct TCompressJob{
+    const GLubyte *rgba;
+    GLuint width, height;
+    GLenum format;
+    GLubyte *out;
+};
+
+/**
+****************************************************************************************************
+@brief Compress rows of blocks [begin, end). Pixels outside image are clamped to edge.
+****************************************************************************************************/
+static void CompressRowsJob(int begin, int end, void *data)
+{
+    TCompressJob *job = (TCompressJob*)data;
+    unsigned bs = GetBlockSize(job->format);
+    GLuint bw = (job->width + 3)/4;
+    GLubyte px[64];
+    for(int by=begin; by<end; by++)
+    {
+        for(GLuint bx=0; bx<bw; bx++)
+        {
+            for(int y=0; y<4; y++)
+            {
+                GLuint sy = min((GLuint)by*4 + y, job->height - 1);
+                for(int x=0; x<4; x++)
+                {
+                    GLuint sx = min(bx*4 + x, job->width - 1);
+                    memcpy(px + (y*4 + x)*4, job->rgba + (sy*job->width + sx)*4, 4);
+                }
+            }
+
+            GLubyte *block = job->out + (by*bw + bx)*bs;
+            if(job->format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+                EncodeBC1Block(px, block);
+            else if(job->format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+                EncodeBC3Block(px, block);
+            else if(job->format == GL_COMPRESSED_RG_RGTC2)
+                EncodeBC5Block(px, block);
+            else
+                EncodeBC4Block(px, 4, block);
+        }
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Compress image including mip chain (down to 1x1)
+@param pixels source image (RGB or RGBA)
+@param width image width
+@param height image height
+@param bpp bytes per pixel of source (3 or 4)
+@param format compressed format (see GetCompressedFormat())
+@param mipmap create mip chain?
+@param img output image
+@param parallel compress blocks in thread pool
+****************************************************************************************************/
+void CompressImage(const GLubyte *pixels, GLuint width, GLuint height, GLuint bpp, GLenum format, bool mipmap,
+                   TCompressedImage &img, bool parallel)
+{
+    //expand to RGBA
+    vector<GLubyte> level(width*height*4), next;
+    for(GLuint i=0; i<width*height; i++)
+    {
+        memcpy(&level[4*i], pixels + i*bpp, 3);
+        level[4*i + 3] = bpp == 4 ? pixels[i*bpp + 3] : 255;
+    }
+
+    unsigned levels = mipmap ? GetMipLevels(width, height) : 1;
+    //color levels are filtered in linear space, RGTC channels hold data
+    bool srgb = format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+
+    img.format = format;
+    img.width = width;
+    img.height = height;
+    img.offsets.resize(levels + 1);
+    unsigned bs = GetBlockSize(format);
+    img.offsets[0] = 0;
+    for(unsigned l=0; l<levels; l++)
+    {
+        GLuint w = max(width >> l, 1u), h = max(height >> l, 1u);
+        img.offsets[l + 1] = img.offsets[l] + ((w + 3)/4)*((h + 3)/4)*bs;
+    }
+    img.data.resize(img.offsets[levels]);
+
+    GLuint w = width, h = height;
+    for(unsigned l=0; l<levels; l++)
+    {
+        TCompressJob job;
+        job.rgba = &level[0];
+        job.width = w;
+        job.height = h;
+        job.format = format;
+        job.out = &img.data[img.offsets[l]];
+
+        int rows = (h + 3)/4;
+        if(parallel)
+            TThreadPool::Instance()->ParallelFor(rows, max(1, COMPRESS_JOB_BLOCKS/(int)((w + 3)/4)), CompressRowsJob, &job);
+        else
+            CompressRowsJob(0, rows, &job);
+
+        if(l + 1 < levels)
+        {
+            next.resize(max(w/2, 1u)*max(h/2, 1u)*4);
+            DownsampleImage(&level[0], w, h, 4, srgb, &next[0], parallel);
+            level.swap(next);
+            w = max(w/2, 1u);
+            h = max(h/2, 1u);
+        }
+    }
+}
+
+
+/**
+****************************************************************************************************
+@brief FNV-1a hash of file content
+****************************************************************************************************/
+unsigned long long HashData(const vector<char> &data)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    for(size_t i=0; i<data.size(); i++)
+    {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+****************************************************************************************************
+@brief Return name of temporary file for writing of cache file. Name is unique for process and
+thread, so concurrent writers (decoding threads, second instance) don't share it.
+@param path cache file
+****************************************************************************************************/
+string TempCachePath(const string &path)
+{
+#ifdef _WIN_
+    unsigned long pid = GetCurrentProcessId();
+#else
+    unsigned long pid = getpid();
+#endif
+    return path + ".tmp" + num2str(pid) + "_" + num2str(SDL_ThreadID());
+}
+
+/**
+****************************************************************************************************
+@brief Move completely written temporary file over cache file, so readers never see truncated
+file (crash during writing leaves only temporary file). Temporary file is removed on failure.
+@param temp written temporary file (TempCachePath())
+@param path cache file
+@return true if cache file was replaced
+****************************************************************************************************/
+bool CommitCacheFile(const string &temp, const string &path)
+{
+#ifdef _WIN_
+    bool ok = MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool ok = rename(temp.c_str(), path.c_str()) == 0;
+#endif
+    if(!ok)
+        remove(temp.c_str());
+    return ok;
+}
+
+/**
+****************************************************************************************************
+@brief Return length of opened cache file, read position is kept
+****************************************************************************************************/
+size_t CacheFileLength(ifstream &fin)
+{
+    streampos pos = fin.tellg();
+    fin.seekg(0, ios::end);
+    streampos length = fin.tellg();
+    fin.seekg(pos);
+    return length > 0 ? (size_t)length : 0;
+}
+
+/**
+****************************************************************************************************
+@brief Read compressed texture from cache file. Level offsets must be increasing and data must fit
+into file, otherwise entry is rejected.
+@return false if file doesn't exist or isn't valid
+****************************************************************************************************/
+static bool ReadCacheFile(const string &path, TCompressedImage &img)
+{
+    ifstream fin(path.c_str(), ios::binary);
+    if(!fin)
+        return false;
+    size_t length = CacheFileLength(fin);
+    TCompressedHeader header;
+    if(!fin.read((char*)&header, sizeof(header)) || memcmp(header.magic, "GXBC", 4) != 0 ||
+        header.version != TEXTURE_CACHE_VERSION || header.levels == 0 || header.levels > 32)
+        return false;
+
+    img.format = header.format;
+    img.width = header.width;
+    img.height = header.height;
+    img.offsets.resize(header.levels + 1);
+    size_t table = img.offsets.size()*sizeof(GLuint);
+    if(sizeof(header) + table > length || !fin.read((char*)&img.offsets[0], table))
+        return false;
+    for(unsigned l=0; l<header.levels; l++)
+        if(img.offsets[l] > img.offsets[l + 1])
+            return false;
+    if(img.offsets[0] != 0 || (size_t)img.offsets[header.levels] != length - sizeof(header) - table)
+        return false;
+    img.data.resize(img.offsets[header.levels]);
+    if(!img.data.empty() && !fin.read((char*)&img.data[0], img.data.size()))
+        return false;
+    return true;
+}
+
+/**
+****************************************************************************************************
+@brief Write compressed texture into cache (cache directory is created when missing). File is
+written under temporary name and renamed when complete.
+****************************************************************************************************/
+static void WriteCacheFile(const string &path, const TCompressedImage &img)
+{
+#ifdef _WIN_
+    _mkdir(TEXTURE_CACHE_DIR);
+#else
+    mkdir(TEXTURE_CACHE_DIR, 0755);
+#endif
+    string temp = TempCachePath(path);
+    ofstream fout(temp.c_str(), ios::binary);
+    if(!fout)
+    {
+        cerr<<"WARNING (LoadCompressedTexture): cannot write "<<path<<"\n";
+        return;
+    }
+    TCompressedHeader header;
+    memcpy(header.magic, "GXBC", 4);
+    header.version = TEXTURE_CACHE_VERSION;
+    header.format = img.format;
+    header.width = img.width;
+    header.height = img.height;
+    header.levels = img.GetLevels();
+    fout.write((const char*)&header, sizeof(header));
+    fout.write((const char*)&img.offsets[0], img.offsets.size()*sizeof(GLuint));
+    if(!img.data.empty())
+        fout.write((const char*)&img.data[0], img.data.size());
+    fout.close();
+    if(fout.fail() || !CommitCacheFile(temp, path))
+    {
+        remove(temp.c_str());
+        cerr<<"WARNING (LoadCompressedTexture): cannot write "<<path<<"\n";
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Load block compressed texture. Cache file is identified by hash of source file content,
+so changed images are compressed again. On cache miss, image is decoded, compressed and stored.
+Can be called from any thread.
+@param filename source image file
+@param textype texture type (selects format)
+@param mipmap should cached texture contain mip chain?
+@param img output image
+@return false when source image can't be loaded
+****************************************************************************************************/
+bool LoadCompressedTexture(const char *filename, int textype, bool mipmap, TCompressedImage &img)
+{
+    ///1. hash source file
+    ifstream fin(filename, ios::binary);
+    if(!fin)
+        return false;
+    fin.seekg(0, ios::end);
+    vector<char> src((size_t)fin.tellg());
+    fin.seekg(0, ios::beg);
+    if(!src.empty())
+        fin.read(&src[0], src.size());
+    fin.close();
+
+    //file name: content hash, kind of data and mipmap flag
+    char name[64];
+    const char *kind = textype == BUMP ? "n" : ((textype == PARALLAX || textype == DISPLACE) ? "h" : "c");
+    sprintf(name, "%016llx_%s%s.btc", HashData(src), kind, mipmap ? "m" : "");
+    string path = string(TEXTURE_CACHE_DIR) + name;
+
+    ///2. use cached blocks
+    if(ReadCacheFile(path, img))
+        return true;
+
+    ///3. otherwise decode image and compress it
+    GLubyte *pixels = NULL;
+    GLuint width, height, bpp;
+    const char *err = Texture::DecodeImage(filename, &pixels, &width, &height, &bpp);
+    if(err != NULL)
+    {
+        delete [] pixels;
+        return false;
+    }
+#ifdef _LINUX_
+    //uncompressed textures are uploaded as BGR on Linux, keep the same channel order
+    for(GLuint i=0; i<width*height; i++)
+        swap(pixels[i*bpp], pixels[i*bpp + 2]);
+#endif
+
+    //opaque images don't need alpha blocks
+    GLuint channels = 3;
+    if(bpp == 4)
+        for(GLuint i=0; i<width*height && channels == 3; i++)
+            if(pixels[i*4 + 3] != 255)
+                channels = 4;
+
+    CompressImage(pixels, width, height, bpp, GetCompressedFormat(textype, channels), mipmap, img);
+    delete [] pixels;
+
+    WriteCacheFile(path, img);
+    return true;
+}
@@ -0,0 +1,68 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: texture_compress.h
+@brief CPU block compression of textures (BC1, BC3, BC4, BC5) and disk cache of compressed
+mip chains
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _TEXTURE_COMPRESS_H_
+#define _TEXTURE_COMPRESS_H_
+
+#include "globals.h"
+
+///directory with compressed textures
+#define TEXTURE_CACHE_DIR "cache/"
+///version of compressed texture files - must be increased when encoder output changes
+#define TEXTURE_CACHE_VERSION 2
+///blocks compressed in one parallel job
+#define COMPRESS_JOB_BLOCKS 256
+
+
+///@brief Block compressed image with complete mip chain
+struct TCompressedImage{
+    GLenum format;
+    GLuint width, height;
+    ///compressed blocks of all levels
+    vector<GLubyte> data;
+    ///offsets of levels in data (levels + 1 values, last one is data size)
+    vector<GLuint> offsets;
+
+    ///@brief Return number of mip levels
+    unsigned GetLevels() const {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+};
+
+//size of one 4x4 block in bytes
+unsigned GetBlockSize(GLenum format);
+//select compressed format for texture type and image channels
+GLenum GetCompressedFormat(int textype, GLuint channels);
+
+//compress 4x4 block of RGBA pixels
+void EncodeBC1Block(const GLubyte *rgba, GLubyte *out);
+void EncodeBC3Block(const GLubyte *rgba, GLubyte *out);
+void EncodeBC5Block(const GLubyte *rgba, GLubyte *out);
+//compress 16 single channel values (stride in bytes between values)
+void EncodeBC4Block(const GLubyte *values, int stride, GLubyte *out);
+
+//decompress blocks (reference decoders used for quality measurements)
+void DecodeBC1Block(const GLubyte *block, GLubyte *rgba);
+void DecodeBC4Block(const GLubyte *block, GLubyte *values, int stride);
+void DecompressImage(const GLubyte *blocks, GLuint width, GLuint height, GLenum format, GLubyte *rgba);
+
+//compress image (3 or 4 bytes per pixel) including mip chain
+void CompressImage(const GLubyte *pixels, GLuint width, GLuint height, GLuint bpp, GLenum format, bool mipmap,
+                   TCompressedImage &img, bool parallel = true);
+//load compressed texture from cache, or compress image file and store it into cache
+bool LoadCompressedTexture(const char *filename, int textype, bool mipmap, TCompressedImage &img);
+//FNV-1a hash of file content (names of cache files)
+unsigned long long HashData(const vector<char> &data);
+//temporary file for writing of cache file (unique for process and thread)
+string TempCachePath(const string &path);
+//replace cache file by completely written temporary file
+bool CommitCacheFile(const string &temp, const string &path);
+//length of opened cache file in bytes
+size_t CacheFileLength(ifstream &fin);
+
+#endif
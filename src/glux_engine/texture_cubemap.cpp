@@ -0,0 +1,602 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: texture_cubemap.cpp
+@brief CPU prefiltering of environment cube maps - GGX roughness mip chain for single fetch glossy
+reflections and SH9 irradiance. Results are cached on disk (see TEXTURE_CACHE_DIR).
+****************************************************************************************************
+***************************************************************************************************/
+#include "texture_cubemap.h"
+#include "texture_compress.h"
+#include "texture.h"
+#include "thread_pool.h"
+#include "hires_timer.h"
+
+#ifdef _WIN_
+    #include <direct.h>
+#else
+    #include <sys/stat.h>
+#endif
+
+///@brief Cache file header
+struct TCubeHeader{
+    char magic[4];
+    GLuint version, size, levels;
+};
+
+///@brief Level of source cube map in linear colors (RGBA floats, faces one after another)
+struct TFloatCube{
+    GLuint size;
+    vector<float> texels;
+};
+
+///@brief Importance sample of GGX lobe in tangent space (normal = z) with source level to fetch
+struct TGGXSample{
+    float x, y, z;
+    float weight, lod;
+};
+
+///@brief Filtering of one output level - rows of all faces are processed in parallel
+struct TPrefilterJob{
+    const vector<TFloatCube> *source;
+    const TGGXSample *samples;
+    unsigned count;
+    GLuint size;
+    GLubyte *dest;
+};
+
+///@brief SH projection of one face
+struct TSHJob{
+    const TFloatCube *source;
+    double sh[6][9][3];
+};
+
+/**
+****************************************************************************************************
+@brief sRGB to linear conversion
+****************************************************************************************************/
+static inline float ToLinear(float c)
+{
+    return c <= 0.04045f ? c/12.92f : pow((c + 0.055f)/1.055f, 2.4f);
+}
+
+/**
+****************************************************************************************************
+@brief Linear to sRGB byte conversion
+****************************************************************************************************/
+static inline GLubyte ToSRGB(float l)
+{
+    l = min(max(l, 0.0f), 1.0f);
+    float c = l <= 0.0031308f ? l*12.92f : 1.055f*pow(l, 1.0f/2.4f) - 0.055f;
+    return (GLubyte)(c*255.0f + 0.5f);
+}
+
+/**
+****************************************************************************************************
+@brief Direction of texel center (OpenGL cube map face orientation)
+@param face cube face (+X, -X, +Y, -Y, +Z, -Z)
+@param s horizontal position on face (-1..1)
+@param t vertical position on face (-1..1)
+****************************************************************************************************/
+static inline glm::vec3 FaceDirection(int face, float s, float t)
+{
+    glm::vec3 d;
+    switch(face)
+    {
+        case 0: d = glm::vec3(1.0f, -t, -s); break;
+        case 1: d = glm::vec3(-1.0f, -t, s); break;
+        case 2: d = glm::vec3(s, 1.0f, t); break;
+        case 3: d = glm::vec3(s, -1.0f, -t); break;
+        case 4: d = glm::vec3(s, -t, 1.0f); break;
+        default: d = glm::vec3(-s, -t, -1.0f); break;
+    }
+    return glm::normalize(d);
+}
+
+/**
+****************************************************************************************************
+@brief Find face and position on face (0..1) of direction (inverse of FaceDirection())
+****************************************************************************************************/
+static inline int DirectionFace(float x, float y, float z, float &s, float &t)
+{
+    float ax = fabs(x), ay = fabs(y), az = fabs(z);
+    int face;
+    float sc, tc, ma;
+    if(ax >= ay && ax >= az)
+    {
+        face = x > 0.0f ? 0 : 1;
+        sc = x > 0.0f ? -z : z;
+        tc = -y;
+        ma = ax;
+    }
+    else if(ay >= az)
+    {
+        face = y > 0.0f ? 2 : 3;
+        sc = x;
+        tc = y > 0.0f ? z : -z;
+        ma = ay;
+    }
+    else
+    {
+        face = z > 0.0f ? 4 : 5;
+        sc = z > 0.0f ? x : -x;
+        tc = -y;
+        ma = az;
+    }
+    s = 0.5f*(sc/ma + 1.0f);
+    t = 0.5f*(tc/ma + 1.0f);
+    return face;
+}
+
+/**
+****************************************************************************************************
+@brief Bilinear fetch from face of source level (edges are clamped to face)
+@param cube source level
+@param face cube face
+@param s horizontal position (0..1)
+@param t vertical position (0..1)
+@param out RGBA color
+****************************************************************************************************/
+static inline void SampleFace(const TFloatCube &cube, int face, float s, float t, float *out)
+{
+    int size = cube.size;
+    float fx = min(max(s*size - 0.5f, 0.0f), size - 1.0f);
+    float fy = min(max(t*size - 0.5f, 0.0f), size - 1.0f);
+    int x0 = (int)fx, y0 = (int)fy;
+    int x1 = min(x0 + 1, size - 1), y1 = min(y0 + 1, size - 1);
+    float wx = fx - x0, wy = fy - y0;
+    const float *base = &cube.texels[face*size*size*4];
+    const float *p00 = base + (y0*size + x0)*4, *p01 = base + (y0*size + x1)*4;
+    const float *p10 = base + (y1*size + x0)*4, *p11 = base + (y1*size + x1)*4;
+#ifdef USE_SSE
+    __m128 top = _mm_add_ps(_mm_loadu_ps(p00), _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p01), _mm_loadu_ps(p00)), _mm_set1_ps(wx)));
+    __m128 bottom = _mm_add_ps(_mm_loadu_ps(p10), _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p11), _mm_loadu_ps(p10)), _mm_set1_ps(wx)));
+    _mm_storeu_ps(out, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), _mm_set1_ps(wy))));
+#else
+    for(int k=0; k<4; k++)
+    {
+        float top = p00[k] + (p01[k] - p00[k])*wx;
+        float bottom = p10[k] + (p11[k] - p10[k])*wx;
+        out[k] = top + (bottom - top)*wy;
+    }
+#endif
+}
+
+/**
+****************************************************************************************************
+@brief Van der Corput radical inverse (second coordinate of Hammersley point set)
+****************************************************************************************************/
+static inline float RadicalInverse(unsigned bits)
+{
+    bits = (bits << 16) | (bits >> 16);
+    bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+    bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+    bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+    bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+    return bits*2.3283064365386963e-10f;
+}
+
+/**
+****************************************************************************************************
+@brief Importance sample GGX lobe (view = normal). Every sample fetches source level whose texel
+covers solid angle of sample (filtered importance sampling), so few samples don't alias.
+@param roughness perceptual roughness (GGX alpha = roughness^2)
+@param source_size face size of source top level
+@param source_levels number of source levels
+@param samples output samples (only samples above horizon)
+****************************************************************************************************/
+static void GenerateGGXSamples(float roughness, GLuint source_size, unsigned source_levels, vector<TGGXSample> &samples)
+{
+    float alpha = roughness*roughness, a2 = alpha*alpha;
+    float texel_angle = 4.0f*PI/(6.0f*source_size*source_size);
+    samples.clear();
+    for(unsigned i=0; i<CUBEMAP_SAMPLES; i++)
+    {
+        float u = (float)i/CUBEMAP_SAMPLES, v = RadicalInverse(i);
+        float phi = 2.0f*PI*u;
+        float cos_h = sqrt((1.0f - v)/(1.0f + (a2 - 1.0f)*v));
+        float sin_h = sqrt(1.0f - cos_h*cos_h);
+        glm::vec3 h(sin_h*cos(phi), sin_h*sin(phi), cos_h);
+        //reflect view (normal) around half vector
+        TGGXSample s;
+        s.x = 2.0f*cos_h*h.x;
+        s.y = 2.0f*cos_h*h.y;
+        s.z = 2.0f*cos_h*cos_h - 1.0f;
+        if(s.z <= 0.0f)
+            continue;
+        s.weight = s.z;
+
+        //pdf of reflected direction is D/4 when view = normal
+        float d = cos_h*cos_h*(a2 - 1.0f) + 1.0f;
+        float pdf = a2/(PI*d*d)/4.0f;
+        float sample_angle = 1.0f/(CUBEMAP_SAMPLES*pdf + 0.0001f);
+        s.lod = roughness == 0.0f ? 0.0f : 0.5f*log(sample_angle/texel_angle)/log(2.0f) + 1.0f;
+        s.lod = min(max(s.lod, 0.0f), source_levels - 1.0f);
+        samples.push_back(s);
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Filter rows [begin, end) of output level (row index = face*size + y)
+****************************************************************************************************/
+static void PrefilterRowsJob(int begin, int end, void *data)
+{
+    TPrefilterJob *job = (TPrefilterJob*)data;
+    const vector<TFloatCube> &source = *job->source;
+    GLuint size = job->size;
+    for(int row=begin; row<end; row++)
+    {
+        int face = row/size, y = row % size;
+        GLubyte *out = job->dest + (face*size*size + y*size)*4;
+        for(GLuint x=0; x<size; x++, out += 4)
+        {
+            glm::vec3 n = FaceDirection(face, 2.0f*(x + 0.5f)/size - 1.0f, 2.0f*(y + 0.5f)/size - 1.0f);
+            glm::vec3 up = fabs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+            glm::vec3 tx = glm::normalize(glm::cross(up, n));
+            glm::vec3 ty = glm::cross(n, tx);
+
+            float color[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, texel[4];
+            float weight = 0.0f;
+#ifdef USE_SSE
+            __m128 sum = _mm_setzero_ps();
+#endif
+            for(unsigned i=0; i<job->count; i++)
+            {
+                const TGGXSample &s = job->samples[i];
+                glm::vec3 l = tx*s.x + ty*s.y + n*s.z;
+                float fs, ft;
+                int f = DirectionFace(l.x, l.y, l.z, fs, ft);
+                SampleFace(source[(int)(s.lod + 0.5f)], f, fs, ft, texel);
+#ifdef USE_SSE
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(texel), _mm_set1_ps(s.weight)));
+#else
+                for(int k=0; k<4; k++)
+                    color[k] += texel[k]*s.weight;
+#endif
+                weight += s.weight;
+            }
+#ifdef USE_SSE
+            _mm_storeu_ps(color, sum);
+#endif
+            float inv = weight > 0.0f ? 1.0f/weight : 0.0f;
+            out[0] = ToSRGB(color[0]*inv);
+            out[1] = ToSRGB(color[1]*inv);
+            out[2] = ToSRGB(color[2]*inv);
+            out[3] = (GLubyte)(min(max(color[3]*inv, 0.0f), 1.0f)*255.0f + 0.5f);
+        }
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Project faces [begin, end) of source level into SH9 (weighted by texel solid angle)
+****************************************************************************************************/
+static void ProjectSHJob(int begin, int end, void *data)
+{
+    TSHJob *job = (TSHJob*)data;
+    const TFloatCube &cube = *job->source;
+    GLuint size = cube.size;
+    for(int face=begin; face<end; face++)
+    {
+        double *sh = &job->sh[face][0][0];
+        memset(sh, 0, 27*sizeof(double));
+        for(GLuint y=0; y<size; y++)
+        {
+            for(GLuint x=0; x<size; x++)
+            {
+                float s = 2.0f*(x + 0.5f)/size - 1.0f, t = 2.0f*(y + 0.5f)/size - 1.0f;
+                glm::vec3 d = FaceDirection(face, s, t);
+                //solid angle of texel
+                float tmp = 1.0f + s*s + t*t;
+                double w = 4.0/(size*size*tmp*sqrt(tmp));
+                double basis[9] = {
+                    0.282095,
+                    0.488603*d.y, 0.488603*d.z, 0.488603*d.x,
+                    1.092548*d.x*d.y, 1.092548*d.y*d.z, 0.315392*(3.0*d.z*d.z - 1.0),
+                    1.092548*d.x*d.z, 0.546274*(d.x*d.x - d.y*d.y)
+                };
+                const float *c = &cube.texels[(face*size*size + y*size + x)*4];
+                for(int i=0; i<9; i++)
+                    for(int k=0; k<3; k++)
+                        sh[i*3 + k] += c[k]*basis[i]*w;
+            }
+        }
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Halve source level with box filter
+****************************************************************************************************/
+static void DownsampleCube(const TFloatCube &src, TFloatCube &dest)
+{
+    GLuint size = src.size, half = max(size/2, 1u);
+    dest.size = half;
+    dest.texels.resize(6*half*half*4);
+    for(int face=0; face<6; face++)
+    {
+        const float *in = &src.texels[face*size*size*4];
+        float *out = &dest.texels[face*half*half*4];
+        for(GLuint y=0; y<half; y++)
+        {
+            for(GLuint x=0; x<half; x++)
+            {
+                GLuint x0 = min(2*x, size - 1), x1 = min(2*x + 1, size - 1);
+                GLuint y0 = min(2*y, size - 1), y1 = min(2*y + 1, size - 1);
+                for(int k=0; k<4; k++)
+                    out[(y*half + x)*4 + k] = 0.25f*(in[(y0*size + x0)*4 + k] + in[(y0*size + x1)*4 + k] +
+                                                     in[(y1*size + x0)*4 + k] + in[(y1*size + x1)*4 + k]);
+            }
+        }
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Prefilter environment cube map. Source is converted to linear colors and downsampled, every
+output level is convolved with GGX lobe of its roughness (view = normal approximation), texels are
+processed by thread pool. Source is also projected into SH9 irradiance.
+@param faces six faces (+X, -X, +Y, -Y, +Z, -Z), sRGB colors
+@param size face size (faces are square)
+@param bpp bytes per pixel (3 or 4)
+@param cube output cube map
+@param parallel filter in thread pool
+@return statistics of filtering
+****************************************************************************************************/
+TPrefilterStats PrefilterCubemap(const GLubyte *faces[6], GLuint size, GLuint bpp, TPrefilteredCube &cube, bool parallel)
+{
+    HRTimer timer;
+    TPrefilterStats stats;
+    stats.texels = stats.samples = 0.0;
+
+    ///1. linear source mip chain
+    float to_linear[256];
+    for(int i=0; i<256; i++)
+        to_linear[i] = ToLinear(i/255.0f);
+    vector<TFloatCube> source(1);
+    source[0].size = size;
+    source[0].texels.resize(6*size*size*4);
+    for(int face=0; face<6; face++)
+    {
+        float *out = &source[0].texels[face*size*size*4];
+        for(GLuint i=0; i<size*size; i++)
+        {
+            const GLubyte *p = faces[face] + i*bpp;
+            out[4*i] = to_linear[p[0]];
+            out[4*i + 1] = to_linear[p[1]];
+            out[4*i + 2] = to_linear[p[2]];
+            out[4*i + 3] = bpp == 4 ? p[3]/255.0f : 1.0f;
+        }
+    }
+    while(source.back().size > 1)
+    {
+        source.push_back(TFloatCube());
+        DownsampleCube(source[source.size() - 2], source.back());
+    }
+
+    ///2. output levels down to CUBEMAP_MIN_SIZE
+    cube.size = min(size, (GLuint)CUBEMAP_PREFILTER_SIZE);
+    cube.levels = 1;
+    while((cube.size >> cube.levels) >= CUBEMAP_MIN_SIZE)
+        cube.levels++;
+    cube.offsets.resize(cube.levels + 1);
+    cube.offsets[0] = 0;
+    for(unsigned l=0; l<cube.levels; l++)
+        cube.offsets[l + 1] = cube.offsets[l] + 6*(cube.size >> l)*(cube.size >> l)*4;
+    cube.data.resize(cube.offsets[cube.levels]);
+
+    vector<TGGXSample> samples;
+    for(unsigned l=0; l<cube.levels; l++)
+    {
+        float roughness = cube.levels > 1 ? (float)l/(cube.levels - 1) : 0.0f;
+        GLuint level_size = cube.size >> l;
+        if(roughness == 0.0f)
+        {
+            //mirror level - single fetch from source level of the same resolution
+            TGGXSample mirror = { 0.0f, 0.0f, 1.0f, 1.0f, 0.0f };
+            while((size >> (int)mirror.lod) > level_size)
+                mirror.lod++;
+            samples.assign(1, mirror);
+        }
+        else
+            GenerateGGXSamples(roughness, size, source.size(), samples);
+
+        TPrefilterJob job;
+        job.source = &source;
+        job.samples = &samples[0];
+        job.count = samples.size();
+        job.size = level_size;
+        job.dest = &cube.data[cube.offsets[l]];
+        if(parallel)
+            TThreadPool::Instance()->ParallelFor(6*level_size, 1, PrefilterRowsJob, &job);
+        else
+            PrefilterRowsJob(0, 6*level_size, &job);
+
+        stats.texels += 6.0*level_size*level_size;
+        stats.samples += 6.0*level_size*level_size*samples.size();
+    }
+
+    ///3. irradiance from small source level
+    unsigned sh_level = 0;
+    while(sh_level + 1 < source.size() && source[sh_level].size > CUBEMAP_SH_SIZE)
+        sh_level++;
+    TSHJob *sh_job = new TSHJob;
+    sh_job->source = &source[sh_level];
+    if(parallel)
+        TThreadPool::Instance()->ParallelFor(6, 1, ProjectSHJob, sh_job);
+    else
+        ProjectSHJob(0, 6, sh_job);
+    //cosine lobe convolution divided by PI: bands are scaled by 1, 2/3 and 1/4
+    const double band[9] = { 1.0, 2.0/3.0, 2.0/3.0, 2.0/3.0, 0.25, 0.25, 0.25, 0.25, 0.25 };
+    for(int i=0; i<9; i++)
+    {
+        double c[3] = { 0.0, 0.0, 0.0 };
+        for(int face=0; face<6; face++)
+            for(int k=0; k<3; k++)
+                c[k] += sh_job->sh[face][i][k];
+        cube.sh[i] = glm::vec3((float)(c[0]*band[i]), (float)(c[1]*band[i]), (float)(c[2]*band[i]));
+    }
+    delete sh_job;
+
+    stats.ms = timer.GetElapsedTimeMilliseconds();
+    return stats;
+}
+
+/**
+****************************************************************************************************
+@brief Read prefiltered cube map from cache file
+@return false if file doesn't exist or isn't valid
+****************************************************************************************************/
+static bool ReadCubeCache(const string &path, TPrefilteredCube &cube)
+{
+    ifstream fin(path.c_str(), ios::binary);
+    if(!fin)
+        return false;
+    size_t length = CacheFileLength(fin);
+    TCubeHeader header;
+    if(!fin.read((char*)&header, sizeof(header)) || memcmp(header.magic, "GXPC", 4) != 0 ||
+        header.version != CUBEMAP_CACHE_VERSION || header.levels == 0 || header.levels > 16 ||
+        header.size == 0 || header.size > 4096)
+        return false;
+
+    cube.size = header.size;
+    cube.levels = header.levels;
+    cube.offsets.resize(cube.levels + 1);
+    cube.offsets[0] = 0;
+    for(unsigned l=0; l<cube.levels; l++)
+        cube.offsets[l + 1] = cube.offsets[l] + 6*max(cube.size >> l, 1u)*max(cube.size >> l, 1u)*4;
+    //levels and irradiance must fill rest of file
+    if(sizeof(header) + cube.offsets[cube.levels] + sizeof(cube.sh) != length)
+        return false;
+    cube.data.resize(cube.offsets[cube.levels]);
+    if(!fin.read((char*)&cube.data[0], cube.data.size()))
+        return false;
+    return !!fin.read((char*)cube.sh, sizeof(cube.sh));
+}
+
+/**
+****************************************************************************************************
+@brief Write prefiltered cube map into cache (cache directory is created when missing). File is
+written under temporary name and renamed when complete.
+****************************************************************************************************/
+static void WriteCubeCache(const string &path, const TPrefilteredCube &cube)
+{
+#ifdef _WIN_
+    _mkdir(TEXTURE_CACHE_DIR);
+#else
+    mkdir(TEXTURE_CACHE_DIR, 0755);
+#endif
+    string temp = TempCachePath(path);
+    ofstream fout(temp.c_str(), ios::binary);
+    if(!fout)
+    {
+        cerr<<"WARNING (LoadPrefilteredCubemap): cannot write "<<path<<"\n";
+        return;
+    }
+    TCubeHeader header;
+    memcpy(header.magic, "GXPC", 4);
+    header.version = CUBEMAP_CACHE_VERSION;
+    header.size = cube.size;
+    header.levels = cube.levels;
+    fout.write((const char*)&header, sizeof(header));
+    fout.write((const char*)&cube.data[0], cube.data.size());
+    fout.write((const char*)cube.sh, sizeof(cube.sh));
+    fout.close();
+    if(fout.fail() || !CommitCacheFile(temp, path))
+    {
+        remove(temp.c_str());
+        cerr<<"WARNING (LoadPrefilteredCubemap): cannot write "<<path<<"\n";
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Load prefiltered environment cube map. Cache file is identified by hash of all six source
+files, on cache miss faces are decoded and prefiltered (throughput is reported).
+@param files six face images (+X, -X, +Y, -Y, +Z, -Z)
+@param cube output cube map
+@return false when faces can't be loaded or they differ in size
+****************************************************************************************************/
+bool LoadPrefilteredCubemap(const char **files, TPrefilteredCube &cube)
+{
+    ///1. hash source files
+    vector<char> src;
+    for(int i=0; i<6; i++)
+    {
+        ifstream fin(files[i], ios::binary);
+        if(!fin)
+        {
+            cerr<<"WARNING (LoadPrefilteredCubemap): cannot open "<<files[i]<<"\n";
+            return false;
+        }
+        fin.seekg(0, ios::end);
+        size_t offset = src.size(), length = (size_t)fin.tellg();
+        fin.seekg(0, ios::beg);
+        src.resize(offset + length);
+        if(length > 0)
+            fin.read(&src[offset], length);
+    }
+    char name[64];
+    sprintf(name, "%016llx_env.pfc", HashData(src));
+    string path = string(TEXTURE_CACHE_DIR) + name;
+
+    ///2. use cached cube map
+    if(ReadCubeCache(path, cube))
+        return true;
+
+    ///3. otherwise decode faces and prefilter them
+    GLubyte *pixels[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+    GLuint width = 0, height = 0, bpp = 0;
+    bool ok = true;
+    for(int i=0; i<6 && ok; i++)
+    {
+        GLuint w, h, b;
+        const char *err = Texture::DecodeImage(files[i], &pixels[i], &w, &h, &b);
+        if(err != NULL)
+        {
+            cerr<<"WARNING (LoadPrefilteredCubemap): "<<files[i]<<": "<<err<<"\n";
+            ok = false;
+        }
+        else if(i > 0 && (w != width || h != height || b != bpp))
+        {
+            cerr<<"WARNING (LoadPrefilteredCubemap): faces of cube map differ in size\n";
+            ok = false;
+        }
+        width = w;
+        height = h;
+        bpp = b;
+    }
+    if(ok && width != height)
+    {
+        cerr<<"WARNING (LoadPrefilteredCubemap): faces of cube map aren't square\n";
+        ok = false;
+    }
+    if(ok)
+    {
+#ifdef _LINUX_
+        //uncompressed textures are uploaded as BGR on Linux, keep the same channel order
+        for(int i=0; i<6; i++)
+            for(GLuint p=0; p<width*height; p++)
+                swap(pixels[i][p*bpp], pixels[i][p*bpp + 2]);
+#endif
+        TPrefilterStats stats = PrefilterCubemap((const GLubyte**)pixels, width, bpp, cube);
+        cout<<"Cube map prefiltered: "<<cube.levels<<" levels, "<<stats.samples/1e6<<" M samples in "<<stats.ms<<" ms ("
+            <<stats.samples/1e3/max(stats.ms, 0.001)<<" M samples/s)\n";
+        WriteCubeCache(path, cube);
+    }
+    for(int i=0; i<6; i++)
+        delete [] pixels[i];
+    return ok;
+}
+
+/**
+****************************************************************************************************
+@brief Roughness of prefiltered level matching Phong exponent (GGX alpha^2 = 2/(shininess + 2))
+@param shininess Phong exponent
+@return perceptual roughness (0..1)
+****************************************************************************************************/
+float ShininessToRoughness(float shininess)
+{
+    return min(max(pow(2.0f/(max(shininess, 0.0f) + 2.0f), 0.25f), 0.0f), 1.0f);
+}
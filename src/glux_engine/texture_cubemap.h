@@ -0,0 +1,56 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: texture_cubemap.h
+@brief CPU prefiltering of environment cube maps - GGX roughness mip chain for single fetch glossy
+reflections and SH9 irradiance. Results are cached on disk (see TEXTURE_CACHE_DIR).
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _TEXTURE_CUBEMAP_H_
+#define _TEXTURE_CUBEMAP_H_
+
+#include "globals.h"
+
+///version of prefiltered cube map cache files (increase when filter changes)
+#define CUBEMAP_CACHE_VERSION 1
+///face size of top (mirror) level of prefiltered cube map
+#define CUBEMAP_PREFILTER_SIZE 128
+///face size of roughest level
+#define CUBEMAP_MIN_SIZE 4
+///GGX importance samples per texel
+#define CUBEMAP_SAMPLES 64
+///face size of source level projected into spherical harmonics
+#define CUBEMAP_SH_SIZE 32
+
+
+///@brief Prefiltered cube map - level l is filtered with roughness l/(levels - 1), faces of level
+///are stored one after another (RGBA, sRGB encoded)
+struct TPrefilteredCube{
+    ///face size of top level, number of levels
+    GLuint size;
+    unsigned levels;
+    ///texels of all levels and offsets of levels in data (levels + 1 values)
+    vector<GLubyte> data;
+    vector<GLuint> offsets;
+    ///irradiance in SH9 coefficients (cosine convolved and divided by PI, so it's diffuse
+    ///reflected color of white surface)
+    glm::vec3 sh[9];
+};
+
+///@brief Prefiltering statistics (for throughput reports)
+struct TPrefilterStats{
+    ///computed texels and GGX samples
+    double texels, samples;
+    ///time of filtering in milliseconds
+    double ms;
+};
+
+//prefilter cube map from six RGB(A) faces (sRGB colors)
+TPrefilterStats PrefilterCubemap(const GLubyte *faces[6], GLuint size, GLuint bpp, TPrefilteredCube &cube,
+                                 bool parallel = true);
+//load prefiltered cube map of six face images from cache, prefilter it on cache miss
+bool LoadPrefilteredCubemap(const char **files, TPrefilteredCube &cube);
+//roughness of mip chain for Phong shininess
+float ShininessToRoughness(float shininess);
+
+#endif
@@ -0,0 +1,194 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: texture_mipmap.cpp
+@brief CPU generation of texture mip chains - gamma correct 2x2 box filter for color maps, linear
+filter for data maps (normals, heights). Levels are processed by thread pool.
+****************************************************************************************************
+***************************************************************************************************/
+#include "texture_mipmap.h"
+#include "thread_pool.h"
+
+///@brief Conversion tables between sRGB bytes and linear intensity (filled at startup, so decoding
+///threads don't race on initialization)
+static struct TGammaTables{
+    float to_linear[256];
+    GLubyte to_srgb[MIPMAP_SRGB_TABLE];
+
+    TGammaTables(){
+        for(int i=0; i<256; i++)
+        {
+            float c = i/255.0f;
+            to_linear[i] = c <= 0.04045f ? c/12.92f : pow((c + 0.055f)/1.055f, 2.4f);
+        }
+        for(int i=0; i<MIPMAP_SRGB_TABLE; i++)
+        {
+            float l = i/(float)(MIPMAP_SRGB_TABLE - 1);
+            float c = l <= 0.0031308f ? l*12.92f : 1.055f*pow(l, 1.0f/2.4f) - 0.055f;
+            to_srgb[i] = (GLubyte)(c*255.0f + 0.5f);
+        }
+    }
+} g_gamma;
+
+///@brief Downsampling of one level - rows of destination are processed in parallel
+struct TDownsampleJob{
+    const GLubyte *src;
+    GLuint width, height, bpp;
+    bool srgb;
+    GLubyte *dest;
+};
+
+/**
+****************************************************************************************************
+@brief Number of levels of complete mip chain
+****************************************************************************************************/
+unsigned GetMipLevels(GLuint width, GLuint height)
+{
+    unsigned levels = 1;
+    while((max(width, height) >> levels) > 0)
+        levels++;
+    return levels;
+}
+
+/**
+****************************************************************************************************
+@brief Average four sRGB pixels in linear space (alpha is averaged directly)
+****************************************************************************************************/
+static inline void AverageSRGB(const GLubyte *p00, const GLubyte *p01, const GLubyte *p10, const GLubyte *p11,
+                               GLuint bpp, GLubyte *out)
+{
+    const float *lin = g_gamma.to_linear;
+#ifdef USE_SSE
+    __m128 sum = _mm_add_ps(
+        _mm_add_ps(_mm_setr_ps(lin[p00[0]], lin[p00[1]], lin[p00[2]], 0.0f), _mm_setr_ps(lin[p01[0]], lin[p01[1]], lin[p01[2]], 0.0f)),
+        _mm_add_ps(_mm_setr_ps(lin[p10[0]], lin[p10[1]], lin[p10[2]], 0.0f), _mm_setr_ps(lin[p11[0]], lin[p11[1]], lin[p11[2]], 0.0f)));
+    //table index = average * (size - 1), rounded
+    const __m128 scale = _mm_set1_ps(0.25f*(MIPMAP_SRGB_TABLE - 1));
+    __m128i idx = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(sum, scale), _mm_set1_ps(0.5f)));
+    int i[4];
+    _mm_storeu_si128((__m128i*)i, idx);
+    out[0] = g_gamma.to_srgb[i[0]];
+    out[1] = g_gamma.to_srgb[i[1]];
+    out[2] = g_gamma.to_srgb[i[2]];
+#else
+    for(int k=0; k<3; k++)
+    {
+        float sum = lin[p00[k]] + lin[p01[k]] + lin[p10[k]] + lin[p11[k]];
+        out[k] = g_gamma.to_srgb[(int)(sum*0.25f*(MIPMAP_SRGB_TABLE - 1) + 0.5f)];
+    }
+#endif
+    if(bpp == 4)
+        out[3] = (GLubyte)((p00[3] + p01[3] + p10[3] + p11[3] + 2)/4);
+}
+
+/**
+****************************************************************************************************
+@brief Downsample destination rows [begin, end)
+****************************************************************************************************/
+static void DownsampleRowsJob(int begin, int end, void *data)
+{
+    TDownsampleJob *job = (TDownsampleJob*)data;
+    GLuint width = job->width, height = job->height, bpp = job->bpp;
+    GLuint w = max(width/2, 1u);
+    for(int y=begin; y<end; y++)
+    {
+        const GLubyte *row0 = job->src + min(2*(GLuint)y, height - 1)*width*bpp;
+        const GLubyte *row1 = job->src + min(2*(GLuint)y + 1, height - 1)*width*bpp;
+        GLubyte *out = job->dest + y*w*bpp;
+        GLuint x = 0;
+
+#ifdef USE_SSE
+        //linear RGBA: two destination pixels from 16 bytes of both rows
+        if(!job->srgb && bpp == 4 && width >= 2)
+        {
+            const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+            for(; 2*x + 4 <= width && x + 2 <= w; x += 2)
+            {
+                __m128i a = _mm_loadu_si128((const __m128i*)(row0 + 8*x));
+                __m128i b = _mm_loadu_si128((const __m128i*)(row1 + 8*x));
+                __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+                __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+                //add horizontal neighbours (pixel in upper half of 64-bit lane)
+                lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+                hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+                __m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+                _mm_storel_epi64((__m128i*)(out + 4*x), _mm_packus_epi16(sum, zero));
+            }
+        }
+#endif
+        for(; x<w; x++)
+        {
+            GLuint x0 = min(2*x, width - 1), x1 = min(2*x + 1, width - 1);
+            const GLubyte *p00 = row0 + x0*bpp, *p01 = row0 + x1*bpp;
+            const GLubyte *p10 = row1 + x0*bpp, *p11 = row1 + x1*bpp;
+            if(job->srgb)
+                AverageSRGB(p00, p01, p10, p11, bpp, out + x*bpp);
+            else
+            {
+                for(GLuint k=0; k<bpp; k++)
+                    out[x*bpp + k] = (GLubyte)((p00[k] + p01[k] + p10[k] + p11[k] + 2)/4);
+            }
+        }
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Halve image with 2x2 box filter. Color maps are filtered in linear space (sRGB decoded and
+encoded through tables), so mip levels keep brightness of the top level. Odd edges are clamped.
+@param src source pixels
+@param width source width
+@param height source height
+@param bpp bytes per pixel (3 or 4)
+@param srgb are RGB channels sRGB encoded colors?
+@param dest destination of max(width/2,1) x max(height/2,1) pixels
+@param parallel process rows in thread pool
+****************************************************************************************************/
+void DownsampleImage(const GLubyte *src, GLuint width, GLuint height, GLuint bpp, bool srgb, GLubyte *dest, bool parallel)
+{
+    TDownsampleJob job;
+    job.src = src;
+    job.width = width;
+    job.height = height;
+    job.bpp = bpp;
+    job.srgb = srgb;
+    job.dest = dest;
+
+    GLuint w = max(width/2, 1u), h = max(height/2, 1u);
+    if(parallel)
+        TThreadPool::Instance()->ParallelFor(h, max(1, MIPMAP_JOB_PIXELS/(int)w), DownsampleRowsJob, &job);
+    else
+        DownsampleRowsJob(0, h, &job);
+}
+
+/**
+****************************************************************************************************
+@brief Create mip chain of image down to 1x1. Each level is computed from previous one, rows of
+level are downsampled in parallel.
+@param pixels source image
+@param width image width
+@param height image height
+@param bpp bytes per pixel (3 or 4)
+@param srgb are RGB channels sRGB encoded colors? (false for normal and height maps)
+@param mipmap create mip levels? (chain contains only top level otherwise)
+@param chain output image
+@param parallel downsample in thread pool
+****************************************************************************************************/
+void GenerateMipChain(const GLubyte *pixels, GLuint width, GLuint height, GLuint bpp, bool srgb, bool mipmap,
+                      TMipChain &chain, bool parallel)
+{
+    unsigned levels = mipmap ? GetMipLevels(width, height) : 1;
+    chain.width = width;
+    chain.height = height;
+    chain.bpp = bpp;
+    chain.offsets.resize(levels + 1);
+    chain.offsets[0] = 0;
+    for(unsigned l=0; l<levels; l++)
+        chain.offsets[l + 1] = chain.offsets[l] + max(width >> l, 1u)*max(height >> l, 1u)*bpp;
+    chain.data.resize(chain.offsets[levels]);
+
+    memcpy(&chain.data[0], pixels, width*height*bpp);
+    for(unsigned l=1; l<levels; l++)
+        DownsampleImage(&chain.data[chain.offsets[l - 1]], max(width >> (l - 1), 1u), max(height >> (l - 1), 1u), bpp,
+                        srgb, &chain.data[chain.offsets[l]], parallel);
+}
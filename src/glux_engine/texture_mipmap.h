@@ -0,0 +1,48 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: texture_mipmap.h
+@brief CPU generation of texture mip chains - gamma correct 2x2 box filter for color maps, linear
+filter for data maps (normals, heights). Levels are processed by thread pool.
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _TEXTURE_MIPMAP_H_
+#define _TEXTURE_MIPMAP_H_
+
+#include "globals.h"
+
+///pixels of mip level downsampled in one parallel job
+#define MIPMAP_JOB_PIXELS 8192
+///size of linear to sRGB conversion table
+#define MIPMAP_SRGB_TABLE 16384
+
+
+///@brief Uncompressed image with mip chain (levels are stored one after another)
+struct TMipChain{
+    GLuint width, height, bpp;
+    ///pixels of all levels
+    vector<GLubyte> data;
+    ///offsets of levels in data (levels + 1 values, last one is data size)
+    vector<GLuint> offsets;
+
+    ///@brief Return number of mip levels
+    unsigned GetLevels() const {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+};
+
+///@brief Do RGB channels of texture type hold sRGB colors? (normal and height maps are linear)
+inline bool IsColorMap(int textype){
+    return textype != BUMP && textype != PARALLAX && textype != DISPLACE;
+}
+
+//number of levels of complete mip chain (down to 1x1)
+unsigned GetMipLevels(GLuint width, GLuint height);
+//halve image with 2x2 box filter (odd edges are clamped)
+void DownsampleImage(const GLubyte *src, GLuint width, GLuint height, GLuint bpp, bool srgb, GLubyte *dest,
+                     bool parallel = true);
+//create mip chain of image (only top level when mipmap isn't set)
+void GenerateMipChain(const GLubyte *pixels, GLuint width, GLuint height, GLuint bpp, bool srgb, bool mipmap,
+                      TMipChain &chain, bool parallel = true);
+
+#endif
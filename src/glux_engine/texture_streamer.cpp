@@ -0,0 +1,475 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: texture_streamer.cpp
+@brief asynchronous loading of textures - images are decoded by worker threads and uploaded
+through pixel buffer objects with limited amount of data per frame
+****************************************************************************************************
+***************************************************************************************************/
+#include "texture_streamer.h"
+#include "texture.h"
+#include "thread_pool.h"
+#include "SceneManager.h"
+#include <SDL/SDL_thread.h>
+#include <SDL/SDL_mutex.h>
+
+TTextureStreamer* TTextureStreamer::m_instance = NULL;
+bool TTextureStreamer::m_enabled = true;
+
+/**
+****************************************************************************************************
+@brief Return global texture streamer, decoding threads are created on first call
+****************************************************************************************************/
+TTextureStreamer* TTextureStreamer::Instance()
+{
+    if(m_instance == NULL)
+        m_instance = new TTextureStreamer();
+    return m_instance;
+}
+
+/**
+****************************************************************************************************
+@brief Delete global streamer - decoding threads are signalled to quit and joined, queued requests
+are freed. Must be called while OpenGL context exists (pixel buffers are deleted).
+****************************************************************************************************/
+void TTextureStreamer::Destroy()
+{
+    delete m_instance;
+    m_instance = NULL;
+}
+
+/**
+****************************************************************************************************
+@brief Create decoding threads. At least one thread is created even on single processor, so
+rendering thread never waits for decoding.
+****************************************************************************************************/
+TTextureStreamer::TTextureStreamer()
+{
+    m_quit = false;
+    m_pending = m_uploaded = 0;
+    m_decoded_bytes = 0;
+    m_pbo_next = 0;
+    m_max_stall = 0.0f;
+    for(int i=0; i<TEXTURE_PBO_COUNT; i++)
+    {
+        m_pbo[i] = 0;
+        m_pbo_size[i] = 0;
+    }
+
+    //image library must be initialized before threads use it
+    Texture::InitImageLibrary();
+    //decoding threads compress and mipmap images in thread pool, its lazy creation isn't
+    //synchronized - create it on this thread before any decoding thread starts
+    TThreadPool::Instance();
+
+    m_mutex = SDL_CreateMutex();
+    m_work_cond = SDL_CreateCond();
+    m_done_cond = SDL_CreateCond();
+
+    m_thread_count = max(1, min(TThreadPool::GetCPUCount() - 1, TEXTURE_DECODE_THREADS));
+    for(int i=0; i<m_thread_count; i++)
+    {
+        m_threads[i] = SDL_CreateThread(DecodeLoop, this);
+        if(m_threads[i] == NULL)
+        {
+            cerr<<"WARNING (TTextureStreamer): cannot create decoding thread: "<<SDL_GetError()<<endl;
+            m_thread_count = i;
+            break;
+        }
+    }
+    //no threads - textures are loaded synchronously
+    if(m_thread_count == 0)
+        m_enabled = false;
+}
+
+/**
+****************************************************************************************************
+@brief Stop decoding threads and free remaining requests
+****************************************************************************************************/
+TTextureStreamer::~TTextureStreamer()
+{
+    SDL_mutexP(m_mutex);
+    m_quit = true;
+    SDL_CondBroadcast(m_work_cond);
+    SDL_mutexV(m_mutex);
+
+    for(int i=0; i<m_thread_count; i++)
+        SDL_WaitThread(m_threads[i], NULL);
+
+    for(list<TTextureRequest*>::iterator it = m_requests.begin(); it != m_requests.end(); ++it)
+    {
+        delete (*it)->mips;
+        delete (*it)->compressed;
+        delete *it;
+    }
+    glDeleteBuffers(TEXTURE_PBO_COUNT, m_pbo);
+
+    SDL_DestroyCond(m_work_cond);
+    SDL_DestroyCond(m_done_cond);
+    SDL_DestroyMutex(m_mutex);
+}
+
+/**
+****************************************************************************************************
+@brief Queue texture file for decoding. Texture should contain placeholder image, which is replaced
+after upload.
+@param texID OpenGL texture
+@param file image file
+@param textype texture type (selects compressed format, BUMP maps are not compressed by driver)
+@param mipmap generate mip chain?
+@param compress load block compressed image (see LoadCompressedTexture())
+@param progressive upload coarse levels first (texture mustn't contain any image but placeholder)
+****************************************************************************************************/
+void TTextureStreamer::Request(GLuint texID, const char *file, int textype, bool mipmap, bool compress, bool progressive)
+{
+    TTextureRequest *req = new TTextureRequest;
+    req->state = TTextureRequest::QUEUED;
+    req->cancelled = req->failed = false;
+    req->texID = texID;
+    req->file = file;
+    req->textype = textype;
+    req->mipmap = mipmap;
+    req->compress = compress;
+    req->progressive = progressive;
+    req->mips = NULL;
+    req->compressed = NULL;
+    req->levels = req->base = 0;
+
+    //without decoding threads, image is decoded immediately and uploaded by next Update()
+    if(m_thread_count == 0)
+    {
+        Decode(req);
+        req->state = TTextureRequest::DECODED;
+    }
+
+    SDL_mutexP(m_mutex);
+    m_requests.push_back(req);
+    m_pending = m_requests.size();
+    SDL_CondSignal(m_work_cond);
+    SDL_mutexV(m_mutex);
+}
+
+/**
+****************************************************************************************************
+@brief Cancel pending request of texture (texture is being deleted)
+@param texID OpenGL texture
+****************************************************************************************************/
+void TTextureStreamer::Cancel(GLuint texID)
+{
+    SDL_mutexP(m_mutex);
+    for(list<TTextureRequest*>::iterator it = m_requests.begin(); it != m_requests.end(); ++it)
+        if((*it)->texID == texID)
+            (*it)->cancelled = true;
+    SDL_mutexV(m_mutex);
+}
+
+/**
+****************************************************************************************************
+@brief Load compressed image from cache or decode image file of request and generate its mip chain
+****************************************************************************************************/
+void TTextureStreamer::Decode(TTextureRequest *req)
+{
+    if(req->compress)
+    {
+        req->compressed = new TCompressedImage;
+        if(!LoadCompressedTexture(req->file.c_str(), req->textype, req->mipmap, *req->compressed))
+        {
+            delete req->compressed;
+            req->compressed = NULL;
+        }
+    }
+    if(req->compressed == NULL)
+    {
+        GLubyte *data = NULL;
+        GLuint width, height, bpp;
+        const char *err = Texture::DecodeImage(req->file.c_str(), &data, &width, &height, &bpp);
+        if(err != NULL)
+        {
+            cerr<<"WARNING (TTextureStreamer): "<<err<<" ("<<req->file<<")\n";
+            req->failed = true;
+            return;
+        }
+        req->mips = new TMipChain;
+        GenerateMipChain(data, width, height, bpp, IsColorMap(req->textype), req->mipmap, *req->mips);
+        delete [] data;
+    }
+    req->levels = req->base = req->compressed ? req->compressed->GetLevels() : req->mips->GetLevels();
+}
+
+/**
+****************************************************************************************************
+@brief Decoding thread loop - takes queued requests in order of submission and decodes them
+****************************************************************************************************/
+int TTextureStreamer::DecodeLoop(void *data)
+{
+    TTextureStreamer *streamer = (TTextureStreamer*)data;
+
+    SDL_mutexP(streamer->m_mutex);
+    while(!streamer->m_quit)
+    {
+        //find first queued request
+        TTextureRequest *req = NULL;
+        for(list<TTextureRequest*>::iterator it = streamer->m_requests.begin(); it != streamer->m_requests.end(); ++it)
+        {
+            if((*it)->state == TTextureRequest::QUEUED)
+            {
+                req = *it;
+                break;
+            }
+        }
+        if(req == NULL)
+        {
+            SDL_CondWait(streamer->m_work_cond, streamer->m_mutex);
+            continue;
+        }
+
+        req->state = TTextureRequest::DECODING;
+        //request stays in list, so it can't be freed during decoding
+        if(!req->cancelled)
+        {
+            SDL_mutexV(streamer->m_mutex);
+            Decode(req);
+            SDL_mutexP(streamer->m_mutex);
+        }
+        req->state = TTextureRequest::DECODED;
+        SDL_CondBroadcast(streamer->m_done_cond);
+    }
+    SDL_mutexV(streamer->m_mutex);
+    return 0;
+}
+
+/**
+****************************************************************************************************
+@brief Return size of mip levels in bytes
+@param req decoded request
+@param first first level
+@param last level after last counted level
+****************************************************************************************************/
+unsigned TTextureStreamer::GetSize(TTextureRequest *req, unsigned first, unsigned last)
+{
+    const vector<GLuint> &offsets = req->compressed ? req->compressed->offsets : req->mips->offsets;
+    return offsets[last] - offsets[first];
+}
+
+/**
+****************************************************************************************************
+@brief Return first level uploaded by next step of request. First step of progressive texture
+contains all levels up to TEXTURE_COARSE_SIZE, every other step adds one finer level.
+@param req decoded request
+****************************************************************************************************/
+unsigned TTextureStreamer::GetNextLevel(TTextureRequest *req)
+{
+    if(req->base < req->levels)
+        return req->base - 1;
+    if(!req->progressive)
+        return 0;
+
+    GLuint width = req->compressed ? req->compressed->width : req->mips->width;
+    GLuint height = req->compressed ? req->compressed->height : req->mips->height;
+    unsigned first = 0;
+    while(first + 1 < req->levels && max(width >> first, height >> first) > TEXTURE_COARSE_SIZE)
+        first++;
+    return first;
+}
+
+/**
+****************************************************************************************************
+@brief Return priority of next upload step. New textures get their coarse levels first, then
+textures used in last frame are refined (coarsest ones first), unused textures come last.
+@param req decoded request
+****************************************************************************************************/
+int TTextureStreamer::GetPriority(TTextureRequest *req)
+{
+    if(req->base == req->levels)
+        return 1000;
+    if(SceneManager::Instance()->IsTextureUsed(req->texID))
+        return 100 + req->base;
+    return req->base;
+}
+
+/**
+****************************************************************************************************
+@brief Copy mip levels into next pixel buffer of ring and specify texture from it. Buffer is
+invalidated before mapping, so driver doesn't wait until previous transfer from it finishes.
+Base level of texture is moved to the finest uploaded level.
+@param req decoded request
+@param first first uploaded level
+@param last level after last uploaded level
+****************************************************************************************************/
+void TTextureStreamer::Upload(TTextureRequest *req, unsigned first, unsigned last)
+{
+    const vector<GLubyte> &data = req->compressed ? req->compressed->data : req->mips->data;
+    const vector<GLuint> &offsets = req->compressed ? req->compressed->offsets : req->mips->offsets;
+    GLsizeiptr size = GetSize(req, first, last);
+    const GLubyte *pixels = &data[offsets[first]];
+
+    //copy to pixel buffer
+    unsigned i = m_pbo_next;
+    m_pbo_next = (m_pbo_next + 1) % TEXTURE_PBO_COUNT;
+    if(m_pbo[i] == 0)
+        glGenBuffers(1, &m_pbo[i]);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[i]);
+    if(size > m_pbo_size[i])
+    {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        m_pbo_size[i] = size;
+    }
+    void *ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if(ptr != NULL)
+    {
+        memcpy(ptr, pixels, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        pixels = NULL;      //offset in pixel buffer
+    }
+    else    //mapping failed - upload from client memory
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    //replace placeholder levels
+    glBindTexture(GL_TEXTURE_2D, req->texID);
+    GLuint width, height;
+    GLenum internal_format, format = 0;
+    if(req->compressed)
+    {
+        width = req->compressed->width;
+        height = req->compressed->height;
+        internal_format = req->compressed->format;
+    }
+    else
+    {
+        width = req->mips->width;
+        height = req->mips->height;
+        Texture::GetUploadFormat(req->textype, req->mips->bpp, &internal_format, &format);
+    }
+    //rows of small RGB levels aren't aligned to 4 bytes
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for(unsigned l=first; l<last; l++)
+    {
+        GLsizei w = max(width >> l, 1u), h = max(height >> l, 1u);
+        const GLubyte *level = pixels + (offsets[l] - offsets[first]);
+        if(req->compressed)
+            glCompressedTexImage2D(GL_TEXTURE_2D, l, internal_format, w, h, 0, offsets[l + 1] - offsets[l], level);
+        else
+            glTexImage2D(GL_TEXTURE_2D, l, internal_format, w, h, 0, format, GL_UNSIGNED_BYTE, level);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    //sample only uploaded levels
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, first);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, req->levels - 1);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+/**
+****************************************************************************************************
+@brief Upload steps of decoded images in order of priority until budget is exhausted. Texture is
+reported to residency manager when its top level is uploaded. Must be called from rendering thread
+(once per frame).
+@param budget maximal amount of uploaded image data in bytes (at least one step is uploaded)
+@return time spent by uploading in milliseconds
+****************************************************************************************************/
+float TTextureStreamer::Update(unsigned budget)
+{
+    if(m_pending == 0)
+        return 0.0f;
+
+    HRTimer timer;
+    unsigned uploaded = 0;
+    bool bound = false;
+
+    SDL_mutexP(m_mutex);
+    for(;;)
+    {
+        //drop cancelled and failed requests, find most important upload step
+        TTextureRequest *next = NULL;
+        int priority = 0;
+        list<TTextureRequest*>::iterator it = m_requests.begin();
+        while(it != m_requests.end())
+        {
+            TTextureRequest *req = *it;
+            if(req->state != TTextureRequest::DECODED)
+            {
+                ++it;
+                continue;
+            }
+            if(req->cancelled || req->failed)
+            {
+                it = m_requests.erase(it);
+                //placeholder stays, texture won't be reloaded
+                if(!req->cancelled)
+                    SceneManager::Instance()->TextureUploaded(req->texID, false);
+                delete req->mips;
+                delete req->compressed;
+                delete req;
+                continue;
+            }
+            int p = GetPriority(req);
+            if(next == NULL || p > priority)
+            {
+                next = req;
+                priority = p;
+            }
+            ++it;
+        }
+        if(next == NULL)
+            break;
+
+        unsigned first = GetNextLevel(next);
+        unsigned size = GetSize(next, first, next->base);
+        if(uploaded > 0 && uploaded + size > budget)
+            break;
+        if(first == 0)
+            m_requests.remove(next);
+        SDL_mutexV(m_mutex);
+
+        Upload(next, first, next->base);
+        next->base = first;
+        uploaded += size;
+        bound = true;
+        //top level uploaded - update texture residency
+        if(first == 0)
+        {
+            cout<<"Image Loaded: "<<next->file<<(next->compressed ? " (compressed)\n" : "\n");
+            SceneManager::Instance()->TextureUploaded(next->texID, true);
+            m_uploaded++;
+            delete next->mips;
+            delete next->compressed;
+            delete next;
+        }
+        SDL_mutexP(m_mutex);
+    }
+    m_pending = m_requests.size();
+    m_decoded_bytes = 0;
+    for(list<TTextureRequest*>::iterator it = m_requests.begin(); it != m_requests.end(); ++it)
+        if((*it)->state == TTextureRequest::DECODED && !(*it)->failed && !(*it)->cancelled)
+            m_decoded_bytes += GetSize(*it, 0, (*it)->base);
+    SDL_mutexV(m_mutex);
+
+    if(bound)
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+    float stall = (float)timer.GetElapsedTimeMilliseconds();
+    if(uploaded > 0)
+        m_max_stall = max(m_max_stall, stall);
+    return stall;
+}
+
+/**
+****************************************************************************************************
+@brief Wait for decoding of all requests and upload them regardless of budget
+****************************************************************************************************/
+void TTextureStreamer::Flush()
+{
+    while(m_pending > 0)
+    {
+        SDL_mutexP(m_mutex);
+        bool decoded = true;
+        for(list<TTextureRequest*>::iterator it = m_requests.begin(); it != m_requests.end(); ++it)
+            if((*it)->state != TTextureRequest::DECODED)
+                decoded = false;
+        if(!decoded)
+            SDL_CondWait(m_done_cond, m_mutex);
+        SDL_mutexV(m_mutex);
+
+        Update(~0u);
+    }
+}
@@ -0,0 +1,146 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: texture_streamer.h
+@brief asynchronous loading of textures - images are decoded by worker threads and uploaded
+through pixel buffer objects with limited amount of data per frame
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _TEXTURE_STREAMER_H_
+#define _TEXTURE_STREAMER_H_
+
+#include "globals.h"
+#include "hires_timer.h"
+#include "texture_compress.h"
+#include "texture_mipmap.h"
+
+///number of image decoding threads
+#define TEXTURE_DECODE_THREADS 2
+///number of pixel buffer objects used for uploads in turn
+#define TEXTURE_PBO_COUNT 3
+///maximal amount of texture data uploaded in one frame (at least one texture is always uploaded)
+#define TEXTURE_UPLOAD_BUDGET (4*1024*1024)
+///largest mip level uploaded in first step of progressive texture (finer levels follow one by one)
+#define TEXTURE_COARSE_SIZE 64
+
+///@brief One streamed texture - placeholder texture ID and decoded image
+struct TTextureRequest{
+    enum{QUEUED, DECODING, DECODED};
+    int state;
+    ///texture was deleted before upload
+    bool cancelled;
+    ///decoding failed, placeholder stays
+    bool failed;
+
+    GLuint texID;
+    string file;
+    int textype;
+    bool mipmap;
+    ///load block compressed image from cache
+    bool compress;
+    ///upload coarse levels first (texture contains placeholder)
+    bool progressive;
+
+    ///decoded image with mip chain generated on CPU (NULL when image is compressed)
+    TMipChain *mips;
+    ///compressed image (NULL when image isn't compressed)
+    TCompressedImage *compressed;
+    ///number of mip levels and finest level uploaded so far (levels - nothing uploaded yet)
+    unsigned levels, base;
+};
+
+
+/**
+@class TTextureStreamer
+@brief Streams 2D textures in background. Texture gets 1x1 placeholder image at load time and file
+is queued for decoding. Worker threads also generate mip chains, so no glGenerateMipmap() stalls
+rendering. Decoded images are uploaded by Update() (called every frame) into the same texture
+object, so materials and texture cache keep valid IDs. Progressive textures get their coarse levels
+first and finer levels are added in later frames (GL_TEXTURE_BASE_LEVEL hides missing levels).
+***************************************************************************************************/
+class TTextureStreamer
+{
+public:
+    //return global streamer (decoding threads are created on first use)
+    static TTextureStreamer* Instance();
+    //stop and join decoding threads, delete global streamer
+    static void Destroy();
+
+    ///@brief Toggle streaming, textures are loaded synchronously when disabled
+    static void Enable(bool flag = true){
+        m_enabled = flag;
+    }
+    ///@brief Are textures streamed?
+    static bool IsEnabled(){
+        return m_enabled;
+    }
+
+    //queue texture file for decoding, texture must already contain placeholder image
+    void Request(GLuint texID, const char *file, int textype, bool mipmap, bool compress = false, bool progressive = true);
+    //drop request of deleted texture
+    void Cancel(GLuint texID);
+
+    //upload decoded images (rendering thread), returns time spent by upload in milliseconds
+    float Update(unsigned budget = TEXTURE_UPLOAD_BUDGET);
+    //wait for all requests and upload them
+    void Flush();
+
+    ///@brief Return number of textures waiting for decoding or upload
+    unsigned GetPendingCount(){
+        return m_pending;
+    }
+    ///@brief Return number of textures uploaded so far
+    unsigned GetUploadedCount(){
+        return m_uploaded;
+    }
+    ///@brief Return size of decoded images waiting for upload
+    size_t GetDecodedBytes(){
+        return m_decoded_bytes;
+    }
+    ///@brief Return longest upload stall of one frame in milliseconds
+    float GetMaxStall(){
+        return m_max_stall;
+    }
+
+private:
+    TTextureStreamer();
+    ~TTextureStreamer();
+
+    //decoding thread main loop
+    static int DecodeLoop(void *data);
+    //load or decode image of request
+    static void Decode(TTextureRequest *req);
+    //copy mip levels to pixel buffer and specify texture from them
+    void Upload(TTextureRequest *req, unsigned first, unsigned last);
+    //first level uploaded by next step of request
+    unsigned GetNextLevel(TTextureRequest *req);
+    //order of upload steps
+    int GetPriority(TTextureRequest *req);
+    //size of mip levels [first, last) in bytes
+    unsigned GetSize(TTextureRequest *req, unsigned first, unsigned last);
+
+    static TTextureStreamer *m_instance;
+    static bool m_enabled;
+
+    SDL_Thread *m_threads[TEXTURE_DECODE_THREADS];
+    int m_thread_count;
+    bool m_quit;
+
+    //synchronization
+    SDL_mutex *m_mutex;
+    SDL_cond *m_work_cond, *m_done_cond;
+
+    ///requests in order of submission
+    list<TTextureRequest*> m_requests;
+    unsigned m_pending, m_uploaded;
+    size_t m_decoded_bytes;
+
+    ///pixel buffer ring
+    GLuint m_pbo[TEXTURE_PBO_COUNT];
+    GLsizeiptr m_pbo_size[TEXTURE_PBO_COUNT];
+    unsigned m_pbo_next;
+
+    float m_max_stall;
+};
+
+#endif
@@ -0,0 +1,190 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: thread_pool.cpp
+@brief worker threads for parallel processing of CPU tasks (culling, mesh and texture processing)
+****************************************************************************************************
+***************************************************************************************************/
+#include "thread_pool.h"
+#include <SDL/SDL_thread.h>
+#include <SDL/SDL_mutex.h>
+
+#ifdef _LINUX_
+    #include <unistd.h>
+#endif
+
+TThreadPool* TThreadPool::m_instance = NULL;
+
+/**
+****************************************************************************************************
+@brief Return global thread pool, threads are created on first call. First call must come from
+main thread (TTextureStreamer creates pool before its decoding threads start).
+****************************************************************************************************/
+TThreadPool* TThreadPool::Instance()
+{
+    if(m_instance == NULL)
+        m_instance = new TThreadPool();
+    return m_instance;
+}
+
+/**
+****************************************************************************************************
+@brief Return number of logical processors
+****************************************************************************************************/
+int TThreadPool::GetCPUCount()
+{
+#ifdef _WIN_
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+/**
+****************************************************************************************************
+@brief Create worker threads (one less than processors, calling thread works too)
+****************************************************************************************************/
+TThreadPool::TThreadPool()
+{
+    m_quit = false;
+    m_busy = false;
+    m_func = NULL;
+    m_data = NULL;
+    m_count = m_grain = m_next = m_pending = 0;
+
+    m_mutex = SDL_CreateMutex();
+    m_work_cond = SDL_CreateCond();
+    m_done_cond = SDL_CreateCond();
+
+    m_thread_count = min(GetCPUCount() - 1, MAX_WORKER_THREADS);
+    for(int i=0; i<m_thread_count; i++)
+    {
+        m_threads[i] = SDL_CreateThread(WorkerLoop, this);
+        if(m_threads[i] == NULL)
+        {
+            cerr<<"WARNING (TThreadPool): cannot create worker thread: "<<SDL_GetError()<<endl;
+            m_thread_count = i;
+            break;
+        }
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Stop and join worker threads
+****************************************************************************************************/
+TThreadPool::~TThreadPool()
+{
+    SDL_mutexP(m_mutex);
+    m_quit = true;
+    SDL_CondBroadcast(m_work_cond);
+    SDL_mutexV(m_mutex);
+
+    for(int i=0; i<m_thread_count; i++)
+        SDL_WaitThread(m_threads[i], NULL);
+
+    SDL_DestroyCond(m_work_cond);
+    SDL_DestroyCond(m_done_cond);
+    SDL_DestroyMutex(m_mutex);
+}
+
+/**
+****************************************************************************************************
+@brief Take chunks of current job and process them. Mutex must be locked when called,
+it's unlocked during processing.
+@return number of processed items
+****************************************************************************************************/
+int TThreadPool::ProcessChunks()
+{
+    int processed = 0;
+    while(m_func != NULL && m_next < m_count)
+    {
+        int begin = m_next;
+        int end = min(begin + m_grain, m_count);
+        m_next = end;
+        TJobFunc func = m_func;
+        void *data = m_data;
+
+        SDL_mutexV(m_mutex);
+        func(begin, end, data);
+        SDL_mutexP(m_mutex);
+
+        m_pending -= end - begin;
+        processed += end - begin;
+        if(m_pending == 0)
+            SDL_CondBroadcast(m_done_cond);
+    }
+    return processed;
+}
+
+/**
+****************************************************************************************************
+@brief Worker thread loop - waits for jobs and processes their chunks
+****************************************************************************************************/
+int TThreadPool::WorkerLoop(void *data)
+{
+    TThreadPool *pool = (TThreadPool*)data;
+
+    SDL_mutexP(pool->m_mutex);
+    while(!pool->m_quit)
+    {
+        if(pool->ProcessChunks() == 0)
+            SDL_CondWait(pool->m_work_cond, pool->m_mutex);
+    }
+    SDL_mutexV(pool->m_mutex);
+    return 0;
+}
+
+/**
+****************************************************************************************************
+@brief Process items in parallel. Items are split into chunks of 'grain' items, calling thread
+processes chunks too. Function returns when all items are processed.
+@param count number of items
+@param grain number of items in one chunk (minimal work for one thread)
+@param func job function
+@param data user data passed to job function
+****************************************************************************************************/
+void TThreadPool::ParallelFor(int count, int grain, TJobFunc func, void *data)
+{
+    if(count <= 0)
+        return;
+    if(grain < 1)
+        grain = 1;
+
+    //small jobs are not worth of synchronization
+    if(m_thread_count == 0 || count <= grain)
+    {
+        func(0, count, data);
+        return;
+    }
+
+    SDL_mutexP(m_mutex);
+    //pool is already working (nested call) - process serially
+    if(m_busy)
+    {
+        SDL_mutexV(m_mutex);
+        func(0, count, data);
+        return;
+    }
+
+    m_busy = true;
+    m_func = func;
+    m_data = data;
+    m_count = m_pending = count;
+    m_grain = grain;
+    m_next = 0;
+    SDL_CondBroadcast(m_work_cond);
+
+    //help workers and wait for remaining chunks
+    ProcessChunks();
+    while(m_pending > 0)
+        SDL_CondWait(m_done_cond, m_mutex);
+
+    m_func = NULL;
+    m_data = NULL;
+    m_busy = false;
+    SDL_mutexV(m_mutex);
+}
@@ -0,0 +1,69 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: thread_pool.h
+@brief worker threads for parallel processing of CPU tasks (culling, mesh and texture processing)
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include "globals.h"
+
+///maximal number of worker threads
+#define MAX_WORKER_THREADS 16
+
+///@brief Job function - processes items in range [begin, end)
+typedef void (*TJobFunc)(int begin, int end, void *data);
+
+
+/**
+@class TThreadPool
+@brief Pool of SDL worker threads. ParallelFor() splits range of items into chunks which are
+processed by workers and calling thread together. Only one parallel job runs at a time, nested or
+concurrent calls are processed serially by calling thread.
+***************************************************************************************************/
+class TThreadPool
+{
+public:
+    //return global thread pool (threads are created on first use)
+    static TThreadPool* Instance();
+
+    //process items in parallel, returns after all items have been processed
+    void ParallelFor(int count, int grain, TJobFunc func, void *data);
+
+    ///@brief Return number of threads working on jobs (including calling thread)
+    int GetThreadCount(){
+        return m_thread_count + 1;
+    }
+
+    //return number of logical processors
+    static int GetCPUCount();
+
+private:
+    TThreadPool();
+    ~TThreadPool();
+
+    //worker thread main loop
+    static int WorkerLoop(void *data);
+    //process chunks of current job, returns number of processed items
+    int ProcessChunks();
+
+    static TThreadPool *m_instance;
+
+    SDL_Thread *m_threads[MAX_WORKER_THREADS];
+    int m_thread_count;
+    bool m_quit;
+
+    //synchronization
+    SDL_mutex *m_mutex;
+    SDL_cond *m_work_cond, *m_done_cond;
+
+    //current job
+    bool m_busy;
+    TJobFunc m_func;
+    void *m_data;
+    int m_count, m_grain, m_next, m_pending;
+};
+
+#endif
@@ -0,0 +1,428 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: virtual_texture.cpp
+@brief software virtual texturing - large virtual texture split into tiles, which are generated on
+demand into physical tile cache. Visible tiles are found by low resolution feedback pass. Works in
+core OpenGL 3.3 without sparse texture extensions.
+****************************************************************************************************
+***************************************************************************************************/
+#include "virtual_texture.h"
+#include "thread_pool.h"
+#include <functional>
+
+///size of tile in cache including border
+static const unsigned VT_SLOT_SIZE = VT_TILE_SIZE + 2*VT_TILE_BORDER;
+
+/**
+****************************************************************************************************
+@brief Create virtual texture, OpenGL objects are created by Create()
+@param pages number of pages per side (power of two up to VT_MAX_PAGES)
+@param generator function generating texels of tiles (called from worker threads)
+@param data user data of generator
+****************************************************************************************************/
+TVirtualTexture::TVirtualTexture(unsigned pages, TTileGenerator generator, void *data)
+{
+    m_pages = 1;
+    while(m_pages < pages && m_pages < VT_MAX_PAGES)
+        m_pages *= 2;
+    if(m_pages != pages)
+        cerr<<"WARNING (TVirtualTexture): "<<pages<<" pages per side not supported, using "<<m_pages<<"\n";
+    m_levels = 1;
+    while((m_pages >> m_levels) > 0)
+        m_levels++;
+
+    m_generator = generator;
+    m_data = data;
+    m_page_table = m_cache = 0;
+    m_fbo = m_fb_color = m_fb_depth = 0;
+    m_fb_pbo[0] = m_fb_pbo[1] = 0;
+    m_fb_resx = m_fb_resy = 0;
+    m_frame = m_fb_frames = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+/**
+****************************************************************************************************
+@brief Delete textures and feedback buffers
+****************************************************************************************************/
+TVirtualTexture::~TVirtualTexture()
+{
+    glDeleteTextures(1, &m_page_table);
+    glDeleteTextures(1, &m_cache);
+    glDeleteFramebuffers(1, &m_fbo);
+    glDeleteTextures(1, &m_fb_color);
+    glDeleteRenderbuffers(1, &m_fb_depth);
+    glDeleteBuffers(2, m_fb_pbo);
+}
+
+/**
+****************************************************************************************************
+@brief Create page table and tile cache textures, generate coarsest tile (it stays resident, so
+every page has some tile to point to) and create feedback buffer
+@param resx screen width
+@param resy screen height
+@return false when feedback framebuffer is incomplete
+****************************************************************************************************/
+bool TVirtualTexture::Create(int resx, int resy)
+{
+    ///1. tile cache - one level, tiles are sampled with their border
+    GLsizei cache_size = VT_CACHE_TILES*VT_SLOT_SIZE;
+    glGenTextures(1, &m_cache);
+    glBindTexture(GL_TEXTURE_2D, m_cache);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cache_size, cache_size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    TTileSlot free_slot = { VT_NO_TILE, 0 };
+    m_slots.assign(VT_CACHE_TILES*VT_CACHE_TILES, free_slot);
+    m_resident.clear();
+    m_requests.clear();
+
+    ///2. page table - all pages point to coarsest tile in slot 0
+    m_entries.resize(m_levels);
+    for(unsigned l=0; l<m_levels; l++)
+    {
+        unsigned w = m_pages >> l;
+        m_entries[l].resize(w*w*4);
+        for(unsigned i=0; i<w*w; i++)
+        {
+            m_entries[l][4*i] = m_entries[l][4*i + 1] = 0;
+            m_entries[l][4*i + 2] = m_levels - 1;
+            m_entries[l][4*i + 3] = 255;
+        }
+    }
+    glGenTextures(1, &m_page_table);
+    glBindTexture(GL_TEXTURE_2D, m_page_table);
+    for(unsigned l=0; l<m_levels; l++)
+    {
+        GLsizei w = m_pages >> l;
+        glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8, w, w, 0, GL_RGBA, GL_UNSIGNED_BYTE, &m_entries[l][0]);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, m_levels - 1);
+
+    ///3. coarsest tile
+    unsigned root = MakeKey(0, 0, m_levels - 1);
+    m_staging.resize(VT_SLOT_SIZE*VT_SLOT_SIZE*4);
+    GenerateTile(root, &m_staging[0]);
+    glBindTexture(GL_TEXTURE_2D, m_cache);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, VT_SLOT_SIZE, VT_SLOT_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, &m_staging[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_slots[0].key = root;
+    m_resident[root] = 0;
+    m_stats.uploaded++;
+
+    CreateFeedback(resx, resy);
+    return m_fbo != 0;
+}
+
+/**
+****************************************************************************************************
+@brief Create feedback framebuffer (RGBA8 color: page x, page y, mip level, coverage) and pixel
+buffers for its readback. Called again when screen is resized.
+@param resx screen width
+@param resy screen height
+****************************************************************************************************/
+void TVirtualTexture::CreateFeedback(int resx, int resy)
+{
+    glDeleteFramebuffers(1, &m_fbo);
+    glDeleteTextures(1, &m_fb_color);
+    glDeleteRenderbuffers(1, &m_fb_depth);
+    glDeleteBuffers(2, m_fb_pbo);
+    m_fb_frames = 0;
+
+    m_fb_resx = max(1, resx/VT_FEEDBACK_DIVISOR);
+    m_fb_resy = max(1, resy/VT_FEEDBACK_DIVISOR);
+
+    glGenTextures(1, &m_fb_color);
+    glBindTexture(GL_TEXTURE_2D, m_fb_color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_fb_resx, m_fb_resy, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenRenderbuffers(1, &m_fb_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_fb_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, m_fb_resx, m_fb_resy);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &m_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_fb_color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_fb_depth);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        cerr<<"WARNING (TVirtualTexture): feedback framebuffer is incomplete\n";
+        glDeleteFramebuffers(1, &m_fbo);
+        m_fbo = 0;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(2, m_fb_pbo);
+    for(int i=0; i<2; i++)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_fb_pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, m_fb_resx*m_fb_resy*4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+/**
+****************************************************************************************************
+@brief Bind feedback framebuffer, set its viewport and clear it (pixels without virtual texture
+have zero coverage)
+****************************************************************************************************/
+void TVirtualTexture::BeginFeedback()
+{
+    GLfloat clear_color[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glViewport(0, 0, m_fb_resx, m_fb_resy);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
+}
+
+/**
+****************************************************************************************************
+@brief Start reading of feedback into pixel buffer. Feedback of previous frame is processed
+instead, its transfer had whole frame to finish, so mapping doesn't stall.
+****************************************************************************************************/
+void TVirtualTexture::EndFeedback()
+{
+    unsigned i = m_fb_frames % 2;
+    bool previous = m_fb_frames > 0;
+    m_fb_frames++;
+    //tiles seen in this feedback get new frame number, so they can't be evicted by next Update()
+    m_frame++;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_fb_pbo[i]);
+    glReadPixels(0, 0, m_fb_resx, m_fb_resy, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    if(previous)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_fb_pbo[1 - i]);
+        const GLubyte *pixels = (const GLubyte*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, m_fb_resx*m_fb_resy*4, GL_MAP_READ_BIT);
+        if(pixels != NULL)
+        {
+            ProcessFeedback(pixels, m_fb_resx*m_fb_resy);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/**
+****************************************************************************************************
+@brief Mark visible resident tiles as used and request missing ones. Missing tile requests also
+its missing ancestors, so coarser tiles come first and quality improves progressively.
+@param pixels feedback pixels
+@param count number of pixels
+****************************************************************************************************/
+void TVirtualTexture::ProcessFeedback(const GLubyte *pixels, unsigned count)
+{
+    //unique visible pages
+    vector<unsigned> visible;
+    for(unsigned i=0; i<count; i++, pixels += 4)
+    {
+        if(pixels[3] == 0 || pixels[2] >= m_levels)
+            continue;
+        visible.push_back(MakeKey(pixels[0], pixels[1], pixels[2]));
+    }
+    sort(visible.begin(), visible.end());
+    visible.erase(unique(visible.begin(), visible.end()), visible.end());
+
+    m_requests.clear();
+    for(unsigned i=0; i<visible.size(); i++)
+    {
+        unsigned x = visible[i] & 0xFF, y = (visible[i] >> 8) & 0xFF, mip = visible[i] >> 16;
+        for(; mip < m_levels; mip++, x /= 2, y /= 2)
+        {
+            map<unsigned,unsigned>::iterator it = m_resident.find(MakeKey(x, y, mip));
+            if(it != m_resident.end())
+            {
+                m_slots[it->second].last_used = m_frame;
+                break;
+            }
+            m_requests.push_back(MakeKey(x, y, mip));
+        }
+    }
+    //coarsest levels first (mip is in highest bits of key)
+    sort(m_requests.begin(), m_requests.end(), greater<unsigned>());
+    m_requests.erase(unique(m_requests.begin(), m_requests.end()), m_requests.end());
+}
+
+/**
+****************************************************************************************************
+@brief Find free slot or slot of least recently used tile, which wasn't visible in last feedback.
+Slot 0 holds coarsest tile and is never replaced.
+@return slot index or -1 if all tiles are in use
+****************************************************************************************************/
+int TVirtualTexture::FindSlot()
+{
+    int lru = -1;
+    for(unsigned i=1; i<m_slots.size(); i++)
+    {
+        if(m_slots[i].key == VT_NO_TILE)
+            return i;
+        if(m_slots[i].last_used < m_frame && (lru < 0 || m_slots[i].last_used < m_slots[lru].last_used))
+            lru = i;
+    }
+    return lru;
+}
+
+/**
+****************************************************************************************************
+@brief Point page of tile and pages of its descendants to slot (pages pointing to finer tiles are
+kept) and upload changed page table entries
+@param key resident tile
+@param slot tile slot
+****************************************************************************************************/
+void TVirtualTexture::MapTile(unsigned key, unsigned slot)
+{
+    unsigned x = key & 0xFF, y = (key >> 8) & 0xFF, mip = key >> 16;
+    GLubyte tx = slot % VT_CACHE_TILES, ty = slot / VT_CACHE_TILES;
+    for(int l=mip; l>=0; l--)
+    {
+        unsigned size = 1 << (mip - l), w = m_pages >> l;
+        for(unsigned py=y*size; py<(y + 1)*size; py++)
+        {
+            GLubyte *e = &m_entries[l][(py*w + x*size)*4];
+            for(unsigned px=0; px<size; px++, e += 4)
+            {
+                if(e[2] >= mip)
+                {
+                    e[0] = tx;
+                    e[1] = ty;
+                    e[2] = mip;
+                }
+            }
+        }
+        UploadPageTable(l, x*size, y*size, size);
+    }
+}
+
+/**
+****************************************************************************************************
+@brief Point pages referencing evicted tile to entry of its parent page (nearest resident ancestor)
+@param key evicted tile
+****************************************************************************************************/
+void TVirtualTexture::UnmapTile(unsigned key)
+{
+    unsigned x = key & 0xFF, y = (key >> 8) & 0xFF, mip = key >> 16;
+    GLubyte parent[4];
+    memcpy(parent, &m_entries[mip + 1][((y/2)*(m_pages >> (mip + 1)) + x/2)*4], 4);
+    for(int l=mip; l>=0; l--)
+    {
+        unsigned size = 1 << (mip - l), w = m_pages >> l;
+        for(unsigned py=y*size; py<(y + 1)*size; py++)
+        {
+            GLubyte *e = &m_entries[l][(py*w + x*size)*4];
+            for(unsigned px=0; px<size; px++, e += 4)
+                if(e[2] == mip)
+                    memcpy(e, parent, 4);
+        }
+        UploadPageTable(l, x*size, y*size, size);
+    }
+    m_resident.erase(key);
+}
+
+/**
+****************************************************************************************************
+@brief Upload square of page table level
+@param level page table level
+@param x first page column
+@param y first page row
+@param size square size
+****************************************************************************************************/
+void TVirtualTexture::UploadPageTable(unsigned level, unsigned x, unsigned y, unsigned size)
+{
+    unsigned w = m_pages >> level;
+    glBindTexture(GL_TEXTURE_2D, m_page_table);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+    glTexSubImage2D(GL_TEXTURE_2D, level, x, y, size, size, GL_RGBA, GL_UNSIGNED_BYTE, &m_entries[level][(y*w + x)*4]);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+/**
+****************************************************************************************************
+@brief Generate texels of tile including its border
+@param key tile
+@param texels output (VT_TILE_SIZE + 2*VT_TILE_BORDER texels per side)
+****************************************************************************************************/
+void TVirtualTexture::GenerateTile(unsigned key, GLubyte *texels)
+{
+    int x = key & 0xFF, y = (key >> 8) & 0xFF, mip = key >> 16;
+    m_generator(x*VT_TILE_SIZE - VT_TILE_BORDER, y*VT_TILE_SIZE - VT_TILE_BORDER, mip, VT_SLOT_SIZE, texels, m_data);
+}
+
+/**
+****************************************************************************************************
+@brief Generate tiles [begin, end) of frame
+****************************************************************************************************/
+void TVirtualTexture::GenerateTilesJob(int begin, int end, void *data)
+{
+    TTileJob *jobs = (TTileJob*)data;
+    for(int i=begin; i<end; i++)
+        jobs[i].vt->GenerateTile(jobs[i].key, jobs[i].texels);
+}
+
+/**
+****************************************************************************************************
+@brief Generate missing tiles (coarsest first) in parallel and upload them into cache slots. Least
+recently used tiles are evicted when cache is full, tiles visible in last feedback stay.
+@param budget maximal number of generated tiles
+****************************************************************************************************/
+void TVirtualTexture::Update(unsigned budget)
+{
+    if(m_requests.empty() || m_cache == 0)
+        return;
+
+    ///1. assign slots (evicted tiles are unmapped before new ones are mapped)
+    vector<TTileJob> jobs;
+    vector<unsigned> slots;
+    unsigned count = min(budget, (unsigned)m_requests.size());
+    m_staging.resize(count*VT_SLOT_SIZE*VT_SLOT_SIZE*4);
+    for(unsigned i=0; i<count; i++)
+    {
+        int slot = FindSlot();
+        if(slot < 0)
+            break;
+        if(m_slots[slot].key != VT_NO_TILE)
+        {
+            UnmapTile(m_slots[slot].key);
+            m_stats.evicted++;
+        }
+        m_slots[slot].key = m_requests[i];
+        m_slots[slot].last_used = m_frame;
+
+        TTileJob job = { this, m_requests[i], &m_staging[jobs.size()*VT_SLOT_SIZE*VT_SLOT_SIZE*4] };
+        jobs.push_back(job);
+        slots.push_back(slot);
+    }
+    m_requests.erase(m_requests.begin(), m_requests.begin() + jobs.size());
+    if(jobs.empty())
+        return;
+
+    ///2. generate tiles in thread pool
+    TThreadPool::Instance()->ParallelFor(jobs.size(), 1, GenerateTilesJob, &jobs[0]);
+
+    ///3. upload tiles and point pages to them
+    for(unsigned i=0; i<jobs.size(); i++)
+    {
+        glBindTexture(GL_TEXTURE_2D, m_cache);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (slots[i] % VT_CACHE_TILES)*VT_SLOT_SIZE, (slots[i] / VT_CACHE_TILES)*VT_SLOT_SIZE,
+                        VT_SLOT_SIZE, VT_SLOT_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, jobs[i].texels);
+        m_resident[jobs[i].key] = slots[i];
+        MapTile(jobs[i].key, slots[i]);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_stats.uploaded += jobs.size();
+}
@@ -0,0 +1,160 @@
+/**
+****************************************************************************************************
+****************************************************************************************************
+@file: virtual_texture.h
+@brief software virtual texturing - large virtual texture split into tiles, which are generated on
+demand into physical tile cache. Visible tiles are found by low resolution feedback pass. Works in
+core OpenGL 3.3 without sparse texture extensions.
+****************************************************************************************************
+***************************************************************************************************/
+#ifndef _VIRTUAL_TEXTURE_H_
+#define _VIRTUAL_TEXTURE_H_
+
+#include "globals.h"
+
+///texels of one tile (page) without border
+#define VT_TILE_SIZE 128
+///border of tiles in cache (bilinear filtering doesn't reach neighbouring tiles)
+#define VT_TILE_BORDER 4
+///size of physical tile cache in tiles (per side)
+#define VT_CACHE_TILES 16
+///maximal pages of virtual texture per side (page coordinates are stored in 8 bits)
+#define VT_MAX_PAGES 256
+///feedback buffer is smaller than screen by this factor
+#define VT_FEEDBACK_DIVISOR 8
+///maximal number of tiles generated and uploaded in one frame
+#define VT_UPLOAD_BUDGET 8
+///key of free tile slot
+#define VT_NO_TILE 0xFFFFFFFFu
+
+/**
+@brief Tile generator - fills square of texels of one mip level (RGBA). Area can reach outside of
+virtual texture by tile border, generator should clamp or wrap coordinates.
+@param x first texel column in mip level
+@param y first texel row in mip level
+@param mip mip level (texel covers 2^mip x 2^mip texels of level 0)
+@param size width and height of generated area
+@param rgba output texels
+@param data user data
+***************************************************************************************************/
+typedef void (*TTileGenerator)(int x, int y, unsigned mip, unsigned size, GLubyte *rgba, void *data);
+
+///@brief Virtual texture statistics
+struct TVirtualTextureStats{
+    ///tiles in cache, tiles waiting for generation
+    unsigned resident, requested;
+    ///tiles generated and evicted in total
+    unsigned uploaded, evicted;
+};
+
+
+/**
+@class TVirtualTexture
+@brief Virtual texture of pages x pages tiles with complete mip chain. Page table texture has one
+texel per page and level (RGBA8: tile position in cache, mip level of tile), pages without resident
+tile point to their nearest resident ancestor. Coarsest tile is always resident. Feedback buffer
+contains page and level required by each pixel, it is read back asynchronously and missing tiles
+are generated in next frames (coarsest first), least recently used tiles are replaced.
+***************************************************************************************************/
+class TVirtualTexture
+{
+public:
+    TVirtualTexture(unsigned pages, TTileGenerator generator, void *data);
+    ~TVirtualTexture();
+
+    //create page table, tile cache and feedback buffer
+    bool Create(int resx, int resy);
+    //create feedback buffer for screen resolution
+    void CreateFeedback(int resx, int resy);
+
+    //bind and clear feedback framebuffer
+    void BeginFeedback();
+    //start reading feedback and process feedback of previous frame
+    void EndFeedback();
+    //generate and upload missing tiles
+    void Update(unsigned budget = VT_UPLOAD_BUDGET);
+
+    ///@brief Return texture with physical tile cache
+    GLuint GetCacheTexture(){
+        return m_cache;
+    }
+    ///@brief Return page table texture
+    GLuint GetPageTable(){
+        return m_page_table;
+    }
+    ///@brief Return number of pages per side
+    unsigned GetPages(){
+        return m_pages;
+    }
+    ///@brief Return number of mip levels
+    unsigned GetLevels(){
+        return m_levels;
+    }
+    ///@brief Return statistics
+    TVirtualTextureStats GetStats(){
+        m_stats.resident = m_resident.size();
+        m_stats.requested = m_requests.size();
+        return m_stats;
+    }
+
+private:
+    ///@brief Tile slot in cache
+    struct TTileSlot{
+        ///resident tile (VT_NO_TILE - slot is free)
+        unsigned key;
+        ///feedback frame of last use
+        unsigned last_used;
+    };
+    ///@brief Tile generated by one parallel job
+    struct TTileJob{
+        TVirtualTexture *vt;
+        unsigned key;
+        GLubyte *texels;
+    };
+
+    ///@brief Pack tile coordinates into key
+    static unsigned MakeKey(unsigned x, unsigned y, unsigned mip){
+        return (mip << 16) | (y << 8) | x;
+    }
+
+    //request missing tiles seen in feedback
+    void ProcessFeedback(const GLubyte *pixels, unsigned count);
+    //find free or least recently used slot
+    int FindSlot();
+    //point pages of tile and its descendants to slot
+    void MapTile(unsigned key, unsigned slot);
+    //point pages of evicted tile to parent tile
+    void UnmapTile(unsigned key);
+    //upload square of page table entries
+    void UploadPageTable(unsigned level, unsigned x, unsigned y, unsigned size);
+    //generate tile texels including border
+    void GenerateTile(unsigned key, GLubyte *texels);
+    //tile generation job (thread pool)
+    static void GenerateTilesJob(int begin, int end, void *data);
+
+    unsigned m_pages, m_levels;
+    TTileGenerator m_generator;
+    void *m_data;
+
+    GLuint m_page_table, m_cache;
+    ///page table levels (4 bytes per page)
+    vector< vector<GLubyte> > m_entries;
+    ///slots of tile cache and resident tiles
+    vector<TTileSlot> m_slots;
+    map<unsigned,unsigned> m_resident;
+    ///missing tiles from last feedback (coarsest first)
+    vector<unsigned> m_requests;
+    ///texels of tiles generated in one frame
+    vector<GLubyte> m_staging;
+
+    ///feedback framebuffer and pixel buffers for asynchronous readback
+    GLuint m_fbo, m_fb_color, m_fb_depth, m_fb_pbo[2];
+    int m_fb_resx, m_fb_resy;
+    unsigned m_fb_frames;
+    ///feedback frame (for least recently used tiles)
+    unsigned m_frame;
+
+    TVirtualTextureStats m_stats;
+};
+
+#endif
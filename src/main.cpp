@@ -1,9 +1,57 @@
 #include "main_ui.h"
+#include "benchmarks.h"
 #include "CCity.h"
 
 CStreetNet*StreetNet;
 CCity*City;
 
+//virtual texture of city - every building has square of pages with its facade
+#define CITY_VT_PAGES 256
+unsigned BuildingPages = 16;
+
+//*****************************************************************************
+//Generate facade texels of virtual texture tile (tile generator, called from worker threads)
+static void FacadeTiles(int x, int y, unsigned mip, unsigned size, GLubyte *rgba, void *data)
+{
+    CCity *city = (CCity*)data;
+    int level_size = max((CITY_VT_PAGES*VT_TILE_SIZE) >> mip, 1);
+    //in coarsest levels building square is smaller than texel - texel shows first building of footprint
+    int region = max((int)(BuildingPages*VT_TILE_SIZE) >> mip, 1);
+    int step = max((1 << mip) / (int)(BuildingPages*VT_TILE_SIZE), 1);
+    int per_row = CITY_VT_PAGES/BuildingPages;
+    //coarse levels average 2x2 samples of texel footprint
+    int samples = mip > 0 ? 2 : 1;
+
+    for(unsigned j=0; j<size; j++)
+    {
+        for(unsigned i=0; i<size; i++)
+        {
+            int tx = min(max(x + (int)i, 0), level_size - 1);
+            int ty = min(max(y + (int)j, 0), level_size - 1);
+            unsigned b = (ty/region*step)*per_row + tx/region*step;
+            unsigned sum[4] = {0, 0, 0, 0};
+            for(int sy=0; sy<samples; sy++)
+            {
+                for(int sx=0; sx<samples; sx++)
+                {
+                    GLubyte c[4] = {90, 90, 90, 255};       //unused pages
+                    if(b < city->Buildings.size())
+                    {
+                        float u = ((tx % region) + (sx + 0.5f)/samples)/region;
+                        float v = ((ty % region) + (sy + 0.5f)/samples)/region;
+                        city->Buildings[b]->GetFacadeColor(u, v, c);
+                    }
+                    for(int k=0; k<4; k++)
+                        sum[k] += c[k];
+                }
+            }
+            GLubyte *out = rgba + 4*(j*size + i);
+            for(int k=0; k<4; k++)
+                out[k] = (GLubyte)(sum[k]/(samples*samples));
+        }
+    }
+}
+
 //*****************************************************************************
 //Initialize OpenGL settings for scene
 bool InitScene(int resx, int resy)
@@ -38,6 +86,30 @@ bool InitScene(int resx, int resy)
 
 		std::cout<<City->Lights.size()<<endl;
     s = new TScene();
+    s->UseTextureStreaming(stream_textures);
+    s->SetTextureBudget(tex_budget);
+    s->UseTextureArrays(tex_arrays);
+    s->SetShaderCache(shader_cache);
+    s->UseAsyncBaking(async_shaders);
+    s->SetShadingLOD(shading_lod);
+    s->SetObjectLights(object_lights);
+    s->UseLazyBaking(lazy_shaders);
+    s->UseClusteredLights(street_lights);
+    s->UseGBuffer(deferred_lights || bench_deferred > 0);
+    s->UseDeferredLighting(deferred_lights);
+    if(preload_materials != NULL)
+    {
+        //comma separated list of materials baked before first frame
+        string list = preload_materials;
+        for(size_t pos = 0, end; pos < list.size(); pos = end + 1)
+        {
+            end = list.find(',', pos);
+            if(end == string::npos)
+                end = list.size();
+            if(end > pos)
+                s->PreloadMaterial(list.substr(pos, end - pos).c_str());
+        }
+    }
     if(!s->PreInit(resx, resy, 0.1f, 10000.0f,45.0f, msaa, false, false)) 
         return false;
 
@@ -63,6 +135,15 @@ bool InitScene(int resx, int resy)
 		s->MoveLight(1,glm::vec3(-120,2000,0));
 		s->AddMaterial("cubemat",white,white,white,20,1,0,PHONG);
 
+		//facades from virtual texture: largest square of pages per building which fits whole city
+		if(virtual_tex)
+		{
+			while(BuildingPages > 1 && (CITY_VT_PAGES/BuildingPages)*(CITY_VT_PAGES/BuildingPages) < City->Buildings.size())
+				BuildingPages /= 2;
+			if(s->CreateVirtualTexture(CITY_VT_PAGES, FacadeTiles, City))
+				s->AddVirtualTexture("cubemat");
+		}
+
 		
 		//now we will push all the buildings of the city into the scene
 		for(unsigned b=0;b<City->Buildings.size();++b){
@@ -82,6 +163,18 @@ bool InitScene(int resx, int resy)
 			s->RotateObj(BuildingName.data(),glm::degrees(City->Buildings[b]->AngleY()),1);
 			s->ResizeObj(BuildingName.data(),glm::length(X)*Scale/2,glm::length(Y)*Scale/2,glm::length(Z)*Scale/2);
 			s->DrawObject(BuildingName.data(),true);
+			if(virtual_tex){
+				unsigned PerRow=CITY_VT_PAGES/BuildingPages;
+				float RectSize=(float)BuildingPages/CITY_VT_PAGES;
+				s->SetVirtualRect(BuildingName.data(),glm::vec4((b%PerRow)*RectSize,(b/PerRow)*RectSize,RectSize,RectSize));
+			}
+		}
+
+		//street lights are local point lights (clustered forward lighting)
+		if(street_lights){
+			float Scale=1000;//size of the city
+			for(unsigned l=0;l<City->Lights.size();++l)
+				s->AddPointLight((City->Lights[l]->Pos+glm::vec3(0,LT.Height,0))*Scale,City->Lights[l]->Color,City->Lights[l]->Range*Scale);
 		}
 
 
@@ -168,6 +261,7 @@ void Redraw()
 	s->updateCamera();
 	s->updateLightPosition();
 
+    s->UseDeferredLighting(deferred_lights);
     s->Redraw();
 
 	if(drawBVs)
@@ -177,6 +271,30 @@ void Redraw()
 
     //update info
     dp_frontFOV = s->DPGetFOV();
+    tris_drawn = s->GetStats().triangles;
+    tris_full = s->GetStats().triangles_full;
+    clusters_culled = s->GetStats().clusters_culled;
+    tris_culled = s->GetStats().cluster_triangles_culled;
+    tex_streaming = s->GetStats().textures_streaming;
+    tex_upload_ms = s->GetStats().texture_upload_ms;
+    TTextureStats tex_stats = SceneManager::Instance()->GetTextureStats();
+    tex_mb = tex_stats.bytes/(1024.0f*1024.0f);
+    tex_evictions = tex_stats.demotions + tex_stats.evictions;
+    tex_reloads = tex_stats.reloads;
+    vt_resident = s->GetStats().vt_resident;
+    vt_requested = s->GetStats().vt_requested;
+    objects_reduced = s->GetStats().objects_reduced;
+    gpu_opaque_ms = s->GetStats().gpu_opaque_ms;
+    materials_deferred = s->GetStats().materials_deferred;
+    programs_compiled = s->GetStats().programs_compiled;
+    lights_clustered = s->GetStats().lights_clustered;
+    cluster_ms = s->GetStats().cluster_ms;
+    lights_per_object = s->GetStats().lights_per_object;
+    deferred_pixels = s->GetStats().deferred_pixels;
+    gpu_lights_ms = s->GetStats().gpu_lights_ms;
+    shadow_maps = s->GetStats().shadow_maps;
+    atlas_occupancy = 100.0f * s->GetStats().atlas_occupancy;
+    array_binds = s->GetStats().array_binds;
 
     //meminfo (ATI only)
     if(GLEW_ATI_meminfo)
@@ -212,7 +330,26 @@ void WrongParams()
         "Parameters:\n"
         "-w,-f: windowed/fullscreen mode\n"
         "resX, resY: screen resolution in pixels\n"
-        "-aa: antialiasing strength (0,1 = off)\n";
+        "-aa: antialiasing strength (0,1 = off)\n"
+        "-sync_textures: load textures before first frame (no streaming)\n"
+        "-tex_budget: video memory budget for textures in MB (0 = unlimited)\n"
+        "-tex_arrays: pack textures with the same size and format into texture arrays\n"
+        "-virtual_tex: texture building facades from procedural virtual texture\n"
+        "-shader_cache: directory of compiled shader programs (off = no cache)\n"
+        "-sync_shaders: compile all materials before first frame (no uber-shader)\n"
+        "-lazy_shaders: compile materials when their first object becomes visible\n"
+        "-no_street_lights: don't light city by street lights (no clustered lighting)\n"
+        "-deferred: light city by street lights from G-buffer (deferred lighting, toggled by G)\n"
+        "-preload: comma separated materials compiled before first frame with -lazy_shaders\n"
+        "-shading_lod: projected object size under which reduced shaders are used (off = full shading)\n"
+        "-object_lights: lights with the largest contribution used per object (off = all lights)\n"
+        "-shader_report: write cost report of generated shaders (.csv or .json) and exit\n"
+        "-bench_dito: run OBB fitting benchmark and exit\n"
+        "-bench_bc: run texture block compression benchmark and exit\n"
+        "-bench_decode: run image decoding benchmark over data/tex and exit\n"
+        "-bench_prefilter: run environment cube map prefiltering benchmark and exit\n"
+        "-bench_clusters: run clustered light assignment benchmark and exit\n"
+        "-bench_deferred: render given number of frames with forward and deferred lighting and exit\n";
     exit(1);
 }
 
@@ -273,6 +410,128 @@ int main(int argc, char **argv)
         //draw tweak bar
         else if(param == "-no_ui")
             draw_ui = false;
+        //////////////////////////////////////////
+        //load textures synchronously
+        else if(param == "-sync_textures")
+            stream_textures = false;
+        //////////////////////////////////////////
+        //texture memory budget
+        else if(param == "-tex_budget")
+        {
+            if(i+1 < argc)
+            {
+                tex_budget = atoi(argv[i+1]);
+                i++;
+            }
+            else
+                WrongParams();
+        }
+        //////////////////////////////////////////
+        //pack textures into texture arrays
+        else if(param == "-tex_arrays")
+            tex_arrays = true;
+        //////////////////////////////////////////
+        //virtual texture with building facades
+        else if(param == "-virtual_tex")
+            virtual_tex = true;
+        //////////////////////////////////////////
+        //compile materials synchronously
+        else if(param == "-sync_shaders")
+            async_shaders = false;
+        //////////////////////////////////////////
+        //compile materials on first visible use
+        else if(param == "-lazy_shaders")
+            lazy_shaders = true;
+        else if(param == "-preload")
+        {
+            if(i+1 < argc)
+            {
+                preload_materials = argv[i+1];
+                i++;
+            }
+            else
+                WrongParams();
+        }
+        //////////////////////////////////////////
+        //street lights (clustered lighting)
+        else if(param == "-no_street_lights")
+            street_lights = false;
+        //deferred lighting of street lights
+        else if(param == "-deferred")
+            deferred_lights = true;
+        //////////////////////////////////////////
+        //directory of shader program binaries
+        else if(param == "-shader_cache")
+        {
+            if(i+1 < argc)
+            {
+                shader_cache = string(argv[i+1]) == "off" ? NULL : argv[i+1];
+                i++;
+            }
+            else
+                WrongParams();
+        }
+        //////////////////////////////////////////
+        //shading level of detail
+        else if(param == "-shading_lod")
+        {
+            if(i+1 < argc)
+            {
+                shading_lod = string(argv[i+1]) == "off" ? 0.0f : (float)atof(argv[i+1]);
+                i++;
+            }
+            else
+                WrongParams();
+        }
+        //////////////////////////////////////////
+        //per-object light lists
+        else if(param == "-object_lights")
+        {
+            if(i+1 < argc)
+            {
+                object_lights = string(argv[i+1]) == "off" ? 0 : atoi(argv[i+1]);
+                i++;
+            }
+            else
+                WrongParams();
+        }
+        //////////////////////////////////////////
+        //cost report of generated shaders (programs must be linked)
+        else if(param == "-shader_report")
+        {
+            if(i+1 < argc)
+            {
+                shader_report = argv[i+1];
+                async_shaders = false;
+                i++;
+            }
+            else
+                WrongParams();
+        }
+        //////////////////////////////////////////
+        //benchmarks (no window is opened)
+        else if(param == "-bench_dito")
+            return BenchDiTO();
+        else if(param == "-bench_bc")
+            return BenchBlockCompression();
+        else if(param == "-bench_decode")
+            return BenchImageDecoding();
+        else if(param == "-bench_prefilter")
+            return BenchCubemapPrefilter();
+        else if(param == "-bench_clusters")
+            return BenchLightClusters();
+        //rendering benchmark (scene is initialized first, materials are compiled before first frame)
+        else if(param == "-bench_deferred")
+        {
+            if(i+1 < argc)
+            {
+                bench_deferred = atoi(argv[i+1]);
+                async_shaders = false;
+                i++;
+            }
+            else
+                WrongParams();
+        }
 
         ///////////////////////////////////////////
         //error
@@ -328,6 +587,25 @@ int main(int argc, char **argv)
     //init scene
     if(!InitScene(resx,resy)) exit(1);
 
+    //write shader report and exit
+    if(shader_report != NULL)
+    {
+        bool ok = s->ReportShaders(shader_report);
+        delete s;
+        SceneManager::Destroy();
+        SDL_Quit();
+        return ok ? 0 : 1;
+    }
+    //compare forward and deferred lighting and exit
+    if(bench_deferred > 0)
+    {
+        int ret = BenchDeferredLighting(s, bench_deferred);
+        delete s;
+        SceneManager::Destroy();
+        SDL_Quit();
+        return ret;
+    }
+
     SDL_WarpMouse((Uint16)resx/2, (Uint16)resy/2);
 
     //Main loop
@@ -420,6 +698,7 @@ int main(int argc, char **argv)
 					{
 						case SDLK_ESCAPE:
 							delete s;
+							SceneManager::Destroy();
 							SDL_Quit();
 							exit(0);
 							break;
@@ -481,6 +760,7 @@ int main(int argc, char **argv)
 
     //deinitialize SDL and scene
     delete s;
+    SceneManager::Destroy();
     TwTerminate();
     SDL_Quit();
     return 0;
@@ -19,6 +19,40 @@ int resx = 1024, resy = 640;
 int mem_use = 0;
 bool draw_ui = true;
 
+//frame statistics
+unsigned tris_drawn = 0, tris_full = 0;
+unsigned clusters_culled = 0, tris_culled = 0;
+unsigned tex_streaming = 0;
+float tex_upload_ms = 0.0f;
+bool stream_textures = true;
+unsigned tex_budget = 0;
+bool tex_arrays = false;
+float tex_mb = 0.0f;
+unsigned tex_evictions = 0, tex_reloads = 0;
+bool virtual_tex = false;
+unsigned vt_resident = 0, vt_requested = 0;
+const char *shader_cache = PROGRAM_CACHE_DIR;
+bool async_shaders = true;
+float shading_lod = SHADING_LOD_SIZE;
+int object_lights = OBJECT_LIGHT_COUNT;
+const char *shader_report = NULL;
+bool lazy_shaders = false;
+const char *preload_materials = NULL;
+unsigned materials_deferred = 0, programs_compiled = 0;
+bool street_lights = true;
+unsigned lights_clustered = 0;
+float cluster_ms = 0.0f;
+bool deferred_lights = false;
+int bench_deferred = 0;
+unsigned deferred_pixels = 0;
+float gpu_lights_ms = 0.0f;
+unsigned shadow_maps = 0;
+float atlas_occupancy = 0.0f;
+unsigned array_binds = 0;
+float lights_per_object = 0.0f;
+unsigned objects_reduced = 0;
+float gpu_opaque_ms = 0.0f;
+
 
 //camera rotation and position
 //glm::vec3 rot, pos; 
@@ -94,10 +128,58 @@ void InitTweakBar()
                " label='Height' group='Scene' ");
     TwAddVarRO(ui, "msaa", TW_TYPE_INT32, &msaa, 
                " label='Antialiasing' group='Scene' ");
+    TwAddVarRO(ui, "tris_drawn", TW_TYPE_UINT32, &tris_drawn, 
+               " label='Triangles' group='Scene' ");
+    TwAddVarRO(ui, "tris_full", TW_TYPE_UINT32, &tris_full, 
+               " label='Triangles (no LOD)' group='Scene' ");
+    TwAddVarRO(ui, "clusters_culled", TW_TYPE_UINT32, &clusters_culled, 
+               " label='Clusters culled' group='Scene' ");
+    TwAddVarRO(ui, "tris_culled", TW_TYPE_UINT32, &tris_culled, 
+               " label='Triangles culled' group='Scene' ");
+    TwAddVarRO(ui, "tex_streaming", TW_TYPE_UINT32, &tex_streaming, 
+               " label='Textures streaming' group='Scene' ");
+    TwAddVarRO(ui, "tex_upload_ms", TW_TYPE_FLOAT, &tex_upload_ms, 
+               " label='Texture upload [ms]' group='Scene' precision=2 ");
+    TwAddVarRO(ui, "tex_mb", TW_TYPE_FLOAT, &tex_mb, 
+               " label='Texture memory [MB]' group='Scene' precision=1 ");
+    TwAddVarRO(ui, "tex_evictions", TW_TYPE_UINT32, &tex_evictions, 
+               " label='Texture demotions' group='Scene' ");
+    TwAddVarRO(ui, "tex_reloads", TW_TYPE_UINT32, &tex_reloads, 
+               " label='Texture reloads' group='Scene' ");
+    TwAddVarRO(ui, "vt_resident", TW_TYPE_UINT32, &vt_resident, 
+               " label='Virtual tiles resident' group='Scene' ");
+    TwAddVarRO(ui, "vt_requested", TW_TYPE_UINT32, &vt_requested, 
+               " label='Virtual tiles requested' group='Scene' ");
+    TwAddVarRO(ui, "objects_reduced", TW_TYPE_UINT32, &objects_reduced, 
+               " label='Reduced shading objects' group='Scene' ");
+    TwAddVarRO(ui, "gpu_opaque_ms", TW_TYPE_FLOAT, &gpu_opaque_ms, 
+               " label='Opaque pass GPU [ms]' group='Scene' precision=2 ");
+    TwAddVarRO(ui, "materials_deferred", TW_TYPE_UINT32, &materials_deferred, 
+               " label='Materials not yet baked' group='Scene' ");
+    TwAddVarRO(ui, "programs_compiled", TW_TYPE_UINT32, &programs_compiled, 
+               " label='Programs compiled' group='Scene' ");
+    TwAddVarRO(ui, "lights_clustered", TW_TYPE_UINT32, &lights_clustered, 
+               " label='Visible street lights' group='Scene' ");
+    TwAddVarRO(ui, "cluster_ms", TW_TYPE_FLOAT, &cluster_ms, 
+               " label='Light clusters CPU [ms]' group='Scene' precision=2 ");
+    TwAddVarRO(ui, "lights_per_object", TW_TYPE_FLOAT, &lights_per_object, 
+               " label='Lights per object' group='Scene' precision=2 ");
+    TwAddVarRO(ui, "deferred_pixels", TW_TYPE_UINT32, &deferred_pixels, 
+               " label='Deferred lit pixels' group='Scene' ");
+    TwAddVarRO(ui, "gpu_lights_ms", TW_TYPE_FLOAT, &gpu_lights_ms, 
+               " label='Deferred lights GPU [ms]' group='Scene' precision=2 ");
+    TwAddVarRO(ui, "shadow_maps", TW_TYPE_UINT32, &shadow_maps, 
+               " label='Shadow maps rendered' group='Scene' ");
+    TwAddVarRO(ui, "atlas_occupancy", TW_TYPE_FLOAT, &atlas_occupancy, 
+               " label='Shadow atlas used [%]' group='Scene' precision=1 ");
+    TwAddVarRO(ui, "array_binds", TW_TYPE_UINT32, &array_binds, 
+               " label='Texture array binds' group='Scene' ");
 
     TwAddSeparator(ui, NULL, "group='Scene'");
     TwAddVarRW(ui, "wire", TW_TYPE_BOOL32, &wire, 
                " label='Wireframe' group='Scene' key=x");
+    TwAddVarRW(ui, "deferred_lights", TW_TYPE_BOOLCPP, &deferred_lights, 
+               " label='Deferred lighting' group='Scene' key=g");
 
     //camera
     TwEnumVal e_cam_type[] = { {FPS, "FPS"}, {ORBIT, "Orbit"}};